@@ -4,6 +4,8 @@
 local Device = {}
 Device.__index = Device
 
+local EVENT_POLL_MS = 10                                       -- slice of a wait inside a coroutine
+
 -- Create a new Device instance by UUID
 function Device.new(uuid)
   local handle = brick.get_device_from_uuid(uuid)              -- Get device from C API
@@ -21,6 +23,100 @@ function Device:is_rgb()
   return self:get_type() == brick.DEVICE_LED_RGB               -- Requires DEVICE_LED_RGB enum exposed to Lua
 end
 
+-- Put the device in one or more groups (bit mask: group 1 = 1, group 2 = 2, ... group 7 = 64);
+-- the eighth group is the host's, for move_together
+function Device:set_groups(mask)
+  return brick.assign_group(self.uuid, mask)
+end
+
+-- Latest distance in cm from the background sampler, plus its age in ms (nil until the first sample)
+function Device:read_cm()
+  return self.handle:read_cm()
+end
+
+-- Up to n recent samples, newest first: { { cm = X, t_ms = Y }, ... }
+function Device:history(n)
+  return self.handle:history(n)
+end
+
+-- Change how often the sampler reads this sensor
+function Device:set_sample_period(ms)
+  return self.handle:set_sample_period(ms)
+end
+
+-- Sensors that measure on their own (protocol 5): measure every period_ms (nil = the sensor's
+-- default), take the median of the last median measurements (odd, 1 = off), then average with
+-- a new median weighing 1/2^ema_shift (0 = off). The module clamps what it cannot do; read
+-- brick.REG_SENSOR_CONFIG back for what it applied.
+function Device:set_filter(median, ema_shift, period_ms)
+  return self.handle:write_registers(brick.REG_SENSOR_CONFIG, string.pack("<I2BB", period_ms or 0, median or 1, ema_shift or 0))
+end
+
+-- Bus health of the device: success/failure/timeout counters, retries, quarantine state
+-- and a latency histogram (latency_us[i] counts transfers faster than 64 us << (i - 1))
+function Device:health()
+  return self.handle:health()
+end
+
+-- Raw register access (modules with a register map): bytes as a string, e.g.
+-- string.unpack("<I2I2I2I2", dev:read_registers(brick.REG_COUNTERS, 8)) -> frames, reads, bus errors, CRC errors
+function Device:read_registers(reg, n)
+  return self.handle:read_registers(reg, n)
+end
+
+function Device:write_registers(reg, bytes)
+  return self.handle:write_registers(reg, bytes)
+end
+
+-- Commands the module had to drop because its queue was full: { dropped, queue_high_water, queue_slots },
+-- and the retries it recognised and did not apply again: duplicates
+function Device:module_status()
+  return self.handle:module_status()
+end
+
+-- Events the module raised since they were last taken (brick.EVENT_* bits, 0 = none), or nil
+-- if it cannot raise events. Taking an event forgets it; mask picks which (default all).
+function Device:events(mask)
+  return self.handle:events(mask)
+end
+
+-- Wait up to timeout_ms for one of the events in mask and take it: returns its bits, 0 on
+-- timeout, nil if the module cannot raise events. Inside a coroutine, yields every
+-- EVENT_POLL_MS so other coroutines keep running.
+function Device:wait_event(mask, timeout_ms)
+  if not coroutine.isyieldable() then
+    return self.handle:wait_events(mask, timeout_ms)
+  end
+  local waited = 0
+  while true do
+    local got = self.handle:wait_events(mask, math.min(EVENT_POLL_MS, timeout_ms - waited))
+    waited = waited + EVENT_POLL_MS
+    if got ~= 0 or waited >= timeout_ms then return got end
+    coroutine.yield()
+  end
+end
+
+-- Wait up to timeout_ms until the module has finished its moves; true once it is idle. A
+-- module that raises events is only read again when it reports the end of a move; older
+-- ones are polled every EVENT_POLL_MS.
+local function wait_idle(device, timeout_ms)
+  local waited = 0
+  while true do
+    local status = device:status()
+    if status and not status.busy then return true end
+    if waited >= timeout_ms then return false end
+
+    local got = device:wait_event(brick.EVENT_MOVE_DONE, timeout_ms - waited)
+    if got == nil then
+      if coroutine.isyieldable() then coroutine.yield() end
+      delay(EVENT_POLL_MS)
+      waited = waited + EVENT_POLL_MS
+    elseif got == 0 then
+      waited = timeout_ms                                      -- one last look at the status
+    end                                                        -- else an end was reported: look again
+  end
+end
+
 -- DeviceRgb subclass: extends Device with RGB-specific methods
 local DeviceRgb = {}
 DeviceRgb.__index = DeviceRgb
@@ -38,8 +134,121 @@ function DeviceRgb:set_rgb(color)
   brick.send_command(self.uuid, brick.CMD_LED_RGB, color)      -- Send RGB command via C API
 end
 
+-- Same as set_rgb, but returns a future instead of waiting for the bus
+function DeviceRgb:set_rgb_async(color)
+  return brick.send_command_async(self.uuid, brick.CMD_LED_RGB, color)
+end
+
+-- Fade to a colour over ms milliseconds; the module runs the fade, one command in all
+function DeviceRgb:fade_rgb(color, ms)
+  return brick.send_command(self.uuid, brick.CMD_LED_FADE,
+    { red = color.red, green = color.green, blue = color.blue, ms = ms })
+end
+
+-- Store a colour that only shows on the next latch(), so a whole group changes at once
+function DeviceRgb:stage_rgb(color)
+  return brick.stage_command(self.uuid, brick.CMD_LED_RGB, color)
+end
+
+-- DeviceStepper subclass: moves run on the module, the script only starts and watches them
+local DeviceStepper = {}
+DeviceStepper.__index = DeviceStepper
+setmetatable(DeviceStepper, { __index = Device })
+
+function DeviceStepper.new(uuid)
+  local base = Device.new(uuid)
+  assert(base:get_type() == brick.DEVICE_MOTOR_STEPPER, "Not a stepper motor")
+  return setmetatable(base, DeviceStepper)
+end
+
+-- Move by steps (negative = reverse) at up to speed steps/s, ramping at accel steps/s²
+-- (0 or nil = no ramp). A move sent while the last one still runs is dropped.
+function DeviceStepper:move(steps, speed, accel, microstep)
+  return brick.send_command(self.uuid, brick.CMD_STEPPER_MOVE,
+    { steps = steps, speed = speed, accel = accel, microstep = microstep })
+end
+
+-- Ramp down and stop
+function DeviceStepper:stop()
+  return brick.send_command(self.uuid, brick.CMD_STEPPER_STOP, {})
+end
+
+-- { position = N, busy = bool, speed = steps/s, rejected = bool }, or nil if the module did not answer
+function DeviceStepper:status()
+  return self.handle:stepper_status()
+end
+
+-- Wait up to timeout_ms for the motor to stop; true once it has
+function DeviceStepper:wait_idle(timeout_ms)
+  return wait_idle(self, timeout_ms)
+end
+
+-- DeviceServo subclass: the module ramps to each angle, so a move is a single command
+local DeviceServo = {}
+DeviceServo.__index = DeviceServo
+setmetatable(DeviceServo, { __index = Device })
+
+function DeviceServo.new(uuid)
+  local base = Device.new(uuid)
+  assert(base:get_type() == brick.DEVICE_MOTOR_SERVO_180, "Not a servo motor")
+  return setmetatable(base, DeviceServo)
+end
+
+-- Turn to angle (0..180 degrees) at slew degrees/s (0 or nil = as fast as the servo goes)
+function DeviceServo:set_angle(angle, slew)
+  return brick.send_command(self.uuid, brick.CMD_SERVO_SET_ANGLE, { angle = angle, slew = slew })
+end
+
+-- { angle = degrees, busy = bool, pulse_us = N }, or nil if the module did not answer
+function DeviceServo:status()
+  return self.handle:servo_status()
+end
+
+-- Wait up to timeout_ms for the servo to reach its angle; true once it has
+function DeviceServo:wait_idle(timeout_ms)
+  return wait_idle(self, timeout_ms)
+end
+
+-- Apply the staged state of every device in the groups at the same instant
+local function latch(mask)
+  return brick.latch(mask or brick.GROUP_ALL)
+end
+
+-- Move several steppers at once so they also arrive together: { [stepper] = steps, ... } with
+-- DeviceStepper objects or UUIDs as keys. The longest axis runs at speed steps/s (ramping at
+-- accel), the others in proportion. All axes must be idle; false if none was started.
+local function move_together(axes, speed, accel, microstep)
+  local by_uuid = {}
+  for axis, steps in pairs(axes) do
+    by_uuid[type(axis) == "table" and axis.uuid or axis] = steps
+  end
+  return brick.move_together(by_uuid, speed, accel, microstep)
+end
+
+-- Set every RGB device in the groups to one colour with a single bus write
+local function set_rgb_group(mask, color)
+  return brick.group_command(mask, brick.CMD_LED_RGB, color)
+end
+
+-- Wait for a future returned by an *_async call. Inside a coroutine, yields
+-- until the transfer is done so other coroutines can keep running.
+local function await(future, timeout_ms)
+  if coroutine.isyieldable() then
+    while not future:done() do
+      coroutine.yield()
+    end
+  end
+  return future:wait(timeout_ms)                               -- Returns true, or false + error
+end
+
 -- Return the module: exposes both classes to users of require("brick_labs")
 return {
   Device = Device,
-  DeviceRgb = DeviceRgb
+  DeviceRgb = DeviceRgb,
+  DeviceStepper = DeviceStepper,
+  DeviceServo = DeviceServo,
+  await = await,
+  latch = latch,
+  move_together = move_together,
+  set_rgb_group = set_rgb_group
 }
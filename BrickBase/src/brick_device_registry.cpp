@@ -0,0 +1,146 @@
+#include "brick_device_registry.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+static_assert((BRICK_REGISTRY_HASH_SIZE & (BRICK_REGISTRY_HASH_SIZE - 1)) == 0,
+              "BRICK_REGISTRY_HASH_SIZE must be a power of two");
+
+// One device record behind a sequence counter: odd while a writer is inside.
+// The UUID never changes once a slot is published, so the hash probe may read it directly.
+struct brick_registry_slot_t {
+    std::atomic<uint32_t> seq;
+    brick_device_t device;
+};
+
+// Devices live in one contiguous array and are only ever appended, which keeps
+// handles stable and lets the hash do without tombstones.
+static brick_registry_slot_t slots[BRICK_REGISTRY_CAPACITY];
+static std::atomic<size_t> device_count{0};
+static std::atomic<brick_device_handle_t> address_table[BRICK_I2C_BUS_COUNT][128]; // one shard per bus
+static std::atomic<brick_device_handle_t> uuid_hash[BRICK_REGISTRY_HASH_SIZE];
+static std::mutex writer_mutex;
+static portMUX_TYPE record_lock = portMUX_INITIALIZER_UNLOCKED; // a record is never half-written while its writer is preempted
+
+// Handles are stored +1 so that the zero-initialised tables read as empty
+static brick_device_handle_t brick_registry_decode(brick_device_handle_t stored) {
+    return stored == 0 ? BRICK_INVALID_DEVICE_HANDLE : stored - 1;
+}
+
+// FNV-1a over the whole UUID; the type prefix alone would put every module of a kind in one bucket
+static uint32_t brick_registry_hash(const brick_uuid_t *uuid) {
+    uint32_t hash = 2166136261u;
+    for (uint8_t byte: uuid->bytes) {
+        hash = (hash ^ byte) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Returns the bucket holding uuid, or the empty bucket where it would go
+static size_t brick_registry_bucket(const brick_uuid_t *uuid) {
+    size_t bucket = brick_registry_hash(uuid) & (BRICK_REGISTRY_HASH_SIZE - 1);
+
+    while (true) {
+        brick_device_handle_t handle = brick_registry_decode(uuid_hash[bucket].load(std::memory_order_acquire));
+        if (handle == BRICK_INVALID_DEVICE_HANDLE) return bucket;
+        if (std::memcmp(slots[handle].device.uuid.bytes, uuid->bytes, sizeof(uuid->bytes)) == 0) return bucket;
+
+        bucket = (bucket + 1) & (BRICK_REGISTRY_HASH_SIZE - 1);
+    }
+}
+
+// Runs in a critical section: a reader of higher priority on the writer's core would
+// otherwise spin on the odd sequence while the writer it waits for never gets to run.
+static void brick_registry_write(brick_registry_slot_t &slot, const brick_device_t &device) {
+    portENTER_CRITICAL(&record_lock);
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.device = device;
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+    portEXIT_CRITICAL(&record_lock);
+}
+
+brick_device_handle_t brick_registry_find_uuid(const brick_uuid_t *uuid) {
+    return brick_registry_decode(uuid_hash[brick_registry_bucket(uuid)].load(std::memory_order_acquire));
+}
+
+brick_device_handle_t brick_registry_find_address(uint8_t bus, uint8_t address) {
+    if (bus >= BRICK_I2C_BUS_COUNT) return BRICK_INVALID_DEVICE_HANDLE;
+
+    return brick_registry_decode(address_table[bus][address & 0x7F].load(std::memory_order_acquire));
+}
+
+bool brick_registry_snapshot(brick_device_handle_t handle, brick_device_t *out) {
+    if (handle >= brick_registry_count()) return false;
+
+    const brick_registry_slot_t &slot = slots[handle];
+    uint32_t before, after;
+
+    do {
+        before = slot.seq.load(std::memory_order_acquire);
+        std::memcpy(out, &slot.device, sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot.seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    return true;
+}
+
+size_t brick_registry_count() {
+    return device_count.load(std::memory_order_acquire);
+}
+
+brick_device_handle_t brick_registry_insert(const brick_device_t *device) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+
+    size_t bucket = brick_registry_bucket(&device->uuid);
+    brick_device_handle_t existing = brick_registry_decode(uuid_hash[bucket].load(std::memory_order_relaxed));
+    if (existing != BRICK_INVALID_DEVICE_HANDLE) return existing;
+
+    size_t count = device_count.load(std::memory_order_relaxed);
+    if (count == BRICK_REGISTRY_CAPACITY) return BRICK_INVALID_DEVICE_HANDLE;
+
+    // Fill the slot first, then make it reachable: count, hash, address
+    auto handle = static_cast<brick_device_handle_t>(count);
+    brick_registry_write(slots[handle], *device);
+    device_count.store(count + 1, std::memory_order_release);
+    uuid_hash[bucket].store(handle + 1, std::memory_order_release);
+    address_table[device->i2c_bus % BRICK_I2C_BUS_COUNT][device->i2c_address & 0x7F].store(handle + 1, std::memory_order_release);
+
+    return handle;
+}
+
+void brick_registry_set_presence(brick_device_handle_t handle, uint8_t bus, uint8_t address, bool online) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (handle >= device_count.load(std::memory_order_relaxed) || bus >= BRICK_I2C_BUS_COUNT) return;
+
+    brick_registry_slot_t &slot = slots[handle];
+    brick_device_t device = slot.device; // writers are serialised, so this read is stable
+    std::atomic<brick_device_handle_t> &old_entry = address_table[device.i2c_bus % BRICK_I2C_BUS_COUNT][device.i2c_address & 0x7F];
+    std::atomic<brick_device_handle_t> &new_entry = address_table[bus][address & 0x7F];
+
+    device.i2c_bus = bus;
+    device.i2c_address = address;
+    device.online = online;
+    brick_registry_write(slot, device);
+
+    if (&old_entry != &new_entry && old_entry.load(std::memory_order_relaxed) == handle + 1) {
+        old_entry.store(0, std::memory_order_release);
+    }
+    new_entry.store(handle + 1, std::memory_order_release);
+}
+
+void brick_registry_set_caps(brick_device_handle_t handle, const brick_caps_t *caps) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (handle >= device_count.load(std::memory_order_relaxed)) return;
+
+    brick_registry_slot_t &slot = slots[handle];
+    brick_device_t device = slot.device;
+    device.caps = *caps;
+    brick_registry_write(slot, device);
+}
@@ -0,0 +1,74 @@
+// brick_device_registry.hpp
+#ifndef BRICK_DEVICE_REGISTRY_HPP
+#define BRICK_DEVICE_REGISTRY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "brick_i2c_api.h"
+#include "brick_i2c_engine.hpp"
+
+#define BRICK_REGISTRY_CAPACITY   160 // devices across all buses
+#define BRICK_REGISTRY_HASH_SIZE  512 // UUID hash buckets, power of two, > 2x capacity
+
+/**
+ * @brief Stable index of a device in the registry. Devices are never removed, so a
+ *        handle stays valid (and keeps pointing at the same UUID) until reboot.
+ */
+typedef uint8_t brick_device_handle_t;
+
+#define BRICK_INVALID_DEVICE_HANDLE 0xFF
+
+static_assert(BRICK_REGISTRY_CAPACITY < BRICK_INVALID_DEVICE_HANDLE, "handles must fit in a byte");
+
+/*
+ * Readers (BLE, Lua) never lock: every slot is protected by a sequence counter and
+ * brick_registry_snapshot() retries until it has copied a version no writer touched.
+ * Writers (the discovery task) serialise among themselves and publish whole records, each
+ * copy inside a short critical section so no reader ever waits on a preempted writer.
+ * Nothing hands out pointers into the registry.
+ */
+
+/**
+ * @brief Looks a device up by UUID through the open-addressing hash. Lock-free.
+ * @return Handle, or BRICK_INVALID_DEVICE_HANDLE if unknown.
+ */
+brick_device_handle_t brick_registry_find_uuid(const brick_uuid_t *uuid);
+
+/**
+ * @brief Looks a device up by its current bus and 7-bit address. Lock-free; may lag a concurrent move.
+ * @return Handle, or BRICK_INVALID_DEVICE_HANDLE if no known device uses the address on that bus.
+ */
+brick_device_handle_t brick_registry_find_address(uint8_t bus, uint8_t address);
+
+/**
+ * @brief Copies a consistent version of a device record. Lock-free.
+ * @param handle Device to read.
+ * @param out Receives the copy.
+ * @return false for an invalid handle.
+ */
+bool brick_registry_snapshot(brick_device_handle_t handle, brick_device_t *out);
+
+/**
+ * @brief Number of registered devices. Handles 0..count-1 are all valid.
+ */
+size_t brick_registry_count();
+
+/**
+ * @brief Adds a device, or returns the existing handle if its UUID is already registered.
+ * @param device Device to copy into the registry.
+ * @return Handle, or BRICK_INVALID_DEVICE_HANDLE if the registry is full.
+ */
+brick_device_handle_t brick_registry_insert(const brick_device_t *device);
+
+/**
+ * @brief Publishes a device's new bus, address and online flag, keeping the address tables in sync.
+ */
+void brick_registry_set_presence(brick_device_handle_t handle, uint8_t bus, uint8_t address, bool online);
+
+/**
+ * @brief Publishes the capabilities a device reported, e.g. after a firmware update.
+ */
+void brick_registry_set_caps(brick_device_handle_t handle, const brick_caps_t *caps);
+
+#endif // BRICK_DEVICE_REGISTRY_HPP
@@ -15,6 +15,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 //====================================================================================
 // Command Types
@@ -32,11 +33,139 @@ typedef enum {
     CMD_LED = 0x01, /**< Set single LED intensity */
     CMD_LED_DOUBLE = 0x02, /**< Set dual LED intensities */
     CMD_LED_RGB = 0x03, /**< Set RGB LED values */
-    CMD_SERVO_SET_ANGLE = 0x10, /**< Set angle for servo motor (-365 to 365 degrees) */
-    CMD_STEPPER_MOVE = 0x11, /**< Move stepper motor: direction + steps + microstepping */
-    CMD_SENSOR_GET_CM = 0x30 /**< Request distance sensor measurement in centimeters */
+    CMD_LED_FADE = 0x04, /**< Fade the RGB LED to a colour on the module: brick_device_led_rgb_impl_t */
+    CMD_SERVO_SET_ANGLE = 0x10, /**< Move the servo to an angle at a slew rate: brick_servo_move_t */
+    CMD_STEPPER_MOVE = 0x11, /**< Run a move on the module: brick_stepper_move_t */
+    CMD_STEPPER_STATUS = 0x12, /**< Request the motion status (brick_stepper_status_t) */
+    CMD_STEPPER_STOP = 0x13, /**< Ramp the running move down and stop */
+    CMD_STEPPER_MOVE_SYNC = 0x14, /**< Run this axis' part of a move shared with others: brick_device_stepper_motor_impl_t */
+    CMD_GROUP_ASSIGN = 0x20, /**< Set the module's group membership: uint8 bit mask */
+    CMD_STAGE = 0x21, /**< Store the wrapped command (cmd + payload) without applying it */
+    CMD_LATCH = 0x22, /**< General call: group mask; members apply their staged command */
+    CMD_GROUP_WRITE = 0x23, /**< General call: group mask + wrapped command; members apply it */
+    CMD_ENUM_RESET = 0x24, /**< To the enumeration address: every unassigned module joins the search */
+    CMD_ENUM_SEARCH = 0x25, /**< To the enumeration address: start bit + value of the bit before it, then read */
+    CMD_ENUM_ASSIGN = 0x26, /**< To the enumeration address: new address + UUID; only that module takes it */
+    CMD_GET_CAPS = 0x27, /**< Request the capabilities record (brick_caps_t) */
+    CMD_BUS_CLOCK = 0x28, /**< General call, no group mask: SCL clock in kHz (uint16) of the device traffic that follows */
+    CMD_GET_STATUS = 0x29, /**< Request the module's status record (brick_module_status_t) */
+    CMD_CHECKED = 0x2A, /**< Sequence number + wrapped command + CRC-8; see BRICK_FRAME_CHECK_LEN */
+    CMD_CHECKED_READ = 0x2B, /**< Register or read command + length + CRC-8, then read: data + CRC-8 */
+    CMD_SENSOR_GET_CM = 0x30 /**< Latest filtered distance in centimeters */
 } brick_command_type_t;
 
+/** Address every module listens on for CMD_LATCH and CMD_GROUP_WRITE (I²C general call). */
+#define BRICK_I2C_GENERAL_CALL_ADDRESS 0x00
+
+/** Group mask matching every module in at least one of the groups scripts use (BRICK_GROUP_SYNC is not one). */
+#define BRICK_GROUP_ALL 0x7F
+
+/** Group the host puts the axes of a synchronised move in for the latch that starts them; scripts use the others. */
+#define BRICK_GROUP_SYNC 0x80
+
+/**
+ * Address every module answers on until the host assigns it one (CMD_ENUM_ASSIGN).
+ * The host resolves several modules sharing it by searching their UUIDs bit by bit:
+ * modules whose bit before the start bit differs from the given value drop out of the
+ * search, the rest answer each UUID bit b as the pair (b, !b), bit 0 first, four pairs
+ * per byte from the least significant bits. Since the bus is a wired AND, a (0, 0) pair
+ * means the active modules disagree on that bit and (1, 1) that none is left.
+ */
+#define BRICK_I2C_ENUM_ADDRESS 0x08
+
+/** UUID bits covered by the search: the bit index counts from the MSB of byte 0. */
+#define BRICK_ENUM_UUID_BITS 128
+
+/** CMD_ENUM_SEARCH reply: bit pairs per byte; pairs past the last UUID bit read as (1, 1). */
+#define BRICK_ENUM_PAIRS_PER_BYTE 4
+
+/**
+ * Protocol revision a module reports in brick_caps_t::protocol_version.
+ * 1: capabilities record. 2: register map (BRICK_REG_BASE). 3: checked frames (CMD_CHECKED).
+ * 4: events and the attention line (BRICK_REG_EVENTS). 5: sensor registers (BRICK_REG_SENSOR_READING).
+ * 6: synchronised stepper moves (CMD_STEPPER_MOVE_SYNC).
+ */
+#define BRICK_PROTOCOL_VERSION 6
+
+/**
+ * Bytes CMD_CHECKED adds around a command: [CMD_CHECKED, seq, cmd, payload..., crc]. The CRC-8
+ * (polynomial 0x07, initial value 0, as the SMBus PEC) covers the address byte and every byte
+ * before it. A read in the same transaction (repeated start) returns the status of the frame
+ * and a CRC-8 over the read address byte and the status; after a stop the status is lost.
+ *
+ * The host numbers the frames it sends a module; a retry repeats the frame unchanged. The
+ * module takes a frame once: a repeat of one of the last BRICK_FRAME_SEQ_WINDOW sequence
+ * numbers, or an older one, is acknowledged as BRICK_FRAME_DUPLICATE and dropped. A frame
+ * without a command resynchronises the module: its sequence number counts as the last taken.
+ *
+ * CMD_CHECKED_READ [cmd, reg, len, crc] reads like a one-byte pointer write, reg being a
+ * register or a read command, and returns len bytes and a CRC-8 over the read address byte
+ * and the data.
+ */
+#define BRICK_FRAME_CHECK_LEN 3
+
+/** Sequence numbers before the newest one that a module still tells apart. */
+#define BRICK_FRAME_SEQ_WINDOW 16
+
+/** CMD_CHECKED status. 0: the module did not take the frame (CRC mismatch, queue full), send it again. */
+#define BRICK_FRAME_ACCEPTED 0x80 /**< The module has the command, from this frame or an earlier copy */
+#define BRICK_FRAME_DUPLICATE 0x40 /**< The frame was a repeat; its command is not applied again */
+
+/** Bytes of a CMD_CHECKED read: status + CRC-8. */
+#define BRICK_FRAME_REPLY_LEN 2
+
+/**
+ * Module events. A module sets bits in its events register as things happen and pulls the
+ * attention line it shares with the rest of its bus low (open drain) while any of them is
+ * also set in event_mask. The host answers the line by reading the events register of its
+ * modules and writing back the bits it has taken: a write clears the bits set in it, so an
+ * event that comes up in between stays pending and keeps the line low.
+ */
+#define BRICK_EVENT_RESET 0x01 /**< The module started up; whatever the host sent it before is gone */
+#define BRICK_EVENT_MOVE_DONE 0x02 /**< A move the module accepted has finished */
+#define BRICK_EVENT_ALL 0xFF /**< event_mask at power-up */
+
+/**
+ * Clock assumed for modules without a capabilities record. Discovery always runs at it,
+ * so a module is found whatever rate the rest of its bus was negotiated to.
+ */
+#define BRICK_CAPS_LEGACY_CLOCK_KHZ 100
+
+/** CMD_SENSOR_GET_CM answers with the distance as uint16 centimetres, little-endian. */
+#define BRICK_SENSOR_CM_READ_LEN 2
+
+/**
+ * Sensor modules of protocol 5 and later measure on their own timer and filter on the
+ * module: a median over the last brick_sensor_config_t::median measurements, then an
+ * exponential average. A read returns the latest result at once instead of waiting for a
+ * measurement; CMD_SENSOR_GET_CM then reads value[0] of brick_sensor_reading_t.
+ */
+#define BRICK_SENSOR_CHANNELS 4 /**< Values per reading: distance uses the first, colour red, green, blue, clear */
+#define BRICK_SENSOR_MAX_MEDIAN 7 /**< Longest median window, in measurements */
+#define BRICK_SENSOR_MAX_EMA_SHIFT 7 /**< Slowest average: a new value weighs 1/128 */
+
+/** brick_sensor_reading_t::flags */
+#define BRICK_SENSOR_VALID 0x01 /**< value holds at least one measurement */
+#define BRICK_SENSOR_OUT_OF_RANGE 0x02 /**< The last measurement found nothing and was left out */
+
+/** Fastest step rate of the on-module motion engine, in steps/s. */
+#define BRICK_STEPPER_MAX_SPEED 10000
+
+/** brick_stepper_move_t::mode: direction bit; the microstep pins S1..S3 follow in bits 1-3. */
+#define BRICK_STEPPER_DIR_REVERSE 0x01
+#define BRICK_STEPPER_MICROSTEP_SHIFT 1
+#define BRICK_STEPPER_MICROSTEP_MASK 0x07
+
+/** brick_stepper_status_t::flags */
+#define BRICK_STEPPER_BUSY 0x01 /**< A move is running or still queued on the module */
+#define BRICK_STEPPER_REJECTED 0x02 /**< The last CMD_STEPPER_MOVE came while busy and was dropped */
+
+/** Widest angle of a servo module, in degrees; larger targets are clamped. */
+#define BRICK_SERVO_MAX_ANGLE 180
+
+/** brick_servo_status_t::flags */
+#define BRICK_SERVO_BUSY 0x01 /**< The servo is still slewing or a move is queued on the module */
+
 //====================================================================================
 // Device Types
 //====================================================================================
@@ -92,6 +221,202 @@ typedef union {
     uint8_t bytes[16]; /**< Raw 16-byte UUID */
 } brick_uuid_t;
 
+/**
+ * @struct brick_caps_t
+ * @brief Capabilities record a module answers CMD_GET_CAPS with.
+ *
+ * Firmware that predates the record answers the read with its UUID instead; the host
+ * recognises the 'B', 'L' prefix and assumes BRICK_CAPS_LEGACY_CLOCK_KHZ.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t protocol_version; /**< BRICK_PROTOCOL_VERSION of the module firmware, 0 = no record */
+    uint16_t max_clock_khz; /**< Fastest SCL clock the module follows, little-endian */
+    uint8_t max_write; /**< Longest write it accepts: command byte + payload */
+    uint8_t max_read; /**< Longest read it serves */
+    uint8_t reserved[3]; /**< Reserved for future expansion */
+} brick_caps_t;
+
+/**
+ * @struct brick_module_status_t
+ * @brief Reply to CMD_GET_STATUS: how the module's command queue has kept up.
+ *
+ * A module queues the commands it receives and applies them outside its interrupt; a
+ * command that finds the queue full, or is longer than brick_caps_t::max_write, is dropped.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t frames_dropped; /**< Commands dropped since power-up, saturating at 255 */
+    uint8_t queue_high_water; /**< Most commands ever waiting at once */
+    uint8_t queue_slots; /**< Commands the queue holds */
+    uint8_t duplicates; /**< Checked frames dropped as repeats, saturating at 255 */
+} brick_module_status_t;
+
+/**
+ * @struct brick_stepper_move_t
+ * @brief CMD_STEPPER_MOVE payload. The module ramps up at accel, cruises at max_speed and
+ *        ramps down to stop after exactly steps steps. Little-endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t mode; /**< BRICK_STEPPER_DIR_REVERSE | microstep pins << BRICK_STEPPER_MICROSTEP_SHIFT */
+    uint32_t steps; /**< Steps to move */
+    uint16_t max_speed; /**< Cruise speed in steps/s, up to BRICK_STEPPER_MAX_SPEED */
+    uint16_t accel; /**< Acceleration in steps/s², 0 = start and stop at max_speed */
+} brick_stepper_move_t;
+
+/**
+ * @struct brick_stepper_status_t
+ * @brief Reply to CMD_STEPPER_STATUS. Little-endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t flags; /**< BRICK_STEPPER_BUSY, BRICK_STEPPER_REJECTED */
+    int32_t position; /**< Steps from power-up, reverse moves counting down */
+    uint16_t speed; /**< Current step rate in steps/s */
+} brick_stepper_status_t;
+
+/**
+ * @struct brick_servo_move_t
+ * @brief Payload of CMD_SERVO_SET_ANGLE. Little-endian. The module ramps to the angle
+ *        itself; the first move after power-up jumps, as the servo's position is unknown.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t angle; /**< Target in degrees, 0..BRICK_SERVO_MAX_ANGLE */
+    uint16_t slew; /**< Degrees/s, 0 = go straight to the target */
+} brick_servo_move_t;
+
+/**
+ * @struct brick_servo_status_t
+ * @brief Where a servo module is driving the servo. Little-endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t flags; /**< BRICK_SERVO_BUSY */
+    uint8_t angle; /**< Angle the pulses currently command, in degrees */
+    uint16_t pulse_us; /**< Current pulse width, 0 until the first move */
+} brick_servo_status_t;
+
+/**
+ * @struct brick_sensor_config_t
+ * @brief How a sensor module measures. Little-endian. The module writes back what it
+ *        applied: periods below what the sensor manages and out-of-range windows are clamped,
+ *        an even median window is cut to the odd one below.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t period_ms; /**< Time between measurements, 0 = the sensor's default */
+    uint8_t median; /**< Median window, 1..BRICK_SENSOR_MAX_MEDIAN; 1 = no median */
+    uint8_t ema_shift; /**< A new median weighs 1/2^ema_shift in the average; 0 = no average */
+} brick_sensor_config_t;
+
+/**
+ * @struct brick_sensor_reading_t
+ * @brief Latest filtered result of a sensor module. Little-endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t flags; /**< BRICK_SENSOR_VALID, BRICK_SENSOR_OUT_OF_RANGE */
+    uint16_t samples; /**< Measurements taken into value since power-up; wraps. Unchanged = nothing new */
+    uint32_t timestamp_ms; /**< Module time of the latest of them */
+    uint16_t age_ms; /**< How long before this read began that was, saturating */
+    uint16_t value[BRICK_SENSOR_CHANNELS]; /**< Filtered, in the sensor's unit (cm for distance) */
+} brick_sensor_reading_t;
+
+//====================================================================================
+// Register Map
+//====================================================================================
+
+/**
+ * First register address. Modules of protocol version 2 also serve a register file: a first
+ * byte of BRICK_REG_BASE or above is a register pointer instead of a command. A write goes
+ * on with data for the registers from the pointer on; a read right after the pointer, in the
+ * same transaction (repeated start), returns the registers from the pointer on. Both
+ * auto-increment, so one transaction covers any contiguous block. Reads past the file return
+ * 0xFF, writes to read-only registers are ignored.
+ *
+ * The reads of CMD_IDENTIFY, CMD_GET_CAPS, CMD_GET_STATUS, CMD_STEPPER_STATUS and
+ * CMD_SENSOR_GET_CM return the same bytes as a read from BRICK_REG_UUID, BRICK_REG_CAPS,
+ * BRICK_REG_STATUS, BRICK_REG_STEPPER_STATUS and BRICK_REG_SENSOR_VALUE.
+ */
+#define BRICK_REG_BASE 0x80
+
+/**
+ * @struct brick_module_counters_t
+ * @brief Traffic counters since power-up; they wrap. Little-endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t frames; /**< Writes received, dropped ones included */
+    uint16_t reads; /**< Reads served */
+    uint16_t bus_errors; /**< Bus collisions the module saw */
+    uint16_t crc_errors; /**< Checked frames and read requests that failed their CRC-8 */
+} brick_module_counters_t;
+
+/**
+ * @struct brick_stepper_registers_t
+ * @brief Device registers of a stepper module.
+ */
+typedef struct __attribute__((packed)) {
+    brick_stepper_move_t move; /**< RW: writing any part of it starts a move with the whole block */
+    brick_stepper_status_t status; /**< R */
+} brick_stepper_registers_t;
+
+/**
+ * @struct brick_servo_registers_t
+ * @brief Device registers of a servo module.
+ */
+typedef struct __attribute__((packed)) {
+    brick_servo_move_t move; /**< RW: writing any part of it starts a move with the whole block */
+    brick_servo_status_t status; /**< R */
+} brick_servo_registers_t;
+
+/**
+ * @struct brick_sensor_registers_t
+ * @brief Device registers of a sensor module.
+ */
+typedef struct __attribute__((packed)) {
+    brick_sensor_config_t config; /**< RW: writing any part of it applies the whole block and restarts the filter */
+    brick_sensor_reading_t reading; /**< R */
+} brick_sensor_registers_t;
+
+/**
+ * @union brick_device_registers_t
+ * @brief Registers whose layout depends on the device type.
+ */
+typedef union __attribute__((packed)) {
+    brick_stepper_registers_t stepper;
+    brick_servo_registers_t servo;
+    brick_sensor_registers_t sensor;
+    uint8_t bytes[32];
+} brick_device_registers_t;
+
+/**
+ * @struct brick_register_file_t
+ * @brief The register file; a field's register is BRICK_REG(field).
+ */
+typedef struct __attribute__((packed)) {
+    brick_uuid_t uuid; /**< R */
+    brick_caps_t caps; /**< R */
+    brick_module_status_t status; /**< R */
+    brick_module_counters_t counters; /**< R */
+    uint8_t group_mask; /**< RW: same as CMD_GROUP_ASSIGN */
+    uint8_t events; /**< RW: BRICK_EVENT_* pending; writing a 1 clears the bit */
+    uint8_t event_mask; /**< RW: events that pull the attention line */
+    uint8_t reserved[9]; /**< Reserved for future expansion */
+    brick_device_registers_t device; /**< Device registers */
+} brick_register_file_t;
+
+#define BRICK_REG(field) ((uint8_t)(BRICK_REG_BASE + offsetof(brick_register_file_t, field)))
+
+#define BRICK_REG_UUID           BRICK_REG(uuid)             /**< 0x80 */
+#define BRICK_REG_CAPS           BRICK_REG(caps)             /**< 0x90 */
+#define BRICK_REG_STATUS         BRICK_REG(status)           /**< 0x98 */
+#define BRICK_REG_COUNTERS       BRICK_REG(counters)         /**< 0x9C */
+#define BRICK_REG_GROUP_MASK     BRICK_REG(group_mask)       /**< 0xA4 */
+#define BRICK_REG_EVENTS         BRICK_REG(events)           /**< 0xA5 */
+#define BRICK_REG_EVENT_MASK     BRICK_REG(event_mask)       /**< 0xA6 */
+#define BRICK_REG_DEVICE         BRICK_REG(device)           /**< 0xB0 */
+#define BRICK_REG_STEPPER_MOVE   BRICK_REG(device.stepper.move)   /**< 0xB0 */
+#define BRICK_REG_STEPPER_STATUS BRICK_REG(device.stepper.status) /**< 0xB9 */
+#define BRICK_REG_SERVO_MOVE     BRICK_REG(device.servo.move)     /**< 0xB0 */
+#define BRICK_REG_SERVO_STATUS   BRICK_REG(device.servo.status)   /**< 0xB3 */
+#define BRICK_REG_SENSOR_CONFIG  BRICK_REG(device.sensor.config)  /**< 0xB0 */
+#define BRICK_REG_SENSOR_READING BRICK_REG(device.sensor.reading) /**< 0xB4 */
+#define BRICK_REG_SENSOR_VALUE   BRICK_REG(device.sensor.reading.value) /**< 0xBD */
+
 //====================================================================================
 // Device Implementation Structures
 //====================================================================================
@@ -112,21 +437,30 @@ typedef struct {
 } brick_device_led_double_impl_t;
 
 /**
- * @brief State for an RGB LED device.
+ * @brief State for an RGB LED device. CMD_LED_RGB sends the colour, CMD_LED_FADE the
+ *        colour and fade_ms. Levels are perceived brightness; the module applies the gamma.
  */
-typedef struct {
+typedef struct __attribute__((packed)) {
     uint8_t red;
     uint8_t blue;
     uint8_t green;
+    uint16_t fade_ms; /**< Time the module takes to get from the current colour to this one */
 } brick_device_led_rgb_impl_t;
 
 typedef struct {
-    uint8_t angle;
+    brick_servo_move_t move; /**< Last move sent */
 } brick_device_servo_180_impl_t;
 
-    typedef struct {
-        uint8_t motor;
-    }brick_device_stepper_motor_impl_t;
+/**
+ * @brief State for a stepper device. CMD_STEPPER_MOVE sends the move, CMD_STEPPER_MOVE_SYNC
+ *        the move and lead_steps: the module then runs the profile of max_speed and accel over
+ *        lead_steps and spreads the move's steps evenly over them (Bresenham), so every axis
+ *        of a shared move takes as long as the longest one.
+ */
+typedef struct __attribute__((packed)) {
+    brick_stepper_move_t move; /**< Last move sent */
+    uint32_t lead_steps; /**< Steps of the longest axis, at least move.steps, below 2^31 */
+} brick_device_stepper_motor_impl_t;
 
 /**
  * @union brick_device_impl_t
@@ -152,8 +486,10 @@ typedef struct {
     brick_uuid_t uuid; /**< Unique device UUID */
     brick_device_type_t device_type; /**< Device type */
     uint8_t i2c_address; /**< 7-bit I²C address */
+    uint8_t i2c_bus; /**< Host controller the module is wired to */
     brick_device_impl_t impl; /**< Device-specific data/state */
     uint8_t online; /**< 1 = online, 0 = offline */
+    brick_caps_t caps; /**< Capabilities the module reported when it was identified */
 } brick_device_t;
 
 /**
@@ -177,9 +513,9 @@ typedef struct {
 brick_device_t brick_get_device_specs_from_uuid(const uint8_t *uuid);
 
 /**
- * @brief Calculates a valid I²C address from the UUID.
+ * @brief Returns the I²C address a module answers on at power-up.
  * @param uuid Pointer to the UUID.
- * @return 7-bit I²C address.
+ * @return BRICK_I2C_ENUM_ADDRESS; the host moves each module to a unique address.
  */
 uint8_t brick_uuid_get_i2c_address(const brick_uuid_t *uuid);
 
@@ -190,6 +526,28 @@ uint8_t brick_uuid_get_i2c_address(const brick_uuid_t *uuid);
  */
 bool brick_uuid_valid(const uint8_t *uuid);
 
+/** CRC-8 of every value of crc ^ byte, for brick_crc8_byte(). */
+extern const uint8_t brick_crc8_table[256];
+
+/**
+ * @brief Adds one byte to a CRC-8 (see BRICK_FRAME_CHECK_LEN).
+ * @param crc CRC so far, 0 to start.
+ * @param byte Next byte.
+ * @return The updated CRC. Adding a CRC to the CRC of the bytes before it gives 0.
+ */
+static inline uint8_t brick_crc8_byte(uint8_t crc, uint8_t byte) {
+    return brick_crc8_table[crc ^ byte];
+}
+
+/**
+ * @brief Adds len bytes to a CRC-8.
+ * @param crc CRC so far, 0 to start.
+ * @param data Bytes to add.
+ * @param len Number of bytes.
+ * @return The updated CRC.
+ */
+uint8_t brick_crc8(uint8_t crc, const uint8_t *data, size_t len);
+
 /**
  * @brief Outputs a formatted UUID string to stdout.
  * @param uuid Pointer to the UUID.
@@ -0,0 +1,602 @@
+#include "brick_i2c_engine.hpp"
+#include "brick_i2c_health.hpp"
+#include "brick_i2c_host.hpp"
+#include "brick_i2c_trace.hpp"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include <algorithm>
+#include <cstdio>
+
+enum brick_i2c_slot_state_t : uint8_t {
+    SLOT_FREE = 0,
+    SLOT_QUEUED,
+    SLOT_ACTIVE,
+    SLOT_DONE
+};
+
+struct brick_i2c_slot_t {
+    brick_i2c_request_t request;
+    uint8_t read_buf[BRICK_I2C_MAX_READ];
+    esp_err_t result;
+    uint32_t generation;
+    brick_i2c_slot_state_t state;
+    bool detached; // released while in flight: free the slot on completion
+    bool superseded; // replaced by a newer coalescing write, skip the bus
+    uint8_t attempts; // bus attempts that failed so far
+    uint8_t trace_task; // submitting task, as named in the trace
+    TaskHandle_t owner;
+    int64_t submitted_us;
+    int64_t retry_at_us; // while waiting for a retry: earliest time to requeue
+    SemaphoreHandle_t done;
+};
+
+static_assert(BRICK_I2C_MAX_PENDING <= 0xFF, "slot index must fit in the low byte of a handle");
+
+// One worker per controller. Queues and retries are per bus, so a slow or failing
+// bus never holds up the other; the slot pool and handles are shared.
+struct brick_i2c_bus_t {
+    i2c_port_t port;
+    i2c_config_t config; // as installed, with the clock of the last transaction
+    uint32_t discovery_hz; // clock discovery traffic runs at
+    QueueHandle_t queues[BRICK_I2C_PRIORITY_COUNT];
+    TaskHandle_t task;
+    int64_t last_ack_us[128];
+
+    // Only one transaction is on a bus at a time, so one link buffer serves all of them
+    uint8_t link_buf[BRICK_I2C_LINK_SIZE];
+
+    // Requests waiting out a retry backoff. Only the bus's own task touches these.
+    uint8_t retry_list[BRICK_I2C_MAX_PENDING];
+    size_t retry_count;
+};
+
+// All slot state transitions and the statistics are guarded by one spinlock.
+// Critical sections are a few instructions long; each bus is only ever
+// touched by its engine task, outside the lock.
+static portMUX_TYPE engine_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_slot_t slots[BRICK_I2C_MAX_PENDING];
+static brick_i2c_bus_t buses[BRICK_I2C_BUS_COUNT];
+static brick_i2c_engine_stats_t stats = {};
+static int64_t engine_started_us = 0;
+static brick_i2c_completion_hook_t completion_hook = nullptr;
+
+static brick_i2c_handle_t make_handle(uint8_t index, uint32_t generation) {
+    return (generation << 8) | index;
+}
+
+// Returns the slot a handle refers to, or nullptr if the handle is stale. Call with the lock held.
+static brick_i2c_slot_t *slot_from_handle(brick_i2c_handle_t handle) {
+    uint8_t index = handle & 0xFF;
+    if (handle == BRICK_I2C_INVALID_HANDLE || index >= BRICK_I2C_MAX_PENDING) return nullptr;
+
+    brick_i2c_slot_t *slot = &slots[index];
+    if (slot->state == SLOT_FREE || slot->generation != (handle >> 8)) return nullptr;
+
+    return slot;
+}
+
+static bool is_write_only(const brick_i2c_request_t &request) {
+    return request.read_len == 0 && request.write_len > 0;
+}
+
+// Writes a module applies; a checked one reads back only the module's status
+static bool is_command_write(const brick_i2c_request_t &request) {
+    if (request.flags & BRICK_I2C_FLAG_CHECKED) return request.write_buf[0] == CMD_CHECKED;
+    return is_write_only(request);
+}
+
+// Requests that may share a transaction with the ones before them. A module starts a new
+// frame on every address match and only hands a plain write on at the stop, so a second
+// write to it in the same transaction, or a general call every module answers, would
+// overwrite the first. A checked frame is taken at its repeated start and closed by its read.
+static bool is_batchable(const brick_i2c_request_t &request) {
+    return (request.flags & BRICK_I2C_FLAG_CHECKED) && request.write_buf[0] == CMD_CHECKED &&
+           request.address != BRICK_I2C_GENERAL_CALL_ADDRESS;
+}
+
+// Command byte of a write, inside the checked frame if it is one
+static uint8_t command_of(const brick_i2c_request_t &request) {
+    return (request.flags & BRICK_I2C_FLAG_CHECKED) ? request.write_buf[2] : request.write_buf[0];
+}
+
+// A checked reply ends in a CRC-8 over the read address byte and the data. For a checked
+// write the data is the module's status; a frame it did not take is sent again too.
+static esp_err_t check_reply(const brick_i2c_slot_t &slot) {
+    const brick_i2c_request_t &request = slot.request;
+    if (!(request.flags & BRICK_I2C_FLAG_CHECKED) || request.read_len == 0) return ESP_OK;
+
+    uint8_t len = request.read_len - 1;
+    uint8_t crc = brick_crc8(brick_crc8_byte(0, (request.address << 1) | I2C_MASTER_READ), slot.read_buf, len);
+    if (crc != slot.read_buf[len]) return ESP_ERR_INVALID_CRC;
+    if (request.write_buf[0] == CMD_CHECKED && !(slot.read_buf[0] & BRICK_FRAME_ACCEPTED)) return ESP_ERR_INVALID_RESPONSE;
+
+    return ESP_OK;
+}
+
+static esp_err_t append_request(i2c_cmd_handle_t cmd, brick_i2c_slot_t &slot) {
+    const brick_i2c_request_t &request = slot.request;
+
+    esp_err_t res = i2c_master_start(cmd);
+    if (res == ESP_OK) res = i2c_master_write_byte(cmd, (request.address << 1) | I2C_MASTER_WRITE, true);
+    if (res == ESP_OK && request.write_len > 0) {
+        res = i2c_master_write(cmd, request.write_buf, request.write_len, true);
+    }
+
+    if (res == ESP_OK && request.read_len > 0) {
+        res = i2c_master_start(cmd); // repeated start
+        if (res == ESP_OK) res = i2c_master_write_byte(cmd, (request.address << 1) | I2C_MASTER_READ, true);
+        if (res == ESP_OK) res = i2c_master_read(cmd, slot.read_buf, request.read_len, I2C_MASTER_LAST_NACK);
+    }
+
+    return res;
+}
+
+static esp_err_t build_link(i2c_cmd_handle_t cmd, brick_i2c_slot_t **batch, size_t count) {
+    esp_err_t res = ESP_OK;
+    for (size_t i = 0; i < count && res == ESP_OK; ++i) {
+        res = append_request(cmd, *batch[i]);
+    }
+
+    return res == ESP_OK ? i2c_master_stop(cmd) : res;
+}
+
+// Batches never mix priorities: discovery runs at the bus's base clock, the rest at the
+// clock negotiated with its modules. Switching is a register rewrite on an idle bus.
+static void select_clock(brick_i2c_bus_t &bus, brick_i2c_priority_t priority) {
+    portENTER_CRITICAL(&engine_lock);
+    uint32_t hz = priority == BRICK_I2C_PRIORITY_DISCOVERY ? bus.discovery_hz : stats.bus_clock_hz[&bus - buses];
+    portEXIT_CRITICAL(&engine_lock);
+
+    if (hz == bus.config.master.clk_speed) return;
+
+    bus.config.master.clk_speed = hz;
+    esp_err_t res = i2c_param_config(bus.port, &bus.config);
+    if (res != ESP_OK) {
+        ESP_LOGW("brick_i2c_engine", "Failed to set bus %u to %lu Hz: %s", static_cast<unsigned>(&bus - buses),
+                 static_cast<unsigned long>(hz), esp_err_to_name(res));
+    }
+
+    portENTER_CRITICAL(&engine_lock);
+    stats.bus_clock_switches[&bus - buses]++;
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+static esp_err_t run_on_bus(brick_i2c_bus_t &bus, brick_i2c_slot_t **batch, size_t count, int64_t *start_us, uint32_t *bus_us) {
+    select_clock(bus, batch[0]->request.priority);
+
+    // The link lives in the bus's own buffer; the heap is only a fallback in case the
+    // driver's link entries outgrow BRICK_I2C_LINK_SIZE
+    bool on_heap = false;
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(bus.link_buf, sizeof(bus.link_buf));
+    if (!cmd || build_link(cmd, batch, count) != ESP_OK) {
+        if (cmd) i2c_cmd_link_delete_static(cmd);
+        cmd = i2c_cmd_link_create();
+        on_heap = true;
+        if (!cmd || build_link(cmd, batch, count) != ESP_OK) {
+            if (cmd) i2c_cmd_link_delete(cmd);
+            *start_us = esp_timer_get_time();
+            *bus_us = 0;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    *start_us = esp_timer_get_time();
+    esp_err_t res = i2c_master_cmd_begin(bus.port, cmd, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
+    int64_t busy_us = esp_timer_get_time() - *start_us;
+    if (on_heap) i2c_cmd_link_delete(cmd);
+    else i2c_cmd_link_delete_static(cmd);
+    *bus_us = static_cast<uint32_t>(busy_us);
+
+    // Batches never mix priorities, so the first request tells whose time this was
+    portENTER_CRITICAL(&engine_lock);
+    stats.busy_us += busy_us;
+    stats.bus_busy_us[&bus - buses] += busy_us;
+    stats.priority[batch[0]->request.priority].busy_us += busy_us;
+    stats.transactions++;
+    if (on_heap) stats.link_heap_allocs++;
+    portEXIT_CRITICAL(&engine_lock);
+
+    return res;
+}
+
+static void complete(brick_i2c_slot_t &slot, esp_err_t result) {
+    const brick_i2c_request_t &request = slot.request;
+    uint32_t bytes = 1 + request.write_len + (request.read_len > 0 ? 1 + request.read_len : 0);
+    int64_t now_us = esp_timer_get_time();
+    uint32_t latency_us = now_us - slot.submitted_us;
+
+    portENTER_CRITICAL(&engine_lock);
+    if (result == ESP_OK) buses[request.bus].last_ack_us[request.address & 0x7F] = now_us;
+    brick_i2c_priority_stats_t &prio = stats.priority[request.priority];
+    if (result == ESP_OK) prio.completed++;
+    else prio.failed++;
+    prio.bytes += bytes;
+    stats.bus_bytes[request.bus] += bytes;
+    prio.latency_us_total += latency_us;
+    prio.latency_us_max = std::max(prio.latency_us_max, latency_us);
+    slot.result = result;
+    portEXIT_CRITICAL(&engine_lock);
+
+    if (completion_hook && (request.flags & BRICK_I2C_FLAG_COALESCE)) completion_hook(&request, result, true);
+
+    // Signal while the slot is still ACTIVE, so it cannot be reused before the give lands
+    xSemaphoreGive(slot.done);
+
+    portENTER_CRITICAL(&engine_lock);
+    slot.state = slot.detached ? SLOT_FREE : SLOT_DONE;
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+// Finishes a write that a newer one replaced while it was queued or waiting for a retry.
+// Its value never reaches the device (again), which is the point: last writer wins.
+static void complete_superseded(brick_i2c_slot_t &slot) {
+    slot.result = ESP_OK;
+    if (completion_hook) completion_hook(&slot.request, ESP_OK, false);
+
+    // Still QUEUED, so the slot cannot be reused before the give lands
+    xSemaphoreGive(slot.done);
+
+    portENTER_CRITICAL(&engine_lock);
+    slot.state = slot.detached ? SLOT_FREE : SLOT_DONE;
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+// Probes must reach quarantined devices to notice their recovery, and the general
+// call has no single device behind it
+static bool is_health_gated(const brick_i2c_request_t &request) {
+    return request.priority != BRICK_I2C_PRIORITY_DISCOVERY && request.address != BRICK_I2C_GENERAL_CALL_ADDRESS;
+}
+
+// Marks a popped request ACTIVE, from which point a newer write can no longer replace it.
+// Returns false (and finishes the request) if it was superseded or its device is quarantined.
+static bool claim(brick_i2c_slot_t &slot) {
+    portENTER_CRITICAL(&engine_lock);
+    bool superseded = slot.superseded;
+    if (!superseded) slot.state = SLOT_ACTIVE;
+    portEXIT_CRITICAL(&engine_lock);
+
+    if (superseded) {
+        complete_superseded(slot);
+        return false;
+    }
+
+    if (is_health_gated(slot.request) && !brick_i2c_health_admit(slot.request.bus, slot.request.address)) {
+        brick_i2c_trace_record(&slot.request, slot.trace_task, esp_timer_get_time(), 0, ESP_ERR_INVALID_STATE,
+                               slot.attempts > 0 ? BRICK_I2C_TRACE_FLAG_RETRY : 0);
+        complete(slot, ESP_ERR_INVALID_STATE);
+        return false;
+    }
+
+    return true;
+}
+
+// Records one bus attempt of a request, then either finishes it or parks it for a retry.
+// NACKs, timeouts and failed checks are retried with exponential backoff; other traffic keeps
+// the bus meanwhile.
+static void settle(brick_i2c_bus_t &bus, brick_i2c_slot_t &slot, esp_err_t result, int64_t start_us, uint32_t bus_us,
+                   size_t batch_size) {
+    const brick_i2c_request_t &request = slot.request;
+    bool gated = is_health_gated(request);
+
+    uint8_t trace_flags = (batch_size > 1 ? BRICK_I2C_TRACE_FLAG_BATCH : 0) | (slot.attempts > 0 ? BRICK_I2C_TRACE_FLAG_RETRY : 0);
+    brick_i2c_trace_record(&request, slot.trace_task, start_us, bus_us, result, trace_flags);
+    bus_us /= batch_size; // health sees each request's share of a batch
+
+    // A probe that finds nobody home is an answer, not a fault of the address
+    if (gated || result == ESP_OK) brick_i2c_health_record(request.bus, request.address, result, bus_us, slot.attempts > 0);
+
+    // If this failure quarantined the device, claim() fails the retry without using the bus
+    bool retryable = result == ESP_FAIL || result == ESP_ERR_TIMEOUT || result == ESP_ERR_INVALID_CRC ||
+                     result == ESP_ERR_INVALID_RESPONSE;
+    bool retry = gated && retryable && slot.attempts < BRICK_I2C_MAX_RETRIES;
+    if (!retry) {
+        complete(slot, result);
+        return;
+    }
+
+    slot.retry_at_us = esp_timer_get_time() + (BRICK_I2C_RETRY_BACKOFF_MS * 1000LL << slot.attempts);
+    slot.attempts++;
+    bus.retry_list[bus.retry_count++] = static_cast<uint8_t>(&slot - slots);
+
+    // Queued again as far as submitters can tell: a newer coalescing write replaces the retry
+    portENTER_CRITICAL(&engine_lock);
+    slot.state = SLOT_QUEUED;
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+// Puts retries whose backoff has run out back at the head of their queue, and superseded
+// ones at once, for claim() to finish. Returns how long the engine may sleep before the next one is due.
+static TickType_t requeue_due_retries(brick_i2c_bus_t &bus) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t next_us = INT64_MAX;
+
+    for (size_t i = 0; i < bus.retry_count;) {
+        brick_i2c_slot_t &slot = slots[bus.retry_list[i]];
+
+        portENTER_CRITICAL(&engine_lock);
+        bool superseded = slot.superseded;
+        portEXIT_CRITICAL(&engine_lock);
+
+        if (superseded || slot.retry_at_us <= now_us) {
+            xQueueSendToFront(bus.queues[slot.request.priority], &bus.retry_list[i], 0);
+            bus.retry_list[i] = bus.retry_list[--bus.retry_count];
+            continue;
+        }
+
+        next_us = std::min(next_us, slot.retry_at_us);
+        ++i;
+    }
+
+    if (next_us == INT64_MAX) return portMAX_DELAY;
+    return std::max<TickType_t>(1, pdMS_TO_TICKS((next_us - now_us + 999) / 1000));
+}
+
+// Pops the next request from the highest non-empty queue, plus any checked frames
+// queued right behind it at the same priority.
+static size_t next_batch(brick_i2c_bus_t &bus, brick_i2c_slot_t **batch) {
+    for (int prio = 0; prio < BRICK_I2C_PRIORITY_COUNT; ++prio) {
+        QueueHandle_t queue = bus.queues[prio];
+        uint8_t index;
+        size_t count = 0;
+
+        while (count == 0 && xQueueReceive(queue, &index, 0) == pdTRUE) {
+            if (claim(slots[index])) batch[count++] = &slots[index];
+        }
+        if (count == 0) continue;
+
+        // Retries go out on their own, so a failure is not hidden in a batch again
+        if (batch[0]->attempts > 0) return count;
+
+        while (count < BRICK_I2C_MAX_BATCH && is_batchable(batch[0]->request)) {
+            if (xQueuePeek(queue, &index, 0) != pdTRUE || !is_batchable(slots[index].request) ||
+                slots[index].attempts > 0) break;
+            xQueueReceive(queue, &index, 0);
+            if (claim(slots[index])) batch[count++] = &slots[index];
+        }
+
+        return count;
+    }
+
+    return 0;
+}
+
+static void brick_i2c_engine_task(void *pvParams) {
+    brick_i2c_bus_t &bus = *static_cast<brick_i2c_bus_t *>(pvParams);
+    brick_i2c_slot_t *batch[BRICK_I2C_MAX_BATCH];
+
+    while (true) {
+        TickType_t idle_wait = requeue_due_retries(bus);
+
+        size_t count = next_batch(bus, batch);
+        if (count == 0) {
+            ulTaskNotifyTake(pdTRUE, idle_wait);
+            continue;
+        }
+
+        if (count > 1) {
+            portENTER_CRITICAL(&engine_lock);
+            stats.batches++;
+            stats.batched_requests += count;
+            portEXIT_CRITICAL(&engine_lock);
+        }
+
+        int64_t start_us;
+        uint32_t bus_us;
+        esp_err_t res = run_on_bus(bus, batch, count, &start_us, &bus_us);
+
+        if (res == ESP_OK || count == 1) {
+            for (size_t i = 0; i < count; ++i) {
+                settle(bus, *batch[i], res == ESP_OK ? check_reply(*batch[i]) : res, start_us, bus_us, count);
+            }
+            continue;
+        }
+
+        // A batch fails as a whole; replay it one by one so each request gets its own result
+        for (size_t i = 0; i < count; ++i) {
+            brick_i2c_trace_record(&batch[i]->request, batch[i]->trace_task, start_us, bus_us, res, BRICK_I2C_TRACE_FLAG_BATCH);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            res = run_on_bus(bus, &batch[i], 1, &start_us, &bus_us);
+            settle(bus, *batch[i], res == ESP_OK ? check_reply(*batch[i]) : res, start_us, bus_us, 1);
+        }
+    }
+}
+
+void brick_i2c_engine_set_completion_hook(brick_i2c_completion_hook_t hook) {
+    completion_hook = hook;
+}
+
+// Marks queued coalescing writes to the same target and command as superseded. Call with the lock held.
+// A write waiting for a retry goes however old it is: it already missed its turn, and sent
+// after the newer one it would undo it.
+static void supersede_queued(const brick_i2c_slot_t &newer) {
+    const brick_i2c_request_t &request = newer.request;
+
+    for (auto &slot: slots) {
+        if (&slot == &newer || slot.state != SLOT_QUEUED || slot.superseded) continue;
+        if (!(slot.request.flags & BRICK_I2C_FLAG_COALESCE) || !is_command_write(slot.request)) continue;
+        if (slot.request.bus != request.bus || slot.request.address != request.address ||
+            command_of(slot.request) != command_of(request)) continue;
+        if (slot.attempts == 0 && newer.submitted_us - slot.submitted_us > BRICK_I2C_COALESCE_WINDOW_US) continue;
+
+        slot.superseded = true;
+        stats.merged++;
+    }
+}
+
+void brick_i2c_engine_start(uint8_t bus_index, i2c_port_t port, const i2c_config_t *config) {
+    if (bus_index >= BRICK_I2C_BUS_COUNT || buses[bus_index].task || !config) return;
+
+    // The shared slot pool is set up by whichever bus starts first
+    if (engine_started_us == 0) {
+        for (auto &slot: slots) {
+            slot.done = xSemaphoreCreateBinary();
+            slot.generation = 0;
+            slot.state = SLOT_FREE;
+        }
+        engine_started_us = esp_timer_get_time();
+    }
+
+    brick_i2c_bus_t &bus = buses[bus_index];
+    bus.port = port;
+    bus.config = *config;
+    bus.discovery_hz = config->master.clk_speed;
+    stats.bus_clock_hz[bus_index] = config->master.clk_speed;
+    for (auto &queue: bus.queues) {
+        queue = xQueueCreate(BRICK_I2C_MAX_PENDING, sizeof(uint8_t));
+    }
+
+    char name[configMAX_TASK_NAME_LEN];
+    snprintf(name, sizeof(name), "i2c_engine%u", bus_index);
+
+    xTaskCreatePinnedToCore(
+        brick_i2c_engine_task,
+        name,
+        BRICK_I2C_ENGINE_STACK_SIZE,
+        &bus,
+        BRICK_I2C_ENGINE_PRIORITY,
+        &bus.task,
+        tskNO_AFFINITY
+    );
+}
+
+void brick_i2c_engine_set_clock(uint8_t bus, uint32_t clk_speed_hz) {
+    if (bus >= BRICK_I2C_BUS_COUNT || clk_speed_hz == 0) return;
+
+    portENTER_CRITICAL(&engine_lock);
+    stats.bus_clock_hz[bus] = clk_speed_hz;
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+brick_i2c_handle_t brick_i2c_submit(const brick_i2c_request_t *request) {
+    if (!request || request->bus >= BRICK_I2C_BUS_COUNT || !buses[request->bus].task ||
+        request->priority >= BRICK_I2C_PRIORITY_COUNT ||
+        request->write_len > BRICK_I2C_MAX_WRITE || request->read_len > BRICK_I2C_MAX_READ) {
+        return BRICK_I2C_INVALID_HANDLE;
+    }
+
+    brick_i2c_slot_t *slot = nullptr;
+    uint8_t index = 0;
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&engine_lock);
+    for (index = 0; index < BRICK_I2C_MAX_PENDING; ++index) {
+        if (slots[index].state == SLOT_FREE) {
+            slot = &slots[index];
+            slot->state = SLOT_QUEUED;
+            slot->generation = (slot->generation + 1) & 0x00FFFFFF;
+            if (slot->generation == 0) slot->generation = 1;
+            slot->detached = false;
+            slot->superseded = false;
+            slot->attempts = 0;
+            slot->request = *request;
+            slot->submitted_us = now_us;
+            break;
+        }
+    }
+    if (!slot) stats.rejected++;
+    else if ((request->flags & BRICK_I2C_FLAG_COALESCE) && is_command_write(*request)) supersede_queued(*slot);
+    portEXIT_CRITICAL(&engine_lock);
+
+    if (!slot) return BRICK_I2C_INVALID_HANDLE;
+
+    slot->owner = xTaskGetCurrentTaskHandle();
+    slot->trace_task = brick_i2c_trace_task_id();
+    xSemaphoreTake(slot->done, 0); // drop a completion left over from the previous user
+
+    brick_i2c_handle_t handle = make_handle(index, slot->generation);
+
+    // Queues hold BRICK_I2C_MAX_PENDING entries, so this never fails once a slot is taken
+    brick_i2c_bus_t &bus = buses[request->bus];
+    xQueueSend(bus.queues[request->priority], &index, 0);
+    xTaskNotifyGive(bus.task);
+
+    return handle;
+}
+
+bool brick_i2c_is_done(brick_i2c_handle_t handle) {
+    if (handle == BRICK_I2C_NOOP_HANDLE) return true;
+
+    portENTER_CRITICAL(&engine_lock);
+    brick_i2c_slot_t *slot = slot_from_handle(handle);
+    bool done = !slot || slot->state == SLOT_DONE;
+    portEXIT_CRITICAL(&engine_lock);
+
+    return done;
+}
+
+esp_err_t brick_i2c_wait(brick_i2c_handle_t handle, TickType_t timeout, uint8_t *read_buf) {
+    if (handle == BRICK_I2C_NOOP_HANDLE) return ESP_OK;
+
+    portENTER_CRITICAL(&engine_lock);
+    brick_i2c_slot_t *slot = slot_from_handle(handle);
+    bool done = slot && slot->state == SLOT_DONE;
+    portEXIT_CRITICAL(&engine_lock);
+
+    if (!slot) return ESP_ERR_INVALID_ARG;
+
+    if (!done) {
+        if (xSemaphoreTake(slot->done, timeout) != pdTRUE) return ESP_ERR_TIMEOUT;
+        xSemaphoreGive(slot->done); // keep it signalled for later waits/polls on the same handle
+    }
+
+    if (read_buf && slot->result == ESP_OK) {
+        std::copy_n(slot->read_buf, slot->request.read_len, read_buf);
+    }
+
+    return slot->result;
+}
+
+void brick_i2c_release(brick_i2c_handle_t handle) {
+    portENTER_CRITICAL(&engine_lock);
+    brick_i2c_slot_t *slot = slot_from_handle(handle);
+    if (slot) {
+        if (slot->state == SLOT_DONE) slot->state = SLOT_FREE;
+        else slot->detached = true;
+    }
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+void brick_i2c_release_task(TaskHandle_t owner) {
+    portENTER_CRITICAL(&engine_lock);
+    for (auto &slot: slots) {
+        if (slot.state == SLOT_FREE || slot.owner != owner) continue;
+
+        if (slot.state == SLOT_DONE) slot.state = SLOT_FREE;
+        else slot.detached = true;
+    }
+    portEXIT_CRITICAL(&engine_lock);
+}
+
+esp_err_t brick_i2c_transfer(const brick_i2c_request_t *request, uint8_t *read_buf) {
+    brick_i2c_handle_t handle = brick_i2c_submit(request);
+    if (handle == BRICK_I2C_INVALID_HANDLE) return ESP_ERR_NO_MEM;
+
+    esp_err_t res = brick_i2c_wait(handle, pdMS_TO_TICKS(BRICK_I2C_WAIT_TIMEOUT_MS), read_buf);
+    brick_i2c_release(handle);
+
+    return res;
+}
+
+int64_t brick_i2c_last_ack_us(uint8_t bus, uint8_t address) {
+    if (bus >= BRICK_I2C_BUS_COUNT) return 0;
+
+    portENTER_CRITICAL(&engine_lock);
+    int64_t ack_us = buses[bus].last_ack_us[address & 0x7F];
+    portEXIT_CRITICAL(&engine_lock);
+
+    return ack_us;
+}
+
+brick_i2c_engine_stats_t brick_i2c_engine_get_stats() {
+    portENTER_CRITICAL(&engine_lock);
+    brick_i2c_engine_stats_t copy = stats;
+    portEXIT_CRITICAL(&engine_lock);
+
+    copy.uptime_us = esp_timer_get_time() - engine_started_us;
+    return copy;
+}
@@ -0,0 +1,185 @@
+// brick_i2c_engine.hpp
+#ifndef BRICK_I2C_ENGINE_HPP
+#define BRICK_I2C_ENGINE_HPP
+
+#include <driver/i2c.h>
+#include <freertos/FreeRTOS.h> // Do NOT remove os headers
+#include <freertos/task.h>
+
+#include <cstdint>
+
+#define BRICK_I2C_BUS_COUNT         2    // I2C controllers, each with its own worker task
+#define BRICK_I2C_MAX_WRITE         20   // command byte + largest payload
+#define BRICK_I2C_MAX_READ          32   // largest read: a register burst (the UUID is 16)
+#define BRICK_I2C_MAX_PENDING       32   // transactions in flight across all priorities
+#define BRICK_I2C_MAX_BATCH         8    // checked frames merged into one bus transaction
+#define BRICK_I2C_WAIT_TIMEOUT_MS   1000 // upper bound for synchronous transfers
+#define BRICK_I2C_COALESCE_WINDOW_US 5000 // queued writes younger than this may be replaced by a newer one
+
+// Command link of one bus transaction, built in a static buffer per bus. A request adds at most
+// 7 link commands (start, address, data, repeated start, address, 2 reads), fewer than the two
+// "transactions" of 5 each the driver's size macro reserves for it.
+#define BRICK_I2C_LINK_SIZE         I2C_LINK_RECOMMENDED_SIZE(2 * BRICK_I2C_MAX_BATCH)
+
+#define BRICK_I2C_ENGINE_STACK_SIZE 4096
+#define BRICK_I2C_ENGINE_PRIORITY   6    // above the scan (5) and Lua (3) tasks
+
+/**
+ * @enum brick_i2c_priority_t
+ * @brief Queue a request is served from. Lower value = served first.
+ */
+enum brick_i2c_priority_t : uint8_t {
+    BRICK_I2C_PRIORITY_ACTUATION = 0, /**< Commands that change module outputs */
+    BRICK_I2C_PRIORITY_SENSOR = 1, /**< Sensor reads */
+    BRICK_I2C_PRIORITY_DISCOVERY = 2, /**< Bus scan probes and identification */
+    BRICK_I2C_PRIORITY_COUNT
+};
+
+#define BRICK_I2C_FLAG_COALESCE 0x01 /**< Write carries full device state; a newer one to the same target supersedes it */
+#define BRICK_I2C_FLAG_CHECKED  0x02 /**< Checked frame (CMD_CHECKED, CMD_CHECKED_READ): the engine verifies the reply's CRC-8 and retries on a mismatch */
+
+/**
+ * @struct brick_i2c_request_t
+ * @brief One bus transaction: optional write, optional read (repeated start), then stop.
+ *
+ * A request with neither write nor read data is an address probe.
+ */
+struct brick_i2c_request_t {
+    uint8_t address; /**< 7-bit target address */
+    uint8_t bus; /**< Controller the target is wired to, < BRICK_I2C_BUS_COUNT */
+    brick_i2c_priority_t priority; /**< Queue to serve the request from */
+    uint8_t write_len; /**< Bytes in write_buf */
+    uint8_t read_len; /**< Bytes to read back after the write */
+    uint8_t flags; /**< BRICK_I2C_FLAG_* */
+    uint8_t write_buf[BRICK_I2C_MAX_WRITE]; /**< Data written after the address byte */
+};
+
+/**
+ * @brief Completion handle for a submitted request. 0 is never a valid handle.
+ */
+typedef uint32_t brick_i2c_handle_t;
+
+#define BRICK_I2C_INVALID_HANDLE 0
+#define BRICK_I2C_NOOP_HANDLE    0xFFFFFFFF // nothing was queued; always done, waits return ESP_OK
+
+/**
+ * @brief Called from the engine task when a BRICK_I2C_FLAG_COALESCE request finishes.
+ * @param request The request.
+ * @param result Result of the transaction.
+ * @param sent false if a newer write superseded the request before it reached the bus.
+ */
+typedef void (*brick_i2c_completion_hook_t)(const brick_i2c_request_t *request, esp_err_t result, bool sent);
+
+/**
+ * @struct brick_i2c_priority_stats_t
+ * @brief Traffic and latency figures for one priority queue.
+ */
+struct brick_i2c_priority_stats_t {
+    uint32_t completed; /**< Requests that succeeded */
+    uint32_t failed; /**< Requests that were NACKed, timed out or hit a bus error */
+    uint32_t bytes; /**< Bytes on the bus, including address bytes */
+    uint64_t latency_us_total; /**< Sum of submit-to-completion latencies */
+    uint32_t latency_us_max; /**< Worst submit-to-completion latency */
+    uint64_t busy_us; /**< Bus time spent serving this queue */
+};
+
+/**
+ * @struct brick_i2c_engine_stats_t
+ * @brief Snapshot of the engine's counters since it started.
+ */
+struct brick_i2c_engine_stats_t {
+    brick_i2c_priority_stats_t priority[BRICK_I2C_PRIORITY_COUNT];
+    uint64_t busy_us; /**< Time spent inside i2c_master_cmd_begin, summed over all buses */
+    uint64_t bus_busy_us[BRICK_I2C_BUS_COUNT]; /**< The same per bus; buses run in parallel */
+    uint64_t bus_bytes[BRICK_I2C_BUS_COUNT]; /**< Bytes on each bus, including address bytes */
+    uint32_t bus_clock_hz[BRICK_I2C_BUS_COUNT]; /**< SCL clock of each bus's device traffic */
+    uint32_t bus_clock_switches[BRICK_I2C_BUS_COUNT]; /**< Times a bus changed clock between discovery and device traffic */
+    uint64_t uptime_us; /**< Time since the engine started */
+    uint32_t batches; /**< Bus transactions that carried more than one request */
+    uint32_t batched_requests; /**< Requests that travelled in such a batch */
+    uint32_t rejected; /**< Submissions refused because the engine was full */
+    uint32_t merged; /**< Coalescing writes dropped because a newer one replaced them in the queue */
+    uint32_t transactions; /**< Bus transactions, single requests and batches alike */
+    uint32_t link_heap_allocs; /**< Transactions whose command link did not fit the static buffer and came from the heap */
+};
+
+/**
+ * @brief Starts the owner task of one bus. Must be called after the bus driver is installed.
+ * @param bus Bus index requests name in brick_i2c_request_t::bus.
+ * @param port Controller the bus is on.
+ * @param config Configuration the driver was set up with (copied). Its clock stays the
+ *        clock of discovery traffic; device traffic starts at it too.
+ */
+void brick_i2c_engine_start(uint8_t bus, i2c_port_t port, const i2c_config_t *config);
+
+/**
+ * @brief Sets the SCL clock of a bus's device traffic. Discovery keeps the clock the bus was
+ *        started with, so modules slower than the new rate are still found. The engine
+ *        reconfigures the controller between transactions, whenever the next batch needs
+ *        the other clock.
+ */
+void brick_i2c_engine_set_clock(uint8_t bus, uint32_t clk_speed_hz);
+
+/**
+ * @brief Installs the hook told about finished coalescing writes. Call before the first submit.
+ */
+void brick_i2c_engine_set_completion_hook(brick_i2c_completion_hook_t hook);
+
+/**
+ * @brief Queues a request without waiting for it.
+ * @param request Transaction to perform (copied).
+ * @return Completion handle, or BRICK_I2C_INVALID_HANDLE if the engine is full or the bus is not started.
+ */
+brick_i2c_handle_t brick_i2c_submit(const brick_i2c_request_t *request);
+
+/**
+ * @brief Checks whether a request has completed, without blocking.
+ * @param handle Handle returned by brick_i2c_submit().
+ * @return true once the request is done (or the handle is no longer valid).
+ */
+bool brick_i2c_is_done(brick_i2c_handle_t handle);
+
+/**
+ * @brief Blocks until a request completes.
+ * @param handle Handle returned by brick_i2c_submit().
+ * @param timeout Maximum time to wait.
+ * @param read_buf Optional buffer receiving request->read_len bytes.
+ * @return Result of the transaction, ESP_ERR_TIMEOUT if it did not complete in time,
+ *         ESP_ERR_INVALID_ARG for a stale handle.
+ */
+esp_err_t brick_i2c_wait(brick_i2c_handle_t handle, TickType_t timeout, uint8_t *read_buf = nullptr);
+
+/**
+ * @brief Gives the handle back. A request still in flight completes in the background.
+ * @param handle Handle returned by brick_i2c_submit().
+ */
+void brick_i2c_release(brick_i2c_handle_t handle);
+
+/**
+ * @brief Releases every handle submitted by a task, e.g. after the task was deleted.
+ * @param owner Task that submitted the requests.
+ */
+void brick_i2c_release_task(TaskHandle_t owner);
+
+/**
+ * @brief Submits a request and waits for it (submit + wait + release).
+ * @param request Transaction to perform.
+ * @param read_buf Optional buffer receiving request->read_len bytes.
+ * @return Result of the transaction.
+ */
+esp_err_t brick_i2c_transfer(const brick_i2c_request_t *request, uint8_t *read_buf);
+
+/**
+ * @brief Time of the last transfer a device acknowledged, from any queue.
+ * @param bus Bus the device is on.
+ * @param address 7-bit address.
+ * @return esp_timer timestamp in microseconds, 0 if the address never answered.
+ */
+int64_t brick_i2c_last_ack_us(uint8_t bus, uint8_t address);
+
+/**
+ * @brief Copies the engine's counters.
+ */
+brick_i2c_engine_stats_t brick_i2c_engine_get_stats();
+
+#endif // BRICK_I2C_ENGINE_HPP
@@ -0,0 +1,226 @@
+#include "brick_i2c_enum.hpp"
+
+#include <esp_log.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <cstring>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_engine.hpp"
+
+static const char *TAG = "brick_i2c_enum";
+
+struct brick_enum_entry_t {
+    brick_uuid_t uuid;
+    uint8_t bus;
+    uint8_t address;
+};
+
+// Address book. Bus and address are unique within it, so it never holds more entries
+// than there are addresses to hand out. The scan tasks of all buses share it.
+static brick_enum_entry_t book[BRICK_I2C_BUS_COUNT * (BRICK_ENUM_ADDRESS_LAST - BRICK_ENUM_ADDRESS_FIRST + 1)];
+static size_t book_count = 0;
+static SemaphoreHandle_t book_mutex = nullptr;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_enum_stats_t stats = {};
+
+static void brick_i2c_enum_count(uint32_t brick_i2c_enum_stats_t::*counter) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.*counter += 1;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static esp_err_t brick_i2c_enum_transfer(uint8_t bus, uint8_t address, const uint8_t *data, uint8_t len,
+                                         uint8_t *read_buf, uint8_t read_len) {
+    brick_i2c_request_t request = {};
+    request.address = address;
+    request.bus = bus;
+    request.priority = BRICK_I2C_PRIORITY_DISCOVERY;
+    if (len > 0) std::memcpy(request.write_buf, data, len);
+    request.write_len = len;
+    request.read_len = read_len;
+
+    return brick_i2c_transfer(&request, read_buf);
+}
+
+static brick_enum_entry_t *brick_i2c_enum_find_uuid(const brick_uuid_t *uuid) {
+    for (size_t i = 0; i < book_count; ++i) {
+        if (std::memcmp(book[i].uuid.bytes, uuid->bytes, 16) == 0) return &book[i];
+    }
+    return nullptr;
+}
+
+static brick_enum_entry_t *brick_i2c_enum_find_address(uint8_t bus, uint8_t address) {
+    for (size_t i = 0; i < book_count; ++i) {
+        if (book[i].bus == bus && book[i].address == address) return &book[i];
+    }
+    return nullptr;
+}
+
+static void brick_i2c_enum_save() {
+    nvs_handle_t nvs;
+    esp_err_t res = nvs_open(BRICK_ENUM_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+
+    if (res == ESP_OK) {
+        res = nvs_set_blob(nvs, BRICK_ENUM_NVS_KEY, book, book_count * sizeof(book[0]));
+        if (res == ESP_OK) res = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+
+    if (res != ESP_OK) ESP_LOGW(TAG, "Failed to save address book: %s", esp_err_to_name(res));
+}
+
+void brick_i2c_enum_init() {
+    book_mutex = xSemaphoreCreateMutex();
+
+    nvs_handle_t nvs;
+    if (nvs_open(BRICK_ENUM_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) return; // nothing saved yet
+
+    size_t size = sizeof(book);
+    if (nvs_get_blob(nvs, BRICK_ENUM_NVS_KEY, book, &size) == ESP_OK && size % sizeof(book[0]) == 0) {
+        book_count = size / sizeof(book[0]);
+    }
+    nvs_close(nvs);
+
+    ESP_LOGI(TAG, "Address book holds %u modules", static_cast<unsigned>(book_count));
+}
+
+void brick_i2c_enum_remember(const brick_uuid_t *uuid, uint8_t bus, uint8_t address) {
+    if (address < BRICK_ENUM_ADDRESS_FIRST || address > BRICK_ENUM_ADDRESS_LAST || bus >= BRICK_I2C_BUS_COUNT) return;
+
+    xSemaphoreTake(book_mutex, portMAX_DELAY);
+    bool changed = false;
+
+    // An address belongs to one module; whoever held it before gets a new one next time
+    for (size_t i = 0; i < book_count;) {
+        if (book[i].bus == bus && book[i].address == address && std::memcmp(book[i].uuid.bytes, uuid->bytes, 16) != 0) {
+            book[i] = book[--book_count];
+            changed = true;
+        } else {
+            ++i;
+        }
+    }
+
+    brick_enum_entry_t *own = brick_i2c_enum_find_uuid(uuid);
+    if (!own) {
+        book[book_count++] = {*uuid, bus, address};
+        changed = true;
+    } else if (own->bus != bus || own->address != address) {
+        own->bus = bus;
+        own->address = address;
+        changed = true;
+    }
+
+    if (changed) brick_i2c_enum_save();
+    xSemaphoreGive(book_mutex);
+}
+
+// Free = no other online module is registered there and nothing acknowledges a probe
+static bool brick_i2c_enum_address_free(uint8_t bus, uint8_t address, const brick_uuid_t *uuid) {
+    brick_device_t device;
+    if (brick_registry_snapshot(brick_registry_find_address(bus, address), &device) && device.online &&
+        std::memcmp(device.uuid.bytes, uuid->bytes, 16) != 0) {
+        return false;
+    }
+
+    return brick_i2c_enum_transfer(bus, address, nullptr, 0, nullptr, 0) != ESP_OK;
+}
+
+// Picks the module's address from the book, then one no other module ever had on this bus,
+// then one of a module that is not around. Call with the book locked.
+static uint8_t brick_i2c_enum_choose_address(uint8_t bus, const brick_uuid_t *uuid) {
+    const brick_enum_entry_t *own = brick_i2c_enum_find_uuid(uuid);
+    if (own && own->bus == bus && brick_i2c_enum_address_free(bus, own->address, uuid)) return own->address;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint8_t addr = BRICK_ENUM_ADDRESS_FIRST; addr <= BRICK_ENUM_ADDRESS_LAST; ++addr) {
+            const brick_enum_entry_t *owner = brick_i2c_enum_find_address(bus, addr);
+            if (owner && (pass == 0 || owner == own)) continue;
+            if (brick_i2c_enum_address_free(bus, addr, uuid)) return addr;
+        }
+    }
+
+    return 0;
+}
+
+// Resolves the UUID of one module waiting on the enumeration address. Where the waiting
+// modules disagree on a bit, the search follows those with a 0 and the others drop out.
+// Returns ESP_ERR_NOT_FOUND if no module is waiting, ESP_FAIL if the search lost its module.
+static esp_err_t brick_i2c_enum_search(uint8_t bus, brick_uuid_t *uuid) {
+    const uint8_t reset[] = {CMD_ENUM_RESET};
+    if (brick_i2c_enum_transfer(bus, BRICK_I2C_ENUM_ADDRESS, reset, sizeof(reset), nullptr, 0) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    std::memset(uuid->bytes, 0, sizeof(uuid->bytes));
+    uint8_t bit = 0, prev = 0;
+
+    while (bit < BRICK_ENUM_UUID_BITS) {
+        const uint8_t search[] = {CMD_ENUM_SEARCH, bit, prev};
+        uint8_t reply[BRICK_ENUM_SEARCH_READ];
+        brick_i2c_enum_count(&brick_i2c_enum_stats_t::search_reads);
+
+        if (brick_i2c_enum_transfer(bus, BRICK_I2C_ENUM_ADDRESS, search, sizeof(search), reply, sizeof(reply)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+
+        bool conflict = false;
+        for (size_t pair = 0; pair < sizeof(reply) * BRICK_ENUM_PAIRS_PER_BYTE && bit < BRICK_ENUM_UUID_BITS && !conflict;
+             ++pair, ++bit) {
+            uint8_t bits = (reply[pair / BRICK_ENUM_PAIRS_PER_BYTE] >> (2 * (pair % BRICK_ENUM_PAIRS_PER_BYTE))) & 0x03;
+            if (bits == 0x03) return ESP_FAIL; // no module left in the search
+
+            // (1, 0) = all have a 1, (0, 1) = all have a 0, (0, 0) = both present
+            conflict = bits == 0x00;
+            prev = bits == 0x01 ? 1 : 0;
+            if (prev) uuid->bytes[bit >> 3] |= 0x80 >> (bit & 7);
+        }
+
+        if (conflict) brick_i2c_enum_count(&brick_i2c_enum_stats_t::conflicts);
+    }
+
+    return brick_uuid_valid(uuid->bytes) ? ESP_OK : ESP_FAIL;
+}
+
+uint8_t brick_i2c_enum_assign_next(uint8_t bus) {
+    brick_uuid_t uuid;
+    esp_err_t res = brick_i2c_enum_search(bus, &uuid);
+    if (res != ESP_OK) {
+        if (res != ESP_ERR_NOT_FOUND) brick_i2c_enum_count(&brick_i2c_enum_stats_t::failures);
+        return 0;
+    }
+
+    xSemaphoreTake(book_mutex, portMAX_DELAY);
+    uint8_t address = brick_i2c_enum_choose_address(bus, &uuid);
+    xSemaphoreGive(book_mutex);
+
+    if (address == 0) {
+        ESP_LOGE(TAG, "No free I2C address left on bus %u for a new module", bus);
+        brick_i2c_enum_count(&brick_i2c_enum_stats_t::failures);
+        return 0;
+    }
+
+    uint8_t assign[2 + sizeof(uuid.bytes)] = {CMD_ENUM_ASSIGN, address};
+    std::memcpy(&assign[2], uuid.bytes, sizeof(uuid.bytes));
+
+    if (brick_i2c_enum_transfer(bus, BRICK_I2C_ENUM_ADDRESS, assign, sizeof(assign), nullptr, 0) != ESP_OK) {
+        brick_i2c_enum_count(&brick_i2c_enum_stats_t::failures);
+        return 0;
+    }
+
+    brick_i2c_enum_count(&brick_i2c_enum_stats_t::assigned);
+    ESP_LOGI(TAG, "Module on bus %u moved from 0x%02X to 0x%02X", bus, BRICK_I2C_ENUM_ADDRESS, address);
+
+    return address;
+}
+
+brick_i2c_enum_stats_t brick_i2c_enum_get_stats() {
+    portENTER_CRITICAL(&stats_lock);
+    brick_i2c_enum_stats_t copy = stats;
+    portEXIT_CRITICAL(&stats_lock);
+
+    return copy;
+}
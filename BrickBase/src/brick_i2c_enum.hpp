@@ -0,0 +1,54 @@
+// brick_i2c_enum.hpp
+#ifndef BRICK_I2C_ENUM_HPP
+#define BRICK_I2C_ENUM_HPP
+
+#include <cstdint>
+
+#include "brick_i2c_api.h"
+
+#define BRICK_ENUM_ADDRESS_FIRST   (BRICK_I2C_ENUM_ADDRESS + 1) // lowest address handed out
+#define BRICK_ENUM_ADDRESS_LAST    0x77
+#define BRICK_ENUM_SEARCH_READ     16 // reply bytes per search step: 64 UUID bits
+
+#define BRICK_ENUM_NVS_NAMESPACE   "brick_i2c"
+#define BRICK_ENUM_NVS_KEY         "addr_book"
+
+/*
+ * Modules power up on BRICK_I2C_ENUM_ADDRESS. Each bus's scan task resolves one of them at
+ * a time by a binary search over the UUIDs (see BRICK_I2C_ENUM_ADDRESS) and moves it to an
+ * address of its own on that bus. Assignments are kept in an address book in NVS, so a
+ * module that is unplugged, or the base itself rebooting, gets the same address again as
+ * long as no other module took it in the meantime.
+ */
+
+/**
+ * @brief Enumeration counters since boot.
+ */
+struct brick_i2c_enum_stats_t {
+    uint32_t assigned; /**< Modules moved off the enumeration address */
+    uint32_t search_reads; /**< Search steps put on the bus */
+    uint32_t conflicts; /**< UUID bits on which the waiting modules disagreed */
+    uint32_t failures; /**< Searches that lost their module or found no free address */
+};
+
+/**
+ * @brief Loads the address book from NVS. Call once, after nvs_flash_init().
+ */
+void brick_i2c_enum_init();
+
+/**
+ * @brief Moves one module waiting on the enumeration address of a bus to an address of its own.
+ *        Called by the bus's scan task; does a single bus write if no module is waiting.
+ * @return The address assigned, 0 if no module was waiting or the assignment failed.
+ */
+uint8_t brick_i2c_enum_assign_next(uint8_t bus);
+
+/**
+ * @brief Records where a module answered, so it gets that address back after a reconnect.
+ *        Called by the scan tasks for every identified module. Writes NVS only on change.
+ */
+void brick_i2c_enum_remember(const brick_uuid_t *uuid, uint8_t bus, uint8_t address);
+
+brick_i2c_enum_stats_t brick_i2c_enum_get_stats();
+
+#endif // BRICK_I2C_ENUM_HPP
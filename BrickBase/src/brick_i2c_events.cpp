@@ -0,0 +1,122 @@
+#include "brick_i2c_events.hpp"
+
+#include "brick_i2c_host.hpp"
+
+// The bus side of events: everything reaches the modules through the transport, so this
+// builds and runs off-target. The attention lines are in brick_i2c_events_line.cpp.
+
+// Oldest protocol with an events register
+#define BRICK_EVENTS_MIN_PROTOCOL 4
+
+static portMUX_TYPE events_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t pending[BRICK_REGISTRY_CAPACITY]; // taken from the module, not handed out yet
+static TaskHandle_t waiters[BRICK_REGISTRY_CAPACITY]; // task in brick_events_wait() per device
+static brick_events_stats_t stats = {};
+
+static const brick_events_transport_t host_transport = {
+    brick_i2c_read_registers,
+    brick_i2c_write_registers,
+    brick_i2c_forget_device_state,
+};
+static const brick_events_transport_t *transport = &host_transport;
+
+static void brick_events_record(brick_device_handle_t device, uint8_t events) {
+    portENTER_CRITICAL(&events_lock);
+    pending[device] |= events;
+    stats.events += __builtin_popcount(events);
+    TaskHandle_t waiter = waiters[device];
+    portEXIT_CRITICAL(&events_lock);
+
+    if (waiter) xTaskNotifyGive(waiter);
+}
+
+size_t brick_events_service_bus(uint8_t bus) {
+    size_t raised = 0;
+    brick_device_t device;
+
+    for (brick_device_handle_t handle = 0; brick_registry_snapshot(handle, &device); ++handle) {
+        if (!device.online || device.i2c_bus != bus || device.caps.protocol_version < BRICK_EVENTS_MIN_PROTOCOL) {
+            continue;
+        }
+
+        uint8_t events;
+        bool read = transport->read_registers(&device, BRICK_REG_EVENTS, &events, 1);
+        portENTER_CRITICAL(&events_lock);
+        if (read) stats.reads++;
+        portEXIT_CRITICAL(&events_lock);
+        if (!read || events == 0) continue;
+
+        // Clears only what was read: an event raised since keeps its bit and the line low.
+        // If the write is lost the same bits come again, which only repeats what is kept.
+        transport->write_registers(&device, BRICK_REG_EVENTS, &events, 1);
+
+        if (events & BRICK_EVENT_RESET) transport->forget_device_state(&device);
+        brick_events_record(handle, events);
+        raised++;
+    }
+
+    portENTER_CRITICAL(&events_lock);
+    stats.passes++;
+    portEXIT_CRITICAL(&events_lock);
+
+    return raised;
+}
+
+void brick_events_set_transport(const brick_events_transport_t *hooks) {
+    transport = hooks ? hooks : &host_transport;
+}
+
+uint8_t brick_events_take(brick_device_handle_t device, uint8_t mask) {
+    if (device >= BRICK_REGISTRY_CAPACITY) return 0;
+
+    portENTER_CRITICAL(&events_lock);
+    uint8_t taken = pending[device] & mask;
+    pending[device] &= ~taken;
+    portEXIT_CRITICAL(&events_lock);
+
+    return taken;
+}
+
+uint8_t brick_events_wait(brick_device_handle_t device, uint8_t mask, TickType_t timeout) {
+    if (device >= BRICK_REGISTRY_CAPACITY) return 0;
+
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    TickType_t start = xTaskGetTickCount();
+
+    while (true) {
+        // Registering and checking under one lock means an event recorded after the check
+        // leaves a notification behind, which the take below returns on at once
+        portENTER_CRITICAL(&events_lock);
+        uint8_t taken = pending[device] & mask;
+        pending[device] &= ~taken;
+        TickType_t waited = xTaskGetTickCount() - start;
+        bool done = taken != 0 || waited >= timeout;
+        waiters[device] = done ? nullptr : self;
+        portEXIT_CRITICAL(&events_lock);
+
+        if (done) return taken;
+        ulTaskNotifyTake(pdTRUE, timeout - waited);
+    }
+}
+
+void brick_events_release_task(TaskHandle_t task) {
+    portENTER_CRITICAL(&events_lock);
+    for (auto &waiter: waiters) {
+        if (waiter == task) waiter = nullptr;
+    }
+    portEXIT_CRITICAL(&events_lock);
+}
+
+void brick_events_count_interrupts(uint32_t count) {
+    portENTER_CRITICAL(&events_lock);
+    stats.interrupts += count;
+    portEXIT_CRITICAL(&events_lock);
+}
+
+brick_events_stats_t brick_events_get_stats() {
+    portENTER_CRITICAL(&events_lock);
+    brick_events_stats_t copy = stats;
+    portEXIT_CRITICAL(&events_lock);
+
+    return copy;
+}
@@ -0,0 +1,90 @@
+// brick_i2c_events.hpp
+#ifndef BRICK_I2C_EVENTS_HPP
+#define BRICK_I2C_EVENTS_HPP
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "brick_device_registry.hpp"
+
+#define BRICK_EVENTS_STACK_SIZE     4096
+#define BRICK_EVENTS_PRIORITY       6    // above the scan (5): an event is worth less the later it is seen
+#define BRICK_EVENTS_LINE_CHECK_MS  200  // a line still held low is looked at again after this
+#define BRICK_EVENTS_MAX_PASSES     4    // passes over a bus per wake while its line stays low
+
+/*
+ * Modules of protocol 4 and later raise events (BRICK_EVENT_*) instead of being polled. The
+ * events task sleeps until an attention line falls, then reads the events register of the
+ * modules on that bus only, clears what it read on each module and keeps the bits for
+ * scripts. A line held low by a module discovery has not identified yet is looked at again
+ * every BRICK_EVENTS_LINE_CHECK_MS; a bus without a line raises no events.
+ */
+
+/**
+ * @brief Event traffic since boot, summed over all buses.
+ */
+struct brick_events_stats_t {
+    uint32_t interrupts; /**< Falls of an attention line that woke the task */
+    uint32_t passes; /**< Passes over a bus's modules */
+    uint32_t reads; /**< Events registers read */
+    uint32_t events; /**< Event bits taken from modules */
+};
+
+/**
+ * @brief How brick_events_service_bus() reaches the modules' events registers. Defaults to
+ *        brick_i2c_read_registers(), brick_i2c_write_registers() and brick_i2c_forget_device_state().
+ */
+struct brick_events_transport_t {
+    bool (*read_registers)(const brick_device_t *device, uint8_t reg, void *out, size_t len);
+    bool (*write_registers)(const brick_device_t *device, uint8_t reg, const void *data, size_t len);
+    void (*forget_device_state)(const brick_device_t *device); /**< After a module reported BRICK_EVENT_RESET */
+};
+
+/**
+ * @brief Sets up the attention lines and starts the events task. Must be called after brick_i2c_init().
+ */
+void brick_events_start();
+
+/**
+ * @brief One pass over a bus: reads the events register of every online module that raises
+ *        events, acknowledges what it read and keeps it for brick_events_take(). Only goes
+ *        through the transport, so it runs against a simulated bus or register file as well.
+ * @return Number of modules that had events pending.
+ */
+size_t brick_events_service_bus(uint8_t bus);
+
+/**
+ * @brief Replaces the transport brick_events_service_bus() uses. Call before brick_events_start().
+ * @param transport Kept, not copied; nullptr restores the I2C host.
+ */
+void brick_events_set_transport(const brick_events_transport_t *transport);
+
+/**
+ * @brief Hands out the events among mask a device raised since they were last taken. Never touches the bus.
+ * @return The events taken, 0 if none.
+ */
+uint8_t brick_events_take(brick_device_handle_t device, uint8_t mask);
+
+/**
+ * @brief Like brick_events_take(), but waits up to timeout for one of the events in mask.
+ *        One task at a time waits on a device.
+ * @return The events taken, 0 on timeout.
+ */
+uint8_t brick_events_wait(brick_device_handle_t device, uint8_t mask, TickType_t timeout);
+
+/**
+ * @brief Stops waking a task that is gone, e.g. a killed script; see brick_i2c_release_task().
+ */
+void brick_events_release_task(TaskHandle_t task);
+
+/**
+ * @brief Counts falls of an attention line that woke the events task.
+ */
+void brick_events_count_interrupts(uint32_t count);
+
+brick_events_stats_t brick_events_get_stats();
+
+#endif // BRICK_I2C_EVENTS_HPP
@@ -0,0 +1,80 @@
+#include "brick_i2c_events.hpp"
+
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "brick_i2c_host.hpp"
+
+// The attention lines: a GPIO interrupt per line wakes the events task, which runs
+// brick_events_service_bus() on the bus whose line fell
+
+static TaskHandle_t events_task = nullptr;
+
+static_assert(BRICK_I2C_BUS_COUNT <= 32, "one notification bit per bus");
+
+static bool brick_events_line_low(uint8_t bus) {
+    gpio_num_t pin = brick_i2c_buses[bus].attention;
+    return pin != GPIO_NUM_NC && gpio_get_level(pin) == 0;
+}
+
+static void IRAM_ATTR brick_events_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(events_task, 1u << reinterpret_cast<uintptr_t>(arg), eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Services a bus again while its line stays low after a pass that found events. A pass that
+// finds none means the line is held by a module that is not known yet, so the bus waits.
+static void brick_events_service_line(uint8_t bus) {
+    for (int pass = 0; pass < BRICK_EVENTS_MAX_PASSES; ++pass) {
+        if (brick_events_service_bus(bus) == 0 || !brick_events_line_low(bus)) return;
+    }
+}
+
+static void brick_task_events(void *pvParams) {
+    uint32_t fallen = 0;
+
+    while (true) {
+        for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+            if ((fallen & (1u << bus)) || brick_events_line_low(bus)) brick_events_service_line(bus);
+        }
+
+        fallen = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &fallen, pdMS_TO_TICKS(BRICK_EVENTS_LINE_CHECK_MS));
+
+        brick_events_count_interrupts(__builtin_popcount(fallen));
+    }
+}
+
+void brick_events_start() {
+    xTaskCreatePinnedToCore(
+        brick_task_events,
+        "i2c_events",
+        BRICK_EVENTS_STACK_SIZE,
+        nullptr,
+        BRICK_EVENTS_PRIORITY,
+        &events_task,
+        tskNO_AFFINITY
+    );
+
+    esp_err_t res = gpio_install_isr_service(0);
+    if (res != ESP_OK && res != ESP_ERR_INVALID_STATE) { // already installed by someone else is fine
+        ESP_LOGE("brick_events", "No GPIO interrupts (%s), events are not collected", esp_err_to_name(res));
+        return;
+    }
+
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        gpio_num_t pin = brick_i2c_buses[bus].attention;
+        if (pin == GPIO_NUM_NC) continue;
+
+        gpio_config_t conf = {};
+        conf.pin_bit_mask = 1ULL << pin;
+        conf.mode = GPIO_MODE_INPUT;
+        conf.pull_up_en = GPIO_PULLUP_ENABLE; // the modules only ever pull it down
+        conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+        conf.intr_type = GPIO_INTR_NEGEDGE;
+        ESP_ERROR_CHECK(gpio_config(&conf));
+        ESP_ERROR_CHECK(gpio_isr_handler_add(pin, brick_events_isr, reinterpret_cast<void *>(static_cast<uintptr_t>(bus))));
+    }
+}
@@ -0,0 +1,102 @@
+#include "brick_i2c_health.hpp"
+
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+
+struct brick_i2c_health_entry_t {
+    brick_i2c_health_t counters;
+    uint16_t consecutive_failures;
+    uint32_t quarantine_ms; /**< Length of the next quarantine */
+    int64_t quarantined_until_us;
+    bool seen;
+};
+
+static portMUX_TYPE health_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_health_entry_t entries[BRICK_I2C_BUS_COUNT][128];
+
+static size_t brick_i2c_health_bucket(uint32_t bus_us) {
+    size_t bucket = 0;
+    for (uint32_t bound = BRICK_I2C_HEALTH_BUCKET_MIN_US; bus_us >= bound && bucket < BRICK_I2C_HEALTH_BUCKETS - 1; bound <<= 1) {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+void brick_i2c_health_record(uint8_t bus, uint8_t address, esp_err_t result, uint32_t bus_us, bool retry) {
+    brick_i2c_health_entry_t &entry = entries[bus % BRICK_I2C_BUS_COUNT][address & 0x7F];
+    int64_t now_us = esp_timer_get_time();
+    bool quarantined = false, recovered = false;
+    uint32_t quarantine_ms = 0;
+
+    portENTER_CRITICAL(&health_lock);
+    entry.seen = true;
+    entry.counters.latency_hist[brick_i2c_health_bucket(bus_us)]++;
+    if (retry) entry.counters.retries++;
+
+    if (result == ESP_OK) {
+        entry.counters.success++;
+        recovered = entry.quarantined_until_us != 0;
+        entry.consecutive_failures = 0;
+        entry.quarantine_ms = 0;
+        entry.quarantined_until_us = 0;
+    } else {
+        if (result == ESP_ERR_TIMEOUT) entry.counters.timeout++;
+        else entry.counters.failure++;
+
+        // A device that fails again right after its quarantine ran out, without a success
+        // in between, goes straight back in for twice as long
+        bool relapse = entry.quarantine_ms != 0;
+        entry.consecutive_failures++;
+
+        if ((relapse || entry.consecutive_failures >= BRICK_I2C_QUARANTINE_FAILURES) && now_us >= entry.quarantined_until_us) {
+            entry.quarantine_ms = entry.quarantine_ms == 0
+                                      ? BRICK_I2C_QUARANTINE_MS
+                                      : std::min<uint32_t>(entry.quarantine_ms * 2, BRICK_I2C_QUARANTINE_MAX_MS);
+            entry.quarantined_until_us = now_us + entry.quarantine_ms * 1000LL;
+            entry.consecutive_failures = 0;
+            entry.counters.quarantines++;
+            quarantined = true;
+            quarantine_ms = entry.quarantine_ms;
+        }
+    }
+    portEXIT_CRITICAL(&health_lock);
+
+    if (quarantined) {
+        ESP_LOGW("brick_i2c_health", "Device at %u:0x%02X keeps failing, quarantined for %lu ms",
+                 bus, address, static_cast<unsigned long>(quarantine_ms));
+    } else if (recovered) {
+        ESP_LOGI("brick_i2c_health", "Device at %u:0x%02X answers again, quarantine lifted", bus, address);
+    }
+}
+
+bool brick_i2c_health_admit(uint8_t bus, uint8_t address) {
+    brick_i2c_health_entry_t &entry = entries[bus % BRICK_I2C_BUS_COUNT][address & 0x7F];
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&health_lock);
+    bool admit = now_us >= entry.quarantined_until_us;
+    if (!admit) entry.counters.skipped++;
+    portEXIT_CRITICAL(&health_lock);
+
+    return admit;
+}
+
+bool brick_i2c_health_get(uint8_t bus, uint8_t address, brick_i2c_health_t *out) {
+    if (bus >= BRICK_I2C_BUS_COUNT) return false;
+
+    const brick_i2c_health_entry_t &entry = entries[bus][address & 0x7F];
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&health_lock);
+    bool seen = entry.seen;
+    *out = entry.counters;
+    int64_t left_us = entry.quarantined_until_us - now_us;
+    portEXIT_CRITICAL(&health_lock);
+
+    out->quarantine_ms_left = left_us > 0 ? static_cast<uint32_t>(left_us / 1000) : 0;
+    return seen;
+}
@@ -0,0 +1,65 @@
+// brick_i2c_health.hpp
+#ifndef BRICK_I2C_HEALTH_HPP
+#define BRICK_I2C_HEALTH_HPP
+
+#include <esp_err.h>
+
+#include <cstdint>
+
+#include "brick_i2c_engine.hpp"
+
+#define BRICK_I2C_HEALTH_BUCKETS       10    // bus time histogram: <64 us, <128 us, ..., >=16 ms
+#define BRICK_I2C_HEALTH_BUCKET_MIN_US 64    // upper bound of the first bucket, doubled per bucket
+
+#define BRICK_I2C_MAX_RETRIES          2     // extra attempts after a NACK, timeout or failed check
+#define BRICK_I2C_RETRY_BACKOFF_MS     10    // delay before the first retry, doubled per attempt
+
+#define BRICK_I2C_QUARANTINE_FAILURES  4     // consecutive failed attempts that quarantine a device
+#define BRICK_I2C_QUARANTINE_MS        1000  // first quarantine, doubled each time the device relapses
+#define BRICK_I2C_QUARANTINE_MAX_MS    30000
+
+/*
+ * Health is tracked per bus and 7-bit address, for every attempt the engine puts on the bus.
+ * A quarantined address gets no actuation or sensor traffic: such requests fail at once
+ * with ESP_ERR_INVALID_STATE instead of costing a bus timeout each. Discovery probes still
+ * go through, and the first transfer the device acknowledges lifts the quarantine.
+ */
+
+/**
+ * @struct brick_i2c_health_t
+ * @brief Counters of one address since boot.
+ */
+struct brick_i2c_health_t {
+    uint32_t success; /**< Attempts the device acknowledged */
+    uint32_t failure; /**< Attempts that were NACKed, hit a bus error or failed a check */
+    uint32_t timeout; /**< Attempts that ran into I2C_TIMEOUT_MS */
+    uint32_t retries; /**< Attempts that were retries of a failed one */
+    uint32_t skipped; /**< Requests failed without touching the bus while quarantined */
+    uint32_t quarantines; /**< Times the device was quarantined */
+    uint32_t quarantine_ms_left; /**< Remaining quarantine, 0 if the device is not quarantined */
+    uint32_t latency_hist[BRICK_I2C_HEALTH_BUCKETS]; /**< Bus time per attempt, bucket i < 64 us << i */
+};
+
+/**
+ * @brief Records the outcome of one attempt. Called by the engine task of the bus.
+ * @param bus Bus the attempt ran on.
+ * @param address 7-bit address.
+ * @param result Result of the attempt.
+ * @param bus_us Bus time the attempt took.
+ * @param retry true if the attempt repeated a failed one.
+ */
+void brick_i2c_health_record(uint8_t bus, uint8_t address, esp_err_t result, uint32_t bus_us, bool retry);
+
+/**
+ * @brief Checks whether a request to the address may use the bus; counts it as skipped if not.
+ * @return false while the address is quarantined.
+ */
+bool brick_i2c_health_admit(uint8_t bus, uint8_t address);
+
+/**
+ * @brief Copies the counters of an address.
+ * @return false if the address never saw any traffic.
+ */
+bool brick_i2c_health_get(uint8_t bus, uint8_t address, brick_i2c_health_t *out);
+
+#endif // BRICK_I2C_HEALTH_HPP
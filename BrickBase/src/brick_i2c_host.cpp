@@ -1,88 +1,443 @@
 #include "brick_i2c_host.hpp"
 
-std::map<brick_uuid_t, brick_device_t, uuid_less> device_map;
-std::mutex device_map_mutex;
+#include <esp_timer.h>
 
-bool uuid_less::operator()(const brick_uuid_t &a, const brick_uuid_t &b) const {
-    return std::memcmp(a.bytes, b.bytes, 16) < 0;
+#include <algorithm>
+
+#include "brick_i2c_enum.hpp"
+
+// Oldest protocol with CMD_STEPPER_MOVE_SYNC
+#define BRICK_SYNC_MOVE_MIN_PROTOCOL 6
+
+// Shadow of the last state each address acknowledged, for suppressing redundant writes.
+// Only requests flagged BRICK_I2C_FLAG_COALESCE (full-state actuator writes) take part.
+struct brick_i2c_shadow_t {
+    uint8_t state[BRICK_I2C_MAX_WRITE]; /**< Command byte + payload last acknowledged */
+    uint8_t state_len; /**< 0 = unknown */
+    uint8_t in_flight; /**< Writes submitted but not finished (dirty while non-zero) */
+};
+
+static portMUX_TYPE shadow_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_shadow_t shadows[BRICK_I2C_BUS_COUNT][128];
+static uint32_t suppressed_writes = 0;
+
+// Sequence number of the last checked frame sent to each address (see BRICK_FRAME_CHECK_LEN)
+static uint8_t frame_seq[BRICK_I2C_BUS_COUNT][128];
+
+// Stages queued without waiting, for the next latch to wait on
+static portMUX_TYPE stage_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_handle_t pending_stages[BRICK_STAGE_MAX_PENDING];
+static size_t pending_stage_count = 0;
+
+// The command a request carries, without the bytes of a checked frame around it
+static const uint8_t *brick_i2c_command_bytes(const brick_i2c_request_t *request, uint8_t *len) {
+    if (!(request->flags & BRICK_I2C_FLAG_CHECKED)) {
+        *len = request->write_len;
+        return request->write_buf;
+    }
+    *len = request->write_len - BRICK_FRAME_CHECK_LEN;
+    return &request->write_buf[2];
+}
+
+static void brick_i2c_shadow_on_complete(const brick_i2c_request_t *request, esp_err_t result, bool sent) {
+    brick_i2c_shadow_t &shadow = shadows[request->bus][request->address & 0x7F];
+    uint8_t len;
+    const uint8_t *command = brick_i2c_command_bytes(request, &len);
+
+    portENTER_CRITICAL(&shadow_lock);
+    if (shadow.in_flight > 0) shadow.in_flight--;
+    if (sent && result == ESP_OK) {
+        std::memcpy(shadow.state, command, len);
+        shadow.state_len = len;
+    } else if (sent) {
+        shadow.state_len = 0; // the device may or may not have applied it
+    }
+    portEXIT_CRITICAL(&shadow_lock);
+}
+
+// Forgets what a device was last told, e.g. because it re-appeared and may have reset
+static void brick_i2c_shadow_invalidate(uint8_t bus, uint8_t addr) {
+    portENTER_CRITICAL(&shadow_lock);
+    shadows[bus][addr & 0x7F].state_len = 0;
+    portEXIT_CRITICAL(&shadow_lock);
+}
+
+// Group writes and latches change modules the host cannot tell apart on the bus
+static void brick_i2c_shadow_invalidate_all() {
+    portENTER_CRITICAL(&shadow_lock);
+    for (auto &bus: shadows) {
+        for (auto &shadow: bus) shadow.state_len = 0;
+    }
+    portEXIT_CRITICAL(&shadow_lock);
+}
+
+// Returns true if the request would only repeat the acknowledged state, otherwise
+// counts it as in flight. Writes are never dropped while others to the device are pending.
+static bool brick_i2c_shadow_suppress(const brick_i2c_request_t *request) {
+    if (!(request->flags & BRICK_I2C_FLAG_COALESCE)) return false;
+
+    brick_i2c_shadow_t &shadow = shadows[request->bus][request->address & 0x7F];
+    bool suppress;
+
+    portENTER_CRITICAL(&shadow_lock);
+    suppress = shadow.in_flight == 0 && shadow.state_len == request->write_len &&
+               std::memcmp(shadow.state, request->write_buf, request->write_len) == 0;
+    if (suppress) suppressed_writes++;
+    else shadow.in_flight++;
+    portEXIT_CRITICAL(&shadow_lock);
+
+    return suppress;
+}
+
+// Undoes brick_i2c_shadow_suppress() for a request the engine refused
+static void brick_i2c_shadow_cancel(const brick_i2c_request_t *request) {
+    if (!(request->flags & BRICK_I2C_FLAG_COALESCE)) return;
+
+    portENTER_CRITICAL(&shadow_lock);
+    shadows[request->bus][request->address & 0x7F].in_flight--;
+    portEXIT_CRITICAL(&shadow_lock);
+}
+
+// Makes a write to a module of protocol 3 or later a checked frame: CMD_CHECKED and the
+// address's next sequence number ahead of the command, the CRC-8 behind it, and a read of
+// the module's status. The engine retries the frame unchanged, so the module applies it
+// once however often it is sent. A write that would not fit goes out plain.
+static void brick_i2c_seal(const brick_device_t *device, brick_i2c_request_t *request) {
+    if (device->caps.protocol_version < 3 || request->read_len > 0 ||
+        request->write_len + BRICK_FRAME_CHECK_LEN > BRICK_I2C_MAX_WRITE) {
+        return;
+    }
+
+    portENTER_CRITICAL(&shadow_lock);
+    uint8_t seq = ++frame_seq[request->bus][request->address & 0x7F];
+    portEXIT_CRITICAL(&shadow_lock);
+
+    std::memmove(&request->write_buf[2], request->write_buf, request->write_len);
+    request->write_buf[0] = CMD_CHECKED;
+    request->write_buf[1] = seq;
+    request->write_len += 2;
+    request->write_buf[request->write_len] =
+        brick_crc8(brick_crc8_byte(0, request->address << 1), request->write_buf, request->write_len);
+    request->write_len++;
+    request->read_len = BRICK_FRAME_REPLY_LEN;
+    request->flags |= BRICK_I2C_FLAG_CHECKED;
+}
+
+// Restarts a module's sequence numbers at ours, e.g. after either side reset: a checked
+// frame without a command
+static void brick_i2c_sync_sequence(const brick_device_t *device) {
+    brick_i2c_request_t request = {};
+    request.address = device->i2c_address;
+    request.bus = device->i2c_bus;
+    request.priority = BRICK_I2C_PRIORITY_ACTUATION;
+    brick_i2c_seal(device, &request);
+
+    if (request.flags & BRICK_I2C_FLAG_CHECKED) brick_i2c_transfer(&request, nullptr);
 }
 
+// Clock each bus's device traffic runs at. Only touched by that bus's scan task after init.
+static uint32_t bus_clock_hz[BRICK_I2C_BUS_COUNT];
+
+const brick_i2c_bus_config_t brick_i2c_buses[BRICK_I2C_BUS_COUNT] = {
+    {I2C_MASTER_NUM, I2C_MASTER_SDA_IO, I2C_MASTER_SCL_IO, I2C_ATTENTION_IO},
+    {I2C_BUS1_NUM, I2C_BUS1_SDA_IO, I2C_BUS1_SCL_IO, I2C_BUS1_ATTENTION_IO},
+};
+
 void brick_i2c_init() {
-    i2c_config_t conf = {};
-    conf.mode = I2C_MODE_MASTER;
-    conf.sda_io_num = I2C_MASTER_SDA_IO;
-    conf.scl_io_num = I2C_MASTER_SCL_IO;
-    conf.sda_pullup_en = GPIO_PULLUP_DISABLE;
-    conf.scl_pullup_en = GPIO_PULLUP_DISABLE;
-    conf.master.clk_speed = I2C_MASTER_FREQ_HZ;
-
-    ESP_ERROR_CHECK(i2c_param_config(I2C_MASTER_NUM, &conf));
-    ESP_ERROR_CHECK(i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0));
-}
-
-void brick_i2c_scan_devices() {
-    for (int addr = 0x08; addr <= 0x77; ++addr) {
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-        i2c_master_write_byte(cmd, (addr << 1) | I2C_MASTER_WRITE, true);
-        i2c_master_stop(cmd);
-        esp_err_t ack = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-        i2c_cmd_link_delete(cmd);
-
-        if (ack != ESP_OK) {
-            std::lock_guard<std::mutex> lock(device_map_mutex);
-            for (auto &[uuid, device]: device_map) {
-                if (device.online && device.i2c_address == addr) {
-                    device.online = 0;
-                    ESP_LOGW("brick_i2c_scan_devices", "Device at 0x%02X removed", addr);
-                    break;
-                }
-            }
+    brick_i2c_engine_set_completion_hook(brick_i2c_shadow_on_complete);
+
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        i2c_config_t conf = {};
+        conf.mode = I2C_MODE_MASTER;
+        conf.sda_io_num = brick_i2c_buses[bus].sda;
+        conf.scl_io_num = brick_i2c_buses[bus].scl;
+        conf.sda_pullup_en = GPIO_PULLUP_DISABLE;
+        conf.scl_pullup_en = GPIO_PULLUP_DISABLE;
+        conf.master.clk_speed = I2C_MASTER_FREQ_HZ;
+
+        ESP_ERROR_CHECK(i2c_param_config(brick_i2c_buses[bus].port, &conf));
+        ESP_ERROR_CHECK(i2c_driver_install(brick_i2c_buses[bus].port, conf.mode, 0, 0, 0));
+
+        // From here on the bus's engine task is the only one touching it
+        brick_i2c_engine_start(bus, brick_i2c_buses[bus].port, &conf);
+        bus_clock_hz[bus] = I2C_MASTER_FREQ_HZ;
+    }
+
+    brick_i2c_enum_init();
+}
+
+// Discovery state of one bus. Only touched by that bus's scan task.
+struct brick_i2c_discovery_t {
+    uint8_t sweep_cursor;
+    int64_t sweep_started_us;
+    int64_t last_probe_us[128];
+};
+
+static brick_i2c_discovery_t discovery[BRICK_I2C_BUS_COUNT];
+static portMUX_TYPE discovery_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_discovery_stats_t discovery_stats[BRICK_I2C_BUS_COUNT] = {};
+
+static esp_err_t brick_i2c_probe(uint8_t bus, uint8_t addr) {
+    brick_i2c_request_t probe = {};
+    probe.address = addr;
+    probe.bus = bus;
+    probe.priority = BRICK_I2C_PRIORITY_DISCOVERY;
+
+    portENTER_CRITICAL(&discovery_lock);
+    discovery_stats[bus].probes++;
+    portEXIT_CRITICAL(&discovery_lock);
+
+    return brick_i2c_transfer(&probe, nullptr);
+}
+
+// Reads a module's capabilities record. Firmware without one answers with its UUID.
+static brick_caps_t brick_i2c_read_caps(uint8_t bus, uint8_t addr) {
+    brick_i2c_request_t request = {};
+    request.address = addr;
+    request.bus = bus;
+    request.priority = BRICK_I2C_PRIORITY_DISCOVERY;
+    request.write_len = 1;
+    request.write_buf[0] = CMD_GET_CAPS;
+    request.read_len = sizeof(brick_caps_t);
+
+    brick_caps_t caps = {};
+    uint8_t reply[sizeof(brick_caps_t)] = {0};
+    if (brick_i2c_transfer(&request, reply) == ESP_OK && !(reply[0] == 'B' && reply[1] == 'L')) {
+        std::memcpy(&caps, reply, sizeof(caps));
+    }
+
+    if (caps.protocol_version == 0 || caps.max_clock_khz == 0) {
+        caps = {};
+        caps.max_clock_khz = BRICK_CAPS_LEGACY_CLOCK_KHZ;
+    }
+
+    return caps;
+}
+
+// Runs a bus's device traffic at the fastest clock all of its online modules follow. The
+// modules hear the new clock first, at the discovery clock, so they can set up for it.
+// announce = also tell them if the clock stays, for a module that just came online.
+static void brick_i2c_negotiate_clock(uint8_t bus, bool announce) {
+    uint32_t hz = I2C_MASTER_FREQ_MAX_HZ;
+    uint8_t slowest = 0; // 0 = no module online, the bus drops back to the discovery clock
+
+    brick_device_t device;
+    for (brick_device_handle_t handle = 0; brick_registry_snapshot(handle, &device); ++handle) {
+        if (device.i2c_bus != bus || !device.online) continue;
+        uint32_t max_hz = device.caps.max_clock_khz * 1000u;
+        if (max_hz <= hz) {
+            hz = max_hz;
+            slowest = device.i2c_address;
+        }
+    }
+    hz = slowest ? std::max<uint32_t>(hz, I2C_MASTER_FREQ_HZ) : I2C_MASTER_FREQ_HZ;
+
+    bool changed = hz != bus_clock_hz[bus];
+    if (!changed && !announce) return;
+
+    uint16_t khz = hz / 1000;
+    brick_i2c_request_t request = {};
+    request.address = BRICK_I2C_GENERAL_CALL_ADDRESS;
+    request.bus = bus;
+    request.priority = BRICK_I2C_PRIORITY_DISCOVERY;
+    request.write_len = 3;
+    request.write_buf[0] = CMD_BUS_CLOCK;
+    request.write_buf[1] = khz & 0xFF;
+    request.write_buf[2] = khz >> 8;
+    brick_i2c_transfer(&request, nullptr); // a bus of legacy modules may leave it unacknowledged
+
+    if (!changed) return;
+
+    brick_i2c_engine_set_clock(bus, hz);
+    bus_clock_hz[bus] = hz;
+    if (slowest) {
+        ESP_LOGI("brick_i2c_scan_devices", "Bus %u now runs at %u kHz (slowest module at 0x%02X)", bus, khz, slowest);
+    } else {
+        ESP_LOGI("brick_i2c_scan_devices", "Bus %u now runs at %u kHz (no module online)", bus, khz);
+    }
+}
+
+// Reads the UUID of whatever answered at addr and marks it online, adding it to the map if new
+static void brick_i2c_identify(uint8_t bus, uint8_t addr) {
+    brick_i2c_request_t identify = {};
+    identify.address = addr;
+    identify.bus = bus;
+    identify.priority = BRICK_I2C_PRIORITY_DISCOVERY;
+    identify.write_len = 1;
+    identify.write_buf[0] = CMD_IDENTIFY;
+    identify.read_len = 16;
+
+    uint8_t uuid_buf[16] = {0};
+    esp_err_t res = brick_i2c_transfer(&identify, uuid_buf);
+
+    if (res != ESP_OK || !brick_uuid_valid(uuid_buf)) {
+        ESP_LOGW("brick_i2c_scan_devices", "Failed to read UUID from %u:0x%02X", bus, addr);
+        return;
+    }
+
+    brick_uuid_t uuid;
+    std::memcpy(uuid.bytes, uuid_buf, 16);
+    brick_i2c_enum_remember(&uuid, bus, addr);
+    brick_caps_t caps = brick_i2c_read_caps(bus, addr);
+    brick_device_handle_t handle = brick_registry_find_uuid(&uuid);
+    brick_device_t device;
+
+    if (brick_registry_snapshot(handle, &device)) {
+        bool was_online = device.online;
+        brick_registry_set_caps(handle, &caps);
+        brick_registry_set_presence(handle, bus, addr, true);
+        if (!was_online) {
+            ESP_LOGI("brick_i2c_scan_devices", "Device at %u:0x%02X back online", bus, addr);
+            brick_i2c_shadow_invalidate(bus, addr);
+            brick_registry_snapshot(handle, &device);
+            brick_i2c_sync_sequence(&device);
+        }
+    } else {
+        brick_device_t new_dev = brick_get_device_specs_from_uuid(uuid_buf);
+        new_dev.i2c_address = addr;
+        new_dev.i2c_bus = bus;
+        new_dev.online = 1;
+        new_dev.caps = caps;
+        brick_i2c_shadow_invalidate(bus, addr);
+        if (brick_registry_insert(&new_dev) == BRICK_INVALID_DEVICE_HANDLE) {
+            ESP_LOGE("brick_i2c_scan_devices", "Device registry full, ignoring device at %u:0x%02X", bus, addr);
+            return;
+        }
+        brick_i2c_sync_sequence(&new_dev);
+
+        ESP_LOGI("brick_i2c_scan_devices", "Device found at %u:0x%02X (%s, protocol %u, up to %u kHz)", bus, addr,
+                 brick_device_type_str(new_dev.device_type), caps.protocol_version, caps.max_clock_khz);
+        brick_print_uuid(&new_dev.uuid);
+    }
+
+    brick_i2c_negotiate_clock(bus, true);
+}
+
+// Re-checks devices we already know on a bus. Online devices that acknowledged any
+// transfer recently are alive by definition; the others get a single address probe.
+static void brick_i2c_verify_known_devices(uint8_t bus) {
+    struct known_t {
+        uint8_t address;
+        uint8_t online;
+    };
+    known_t known[BRICK_REGISTRY_CAPACITY];
+    size_t count = 0;
+
+    brick_device_t device;
+    for (brick_device_handle_t handle = 0; brick_registry_snapshot(handle, &device); ++handle) {
+        if (device.i2c_bus == bus) known[count++] = {device.i2c_address, device.online};
+    }
+
+    brick_i2c_discovery_t &state = discovery[bus];
+    int64_t now_us = esp_timer_get_time();
+
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t addr = known[i].address;
+        int64_t last_ack = brick_i2c_last_ack_us(bus, addr);
+
+        if (now_us - last_ack < BRICK_DISCOVERY_HEARTBEAT_MS * 1000LL) {
+            if (!known[i].online) brick_i2c_identify(bus, addr);
             continue;
         }
 
-        uint8_t cmd_ident = CMD_IDENTIFY;
-        uint8_t uuid_buf[16] = {0};
-        esp_err_t res = i2c_master_write_read_device(
-            I2C_MASTER_NUM, addr, &cmd_ident, 1, uuid_buf, 16,
-            pdMS_TO_TICKS(I2C_TIMEOUT_MS)
-        );
-
-        if (res == ESP_OK && brick_uuid_valid(uuid_buf)) {
-            brick_uuid_t uuid;
-            std::memcpy(uuid.bytes, uuid_buf, 16);
-            std::lock_guard lock(device_map_mutex);
-            auto it = device_map.find(uuid);
-
-            if (it != device_map.end()) {
-                it->second.online = 1;
-            } else {
-                brick_device_t new_dev = brick_get_device_specs_from_uuid(uuid_buf);
-                new_dev.i2c_address = addr;
-                new_dev.online = 1;
-                device_map[uuid] = new_dev;
-
-                ESP_LOGI("brick_i2c_scan_devices", "Device found at 0x%02X (%s)", addr, brick_device_type_str(new_dev.device_type));
-                brick_print_uuid(&new_dev.uuid);
+        // Silent devices, online or not, are probed at most once per heartbeat period
+        if (now_us - state.last_probe_us[addr] < BRICK_DISCOVERY_HEARTBEAT_MS * 1000LL) continue;
+        state.last_probe_us[addr] = now_us;
+
+        portENTER_CRITICAL(&discovery_lock);
+        discovery_stats[bus].verifications++;
+        portEXIT_CRITICAL(&discovery_lock);
+
+        esp_err_t ack = brick_i2c_probe(bus, addr);
+
+        if (ack == ESP_OK && !known[i].online) {
+            brick_i2c_identify(bus, addr);
+        } else if (ack != ESP_OK && known[i].online) {
+            brick_device_handle_t handle = brick_registry_find_address(bus, addr);
+            if (brick_registry_snapshot(handle, &device) && device.online) {
+                brick_registry_set_presence(handle, bus, addr, false);
+                ESP_LOGW("brick_i2c_scan_devices", "Device at %u:0x%02X removed", bus, addr);
+                brick_i2c_negotiate_clock(bus, false); // may speed the bus back up
             }
-        } else {
-            ESP_LOGW("brick_i2c_scan_devices", "Failed to read UUID from 0x%02X", addr);
         }
     }
 }
 
+static bool brick_i2c_is_known_address(uint8_t bus, uint8_t addr) {
+    return brick_registry_find_address(bus, addr) != BRICK_INVALID_DEVICE_HANDLE;
+}
+
+// Probes the next part of a bus's unknown address space, stopping once the slice's bus budget is spent
+static void brick_i2c_sweep_slice(uint8_t bus) {
+    brick_i2c_discovery_t &state = discovery[bus];
+    int64_t slice_start_us = esp_timer_get_time();
+    if (state.sweep_started_us == 0) state.sweep_started_us = slice_start_us;
+    if (state.sweep_cursor < BRICK_I2C_ADDRESS_MIN) state.sweep_cursor = BRICK_I2C_ADDRESS_MIN;
+
+    while (esp_timer_get_time() - slice_start_us < BRICK_DISCOVERY_SLICE_BUDGET_US) {
+        uint8_t addr = state.sweep_cursor;
+
+        if (!brick_i2c_is_known_address(bus, addr) && brick_i2c_probe(bus, addr) == ESP_OK) {
+            brick_i2c_identify(bus, addr);
+        }
+
+        if (++state.sweep_cursor > BRICK_I2C_ADDRESS_MAX) {
+            int64_t now_us = esp_timer_get_time();
+
+            portENTER_CRITICAL(&discovery_lock);
+            discovery_stats[bus].sweeps++;
+            discovery_stats[bus].last_sweep_us = now_us - state.sweep_started_us;
+            portEXIT_CRITICAL(&discovery_lock);
+
+            state.sweep_cursor = BRICK_I2C_ADDRESS_MIN;
+            state.sweep_started_us = now_us;
+            break;
+        }
+    }
+}
+
+void brick_i2c_scan_devices(uint8_t bus) {
+    if (bus >= BRICK_I2C_BUS_COUNT) return;
+
+    brick_i2c_verify_known_devices(bus);
+
+    // Modules waiting for an address come first; the sweep resumes once none is left
+    uint8_t assigned = brick_i2c_enum_assign_next(bus);
+    if (assigned != 0) {
+        brick_i2c_identify(bus, assigned);
+        return;
+    }
+
+    brick_i2c_sweep_slice(bus);
+}
+
+brick_i2c_discovery_stats_t brick_i2c_get_discovery_stats() {
+    brick_i2c_discovery_stats_t total = {};
+
+    portENTER_CRITICAL(&discovery_lock);
+    for (const auto &stats: discovery_stats) {
+        total.probes += stats.probes;
+        total.verifications += stats.verifications;
+        total.sweeps += stats.sweeps;
+        total.last_sweep_us = std::max(total.last_sweep_us, stats.last_sweep_us);
+    }
+    portEXIT_CRITICAL(&discovery_lock);
+
+    return total;
+}
+
 void brick_task_i2c_scan_devices(void *pvParams) {
-    ESP_LOGI("brick_task_i2c_scan_devices", "I\302\262C initialized on SDA=GPIO%d, SCL=GPIO%d", I2C_MASTER_SDA_IO, I2C_MASTER_SCL_IO);\
-    brick_i2c_init();
+    auto bus = static_cast<uint8_t>(reinterpret_cast<uintptr_t>(pvParams));
+    TickType_t last_wake = xTaskGetTickCount();
 
     while (true) {
-        brick_i2c_scan_devices();
-        vTaskDelay(pdMS_TO_TICKS(3000));
+        brick_i2c_scan_devices(bus);
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(BRICK_DISCOVERY_PERIOD_MS));
     }
 }
 
-brick_device_t *brick_i2c_get_device_uuid(const char *uuid_str) {
-    if (!uuid_str || std::strlen(uuid_str) != 36) return nullptr;
+brick_device_handle_t brick_i2c_get_device_uuid(const char *uuid_str) {
+    if (!uuid_str || std::strlen(uuid_str) != 36) return BRICK_INVALID_DEVICE_HANDLE;
 
     brick_uuid_t uuid;
     int byte_index = 0;
@@ -102,85 +457,72 @@ brick_device_t *brick_i2c_get_device_uuid(const char *uuid_str) {
 
         int high = hex_char_to_int(uuid_str[i]);
         int low = hex_char_to_int(uuid_str[i + 1]);
-        if (high < 0 || low < 0) return nullptr;
+        if (high < 0 || low < 0) return BRICK_INVALID_DEVICE_HANDLE;
 
         uuid.bytes[byte_index++] = static_cast<uint8_t>((high << 4) | low);
         i += 2;
     }
 
-    if (byte_index != 16) return nullptr;
-
-    std::lock_guard<std::mutex> lock(device_map_mutex);
-    for (auto &x: device_map) {
-        if (std::memcmp(x.second.uuid.bytes, uuid.bytes, sizeof(uuid.bytes)) == 0) {
-            return &x.second;
-        }
-    }
+    if (byte_index != 16) return BRICK_INVALID_DEVICE_HANDLE;
 
-    return nullptr;
+    return brick_i2c_get_device_uuid(uuid);
 }
 
-brick_device_t *brick_i2c_get_device_uuid(brick_uuid_t uuid) {
-    std::lock_guard<std::mutex> lock(device_map_mutex);
-
-    for (auto &x: device_map) {
-        if (std::memcmp(x.second.uuid.bytes, uuid.bytes, sizeof(uuid.bytes)) == 0) {
-            return &x.second;
-        }
-    }
-
-    return nullptr;
+brick_device_handle_t brick_i2c_get_device_uuid(brick_uuid_t uuid) {
+    return brick_registry_find_uuid(&uuid);
 }
 
 
-bool brick_i2c_send_device_command(const brick_command_t *cmd) {
+// Encodes a device command into an engine request. Payloads are copied, so the
+// device state may change again as soon as the request is queued.
+static bool brick_i2c_build_device_command(const brick_command_t *cmd, brick_i2c_request_t *request) {
     if (!cmd || !cmd->device) {
         ESP_LOGE("brick_i2c_send_device_command", "Null device or command pointer");
         return false;
     }
 
-    brick_device_t *device = cmd->device;
-    i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
-    i2c_master_start(cmd_handle);
-    i2c_master_write_byte(cmd_handle, (device->i2c_address << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd_handle, static_cast<uint8_t>(cmd->command), true);
+    const brick_device_t *device = cmd->device;
+    const void *payload = nullptr;
+    size_t payload_len = 0;
 
     // Optional payload based on command type
     switch (cmd->command) {
         case CMD_LED:
-            i2c_master_write(cmd_handle,
-                             reinterpret_cast<const uint8_t *>(&device->impl.led_single),
-                             sizeof(device->impl.led_single),
-                             true
-            );
+            payload = &device->impl.led_single;
+            payload_len = sizeof(device->impl.led_single);
             break;
 
         case CMD_LED_DOUBLE:
-            i2c_master_write(cmd_handle,
-                             reinterpret_cast<const uint8_t *>(&device->impl.led_double),
-                             sizeof(device->impl.led_double),
-                             true
-            );
+            payload = &device->impl.led_double;
+            payload_len = sizeof(device->impl.led_double);
             break;
 
         case CMD_LED_RGB:
-            i2c_master_write(cmd_handle,
-                             reinterpret_cast<const uint8_t *>(&device->impl.led_rgb),
-                             sizeof(device->impl.led_rgb),
-                             true
-            );
+            payload = &device->impl.led_rgb;
+            payload_len = offsetof(brick_device_led_rgb_impl_t, fade_ms); // the colour
+            break;
+
+        case CMD_LED_FADE:
+            payload = &device->impl.led_rgb;
+            payload_len = sizeof(device->impl.led_rgb);
             break;
 
         case CMD_SERVO_SET_ANGLE:
-            i2c_master_write(cmd_handle,
-                             reinterpret_cast<const uint8_t *>(&device->impl.servo_180),
-                             sizeof(device->impl.servo_180),
-                             true
-            );
+            payload = &device->impl.servo_180.move;
+            payload_len = sizeof(device->impl.servo_180.move);
             break;
 
         case CMD_STEPPER_MOVE:
-            // Add support if there's a struct for stepper move
+            payload = &device->impl.stepper_motor.move;
+            payload_len = sizeof(device->impl.stepper_motor.move);
+            break;
+
+        case CMD_STEPPER_MOVE_SYNC:
+            payload = &device->impl.stepper_motor;
+            payload_len = sizeof(device->impl.stepper_motor);
+            break;
+
+        case CMD_STEPPER_STOP:
             break;
 
         case CMD_SENSOR_GET_CM:
@@ -192,13 +534,386 @@ bool brick_i2c_send_device_command(const brick_command_t *cmd) {
             break;
     }
 
-    i2c_master_stop(cmd_handle);
-    esp_err_t res = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-    i2c_cmd_link_delete(cmd_handle);
+    *request = {};
+    request->address = device->i2c_address;
+    request->bus = device->i2c_bus;
+    request->priority = cmd->command == CMD_SENSOR_GET_CM ? BRICK_I2C_PRIORITY_SENSOR : BRICK_I2C_PRIORITY_ACTUATION;
+    request->write_buf[0] = static_cast<uint8_t>(cmd->command);
+    if (payload_len > 0) std::memcpy(&request->write_buf[1], payload, payload_len);
+    request->write_len = 1 + payload_len;
+
+    // Writes carrying the full output state can be deduplicated and merged. A move is
+    // relative, so sending the same one twice is meant to move twice.
+    if (payload_len > 0 && cmd->command != CMD_STEPPER_MOVE && cmd->command != CMD_STEPPER_MOVE_SYNC) {
+        request->flags |= BRICK_I2C_FLAG_COALESCE;
+    }
+
+    return true;
+}
+
+bool brick_i2c_send_device_command(const brick_command_t *cmd) {
+    brick_i2c_request_t request;
+    if (!brick_i2c_build_device_command(cmd, &request)) return false;
+    if (brick_i2c_shadow_suppress(&request)) return true;
+    brick_i2c_seal(cmd->device, &request);
+
+    esp_err_t res = brick_i2c_transfer(&request, nullptr);
+    if (res == ESP_ERR_NO_MEM) brick_i2c_shadow_cancel(&request);
 
     if (res != ESP_OK) {
-        ESP_LOGE("brick_i2c_send_device_command", "Failed to send command 0x%02X to device at 0x%02X", cmd->command, device->i2c_address);
+        ESP_LOGE("brick_i2c_send_device_command", "Failed to send command 0x%02X to device at %u:0x%02X", cmd->command,
+                 request.bus, request.address);
     }
 
     return res == ESP_OK;
 }
+
+brick_i2c_handle_t brick_i2c_send_device_command_async(const brick_command_t *cmd) {
+    brick_i2c_request_t request;
+    if (!brick_i2c_build_device_command(cmd, &request)) return BRICK_I2C_INVALID_HANDLE;
+    if (brick_i2c_shadow_suppress(&request)) return BRICK_I2C_NOOP_HANDLE;
+    brick_i2c_seal(cmd->device, &request);
+
+    brick_i2c_handle_t handle = brick_i2c_submit(&request);
+    if (handle == BRICK_I2C_INVALID_HANDLE) brick_i2c_shadow_cancel(&request);
+
+    return handle;
+}
+
+void brick_i2c_build_read(const brick_device_t *device, uint8_t reg, uint8_t len, brick_i2c_request_t *request) {
+    *request = {};
+    request->address = device->i2c_address;
+    request->bus = device->i2c_bus;
+    request->priority = BRICK_I2C_PRIORITY_SENSOR;
+
+    if (device->caps.protocol_version < 3) {
+        request->write_len = 1;
+        request->write_buf[0] = reg;
+        request->read_len = len;
+        return;
+    }
+
+    request->write_buf[0] = CMD_CHECKED_READ;
+    request->write_buf[1] = reg;
+    request->write_buf[2] = len;
+    request->write_buf[3] = brick_crc8(brick_crc8_byte(0, request->address << 1), request->write_buf, 3);
+    request->write_len = 4;
+    request->read_len = len + 1;
+    request->flags = BRICK_I2C_FLAG_CHECKED;
+}
+
+// Reads len bytes from a register or read command
+static bool brick_i2c_read_block(const brick_device_t *device, uint8_t reg, uint8_t *out, uint8_t len) {
+    brick_i2c_request_t request;
+    brick_i2c_build_read(device, reg, len, &request);
+
+    uint8_t reply[BRICK_I2C_MAX_READ];
+    if (brick_i2c_transfer(&request, reply) != ESP_OK) return false;
+    std::memcpy(out, reply, len);
+    return true;
+}
+
+// Reads the record a module answers a one-byte command with. Firmware that predates the
+// command answers with its UUID, which no record starts with.
+static bool brick_i2c_read_record(const brick_device_t *device, brick_command_type_t command, void *record,
+                                  uint8_t len) {
+    auto *reply = static_cast<uint8_t *>(record);
+    return brick_i2c_read_block(device, command, reply, len) && !(len >= 2 && reply[0] == 'B' && reply[1] == 'L');
+}
+
+bool brick_i2c_read_stepper_status(const brick_device_t *device, brick_stepper_status_t *status) {
+    return brick_i2c_read_record(device, CMD_STEPPER_STATUS, status, sizeof(*status));
+}
+
+bool brick_i2c_read_servo_status(const brick_device_t *device, brick_servo_status_t *status) {
+    return brick_i2c_read_registers(device, BRICK_REG_SERVO_STATUS, status, sizeof(*status));
+}
+
+bool brick_i2c_read_module_status(const brick_device_t *device, brick_module_status_t *status) {
+    return brick_i2c_read_record(device, CMD_GET_STATUS, status, sizeof(*status));
+}
+
+bool brick_i2c_read_registers(const brick_device_t *device, uint8_t reg, void *out, size_t len) {
+    if (device->caps.protocol_version < 2 || reg < BRICK_REG_BASE || reg + len > 0x100) return false;
+
+    // One transaction per BRICK_I2C_MAX_READ bytes (less the CRC), the pointer moving on with each
+    size_t max_chunk = device->caps.protocol_version < 3 ? BRICK_I2C_MAX_READ : BRICK_I2C_MAX_READ - 1;
+    auto *dst = static_cast<uint8_t *>(out);
+    while (len > 0) {
+        uint8_t chunk = static_cast<uint8_t>(std::min(len, max_chunk));
+        if (!brick_i2c_read_block(device, reg, dst, chunk)) return false;
+        reg += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+bool brick_i2c_write_registers(const brick_device_t *device, uint8_t reg, const void *data, size_t len) {
+    // A write is never split: the module acts on the blocks it touched once it ends
+    if (device->caps.protocol_version < 2 || reg < BRICK_REG_BASE || len == 0 || 1 + len > BRICK_I2C_MAX_WRITE) {
+        return false;
+    }
+
+    brick_i2c_request_t request = {};
+    request.address = device->i2c_address;
+    request.bus = device->i2c_bus;
+    request.priority = BRICK_I2C_PRIORITY_ACTUATION;
+    request.write_buf[0] = reg;
+    std::memcpy(&request.write_buf[1], data, len);
+    request.write_len = static_cast<uint8_t>(1 + len);
+    brick_i2c_seal(device, &request);
+
+    return brick_i2c_transfer(&request, nullptr) == ESP_OK;
+}
+
+void brick_i2c_forget_device_state(const brick_device_t *device) {
+    brick_i2c_shadow_invalidate(device->i2c_bus, device->i2c_address);
+    brick_i2c_sync_sequence(device);
+}
+
+bool brick_i2c_assign_group(const brick_device_t *device, uint8_t group_mask) {
+    if (!device || (group_mask & BRICK_GROUP_SYNC)) return false; // move_together's to set and clear
+
+    brick_i2c_request_t request = {};
+    request.address = device->i2c_address;
+    request.bus = device->i2c_bus;
+    request.priority = BRICK_I2C_PRIORITY_ACTUATION;
+    request.write_buf[0] = CMD_GROUP_ASSIGN;
+    request.write_buf[1] = group_mask;
+    request.write_len = 2;
+    brick_i2c_seal(device, &request);
+
+    return brick_i2c_transfer(&request, nullptr) == ESP_OK;
+}
+
+// Wraps an encoded device command behind a prefix: [prefix..., cmd, payload...]
+static bool brick_i2c_wrap_device_command(const brick_command_t *cmd, const uint8_t *prefix, uint8_t prefix_len,
+                                          brick_i2c_request_t *request) {
+    brick_i2c_request_t inner;
+    if (!brick_i2c_build_device_command(cmd, &inner)) return false;
+    if (inner.write_len + prefix_len > BRICK_I2C_MAX_WRITE) return false;
+
+    *request = inner;
+    request->flags = 0; // the device does not apply it as a plain write, so keep it out of the shadow
+    std::memcpy(request->write_buf, prefix, prefix_len);
+    std::memcpy(&request->write_buf[prefix_len], inner.write_buf, inner.write_len);
+    request->write_len = prefix_len + inner.write_len;
+
+    return true;
+}
+
+static bool brick_i2c_build_stage(const brick_command_t *cmd, brick_i2c_request_t *request) {
+    const uint8_t prefix[] = {CMD_STAGE};
+    if (!brick_i2c_wrap_device_command(cmd, prefix, sizeof(prefix), request)) return false;
+    brick_i2c_seal(cmd->device, request);
+    return true;
+}
+
+bool brick_i2c_stage_device_command(const brick_command_t *cmd) {
+    brick_i2c_request_t request;
+    if (!brick_i2c_build_stage(cmd, &request)) return false;
+
+    return brick_i2c_transfer(&request, nullptr) == ESP_OK;
+}
+
+bool brick_i2c_stage_device_command_async(const brick_command_t *cmd) {
+    brick_i2c_request_t request;
+    if (!brick_i2c_build_stage(cmd, &request)) return false;
+
+    brick_i2c_handle_t handle = brick_i2c_submit(&request);
+    if (handle == BRICK_I2C_INVALID_HANDLE) return false;
+
+    portENTER_CRITICAL(&stage_lock);
+    bool queued = pending_stage_count < BRICK_STAGE_MAX_PENDING;
+    if (queued) pending_stages[pending_stage_count++] = handle;
+    portEXIT_CRITICAL(&stage_lock);
+    if (queued) return true;
+
+    // No room to leave it for the latch: wait for it here
+    esp_err_t res = brick_i2c_wait(handle, pdMS_TO_TICKS(BRICK_I2C_WAIT_TIMEOUT_MS));
+    brick_i2c_release(handle);
+    return res == ESP_OK;
+}
+
+// Waits for every stage queued so far; false if a module did not acknowledge its stage
+static bool brick_i2c_wait_stages() {
+    brick_i2c_handle_t handles[BRICK_STAGE_MAX_PENDING];
+    size_t count;
+
+    portENTER_CRITICAL(&stage_lock);
+    count = pending_stage_count;
+    std::copy_n(pending_stages, count, handles);
+    pending_stage_count = 0;
+    portEXIT_CRITICAL(&stage_lock);
+
+    bool ok = true;
+    for (size_t i = 0; i < count; ++i) {
+        ok &= brick_i2c_wait(handles[i], pdMS_TO_TICKS(BRICK_I2C_WAIT_TIMEOUT_MS)) == ESP_OK;
+        brick_i2c_release(handles[i]);
+    }
+
+    return ok;
+}
+
+// Puts a general call on every bus that has a module online, all queued before waiting on
+// any, so the buses carry it at the same time. With nothing online it still goes out on bus 0.
+static bool brick_i2c_general_call_all(brick_i2c_request_t *request) {
+    bool populated[BRICK_I2C_BUS_COUNT] = {};
+    bool any = false;
+    brick_device_t device;
+    for (brick_device_handle_t handle = 0; brick_registry_snapshot(handle, &device); ++handle) {
+        if (device.online && device.i2c_bus < BRICK_I2C_BUS_COUNT) populated[device.i2c_bus] = any = true;
+    }
+    if (!any) populated[0] = true;
+
+    brick_i2c_handle_t handles[BRICK_I2C_BUS_COUNT] = {};
+    request->address = BRICK_I2C_GENERAL_CALL_ADDRESS;
+    brick_i2c_shadow_invalidate_all();
+
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        if (!populated[bus]) continue;
+        request->bus = bus;
+        handles[bus] = brick_i2c_submit(request);
+    }
+
+    bool ok = true;
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        if (!populated[bus]) continue;
+        if (handles[bus] == BRICK_I2C_INVALID_HANDLE) {
+            ok = false;
+            continue;
+        }
+        ok &= brick_i2c_wait(handles[bus], pdMS_TO_TICKS(BRICK_I2C_WAIT_TIMEOUT_MS)) == ESP_OK;
+        brick_i2c_release(handles[bus]);
+    }
+
+    return ok;
+}
+
+bool brick_i2c_send_group_command(uint8_t group_mask, const brick_command_t *cmd) {
+    const uint8_t prefix[] = {CMD_GROUP_WRITE, group_mask};
+    brick_i2c_request_t request;
+    if (!brick_i2c_wrap_device_command(cmd, prefix, sizeof(prefix), &request)) return false;
+
+    return brick_i2c_general_call_all(&request);
+}
+
+bool brick_i2c_latch(uint8_t group_mask) {
+    // A module starts a new frame on every address match and takes a plain write at its stop,
+    // so the latch only goes out once every stage is acknowledged, in a transaction of its own
+    if (!brick_i2c_wait_stages()) {
+        ESP_LOGE("brick_i2c_latch", "A staged command was not acknowledged; latch of 0x%02X not sent", group_mask);
+        return false;
+    }
+
+    brick_i2c_request_t request = {};
+    request.priority = BRICK_I2C_PRIORITY_ACTUATION;
+    request.write_buf[0] = CMD_LATCH;
+    request.write_buf[1] = group_mask;
+    request.write_len = 2;
+
+    return brick_i2c_general_call_all(&request);
+}
+
+// Stages an axis' part of a shared move, the axis joining BRICK_GROUP_SYNC on top of its own
+// groups. Sets *joined once the groups it had are in *groups, to be put back.
+static bool brick_i2c_stage_axis(brick_device_t *axis, uint8_t *groups, bool *joined) {
+    brick_stepper_status_t status;
+    if (!brick_i2c_read_stepper_status(axis, &status) || (status.flags & BRICK_STEPPER_BUSY)) return false;
+    if (!brick_i2c_read_registers(axis, BRICK_REG_GROUP_MASK, groups, 1)) return false;
+    *joined = true;
+
+    uint8_t mask = *groups | BRICK_GROUP_SYNC;
+    if (!brick_i2c_write_registers(axis, BRICK_REG_GROUP_MASK, &mask, 1)) return false;
+
+    // Left for the latch to wait on, so the axes of both buses stage in parallel
+    brick_command_t cmd = {.command = CMD_STEPPER_MOVE_SYNC, .device = axis};
+    return brick_i2c_stage_device_command_async(&cmd);
+}
+
+bool brick_i2c_move_together(brick_device_t *axes, const int32_t *steps, size_t count, uint16_t speed,
+                             uint16_t accel, uint8_t microstep) {
+    if (count > BRICK_SYNC_MOVE_MAX_AXES || speed == 0 || microstep > BRICK_STEPPER_MICROSTEP_MASK) return false;
+
+    // The longest axis leads: its steps set how long the move takes on every module
+    uint32_t lead = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (axes[i].device_type != MOTOR_STEPPER || axes[i].caps.protocol_version < BRICK_SYNC_MOVE_MIN_PROTOCOL) {
+            return false;
+        }
+        uint32_t axis_steps = steps[i] < 0 ? 0u - static_cast<uint32_t>(steps[i]) : static_cast<uint32_t>(steps[i]);
+        lead = std::max(lead, axis_steps);
+    }
+    if (lead == 0) return true;
+
+    uint8_t groups[BRICK_SYNC_MOVE_MAX_AXES] = {};
+    bool joined[BRICK_SYNC_MOVE_MAX_AXES] = {};
+    bool staged = true;
+    for (size_t i = 0; i < count && staged; ++i) {
+        if (steps[i] == 0) continue;
+
+        brick_device_stepper_motor_impl_t &impl = axes[i].impl.stepper_motor;
+        impl.move.mode = static_cast<uint8_t>((microstep << BRICK_STEPPER_MICROSTEP_SHIFT) |
+                                              (steps[i] < 0 ? BRICK_STEPPER_DIR_REVERSE : 0));
+        impl.move.steps = steps[i] < 0 ? 0u - static_cast<uint32_t>(steps[i]) : static_cast<uint32_t>(steps[i]);
+        impl.move.max_speed = speed;
+        impl.move.accel = accel;
+        impl.lead_steps = lead;
+
+        staged = brick_i2c_stage_axis(&axes[i], &groups[i], &joined[i]);
+    }
+
+    bool started = staged && brick_i2c_latch(BRICK_GROUP_SYNC);
+    if (!staged) brick_i2c_wait_stages(); // the parts already queued land before they are replaced
+
+    // The engine has retried each of these already; one more call gives the module another
+    // backoff to come back before the axis is reported
+    bool restored = true;
+    for (size_t i = 0; i < count; ++i) {
+        if (!joined[i]) continue;
+        uint8_t own = groups[i] & ~BRICK_GROUP_SYNC;
+        if (!started) {
+            // Replace the staged part with a command that does nothing on an idle motor, so a
+            // later latch of one of the axis' own groups does not start it
+            brick_command_t cmd = {.command = CMD_STEPPER_STOP, .device = &axes[i]};
+            if (!brick_i2c_stage_device_command(&cmd) && !brick_i2c_stage_device_command(&cmd)) {
+                ESP_LOGE("brick_i2c_move_together", "Staged move of %u:0x%02X not replaced; a latch of 0x%02X starts it",
+                         axes[i].i2c_bus, axes[i].i2c_address, own | BRICK_GROUP_SYNC);
+            }
+        }
+        if (!brick_i2c_write_registers(&axes[i], BRICK_REG_GROUP_MASK, &own, 1) &&
+            !brick_i2c_write_registers(&axes[i], BRICK_REG_GROUP_MASK, &own, 1)) {
+            ESP_LOGE("brick_i2c_move_together", "Axis %u:0x%02X left in group 0x%02X", axes[i].i2c_bus,
+                     axes[i].i2c_address, BRICK_GROUP_SYNC);
+            restored = false;
+        }
+    }
+
+    return started && restored;
+}
+
+brick_i2c_coalesce_stats_t brick_i2c_get_coalesce_stats() {
+    brick_i2c_coalesce_stats_t coalesce = {};
+
+    portENTER_CRITICAL(&shadow_lock);
+    coalesce.suppressed = suppressed_writes;
+    portEXIT_CRITICAL(&shadow_lock);
+    coalesce.merged = brick_i2c_engine_get_stats().merged;
+
+    return coalesce;
+}
+
+brick_i2c_counters_t brick_i2c_get_command_counters() {
+    brick_i2c_engine_stats_t stats = brick_i2c_engine_get_stats();
+    brick_i2c_counters_t counters = {};
+
+    for (int prio = BRICK_I2C_PRIORITY_ACTUATION; prio <= BRICK_I2C_PRIORITY_SENSOR; ++prio) {
+        counters.transactions += stats.priority[prio].completed + stats.priority[prio].failed;
+        counters.bytes += stats.priority[prio].bytes;
+        counters.errors += stats.priority[prio].failed;
+    }
+
+    return counters;
+}
@@ -8,33 +8,182 @@
 #include <freertos/task.h>
 
 #include <cstring>
-#include <map>
-#include <mutex>
 
 #include "brick_i2c_api.h"
+#include "brick_device_registry.hpp"
+#include "brick_i2c_engine.hpp"
 
-#define I2C_MASTER_NUM         I2C_NUM_0
+#define I2C_MASTER_NUM         I2C_NUM_0   // bus 0
 #define I2C_MASTER_SDA_IO      GPIO_NUM_16
 #define I2C_MASTER_SCL_IO      GPIO_NUM_17
-#define I2C_MASTER_FREQ_HZ     100000
+#define I2C_BUS1_NUM           I2C_NUM_1   // bus 1, on the second module connector
+#define I2C_BUS1_SDA_IO        GPIO_NUM_21
+#define I2C_BUS1_SCL_IO        GPIO_NUM_22
+#define I2C_ATTENTION_IO       GPIO_NUM_18 // attention line of bus 0 (see BRICK_EVENT_RESET)
+#define I2C_BUS1_ATTENTION_IO  GPIO_NUM_19
+#define I2C_MASTER_FREQ_HZ     (BRICK_CAPS_LEGACY_CLOCK_KHZ * 1000) // discovery, and the floor of every bus
+#define I2C_MASTER_FREQ_MAX_HZ 1000000 // fastest clock device traffic is negotiated up to (Fm+)
 #define I2C_TIMEOUT_MS         100
 
-#define MAX_DEVICES 16
+#define BRICK_I2C_ADDRESS_MIN             0x09 // 0x08 is BRICK_I2C_ENUM_ADDRESS, served by enumeration
+#define BRICK_I2C_ADDRESS_MAX             0x77
 
-struct uuid_less {
-    bool operator()(const brick_uuid_t& a, const brick_uuid_t& b) const;
+#define BRICK_DISCOVERY_PERIOD_MS         50   // one verify pass + sweep slice per period
+#define BRICK_DISCOVERY_SLICE_BUDGET_US   2000 // wall time a sweep slice may spend probing
+#define BRICK_DISCOVERY_HEARTBEAT_MS      1000 // traffic younger than this proves a device alive
+
+#define BRICK_SYNC_MOVE_MAX_AXES          8    // stepper modules one brick_i2c_move_together() drives
+#define BRICK_STAGE_MAX_PENDING           16   // stages queued for the next latch without waiting
+
+/**
+ * @brief Running totals of device command traffic (discovery probes are not counted).
+ */
+struct brick_i2c_counters_t {
+    uint32_t transactions; /**< Commands attempted */
+    uint32_t bytes; /**< Bytes put on the bus, including the address byte */
+    uint32_t errors; /**< Commands that failed (NACK, timeout, bus error) */
+};
+
+/**
+ * @brief Actuator writes that never reached the bus, since boot.
+ */
+struct brick_i2c_coalesce_stats_t {
+    uint32_t suppressed; /**< Writes identical to the state the device last acknowledged */
+    uint32_t merged; /**< Queued writes replaced by a newer one to the same device (last writer wins) */
+};
+
+/**
+ * @brief Discovery counters since boot, summed over all buses.
+ */
+struct brick_i2c_discovery_stats_t {
+    uint32_t probes; /**< Address probes put on the bus */
+    uint32_t verifications; /**< Probes of known devices whose heartbeat went stale */
+    uint32_t sweeps; /**< Completed passes over the unknown address space */
+    uint32_t last_sweep_us; /**< Longest last pass of any bus: worst-case latency to find a new module */
 };
 
-extern std::map<brick_uuid_t, brick_device_t, uuid_less> device_map;
-extern std::mutex device_map_mutex;
+/**
+ * @brief Pins and controller of each bus, indexed like brick_device_t::i2c_bus.
+ */
+struct brick_i2c_bus_config_t {
+    i2c_port_t port;
+    gpio_num_t sda;
+    gpio_num_t scl;
+    gpio_num_t attention; /**< Open-drain line the bus's modules pull while they have events, GPIO_NUM_NC = none */
+};
+
+extern const brick_i2c_bus_config_t brick_i2c_buses[BRICK_I2C_BUS_COUNT];
 
 void brick_i2c_init();
-void brick_i2c_scan_devices();
+void brick_i2c_scan_devices(uint8_t bus);
+
+/**
+ * @brief Discovery loop of one bus. pvParams carries the bus index; run one task per bus.
+ */
 void brick_task_i2c_scan_devices(void *pvParams);
 
-brick_device_t * brick_i2c_get_device_uuid(const char* uuid);
-brick_device_t* brick_i2c_get_device_uuid(brick_uuid_t uuid);
+brick_device_handle_t brick_i2c_get_device_uuid(const char* uuid);
+brick_device_handle_t brick_i2c_get_device_uuid(brick_uuid_t uuid);
 
 bool brick_i2c_send_device_command(const brick_command_t *command);
+brick_i2c_handle_t brick_i2c_send_device_command_async(const brick_command_t *command);
+
+/**
+ * @brief Reads where a stepper module's motor is and whether a move is still running.
+ */
+bool brick_i2c_read_stepper_status(const brick_device_t *device, brick_stepper_status_t *status);
+
+/**
+ * @brief Reads the angle a servo module is driving its servo to and whether it is still slewing.
+ */
+bool brick_i2c_read_servo_status(const brick_device_t *device, brick_servo_status_t *status);
+
+/**
+ * @brief Reads how a module's command queue has kept up: commands dropped and peak depth.
+ */
+bool brick_i2c_read_module_status(const brick_device_t *device, brick_module_status_t *status);
+
+/**
+ * @brief Fills in a read of len bytes from a register or read command, for callers that
+ *        submit it themselves. Modules of protocol 3 or later get a CMD_CHECKED_READ, whose
+ *        reply the engine checks and retries; its data is followed by the CRC-8, so the reply
+ *        takes request->read_len bytes with the data first.
+ */
+void brick_i2c_build_read(const brick_device_t *device, uint8_t reg, uint8_t len, brick_i2c_request_t *request);
+
+/**
+ * @brief Reads len bytes of a module's register file from reg on (see BRICK_REG_BASE), in as
+ *        few transactions as BRICK_I2C_MAX_READ allows.
+ * @return false if a transfer failed or the module predates the register map.
+ */
+bool brick_i2c_read_registers(const brick_device_t *device, uint8_t reg, void *out, size_t len);
+
+/**
+ * @brief Writes len bytes to a module's registers from reg on, in a single transaction.
+ *        Read-only registers in the range keep their value.
+ * @return false if the write failed, does not fit one transaction or the module predates
+ *         the register map.
+ */
+bool brick_i2c_write_registers(const brick_device_t *device, uint8_t reg, const void *data, size_t len);
+
+/**
+ * @brief Drops what the host assumed about a module that restarted: the state it last
+ *        acknowledged, so the next write goes out again, and its checked-frame sequence.
+ */
+void brick_i2c_forget_device_state(const brick_device_t *device);
+
+/**
+ * @brief Sets which groups (bit mask) a module answers to for group writes and latches.
+ *        A mask with BRICK_GROUP_SYNC in it is refused: only brick_i2c_move_together() puts
+ *        a module there, and a module left in it would start with every synchronised move.
+ */
+bool brick_i2c_assign_group(const brick_device_t *device, uint8_t group_mask);
+
+/**
+ * @brief Sends a command the module stores but does not apply until the next matching latch.
+ */
+bool brick_i2c_stage_device_command(const brick_command_t *command);
+
+/**
+ * @brief Queues a staged command without waiting for it. The next brick_i2c_latch() waits
+ *        until it is acknowledged.
+ * @return false if the command could not be encoded or queued.
+ */
+bool brick_i2c_stage_device_command_async(const brick_command_t *command);
+
+/**
+ * @brief Sends one command to every module in the groups, in a single general-call write per bus.
+ *        command->device only supplies the payload; its address is not used.
+ */
+bool brick_i2c_send_group_command(uint8_t group_mask, const brick_command_t *command);
+
+/**
+ * @brief Makes every module in the groups apply its staged command at the same instant.
+ *        The latch goes out on all buses in parallel, so they only differ by the engines' wake-up.
+ *        It waits for the stages brick_i2c_stage_device_command_async() queued first and goes
+ *        out in a transaction of its own, after them.
+ * @return false if one of those stages or the latch itself failed; a failed stage means no latch.
+ */
+bool brick_i2c_latch(uint8_t group_mask);
+
+/**
+ * @brief Moves several stepper modules (axes) so that they start at the same instant and
+ *        arrive together. The longest axis runs at speed and accel; every module runs that
+ *        profile and steps its own axis in proportion (CMD_STEPPER_MOVE_SYNC), so the shorter
+ *        axes run slower. Each axis has its part staged, then one latch of BRICK_GROUP_SYNC
+ *        starts them all; the axes are in that group for the latch only.
+ * @param axes Snapshots of the modules; their stepper impl is filled in. Axes of 0 steps are left out.
+ * @param steps Steps per axis, negative in reverse.
+ * @return false if an axis is not an idle stepper of protocol 6 or later, there are more than
+ *         BRICK_SYNC_MOVE_MAX_AXES, or a transfer failed. Nothing moves unless the latch went out.
+ *         Also false, moving or not, if an axis could not be taken back out of BRICK_GROUP_SYNC:
+ *         the next synchronised move would start it with whatever it has staged.
+ */
+bool brick_i2c_move_together(brick_device_t *axes, const int32_t *steps, size_t count, uint16_t speed,
+                             uint16_t accel, uint8_t microstep);
+
+brick_i2c_counters_t brick_i2c_get_command_counters();
+brick_i2c_discovery_stats_t brick_i2c_get_discovery_stats();
+brick_i2c_coalesce_stats_t brick_i2c_get_coalesce_stats();
 
 #endif // I2CHOST_HPP
@@ -0,0 +1,99 @@
+#include "brick_i2c_trace.hpp"
+
+#include <cstring>
+
+static_assert((BRICK_I2C_TRACE_ENTRIES & (BRICK_I2C_TRACE_ENTRIES - 1)) == 0,
+              "BRICK_I2C_TRACE_ENTRIES must be a power of two");
+
+// Recording is a 16-byte copy under a spinlock, so the ring stays on in production
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_i2c_trace_entry_t ring[BRICK_I2C_TRACE_ENTRIES];
+static uint32_t next_seq = 0;
+
+// Task names are interned once; tasks come and go (a Lua task per script) but their names repeat
+static portMUX_TYPE task_lock = portMUX_INITIALIZER_UNLOCKED;
+static char task_names[BRICK_I2C_TRACE_MAX_TASKS][BRICK_I2C_TRACE_TASK_NAME];
+static uint8_t task_count = 0;
+
+static uint8_t brick_i2c_trace_result(esp_err_t result) {
+    switch (result) {
+        case ESP_OK: return BRICK_I2C_TRACE_OK;
+        case ESP_FAIL: return BRICK_I2C_TRACE_NACK;
+        case ESP_ERR_TIMEOUT: return BRICK_I2C_TRACE_TIMEOUT;
+        case ESP_ERR_INVALID_STATE: return BRICK_I2C_TRACE_SKIPPED;
+        case ESP_ERR_INVALID_CRC:
+        case ESP_ERR_INVALID_RESPONSE: return BRICK_I2C_TRACE_CHECK;
+        default: return BRICK_I2C_TRACE_ERROR;
+    }
+}
+
+uint8_t brick_i2c_trace_task_id() {
+    const char *name = pcTaskGetName(nullptr);
+    uint8_t id = BRICK_I2C_TRACE_TASK_OTHER;
+
+    portENTER_CRITICAL(&task_lock);
+    for (uint8_t i = 0; i < task_count; ++i) {
+        if (std::strncmp(task_names[i], name, BRICK_I2C_TRACE_TASK_NAME - 1) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id == BRICK_I2C_TRACE_TASK_OTHER && task_count < BRICK_I2C_TRACE_MAX_TASKS) {
+        std::strncpy(task_names[task_count], name, BRICK_I2C_TRACE_TASK_NAME - 1);
+        id = task_count++;
+    }
+    portEXIT_CRITICAL(&task_lock);
+
+    return id;
+}
+
+void brick_i2c_trace_record(const brick_i2c_request_t *request, uint8_t task, int64_t start_us,
+                            uint32_t duration_us, esp_err_t result, uint8_t flags) {
+    brick_i2c_trace_entry_t entry;
+    entry.start_us = static_cast<uint32_t>(start_us);
+    entry.duration_us = duration_us;
+    entry.address = request->address;
+    entry.command = request->write_len > 0 ? request->write_buf[0] : 0;
+    entry.write_len = request->write_len;
+    entry.read_len = request->read_len;
+    entry.result = brick_i2c_trace_result(result);
+    entry.flags = (request->priority & BRICK_I2C_TRACE_PRIORITY_MASK) | flags;
+    entry.task = task;
+    entry.bus = request->bus;
+
+    portENTER_CRITICAL(&trace_lock);
+    ring[next_seq & (BRICK_I2C_TRACE_ENTRIES - 1)] = entry;
+    next_seq++;
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+size_t brick_i2c_trace_read(uint32_t from_seq, brick_i2c_trace_entry_t *out, size_t max_count, uint32_t *first_seq) {
+    portENTER_CRITICAL(&trace_lock);
+    uint32_t oldest = next_seq > BRICK_I2C_TRACE_ENTRIES ? next_seq - BRICK_I2C_TRACE_ENTRIES : 0;
+    uint32_t seq = from_seq < oldest || from_seq > next_seq ? oldest : from_seq;
+
+    size_t count = 0;
+    for (; count < max_count && seq + count != next_seq; ++count) {
+        out[count] = ring[(seq + count) & (BRICK_I2C_TRACE_ENTRIES - 1)];
+    }
+    portEXIT_CRITICAL(&trace_lock);
+
+    *first_seq = seq;
+    return count;
+}
+
+uint32_t brick_i2c_trace_next_seq() {
+    portENTER_CRITICAL(&trace_lock);
+    uint32_t seq = next_seq;
+    portEXIT_CRITICAL(&trace_lock);
+
+    return seq;
+}
+
+const char *brick_i2c_trace_task_name(uint8_t task) {
+    portENTER_CRITICAL(&task_lock);
+    const char *name = task < task_count ? task_names[task] : nullptr;
+    portEXIT_CRITICAL(&task_lock);
+
+    return name;
+}
@@ -0,0 +1,84 @@
+// brick_i2c_trace.hpp
+#ifndef BRICK_I2C_TRACE_HPP
+#define BRICK_I2C_TRACE_HPP
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h> // Do NOT remove os headers
+#include <freertos/task.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "brick_i2c_engine.hpp"
+
+#define BRICK_I2C_TRACE_ENTRIES   256 // ring size, power of two (16 bytes each)
+#define BRICK_I2C_TRACE_MAX_TASKS 8   // distinct task names the trace can tell apart
+#define BRICK_I2C_TRACE_TASK_NAME 16  // including the terminator
+
+#define BRICK_I2C_TRACE_TASK_OTHER 0xFF // task id once the name table is full
+
+/** Outcome of a traced attempt */
+enum brick_i2c_trace_result_t : uint8_t {
+    BRICK_I2C_TRACE_OK = 0,
+    BRICK_I2C_TRACE_NACK = 1,
+    BRICK_I2C_TRACE_TIMEOUT = 2,
+    BRICK_I2C_TRACE_SKIPPED = 3, /**< Failed without bus traffic: device quarantined */
+    BRICK_I2C_TRACE_ERROR = 4, /**< Any other driver error */
+    BRICK_I2C_TRACE_CHECK = 5 /**< A checked frame's reply failed its CRC-8, or the module did not take the frame */
+};
+
+#define BRICK_I2C_TRACE_PRIORITY_MASK 0x03
+#define BRICK_I2C_TRACE_FLAG_BATCH    0x04 /**< Shared the transaction with other requests */
+#define BRICK_I2C_TRACE_FLAG_RETRY    0x08 /**< Repeated a failed attempt */
+
+/**
+ * @struct brick_i2c_trace_entry_t
+ * @brief One bus attempt of one request. Sent over BLE as is (little-endian, 16 bytes).
+ */
+struct brick_i2c_trace_entry_t {
+    uint32_t start_us; /**< Low 32 bits of esp_timer_get_time() when the attempt started */
+    uint32_t duration_us; /**< Bus time of the transaction (shared by all requests of a batch) */
+    uint8_t address; /**< 7-bit target address */
+    uint8_t command; /**< First written byte, 0 for probes and pure reads */
+    uint8_t write_len; /**< Bytes written after the address byte */
+    uint8_t read_len; /**< Bytes read back */
+    uint8_t result; /**< brick_i2c_trace_result_t */
+    uint8_t flags; /**< Priority in the low bits, BRICK_I2C_TRACE_FLAG_* */
+    uint8_t task; /**< Index into the task name table, BRICK_I2C_TRACE_TASK_OTHER if unknown */
+    uint8_t bus; /**< Bus the attempt ran on */
+};
+
+static_assert(sizeof(brick_i2c_trace_entry_t) == 16, "trace entries are sent as 16-byte records");
+
+/**
+ * @brief Returns the trace id of the calling task, registering its name on first use.
+ */
+uint8_t brick_i2c_trace_task_id();
+
+/**
+ * @brief Appends an attempt to the ring, overwriting the oldest entry. Called by the engine tasks.
+ */
+void brick_i2c_trace_record(const brick_i2c_request_t *request, uint8_t task, int64_t start_us,
+                            uint32_t duration_us, esp_err_t result, uint8_t flags);
+
+/**
+ * @brief Copies entries starting at sequence number from_seq (or the oldest one still held).
+ * @param from_seq First wanted sequence number; entries are numbered from 0 since boot.
+ * @param out Receives the entries, oldest first.
+ * @param max_count Capacity of out.
+ * @param first_seq Receives the sequence number of out[0].
+ * @return Number of entries copied. The next chunk starts at *first_seq + return value.
+ */
+size_t brick_i2c_trace_read(uint32_t from_seq, brick_i2c_trace_entry_t *out, size_t max_count, uint32_t *first_seq);
+
+/**
+ * @brief Sequence number the next entry will get (= entries recorded since boot).
+ */
+uint32_t brick_i2c_trace_next_seq();
+
+/**
+ * @brief Name of a task id, or nullptr if the id is unused.
+ */
+const char *brick_i2c_trace_task_name(uint8_t task);
+
+#endif // BRICK_I2C_TRACE_HPP
@@ -0,0 +1,31 @@
+/**
+ * @file brick_lua_user.h
+ * @brief Lua user configuration header (included by lua.h through LUA_USER_H).
+ *
+ * Routes the VM's GC step trace point to BrickLab so garbage collection
+ * time can be reported in the per-run metrics.
+ */
+
+#ifndef BRICK_LUA_USER_H
+#define BRICK_LUA_USER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lua_State;
+
+/**
+ * @brief Called by the Lua GC around every collection step.
+ * @param L Lua state running the step.
+ * @param first 1 when the step starts, 0 when it ends.
+ */
+void brick_lua_vm_trace_gc(struct lua_State *L, int first);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define luai_tracegc(L, f) brick_lua_vm_trace_gc(L, f)
+
+#endif // BRICK_LUA_USER_H
@@ -1,24 +1,73 @@
 #include "brick_lua_vm.hpp"
 
 #include <brick_i2c_api.h>
+#include <brick_i2c_events.hpp>
+#include <brick_i2c_health.hpp>
 #include <brick_i2c_host.hpp>
+#include <brick_sensor_sampler.hpp>
 #include <freertos/FreeRTOS.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
 
 lua_State *vm_state = nullptr;
 std::function<const char*()> on_vm_exception_callback = nullptr;
 
+// Profiler state. Guarded by a spinlock rather than a mutex: the Lua task can be
+// deleted at any time by a new upload and must never die holding a lock.
+static portMUX_TYPE profiler_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_lua_profile_entry_t profiler_table[BRICK_PROFILER_MAX_ENTRIES];
+static uint32_t profiler_total_samples = 0;
+static uint32_t profiler_dropped_samples = 0;
+
+// Metrics of the current run. Only touched from the task running the VM.
+static brick_lua_run_metrics_t run_metrics = {};
+static int64_t gc_step_start_us = 0;
+static size_t heap_bytes = 0;
+static lua_Alloc base_alloc = nullptr;
+static void *base_alloc_ud = nullptr;
+
+extern "C" void brick_lua_vm_trace_gc(lua_State *L, int first) {
+    if (first) {
+        gc_step_start_us = esp_timer_get_time();
+    } else {
+        run_metrics.gc_us += esp_timer_get_time() - gc_step_start_us;
+    }
+}
+
+// Wraps the default allocator to track the peak heap held by the VM
+static void *brick_lua_vm_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    void *result = base_alloc(ud, ptr, osize, nsize);
+
+    if (ptr == nullptr) osize = 0; // osize encodes the object type for new blocks
+    if (nsize == 0 || result != nullptr) {
+        heap_bytes = heap_bytes - osize + nsize;
+        run_metrics.peak_heap_bytes = std::max<uint32_t>(run_metrics.peak_heap_bytes, heap_bytes);
+    }
+
+    return result;
+}
+
+// Finalizer of a throw-away object: runs once per completed GC cycle and re-arms itself
+static int brick_lua_vm_gc_sentinel(lua_State *L) {
+    run_metrics.gc_cycles++;
+    lua_newtable(L);
+    luaL_setmetatable(L, "BrickGcSentinel");
+    lua_pop(L, 1);
+    return 0;
+}
+
 int brick_lua_vm_delay(lua_State *L) {
     int ms = luaL_checkinteger(L, 1);
     vTaskDelay(pdMS_TO_TICKS(ms));
     return 0;
 }
 
-int brick_lua_vm_send_command(lua_State *vm_state) {
-    const char *uuid_str = luaL_checkstring(vm_state, 1);
-    int cmd_type = luaL_checkinteger(vm_state, 2);
-    luaL_checktype(vm_state, 3, LUA_TTABLE);
+// Resolves the UUID string at arg into a snapshot of the device. Raises a Lua error if unknown.
+static int brick_lua_vm_check_device(lua_State *vm_state, int arg, brick_device_t *dev) {
+    const char *uuid_str = luaL_checkstring(vm_state, arg);
 
     // --- Validate UUID string length ---
     if (!uuid_str || strlen(uuid_str) != 36) {
@@ -62,14 +111,24 @@ int brick_lua_vm_send_command(lua_State *vm_state) {
     }
 
     // --- Lookup device by UUID ---
-    brick_device_t *dev = brick_i2c_get_device_uuid(uuid);
-    if (!dev) return luaL_error(vm_state, "Device not found for given UUID");
+    if (!brick_registry_snapshot(brick_i2c_get_device_uuid(uuid), dev)) {
+        return luaL_error(vm_state, "Device not found for given UUID");
+    }
+
+    return 0;
+}
+
+// Fills dev's state from the payload table at arg and returns the command. Raises a Lua error if
+// the command is not supported for the device type.
+static int brick_lua_vm_check_payload(lua_State *vm_state, int cmd_type, int arg, brick_device_t *dev, brick_command_t *cmd) {
+    luaL_checktype(vm_state, arg, LUA_TTABLE);
 
     // --- Handle supported command ---
-    if (cmd_type == CMD_LED_RGB && dev->device_type == LED_RGB) {
-        lua_getfield(vm_state, 3, "red");
-        lua_getfield(vm_state, 3, "green");
-        lua_getfield(vm_state, 3, "blue");
+    if ((cmd_type == CMD_LED_RGB || cmd_type == CMD_LED_FADE) && dev->device_type == LED_RGB) {
+        // { red, green, blue } levels of perceived brightness; CMD_LED_FADE adds ms = fade time
+        lua_getfield(vm_state, arg, "red");
+        lua_getfield(vm_state, arg, "green");
+        lua_getfield(vm_state, arg, "blue");
 
         if (!lua_isinteger(vm_state, -3) || !lua_isinteger(vm_state, -2) || !lua_isinteger(vm_state, -1)) {
             lua_pop(vm_state, 3);
@@ -80,31 +139,249 @@ int brick_lua_vm_send_command(lua_State *vm_state) {
         dev->impl.led_rgb.green = lua_tointeger(vm_state, -2);
         dev->impl.led_rgb.blue = lua_tointeger(vm_state, -1);
         lua_pop(vm_state, 3);
+
+        if (cmd_type == CMD_LED_FADE) {
+            lua_getfield(vm_state, arg, "ms");
+            lua_Integer ms = lua_isinteger(vm_state, -1) ? lua_tointeger(vm_state, -1) : -1;
+            lua_pop(vm_state, 1);
+
+            if (ms < 0 || ms > UINT16_MAX) return luaL_error(vm_state, "Fade time must be an integer of 0..65535 ms");
+            dev->impl.led_rgb.fade_ms = static_cast<uint16_t>(ms);
+        }
+    } else if (cmd_type == CMD_STEPPER_MOVE && dev->device_type == MOTOR_STEPPER) {
+        // { steps = N, speed = steps/s, accel = steps/s² (optional), microstep = 0..7 (optional) };
+        // negative steps move in reverse
+        lua_getfield(vm_state, arg, "steps");
+        lua_getfield(vm_state, arg, "speed");
+        lua_getfield(vm_state, arg, "accel");
+        lua_getfield(vm_state, arg, "microstep");
+
+        if (!lua_isinteger(vm_state, -4) || !lua_isinteger(vm_state, -3) ||
+            !(lua_isnil(vm_state, -2) || lua_isinteger(vm_state, -2)) ||
+            !(lua_isnil(vm_state, -1) || lua_isinteger(vm_state, -1))) {
+            lua_pop(vm_state, 4);
+            return luaL_error(vm_state, "Stepper values must be integers");
+        }
+
+        lua_Integer steps = lua_tointeger(vm_state, -4);
+        lua_Integer speed = lua_tointeger(vm_state, -3);
+        lua_Integer accel = lua_tointeger(vm_state, -2); // nil reads as 0
+        lua_Integer microstep = lua_tointeger(vm_state, -1);
+        lua_pop(vm_state, 4);
+
+        if (speed <= 0 || speed > BRICK_STEPPER_MAX_SPEED || accel < 0 || accel > UINT16_MAX ||
+            microstep < 0 || microstep > BRICK_STEPPER_MICROSTEP_MASK) {
+            return luaL_error(vm_state, "Stepper move out of range");
+        }
+
+        brick_stepper_move_t &move = dev->impl.stepper_motor.move;
+        move.mode = static_cast<uint8_t>((microstep << BRICK_STEPPER_MICROSTEP_SHIFT) |
+                                         (steps < 0 ? BRICK_STEPPER_DIR_REVERSE : 0));
+        move.steps = steps < 0 ? 0u - static_cast<uint32_t>(steps) : static_cast<uint32_t>(steps);
+        move.max_speed = static_cast<uint16_t>(speed);
+        move.accel = static_cast<uint16_t>(accel);
+    } else if (cmd_type == CMD_STEPPER_STOP && dev->device_type == MOTOR_STEPPER) {
+        // no payload
+    } else if (cmd_type == CMD_SERVO_SET_ANGLE && dev->device_type == MOTOR_SERVO_180) {
+        // { angle = degrees, slew = degrees/s (optional, 0 or nil = jump) }
+        lua_getfield(vm_state, arg, "angle");
+        lua_getfield(vm_state, arg, "slew");
+
+        if (!lua_isinteger(vm_state, -2) || !(lua_isnil(vm_state, -1) || lua_isinteger(vm_state, -1))) {
+            lua_pop(vm_state, 2);
+            return luaL_error(vm_state, "Servo values must be integers");
+        }
+
+        lua_Integer angle = lua_tointeger(vm_state, -2);
+        lua_Integer slew = lua_tointeger(vm_state, -1); // nil reads as 0
+        lua_pop(vm_state, 2);
+
+        if (angle < 0 || angle > BRICK_SERVO_MAX_ANGLE || slew < 0 || slew > UINT16_MAX) {
+            return luaL_error(vm_state, "Servo move out of range");
+        }
+
+        dev->impl.servo_180.move.angle = static_cast<uint8_t>(angle);
+        dev->impl.servo_180.move.slew = static_cast<uint16_t>(slew);
     } else {
         return luaL_error(vm_state, "Unsupported command or mismatched device type");
     }
 
-    // --- Create and send command ---
-    const brick_command_t cmd = {
+    *cmd = {
         .command = static_cast<brick_command_type_t>(cmd_type),
         .device = dev
     };
+    return 0;
+}
+
+// Parses the (uuid, cmd, table) arguments shared by send_command, send_command_async and
+// stage_command into a command for a snapshot of the device held in dev.
+static int brick_lua_vm_check_command(lua_State *vm_state, brick_device_t *dev, brick_command_t *cmd) {
+    int cmd_type = luaL_checkinteger(vm_state, 2);
+    luaL_checktype(vm_state, 3, LUA_TTABLE);
+
+    brick_lua_vm_check_device(vm_state, 1, dev);
+    return brick_lua_vm_check_payload(vm_state, cmd_type, 3, dev, cmd);
+}
+
+static uint8_t brick_lua_vm_check_group_mask(lua_State *vm_state, int arg) {
+    lua_Integer mask = luaL_checkinteger(vm_state, arg);
+    luaL_argcheck(vm_state, mask > 0 && mask <= BRICK_GROUP_ALL, arg, "group mask must be 1..127");
+    return static_cast<uint8_t>(mask);
+}
+
+int brick_lua_vm_assign_group(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    lua_Integer mask = luaL_checkinteger(vm_state, 2); // 0 leaves all groups
+    luaL_argcheck(vm_state, mask >= 0 && mask <= BRICK_GROUP_ALL, 2, "group mask must be 0..127");
+    brick_device_t dev;
+    brick_lua_vm_check_device(vm_state, 1, &dev);
+
+    lua_pushboolean(vm_state, brick_i2c_assign_group(&dev, static_cast<uint8_t>(mask)));
+    return 1;
+}
+
+int brick_lua_vm_stage_command(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_t dev;
+    brick_command_t cmd;
+    brick_lua_vm_check_command(vm_state, &dev, &cmd);
+
+    lua_pushboolean(vm_state, brick_i2c_stage_device_command(&cmd));
+    return 1;
+}
+
+int brick_lua_vm_group_command(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    uint8_t mask = brick_lua_vm_check_group_mask(vm_state, 1);
+    int cmd_type = luaL_checkinteger(vm_state, 2);
+
+    // No single target: the payload is encoded for the device type the command drives
+    brick_device_t dev = {};
+    if (cmd_type == CMD_LED_RGB || cmd_type == CMD_LED_FADE) dev.device_type = LED_RGB;
+    if (cmd_type == CMD_STEPPER_MOVE || cmd_type == CMD_STEPPER_STOP) dev.device_type = MOTOR_STEPPER;
+    if (cmd_type == CMD_SERVO_SET_ANGLE) dev.device_type = MOTOR_SERVO_180;
+
+    brick_command_t cmd;
+    brick_lua_vm_check_payload(vm_state, cmd_type, 3, &dev, &cmd);
+
+    lua_pushboolean(vm_state, brick_i2c_send_group_command(mask, &cmd));
+    return 1;
+}
+
+int brick_lua_vm_latch(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    lua_pushboolean(vm_state, brick_i2c_latch(brick_lua_vm_check_group_mask(vm_state, 1)));
+    return 1;
+}
+
+int brick_lua_vm_move_together(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    luaL_checktype(vm_state, 1, LUA_TTABLE);
+    lua_Integer speed = luaL_checkinteger(vm_state, 2);
+    lua_Integer accel = luaL_optinteger(vm_state, 3, 0);
+    lua_Integer microstep = luaL_optinteger(vm_state, 4, 0);
+    luaL_argcheck(vm_state, speed > 0 && speed <= BRICK_STEPPER_MAX_SPEED, 2, "speed out of range");
+    luaL_argcheck(vm_state, accel >= 0 && accel <= UINT16_MAX, 3, "accel out of range");
+    luaL_argcheck(vm_state, microstep >= 0 && microstep <= BRICK_STEPPER_MICROSTEP_MASK, 4, "microstep out of range");
+
+    // { [uuid] = steps, ... }, negative steps in reverse
+    brick_device_t axes[BRICK_SYNC_MOVE_MAX_AXES];
+    int32_t steps[BRICK_SYNC_MOVE_MAX_AXES];
+    size_t count = 0;
+    lua_pushnil(vm_state);
+    while (lua_next(vm_state, 1) != 0) {
+        if (lua_type(vm_state, -2) != LUA_TSTRING || !lua_isinteger(vm_state, -1)) {
+            return luaL_error(vm_state, "Axes must map device UUIDs to integer steps");
+        }
+        lua_Integer axis_steps = lua_tointeger(vm_state, -1);
+        if (axis_steps <= INT32_MIN || axis_steps > INT32_MAX) return luaL_error(vm_state, "Axis steps out of range");
+        if (count == BRICK_SYNC_MOVE_MAX_AXES) return luaL_error(vm_state, "Too many axes (at most %d)", BRICK_SYNC_MOVE_MAX_AXES);
+
+        brick_lua_vm_check_device(vm_state, lua_absindex(vm_state, -2), &axes[count]);
+        if (axes[count].device_type != MOTOR_STEPPER) return luaL_error(vm_state, "Not a stepper motor");
+        steps[count++] = static_cast<int32_t>(axis_steps);
+        lua_pop(vm_state, 1);
+    }
+
+    lua_pushboolean(vm_state, brick_i2c_move_together(axes, steps, count, static_cast<uint16_t>(speed),
+                                                      static_cast<uint16_t>(accel), static_cast<uint8_t>(microstep)));
+    return 1;
+}
+
+int brick_lua_vm_send_command(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_t dev;
+    brick_command_t cmd;
+    brick_lua_vm_check_command(vm_state, &dev, &cmd);
 
     brick_i2c_send_device_command(&cmd);
     return 0;
 }
 
+int brick_lua_vm_send_command_async(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_t dev;
+    brick_command_t cmd;
+    brick_lua_vm_check_command(vm_state, &dev, &cmd);
+
+    brick_i2c_handle_t handle = brick_i2c_send_device_command_async(&cmd);
+    if (handle == BRICK_I2C_INVALID_HANDLE) {
+        // Futures the script dropped still hold their slots until collected
+        lua_gc(vm_state, LUA_GCCOLLECT);
+        handle = brick_i2c_send_device_command_async(&cmd);
+    }
+    if (handle == BRICK_I2C_INVALID_HANDLE) {
+        return luaL_error(vm_state, "Too many I2C transfers in flight");
+    }
+
+    auto *ud = static_cast<brick_i2c_handle_t *>(lua_newuserdata(vm_state, sizeof(brick_i2c_handle_t)));
+    *ud = handle;
+
+    luaL_getmetatable(vm_state, "BrickFuture");
+    lua_setmetatable(vm_state, -2);
+
+    return 1;
+}
+
+int brick_future_done(lua_State *vm_state) {
+    auto *ud = static_cast<brick_i2c_handle_t *>(luaL_checkudata(vm_state, 1, "BrickFuture"));
+    lua_pushboolean(vm_state, brick_i2c_is_done(*ud));
+    return 1;
+}
+
+int brick_future_wait(lua_State *vm_state) {
+    auto *ud = static_cast<brick_i2c_handle_t *>(luaL_checkudata(vm_state, 1, "BrickFuture"));
+    lua_Integer timeout_ms = luaL_optinteger(vm_state, 2, BRICK_I2C_WAIT_TIMEOUT_MS);
+
+    esp_err_t res = brick_i2c_wait(*ud, pdMS_TO_TICKS(timeout_ms));
+    lua_pushboolean(vm_state, res == ESP_OK);
+    if (res == ESP_OK) return 1;
+
+    lua_pushstring(vm_state, esp_err_to_name(res));
+    return 2;
+}
+
+int brick_future_gc(lua_State *vm_state) {
+    auto *ud = static_cast<brick_i2c_handle_t *>(luaL_checkudata(vm_state, 1, "BrickFuture"));
+    brick_i2c_release(*ud);
+    *ud = BRICK_I2C_INVALID_HANDLE;
+    return 0;
+}
+
+
 int brick_lua_vm_get_device_uuid(lua_State *vm_state) {
+    run_metrics.brick_calls++;
     const char *uuid_str = luaL_checkstring(vm_state, 1);
 
-    brick_device_t *dev = brick_i2c_get_device_uuid(uuid_str);
-    if (!dev) {
+    brick_device_handle_t handle = brick_i2c_get_device_uuid(uuid_str);
+    if (handle == BRICK_INVALID_DEVICE_HANDLE) {
         lua_pushnil(vm_state);
         return 1;
     }
 
-    brick_device_t **ud = static_cast<brick_device_t **>(lua_newuserdata(vm_state, sizeof(brick_device_t *)));
-    *ud = dev;
+    // The userdata keeps the registry handle; every access reads a fresh snapshot
+    auto *ud = static_cast<brick_device_handle_t *>(lua_newuserdata(vm_state, sizeof(brick_device_handle_t)));
+    *ud = handle;
 
     // set metatable for the object
     luaL_getmetatable(vm_state, "BrickDevice");
@@ -114,11 +391,22 @@ int brick_lua_vm_get_device_uuid(lua_State *vm_state) {
 }
 
 int brick_device_index(lua_State *vm_state) {
-    auto **ud = static_cast<brick_device_t **>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
     const char *key = luaL_checkstring(vm_state, 2);
 
+    // Methods live in the table bound as upvalue; everything else is read from the registry
+    lua_pushvalue(vm_state, 2);
+    if (lua_rawget(vm_state, lua_upvalueindex(1)) != LUA_TNIL) return 1;
+    lua_pop(vm_state, 1);
+
+    brick_device_t device;
+    if (!brick_registry_snapshot(*ud, &device)) {
+        lua_pushnil(vm_state);
+        return 1;
+    }
+
     if (strcmp(key, "device_type") == 0) {
-        lua_pushinteger(vm_state, (*ud)->device_type);
+        lua_pushinteger(vm_state, device.device_type);
         return 1;
     }
 
@@ -126,10 +414,358 @@ int brick_device_index(lua_State *vm_state) {
     return 1;
 }
 
+// Raises a Lua error unless the device at arg 1 is a sensor the sampler serves
+static brick_device_handle_t brick_device_check_sensor(lua_State *vm_state) {
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+
+    brick_device_t device;
+    if (!brick_registry_snapshot(*ud, &device) || device.device_type != SENSOR_DISTANCE) {
+        luaL_error(vm_state, "Not a distance sensor");
+    }
+
+    return *ud;
+}
+
+int brick_device_read_cm(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_handle_t handle = brick_device_check_sensor(vm_state);
+
+    brick_sensor_sample_t sample;
+    if (!brick_sampler_latest(handle, &sample)) {
+        lua_pushnil(vm_state);
+        return 1;
+    }
+
+    uint32_t now_ms = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+    lua_pushinteger(vm_state, sample.value);
+    lua_pushinteger(vm_state, now_ms - sample.timestamp_ms);
+    return 2;
+}
+
+int brick_device_history(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_handle_t handle = brick_device_check_sensor(vm_state);
+    lua_Integer requested = luaL_optinteger(vm_state, 2, BRICK_SAMPLER_HISTORY);
+
+    brick_sensor_sample_t samples[BRICK_SAMPLER_HISTORY];
+    size_t count = brick_sampler_history(handle, samples, std::clamp<lua_Integer>(requested, 0, BRICK_SAMPLER_HISTORY));
+
+    lua_createtable(vm_state, static_cast<int>(count), 0);
+    for (size_t i = 0; i < count; ++i) {
+        lua_createtable(vm_state, 0, 2);
+        lua_pushinteger(vm_state, samples[i].value);
+        lua_setfield(vm_state, -2, "cm");
+        lua_pushinteger(vm_state, samples[i].timestamp_ms);
+        lua_setfield(vm_state, -2, "t_ms");
+        lua_rawseti(vm_state, -2, static_cast<lua_Integer>(i + 1));
+    }
+
+    return 1;
+}
+
+int brick_device_set_sample_period(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_handle_t handle = brick_device_check_sensor(vm_state);
+    lua_Integer period_ms = luaL_checkinteger(vm_state, 2);
+    luaL_argcheck(vm_state, period_ms > 0, 2, "period must be positive");
+
+    lua_pushboolean(vm_state, brick_sampler_set_period(handle, static_cast<uint32_t>(period_ms)));
+    return 1;
+}
+
+int brick_device_health(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+
+    brick_device_t device;
+    brick_i2c_health_t health = {};
+    if (!brick_registry_snapshot(*ud, &device)) return luaL_error(vm_state, "Device not found");
+    brick_i2c_health_get(device.i2c_bus, device.i2c_address, &health);
+
+    lua_createtable(vm_state, 0, 9);
+    lua_pushinteger(vm_state, health.success);
+    lua_setfield(vm_state, -2, "success");
+    lua_pushinteger(vm_state, health.failure);
+    lua_setfield(vm_state, -2, "failure");
+    lua_pushinteger(vm_state, health.timeout);
+    lua_setfield(vm_state, -2, "timeout");
+    lua_pushinteger(vm_state, health.retries);
+    lua_setfield(vm_state, -2, "retries");
+    lua_pushinteger(vm_state, health.skipped);
+    lua_setfield(vm_state, -2, "skipped");
+    lua_pushinteger(vm_state, health.quarantines);
+    lua_setfield(vm_state, -2, "quarantines");
+    lua_pushboolean(vm_state, health.quarantine_ms_left > 0);
+    lua_setfield(vm_state, -2, "quarantined");
+    lua_pushinteger(vm_state, health.quarantine_ms_left);
+    lua_setfield(vm_state, -2, "quarantine_ms_left");
+
+    // latency_us[i] counts attempts that took less than 64 us << (i - 1); the last bucket is open-ended
+    lua_createtable(vm_state, BRICK_I2C_HEALTH_BUCKETS, 0);
+    for (int i = 0; i < BRICK_I2C_HEALTH_BUCKETS; ++i) {
+        lua_pushinteger(vm_state, health.latency_hist[i]);
+        lua_rawseti(vm_state, -2, i + 1);
+    }
+    lua_setfield(vm_state, -2, "latency_us");
+
+    return 1;
+}
+
+int brick_device_stepper_status(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+
+    brick_device_t device;
+    if (!brick_registry_snapshot(*ud, &device) || device.device_type != MOTOR_STEPPER) {
+        return luaL_error(vm_state, "Not a stepper motor");
+    }
+
+    brick_stepper_status_t status;
+    if (!brick_i2c_read_stepper_status(&device, &status)) {
+        lua_pushnil(vm_state);
+        return 1;
+    }
+
+    lua_createtable(vm_state, 0, 4);
+    lua_pushinteger(vm_state, status.position);
+    lua_setfield(vm_state, -2, "position");
+    lua_pushboolean(vm_state, (status.flags & BRICK_STEPPER_BUSY) != 0);
+    lua_setfield(vm_state, -2, "busy");
+    lua_pushinteger(vm_state, status.speed);
+    lua_setfield(vm_state, -2, "speed");
+    lua_pushboolean(vm_state, (status.flags & BRICK_STEPPER_REJECTED) != 0);
+    lua_setfield(vm_state, -2, "rejected");
+
+    return 1;
+}
+
+int brick_device_servo_status(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+
+    brick_device_t device;
+    if (!brick_registry_snapshot(*ud, &device) || device.device_type != MOTOR_SERVO_180) {
+        return luaL_error(vm_state, "Not a servo motor");
+    }
+
+    brick_servo_status_t status;
+    if (!brick_i2c_read_servo_status(&device, &status)) {
+        lua_pushnil(vm_state);
+        return 1;
+    }
+
+    lua_createtable(vm_state, 0, 3);
+    lua_pushinteger(vm_state, status.angle);
+    lua_setfield(vm_state, -2, "angle");
+    lua_pushboolean(vm_state, (status.flags & BRICK_SERVO_BUSY) != 0);
+    lua_setfield(vm_state, -2, "busy");
+    lua_pushinteger(vm_state, status.pulse_us);
+    lua_setfield(vm_state, -2, "pulse_us");
+
+    return 1;
+}
+
+int brick_device_module_status(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+
+    brick_device_t device;
+    if (!brick_registry_snapshot(*ud, &device)) return luaL_error(vm_state, "Device not found");
+
+    brick_module_status_t status;
+    if (!brick_i2c_read_module_status(&device, &status)) {
+        lua_pushnil(vm_state);
+        return 1;
+    }
+
+    lua_createtable(vm_state, 0, 4);
+    lua_pushinteger(vm_state, status.frames_dropped);
+    lua_setfield(vm_state, -2, "dropped");
+    lua_pushinteger(vm_state, status.queue_high_water);
+    lua_setfield(vm_state, -2, "queue_high_water");
+    lua_pushinteger(vm_state, status.queue_slots);
+    lua_setfield(vm_state, -2, "queue_slots");
+    lua_pushinteger(vm_state, status.duplicates);
+    lua_setfield(vm_state, -2, "duplicates");
+
+    return 1;
+}
+
+// Checks (dev, reg) and snapshots the device
+static uint8_t brick_device_check_register(lua_State *vm_state, brick_device_t *device) {
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+    lua_Integer reg = luaL_checkinteger(vm_state, 2);
+    luaL_argcheck(vm_state, reg >= BRICK_REG_BASE && reg <= 0xFF, 2, "register must be 0x80..0xFF");
+
+    if (!brick_registry_snapshot(*ud, device)) luaL_error(vm_state, "Device not found");
+    return static_cast<uint8_t>(reg);
+}
+
+int brick_device_read_registers(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_t device;
+    uint8_t reg = brick_device_check_register(vm_state, &device);
+    lua_Integer len = luaL_checkinteger(vm_state, 3);
+    luaL_argcheck(vm_state, len > 0 && reg + len <= 0x100, 3, "read runs past the register file");
+
+    uint8_t data[0x100 - BRICK_REG_BASE];
+    if (!brick_i2c_read_registers(&device, reg, data, static_cast<size_t>(len))) {
+        lua_pushnil(vm_state);
+        return 1;
+    }
+
+    lua_pushlstring(vm_state, reinterpret_cast<const char *>(data), static_cast<size_t>(len));
+    return 1;
+}
+
+int brick_device_write_registers(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    brick_device_t device;
+    uint8_t reg = brick_device_check_register(vm_state, &device);
+    size_t len;
+    const char *data = luaL_checklstring(vm_state, 3, &len);
+    if (reg <= BRICK_REG_GROUP_MASK && reg + len > BRICK_REG_GROUP_MASK) {
+        luaL_argcheck(vm_state, !(data[BRICK_REG_GROUP_MASK - reg] & BRICK_GROUP_SYNC), 3, "group 0x80 is the host's");
+    }
+
+    lua_pushboolean(vm_state, brick_i2c_write_registers(&device, reg, data, len));
+    return 1;
+}
+
+// Checks (dev, [mask]) and returns the device, or BRICK_INVALID_DEVICE_HANDLE if the module raises no events
+static brick_device_handle_t brick_device_check_events(lua_State *vm_state, uint8_t *mask) {
+    auto *ud = static_cast<brick_device_handle_t *>(luaL_checkudata(vm_state, 1, "BrickDevice"));
+    lua_Integer bits = luaL_optinteger(vm_state, 2, BRICK_EVENT_ALL);
+    luaL_argcheck(vm_state, bits > 0 && bits <= BRICK_EVENT_ALL, 2, "event mask must be 1..255");
+    *mask = static_cast<uint8_t>(bits);
+
+    brick_device_t device;
+    if (!brick_registry_snapshot(*ud, &device)) luaL_error(vm_state, "Device not found");
+    return device.caps.protocol_version >= 4 ? *ud : BRICK_INVALID_DEVICE_HANDLE;
+}
+
+int brick_device_events(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    uint8_t mask;
+    brick_device_handle_t handle = brick_device_check_events(vm_state, &mask);
+
+    if (handle == BRICK_INVALID_DEVICE_HANDLE) lua_pushnil(vm_state);
+    else lua_pushinteger(vm_state, brick_events_take(handle, mask));
+    return 1;
+}
+
+int brick_device_wait_events(lua_State *vm_state) {
+    run_metrics.brick_calls++;
+    uint8_t mask;
+    brick_device_handle_t handle = brick_device_check_events(vm_state, &mask);
+    lua_Integer timeout_ms = luaL_checkinteger(vm_state, 3);
+    luaL_argcheck(vm_state, timeout_ms >= 0, 3, "timeout must not be negative");
+
+    if (handle == BRICK_INVALID_DEVICE_HANDLE) lua_pushnil(vm_state);
+    else lua_pushinteger(vm_state, brick_events_wait(handle, mask, pdMS_TO_TICKS(timeout_ms)));
+    return 1;
+}
+
+static void brick_lua_vm_profiler_record(uint16_t line, uint16_t function_line) {
+    // Open addressing on (line, function_line); the table size is a power of two
+    static_assert((BRICK_PROFILER_MAX_ENTRIES & (BRICK_PROFILER_MAX_ENTRIES - 1)) == 0,
+                  "BRICK_PROFILER_MAX_ENTRIES must be a power of two");
+    uint32_t index = (line * 31u + function_line) & (BRICK_PROFILER_MAX_ENTRIES - 1);
+
+    portENTER_CRITICAL(&profiler_lock);
+    profiler_total_samples++;
+    for (int probe = 0; probe < BRICK_PROFILER_MAX_ENTRIES; ++probe) {
+        brick_lua_profile_entry_t &entry = profiler_table[index];
+
+        if (entry.samples == 0) {
+            entry.line = line;
+            entry.function_line = function_line;
+            entry.samples = 1;
+            portEXIT_CRITICAL(&profiler_lock);
+            return;
+        }
+
+        if (entry.line == line && entry.function_line == function_line) {
+            entry.samples++;
+            portEXIT_CRITICAL(&profiler_lock);
+            return;
+        }
+
+        index = (index + 1) & (BRICK_PROFILER_MAX_ENTRIES - 1);
+    }
+    profiler_dropped_samples++;
+    portEXIT_CRITICAL(&profiler_lock);
+}
+
+static void brick_lua_vm_profiler_hook(lua_State *L, lua_Debug *ar) {
+    if (ar->event != LUA_HOOKCOUNT) return;
+
+    // Attribute the sample to the innermost frame of the user script, so time spent
+    // inside brick_lab helpers is charged to the line that called them.
+    lua_Debug frame;
+    for (int level = 0; level < BRICK_PROFILER_MAX_DEPTH && lua_getstack(L, level, &frame); ++level) {
+        lua_getinfo(L, "Sl", &frame);
+
+        if (frame.currentline > 0 && strcmp(frame.source, BRICK_LUA_MAIN_CHUNKNAME) == 0) {
+            brick_lua_vm_profiler_record(static_cast<uint16_t>(frame.currentline),
+                                         static_cast<uint16_t>(frame.linedefined));
+            return;
+        }
+    }
+
+    portENTER_CRITICAL(&profiler_lock);
+    profiler_total_samples++;
+    profiler_dropped_samples++;
+    portEXIT_CRITICAL(&profiler_lock);
+}
+
+void brick_lua_vm_profiler_reset() {
+    portENTER_CRITICAL(&profiler_lock);
+    memset(profiler_table, 0, sizeof(profiler_table));
+    profiler_total_samples = 0;
+    profiler_dropped_samples = 0;
+    portEXIT_CRITICAL(&profiler_lock);
+}
+
+brick_lua_profile_t brick_lua_vm_profiler_snapshot() {
+    brick_lua_profile_entry_t table_copy[BRICK_PROFILER_MAX_ENTRIES];
+    brick_lua_profile_t profile;
+    profile.interval = BRICK_PROFILER_SAMPLE_INTERVAL;
+
+    portENTER_CRITICAL(&profiler_lock);
+    memcpy(table_copy, profiler_table, sizeof(profiler_table));
+    profile.total_samples = profiler_total_samples;
+    profile.dropped_samples = profiler_dropped_samples;
+    portEXIT_CRITICAL(&profiler_lock);
+
+    for (const auto &entry: table_copy) {
+        if (entry.samples > 0) profile.entries.push_back(entry);
+    }
+
+    return profile;
+}
+
 void brick_lua_vm_init() {
     vm_state = luaL_newstate();
     luaL_openlibs(vm_state); // Load standard Lua libraries
 
+    // Sample the running line every BRICK_PROFILER_SAMPLE_INTERVAL VM instructions
+    lua_sethook(vm_state, brick_lua_vm_profiler_hook, LUA_MASKCOUNT, BRICK_PROFILER_SAMPLE_INTERVAL);
+
+    // Track heap usage from here on, starting from what the libraries already hold
+    base_alloc = lua_getallocf(vm_state, &base_alloc_ud);
+    lua_setallocf(vm_state, brick_lua_vm_alloc, base_alloc_ud);
+    heap_bytes = lua_gc(vm_state, LUA_GCCOUNT) * 1024 + lua_gc(vm_state, LUA_GCCOUNTB);
+
+    // Arm the GC cycle counter
+    luaL_newmetatable(vm_state, "BrickGcSentinel");
+    lua_pushcfunction(vm_state, brick_lua_vm_gc_sentinel);
+    lua_setfield(vm_state, -2, "__gc");
+    lua_pop(vm_state, 1);
+    lua_newtable(vm_state);
+    luaL_setmetatable(vm_state, "BrickGcSentinel");
+    lua_pop(vm_state, 1);
+
     // --- Register global C functions (into _G) ---
     static constexpr luaL_Reg global_funcs[] = {
         {"delay", brick_lua_vm_delay},
@@ -143,6 +779,12 @@ void brick_lua_vm_init() {
     static constexpr luaL_Reg brick_funcs[] = {
         {"get_device_from_uuid", brick_lua_vm_get_device_uuid},
         {"send_command", brick_lua_vm_send_command},
+        {"send_command_async", brick_lua_vm_send_command_async},
+        {"assign_group", brick_lua_vm_assign_group},
+        {"stage_command", brick_lua_vm_stage_command},
+        {"group_command", brick_lua_vm_group_command},
+        {"latch", brick_lua_vm_latch},
+        {"move_together", brick_lua_vm_move_together},
         {nullptr, nullptr}
     };
     luaL_newlib(vm_state, brick_funcs); // stack: [brick table]
@@ -156,28 +798,102 @@ void brick_lua_vm_init() {
     lua_setfield(vm_state, -2, "CMD_LED_DOUBLE");
     lua_pushinteger(vm_state, CMD_LED_RGB);
     lua_setfield(vm_state, -2, "CMD_LED_RGB");
+    lua_pushinteger(vm_state, CMD_LED_FADE);
+    lua_setfield(vm_state, -2, "CMD_LED_FADE");
     lua_pushinteger(vm_state, CMD_SERVO_SET_ANGLE);
     lua_setfield(vm_state, -2, "CMD_SERVO_SET_ANGLE");
     lua_pushinteger(vm_state, CMD_STEPPER_MOVE);
     lua_setfield(vm_state, -2, "CMD_STEPPER_MOVE");
+    lua_pushinteger(vm_state, CMD_STEPPER_STOP);
+    lua_setfield(vm_state, -2, "CMD_STEPPER_STOP");
     lua_pushinteger(vm_state, CMD_SENSOR_GET_CM);
     lua_setfield(vm_state, -2, "CMD_SENSOR_GET_CM");
+    lua_pushinteger(vm_state, BRICK_GROUP_ALL);
+    lua_setfield(vm_state, -2, "GROUP_ALL");
+
+    // === Registers ===
+    lua_pushinteger(vm_state, BRICK_REG_UUID);
+    lua_setfield(vm_state, -2, "REG_UUID");
+    lua_pushinteger(vm_state, BRICK_REG_CAPS);
+    lua_setfield(vm_state, -2, "REG_CAPS");
+    lua_pushinteger(vm_state, BRICK_REG_STATUS);
+    lua_setfield(vm_state, -2, "REG_STATUS");
+    lua_pushinteger(vm_state, BRICK_REG_COUNTERS);
+    lua_setfield(vm_state, -2, "REG_COUNTERS");
+    lua_pushinteger(vm_state, BRICK_REG_GROUP_MASK);
+    lua_setfield(vm_state, -2, "REG_GROUP_MASK");
+    lua_pushinteger(vm_state, BRICK_REG_EVENTS);
+    lua_setfield(vm_state, -2, "REG_EVENTS");
+    lua_pushinteger(vm_state, BRICK_REG_EVENT_MASK);
+    lua_setfield(vm_state, -2, "REG_EVENT_MASK");
+    lua_pushinteger(vm_state, BRICK_REG_STEPPER_MOVE);
+    lua_setfield(vm_state, -2, "REG_STEPPER_MOVE");
+    lua_pushinteger(vm_state, BRICK_REG_STEPPER_STATUS);
+    lua_setfield(vm_state, -2, "REG_STEPPER_STATUS");
+    lua_pushinteger(vm_state, BRICK_REG_SERVO_MOVE);
+    lua_setfield(vm_state, -2, "REG_SERVO_MOVE");
+    lua_pushinteger(vm_state, BRICK_REG_SERVO_STATUS);
+    lua_setfield(vm_state, -2, "REG_SERVO_STATUS");
+    lua_pushinteger(vm_state, BRICK_REG_SENSOR_CONFIG);
+    lua_setfield(vm_state, -2, "REG_SENSOR_CONFIG");
+    lua_pushinteger(vm_state, BRICK_REG_SENSOR_READING);
+    lua_setfield(vm_state, -2, "REG_SENSOR_READING");
+
+    // === Module events ===
+    lua_pushinteger(vm_state, BRICK_EVENT_RESET);
+    lua_setfield(vm_state, -2, "EVENT_RESET");
+    lua_pushinteger(vm_state, BRICK_EVENT_MOVE_DONE);
+    lua_setfield(vm_state, -2, "EVENT_MOVE_DONE");
 
     // === Device types ===
     lua_pushinteger(vm_state, LED_RGB);
     lua_setfield(vm_state, -2, "DEVICE_LED_RGB");
     lua_pushinteger(vm_state, LED_SINGLE);
     lua_setfield(vm_state, -2, "DEVICE_LED_SINGLE");
+    lua_pushinteger(vm_state, SENSOR_DISTANCE);
+    lua_setfield(vm_state, -2, "DEVICE_SENSOR_DISTANCE");
+    lua_pushinteger(vm_state, MOTOR_STEPPER);
+    lua_setfield(vm_state, -2, "DEVICE_MOTOR_STEPPER");
+    lua_pushinteger(vm_state, MOTOR_SERVO_180);
+    lua_setfield(vm_state, -2, "DEVICE_MOTOR_SERVO_180");
 
     // Finalize 'brick' global table
     lua_setglobal(vm_state, "brick"); // _G["brick"] = brick table
 
     // --- Set BrickDevice metatable ---
+    static constexpr luaL_Reg device_methods[] = {
+        {"read_cm", brick_device_read_cm},
+        {"history", brick_device_history},
+        {"set_sample_period", brick_device_set_sample_period},
+        {"health", brick_device_health},
+        {"stepper_status", brick_device_stepper_status},
+        {"servo_status", brick_device_servo_status},
+        {"module_status", brick_device_module_status},
+        {"read_registers", brick_device_read_registers},
+        {"write_registers", brick_device_write_registers},
+        {"events", brick_device_events},
+        {"wait_events", brick_device_wait_events},
+        {nullptr, nullptr}
+    };
     luaL_newmetatable(vm_state, "BrickDevice");
-    lua_pushcfunction(vm_state, brick_device_index);
+    luaL_newlib(vm_state, device_methods);
+    lua_pushcclosure(vm_state, brick_device_index, 1);
     lua_setfield(vm_state, -2, "__index");
     lua_pop(vm_state, 1); // pop metatable
 
+    // --- Set BrickFuture metatable ---
+    static constexpr luaL_Reg future_methods[] = {
+        {"done", brick_future_done},
+        {"wait", brick_future_wait},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(vm_state, "BrickFuture");
+    luaL_newlib(vm_state, future_methods);
+    lua_setfield(vm_state, -2, "__index");
+    lua_pushcfunction(vm_state, brick_future_gc);
+    lua_setfield(vm_state, -2, "__gc");
+    lua_pop(vm_state, 1); // pop metatable
+
     // --- Preload embedded Lua module as 'brick_lab' ---
     lua_getglobal(vm_state, "package");
     lua_getfield(vm_state, -1, "preload");
@@ -199,25 +915,45 @@ void brick_lua_vm_reset() {
     brick_lua_vm_init();
 }
 
-const char *brick_lua_vm_run(const char *code) {
+const char *brick_lua_vm_run(const char *code, brick_lua_run_metrics_t *metrics) {
     brick_lua_vm_reset();
     assert(vm_state && "Lua VM not initialized");
 
     printf("Lua code:\n%s\n", code);
 
-    // Load the Lua code
-    if (luaL_loadstring(vm_state, code) != LUA_OK) {
-        const char *err = lua_tostring(vm_state, -1);
+    brick_lua_vm_profiler_reset();
+    run_metrics = {};
+    run_metrics.peak_heap_bytes = heap_bytes;
+    const brick_i2c_counters_t i2c_before = brick_i2c_get_command_counters();
+    const char *error = nullptr;
+
+    // Load the Lua code under a fixed chunk name so profiler samples map to script lines
+    int64_t start_us = esp_timer_get_time();
+    if (luaL_loadbuffer(vm_state, code, strlen(code), BRICK_LUA_MAIN_CHUNKNAME) != LUA_OK) {
+        run_metrics.status = BRICK_LUA_RUN_LOAD_ERROR;
+        error = lua_tostring(vm_state, -1);
         lua_pop(vm_state, 1);
-        return err;
     }
+    run_metrics.load_us = esp_timer_get_time() - start_us;
 
     // Run it protected
-    if (lua_pcall(vm_state, 0, LUA_MULTRET, 0) != LUA_OK) {
-        const char *err = lua_tostring(vm_state, -1);
-        lua_pop(vm_state, 1);
-        return err;
+    if (!error) {
+        start_us = esp_timer_get_time();
+        if (lua_pcall(vm_state, 0, LUA_MULTRET, 0) != LUA_OK) {
+            run_metrics.status = BRICK_LUA_RUN_RUNTIME_ERROR;
+            error = lua_tostring(vm_state, -1);
+            lua_pop(vm_state, 1);
+        }
+        run_metrics.exec_us = esp_timer_get_time() - start_us;
+    }
+
+    if (metrics) {
+        const brick_i2c_counters_t i2c_after = brick_i2c_get_command_counters();
+        run_metrics.i2c_transactions = i2c_after.transactions - i2c_before.transactions;
+        run_metrics.i2c_bytes = i2c_after.bytes - i2c_before.bytes;
+        run_metrics.i2c_errors = i2c_after.errors - i2c_before.errors;
+        *metrics = run_metrics;
     }
 
-    return nullptr; // success
+    return error; // null on success
 }
@@ -1,7 +1,9 @@
 #ifndef BRICK_LUA_VM_HPP
 #define BRICK_LUA_VM_HPP
 
+#include <cstdint>
 #include <functional>
+#include <vector>
 
 extern "C" {
 #include "lua/lua.h"
@@ -25,6 +27,75 @@ extern std::function<const char*()> on_vm_exception_callback;
  */
 extern const char *brick_lab_lua_module;
 
+/**
+ * @brief Chunk name given to user scripts, so samples and errors can be attributed to their lines.
+ */
+#define BRICK_LUA_MAIN_CHUNKNAME "=main"
+
+/**
+ * @brief Number of VM instructions between two profiler samples (count hook period).
+ */
+#define BRICK_PROFILER_SAMPLE_INTERVAL 1000
+
+/**
+ * @brief Maximum number of distinct script lines tracked by the profiler.
+ */
+#define BRICK_PROFILER_MAX_ENTRIES 64
+
+/**
+ * @brief Maximum call depth walked to find the user script frame for a sample.
+ */
+#define BRICK_PROFILER_MAX_DEPTH 8
+
+/**
+ * @struct brick_lua_profile_entry_t
+ * @brief Sample count for one line of the user script.
+ */
+struct brick_lua_profile_entry_t {
+    uint16_t line; /**< Line in the user script (1-based) */
+    uint16_t function_line; /**< Line where the enclosing function is defined (0 = main chunk) */
+    uint32_t samples; /**< Number of samples attributed to this line */
+};
+
+/**
+ * @struct brick_lua_profile_t
+ * @brief Snapshot of the sampling profiler histogram.
+ */
+struct brick_lua_profile_t {
+    uint32_t interval; /**< Instructions between samples */
+    uint32_t total_samples; /**< All samples taken since the script started */
+    uint32_t dropped_samples; /**< Samples lost because the table was full or no script frame was found */
+    std::vector<brick_lua_profile_entry_t> entries; /**< Per-line histogram */
+};
+
+/**
+ * @enum brick_lua_run_status_t
+ * @brief How a script run ended.
+ */
+enum brick_lua_run_status_t : uint8_t {
+    BRICK_LUA_RUN_OK = 0, /**< Script returned normally */
+    BRICK_LUA_RUN_LOAD_ERROR = 1, /**< Script failed to compile */
+    BRICK_LUA_RUN_RUNTIME_ERROR = 2 /**< Script raised an error */
+};
+
+/**
+ * @struct brick_lua_run_metrics_t
+ * @brief Execution metrics collected for a single script run.
+ */
+struct brick_lua_run_metrics_t {
+    brick_lua_run_status_t status; /**< Outcome of the run */
+    uint32_t load_us; /**< Time spent compiling the script */
+    uint32_t exec_us; /**< Time spent running the script (includes GC and I²C) */
+    uint32_t gc_cycles; /**< Completed GC cycles */
+    uint32_t gc_us; /**< Total time spent in GC steps */
+    uint32_t peak_heap_bytes; /**< Peak memory held by the Lua allocator */
+    uint32_t brick_calls; /**< Calls into the `brick` native API */
+    uint32_t i2c_transactions; /**< Device commands issued */
+    uint32_t i2c_bytes; /**< Bytes put on the bus by those commands */
+    uint32_t i2c_errors; /**< Device commands that failed */
+    uint32_t stack_headroom_bytes; /**< Minimum free stack of the running task (filled in by the caller) */
+};
+
 // ---------------- Exposed Lua-C Binding Functions ----------------
 
 /**
@@ -43,6 +114,55 @@ int brick_lua_vm_delay(lua_State *vm_state);
  */
 int brick_lua_vm_send_command(lua_State *vm_state);
 
+/**
+ * @brief Queues a command without waiting for the bus, using `send_command_async(uuid, cmd, table)`.
+ *
+ * @param vm_state Lua state.
+ * @return Returns 1 value on the Lua stack (`BrickFuture` userdata), or error message.
+ */
+int brick_lua_vm_send_command_async(lua_State *vm_state);
+
+/**
+ * @brief Sets a module's group membership with `assign_group(uuid, mask)`.
+ *
+ * @param vm_state Lua state.
+ * @return Returns 1 value on the Lua stack (true if the module acknowledged).
+ */
+int brick_lua_vm_assign_group(lua_State *vm_state);
+
+/**
+ * @brief Stages a command for the next latch with `stage_command(uuid, cmd, table)`.
+ *
+ * @param vm_state Lua state.
+ * @return Returns 1 value on the Lua stack (true if the module acknowledged).
+ */
+int brick_lua_vm_stage_command(lua_State *vm_state);
+
+/**
+ * @brief Sends one command to all modules of the groups with `group_command(mask, cmd, table)`.
+ *
+ * @param vm_state Lua state.
+ * @return Returns 1 value on the Lua stack (true if any module acknowledged).
+ */
+int brick_lua_vm_group_command(lua_State *vm_state);
+
+/**
+ * @brief Applies staged commands of the groups at once with `latch(mask)`.
+ *
+ * @param vm_state Lua state.
+ * @return Returns 1 value on the Lua stack (true if any module acknowledged).
+ */
+int brick_lua_vm_latch(lua_State *vm_state);
+
+/**
+ * @brief Starts stepper modules together so they also arrive together with
+ *        `move_together({[uuid] = steps, ...}, speed, [accel], [microstep])`; see brick_i2c_move_together().
+ *
+ * @param vm_state Lua state.
+ * @return Returns 1 value on the Lua stack (true if the axes were started).
+ */
+int brick_lua_vm_move_together(lua_State *vm_state);
+
 /**
  * @brief Retrieves a device handle by UUID using `get_device_from_uuid(uuid)` in Lua.
  *
@@ -59,6 +179,103 @@ int brick_lua_vm_get_device_uuid(lua_State *vm_state);
  */
 int brick_device_index(lua_State *vm_state);
 
+/**
+ * @brief `dev:read_cm()` - latest cached distance, without touching the bus.
+ *
+ * @return The distance in cm plus the sample's age in ms, or nil if there is no sample yet.
+ */
+int brick_device_read_cm(lua_State *vm_state);
+
+/**
+ * @brief `dev:history([n])` - up to n recent samples, newest first, as `{ cm = X, t_ms = Y }` tables.
+ */
+int brick_device_history(lua_State *vm_state);
+
+/**
+ * @brief `dev:set_sample_period(ms)` - changes how often the sampler polls the sensor.
+ *
+ * @return true, or false if the sampler has no room for another sensor.
+ */
+int brick_device_set_sample_period(lua_State *vm_state);
+
+/**
+ * @brief `dev:health()` - bus health counters of the device's address.
+ *
+ * @return Table with success, failure, timeout, retries, skipped, quarantines, quarantined,
+ *         quarantine_ms_left and the latency_us histogram (bucket i: < 64 us << (i - 1)).
+ */
+int brick_device_health(lua_State *vm_state);
+
+/**
+ * @brief `dev:stepper_status()` - reads the motion state from a stepper module.
+ *
+ * @return Table with position, busy, speed (steps/s) and rejected, or nil if the read failed.
+ */
+int brick_device_stepper_status(lua_State *vm_state);
+
+/**
+ * @brief `dev:servo_status()` - reads where a servo module is driving its servo.
+ *
+ * @return Table with angle (degrees), busy and pulse_us, or nil if the read failed.
+ */
+int brick_device_servo_status(lua_State *vm_state);
+
+/**
+ * @brief `dev:module_status()` - how the module's command queue has kept up.
+ *
+ * @return Table with dropped (saturates at 255), queue_high_water and queue_slots, or nil
+ *         if the module did not answer or its firmware has no status record.
+ */
+int brick_device_module_status(lua_State *vm_state);
+
+/**
+ * @brief `dev:read_registers(reg, n)` - n bytes of the register file from reg (brick.REG_*) on.
+ *
+ * @return The bytes as a string (decode with string.unpack), or nil if the read failed or the
+ *         module has no register map.
+ */
+int brick_device_read_registers(lua_State *vm_state);
+
+/**
+ * @brief `dev:write_registers(reg, bytes)` - writes a string of bytes from reg on, in one transaction.
+ *
+ * @return true, or false if the write failed or the module has no register map.
+ */
+int brick_device_write_registers(lua_State *vm_state);
+
+/**
+ * @brief `future:done()` - true once the transfer has completed.
+ */
+int brick_future_done(lua_State *vm_state);
+
+/**
+ * @brief `future:wait([timeout_ms])` - blocks until the transfer completes.
+ *
+ * @return true, or false plus an error name if the transfer failed or timed out.
+ */
+int brick_future_wait(lua_State *vm_state);
+
+/**
+ * @brief Finalizer of `BrickFuture`: hands the completion handle back to the I²C engine.
+ */
+int brick_future_gc(lua_State *vm_state);
+
+// ---------------- Profiler ----------------
+
+/**
+ * @brief Clears the profiler histogram. Called automatically before each script run.
+ */
+void brick_lua_vm_profiler_reset();
+
+/**
+ * @brief Takes a consistent copy of the profiler histogram.
+ *
+ * Safe to call from any task while a script is running.
+ *
+ * @return Snapshot of the current samples.
+ */
+brick_lua_profile_t brick_lua_vm_profiler_snapshot();
+
 // ---------------- Lua VM Management ----------------
 
 /**
@@ -75,8 +292,9 @@ void brick_lua_vm_reset();
  * @brief Runs a string of Lua code in the current VM.
  *
  * @param code A null-terminated Lua script.
+ * @param metrics Optional output for the run's execution metrics.
  * @return Null on success, or a string describing the Lua error.
  */
-const char* brick_lua_vm_run(const char* code);
+const char* brick_lua_vm_run(const char* code, brick_lua_run_metrics_t *metrics = nullptr);
 
 #endif // BRICK_LUA_VM_HPP
@@ -0,0 +1,261 @@
+#include "brick_sensor_sampler.hpp"
+
+#include <esp_timer.h>
+
+#include <cstring>
+
+#include "brick_i2c_host.hpp"
+
+// Oldest protocol whose sensors measure on their own and serve the reading registers
+#define BRICK_SAMPLER_REGISTERS_MIN_PROTOCOL 5
+
+static_assert((BRICK_SAMPLER_HISTORY & (BRICK_SAMPLER_HISTORY - 1)) == 0,
+              "BRICK_SAMPLER_HISTORY must be a power of two");
+static_assert(sizeof(brick_sensor_reading_t) < BRICK_I2C_MAX_READ, "a reading and its CRC-8 take one read");
+
+// Samples of one sensor, oldest overwritten first
+struct brick_sampler_ring_t {
+    brick_device_handle_t device;
+    uint32_t period_ms;
+    int64_t next_due_us; /**< 0 = sample on the next tick */
+    uint32_t head; /**< Total samples written; head - 1 is the newest */
+    uint16_t module_samples; /**< brick_sensor_reading_t::samples of the newest sample */
+    brick_sensor_sample_t samples[BRICK_SAMPLER_HISTORY];
+};
+
+static portMUX_TYPE sampler_lock = portMUX_INITIALIZER_UNLOCKED;
+static brick_sampler_ring_t rings[BRICK_SAMPLER_MAX_SENSORS]; // device BRICK_INVALID_DEVICE_HANDLE = free
+static size_t ring_count = 0; // rings ever claimed; those past it were never used
+static uint8_t ring_of_device[BRICK_REGISTRY_CAPACITY]; // ring index + 1, 0 = not sampled
+static bool ring_refused[BRICK_REGISTRY_CAPACITY]; // logged as left without a ring
+
+// Returns the ring of a device, claiming a free one if needed. Caller holds sampler_lock.
+static brick_sampler_ring_t *brick_sampler_ring(brick_device_handle_t device, bool create) {
+    if (device >= BRICK_REGISTRY_CAPACITY) return nullptr;
+    if (ring_of_device[device] != 0) return &rings[ring_of_device[device] - 1];
+    if (!create) return nullptr;
+
+    size_t index = 0;
+    while (index < ring_count && rings[index].device != BRICK_INVALID_DEVICE_HANDLE) index++;
+    if (index == BRICK_SAMPLER_MAX_SENSORS) return nullptr;
+    if (index == ring_count) ring_count++;
+
+    brick_sampler_ring_t &ring = rings[index];
+    ring.device = device;
+    ring.period_ms = BRICK_SAMPLER_DEFAULT_PERIOD_MS;
+    ring.next_due_us = 0;
+    ring.head = 0;
+    ring.module_samples = 0;
+    ring_of_device[device] = static_cast<uint8_t>(index + 1);
+
+    return &ring;
+}
+
+static bool brick_sampler_is_sampled(const brick_device_t &device) {
+    return device.online && device.device_type == SENSOR_DISTANCE;
+}
+
+// Frees the rings of devices that went offline or are no longer sensors, for sensors seen
+// since to take. The registry is read outside sampler_lock; a ring claimed again meanwhile
+// stays with its new device.
+static void brick_sampler_reclaim() {
+    brick_device_handle_t owners[BRICK_SAMPLER_MAX_SENSORS];
+
+    portENTER_CRITICAL(&sampler_lock);
+    size_t count = ring_count;
+    for (size_t i = 0; i < count; ++i) owners[i] = rings[i].device;
+    portEXIT_CRITICAL(&sampler_lock);
+
+    for (size_t i = 0; i < count; ++i) {
+        brick_device_t device;
+        if (owners[i] == BRICK_INVALID_DEVICE_HANDLE) continue;
+        if (brick_registry_snapshot(owners[i], &device) && brick_sampler_is_sampled(device)) {
+            owners[i] = BRICK_INVALID_DEVICE_HANDLE; // still sampled, kept
+        }
+    }
+
+    portENTER_CRITICAL(&sampler_lock);
+    for (size_t i = 0; i < count; ++i) {
+        if (owners[i] == BRICK_INVALID_DEVICE_HANDLE || rings[i].device != owners[i]) continue;
+        ring_of_device[owners[i]] = 0;
+        rings[i].device = BRICK_INVALID_DEVICE_HANDLE;
+    }
+    portEXIT_CRITICAL(&sampler_lock);
+}
+
+// Claims a ring for device, reclaiming stale ones first if all are taken. Logs a sensor left
+// without one once, until it gets one.
+static bool brick_sampler_claim(brick_device_handle_t device) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (attempt > 0) brick_sampler_reclaim();
+
+        portENTER_CRITICAL(&sampler_lock);
+        bool claimed = brick_sampler_ring(device, true) != nullptr;
+        if (claimed) ring_refused[device] = false;
+        portEXIT_CRITICAL(&sampler_lock);
+        if (claimed) return true;
+    }
+
+    if (device >= BRICK_REGISTRY_CAPACITY) return false;
+
+    portENTER_CRITICAL(&sampler_lock);
+    bool first = !ring_refused[device];
+    ring_refused[device] = true;
+    portEXIT_CRITICAL(&sampler_lock);
+
+    if (first) {
+        ESP_LOGW("brick_sampler", "Sensor %u not sampled: all %d rings in use by online sensors", device,
+                 BRICK_SAMPLER_MAX_SENSORS);
+    }
+    return false;
+}
+
+static void brick_sampler_record(brick_device_handle_t device, uint16_t value, uint32_t timestamp_ms) {
+    portENTER_CRITICAL(&sampler_lock);
+    brick_sampler_ring_t *ring = brick_sampler_ring(device, false);
+    if (ring) {
+        ring->samples[ring->head & (BRICK_SAMPLER_HISTORY - 1)] = {timestamp_ms, value};
+        ring->head++;
+    }
+    portEXIT_CRITICAL(&sampler_lock);
+}
+
+// A reading of a module that measures on its own: kept only if it holds a measurement the
+// ring does not have yet, stamped with when the module took it
+static void brick_sampler_record_reading(brick_device_handle_t device, const brick_sensor_reading_t &reading,
+                                         int64_t now_us) {
+    if (!(reading.flags & BRICK_SENSOR_VALID)) return;
+
+    portENTER_CRITICAL(&sampler_lock);
+    brick_sampler_ring_t *ring = brick_sampler_ring(device, false);
+    bool fresh = ring && (ring->head == 0 || reading.samples != ring->module_samples);
+    if (fresh) ring->module_samples = reading.samples;
+    portEXIT_CRITICAL(&sampler_lock);
+
+    if (fresh) brick_sampler_record(device, reading.value[0], static_cast<uint32_t>(now_us / 1000) - reading.age_ms);
+}
+
+// Submits a read to every sensor that is due, then collects the results. All reads of a
+// tick are queued before the first wait so the engine serves them back to back. Sensors of
+// protocol 5 and later are read from their reading registers, which hold the module's latest
+// filtered measurement; older ones measure on CMD_SENSOR_GET_CM.
+static void brick_sampler_tick() {
+    struct pending_t {
+        brick_device_handle_t device;
+        brick_i2c_handle_t handle;
+        bool registers;
+    };
+    pending_t pending[BRICK_SAMPLER_MAX_SENSORS];
+    size_t pending_count = 0;
+
+    int64_t now_us = esp_timer_get_time();
+    brick_device_t device;
+
+    for (brick_device_handle_t handle = 0; brick_registry_snapshot(handle, &device); ++handle) {
+        if (!brick_sampler_is_sampled(device)) continue;
+
+        bool due = false;
+        if (!brick_sampler_claim(handle)) continue;
+        portENTER_CRITICAL(&sampler_lock);
+        brick_sampler_ring_t *ring = brick_sampler_ring(handle, false);
+        if (ring && now_us >= ring->next_due_us) {
+            // Keep the cadence, but do not try to catch up on periods missed while offline or busy
+            ring->next_due_us += ring->period_ms * 1000LL;
+            if (ring->next_due_us <= now_us) ring->next_due_us = now_us + ring->period_ms * 1000LL;
+            due = true;
+        }
+        portEXIT_CRITICAL(&sampler_lock);
+
+        if (!due || pending_count == BRICK_SAMPLER_MAX_SENSORS) continue;
+
+        bool registers = device.caps.protocol_version >= BRICK_SAMPLER_REGISTERS_MIN_PROTOCOL;
+        brick_i2c_request_t request;
+        if (registers) {
+            brick_i2c_build_read(&device, BRICK_REG_SENSOR_READING, sizeof(brick_sensor_reading_t), &request);
+        } else {
+            request = {};
+            request.address = device.i2c_address;
+            request.bus = device.i2c_bus;
+            request.priority = BRICK_I2C_PRIORITY_SENSOR;
+            request.write_len = 1;
+            request.read_len = BRICK_SENSOR_CM_READ_LEN;
+            request.write_buf[0] = CMD_SENSOR_GET_CM;
+        }
+
+        brick_i2c_handle_t submitted = brick_i2c_submit(&request);
+        if (submitted != BRICK_I2C_INVALID_HANDLE) pending[pending_count++] = {handle, submitted, registers};
+    }
+
+    for (size_t i = 0; i < pending_count; ++i) {
+        uint8_t reply[BRICK_I2C_MAX_READ];
+        esp_err_t ret = brick_i2c_wait(pending[i].handle, pdMS_TO_TICKS(BRICK_I2C_WAIT_TIMEOUT_MS), reply);
+        brick_i2c_release(pending[i].handle);
+        if (ret != ESP_OK) continue;
+
+        int64_t now_us = esp_timer_get_time();
+        if (pending[i].registers) {
+            brick_sensor_reading_t reading;
+            std::memcpy(&reading, reply, sizeof(reading));
+            brick_sampler_record_reading(pending[i].device, reading, now_us);
+        } else {
+            brick_sampler_record(pending[i].device, reply[0] | (reply[1] << 8), static_cast<uint32_t>(now_us / 1000));
+        }
+    }
+}
+
+static void brick_task_sensor_sampler(void *pvParams) {
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (true) {
+        brick_sampler_tick();
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(BRICK_SAMPLER_MIN_PERIOD_MS));
+    }
+}
+
+void brick_sampler_start() {
+    xTaskCreatePinnedToCore(
+        brick_task_sensor_sampler,
+        "sensor_sampler",
+        BRICK_SAMPLER_STACK_SIZE,
+        nullptr,
+        BRICK_SAMPLER_PRIORITY,
+        nullptr,
+        tskNO_AFFINITY
+    );
+}
+
+bool brick_sampler_latest(brick_device_handle_t device, brick_sensor_sample_t *out) {
+    return brick_sampler_history(device, out, 1) == 1;
+}
+
+size_t brick_sampler_history(brick_device_handle_t device, brick_sensor_sample_t *out, size_t max_count) {
+    size_t copied = 0;
+
+    portENTER_CRITICAL(&sampler_lock);
+    const brick_sampler_ring_t *ring = brick_sampler_ring(device, false);
+    if (ring) {
+        size_t available = ring->head < BRICK_SAMPLER_HISTORY ? ring->head : BRICK_SAMPLER_HISTORY;
+        for (; copied < max_count && copied < available; ++copied) {
+            out[copied] = ring->samples[(ring->head - 1 - copied) & (BRICK_SAMPLER_HISTORY - 1)];
+        }
+    }
+    portEXIT_CRITICAL(&sampler_lock);
+
+    return copied;
+}
+
+bool brick_sampler_set_period(brick_device_handle_t device, uint32_t period_ms) {
+    if (period_ms < BRICK_SAMPLER_MIN_PERIOD_MS) period_ms = BRICK_SAMPLER_MIN_PERIOD_MS;
+
+    if (!brick_sampler_claim(device)) return false;
+
+    portENTER_CRITICAL(&sampler_lock);
+    brick_sampler_ring_t *ring = brick_sampler_ring(device, false);
+    if (ring) {
+        ring->period_ms = period_ms;
+        ring->next_due_us = 0;
+    }
+    portEXIT_CRITICAL(&sampler_lock);
+
+    return ring != nullptr;
+}
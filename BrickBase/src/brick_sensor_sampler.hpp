@@ -0,0 +1,54 @@
+// brick_sensor_sampler.hpp
+#ifndef BRICK_SENSOR_SAMPLER_HPP
+#define BRICK_SENSOR_SAMPLER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "brick_device_registry.hpp"
+
+#define BRICK_SAMPLER_MAX_SENSORS        8    // sensors sampled at the same time
+#define BRICK_SAMPLER_HISTORY            32   // samples kept per sensor, power of two
+#define BRICK_SAMPLER_DEFAULT_PERIOD_MS  100  // sampling period until a script sets one
+#define BRICK_SAMPLER_MIN_PERIOD_MS      10   // also the sampler's own tick
+
+#define BRICK_SAMPLER_STACK_SIZE         4096
+#define BRICK_SAMPLER_PRIORITY           4    // below the scan (5), above Lua (3)
+
+/**
+ * @struct brick_sensor_sample_t
+ * @brief One reading taken by the sampler.
+ */
+struct brick_sensor_sample_t {
+    uint32_t timestamp_ms; /**< Time since boot of the measurement; of the read for sensors older than protocol 5 */
+    uint16_t value; /**< Reading in the sensor's unit (cm for distance sensors) */
+};
+
+/**
+ * @brief Starts the sampler task. Must be called after brick_i2c_init().
+ */
+void brick_sampler_start();
+
+/**
+ * @brief Copies the latest cached sample of a sensor. Never touches the bus.
+ * @return false if the device is not sampled or has no sample yet.
+ */
+bool brick_sampler_latest(brick_device_handle_t device, brick_sensor_sample_t *out);
+
+/**
+ * @brief Copies up to max_count recent samples, newest first. Never touches the bus.
+ * @return Number of samples copied.
+ */
+size_t brick_sampler_history(brick_device_handle_t device, brick_sensor_sample_t *out, size_t max_count);
+
+/**
+ * @brief Changes how often a sensor is polled. Sensors of protocol 5 and later measure on
+ *        their own period (brick_sensor_config_t); reads in between find no new measurement
+ *        and add no sample.
+ * @param period_ms Sampling period, clamped to at least BRICK_SAMPLER_MIN_PERIOD_MS.
+ * @return false if every ring is taken by a sensor that is online; rings of sensors gone
+ *         offline are reclaimed first.
+ */
+bool brick_sampler_set_period(brick_device_handle_t device, uint32_t period_ms);
+
+#endif // BRICK_SENSOR_SAMPLER_HPP
@@ -4,15 +4,22 @@
 #include <freertos/task.h>
 #include <freertos/queue.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs_flash.h>
 
+#include "brick_i2c_events.hpp"
+#include "brick_i2c_health.hpp"
 #include "brick_i2c_host.hpp"
+#include "brick_i2c_trace.hpp"
 #include "brick_lua_vm.hpp"
+#include "brick_sensor_sampler.hpp"
 
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
 
+#include <algorithm>
 #include <vector>
 
 #define GATTS_TAG "BLE_SERVER"
@@ -25,11 +32,24 @@
 #define CMD_DEVICE_LIST_REQUEST 0xFF
 #define CMD_DEVICE_LIST_RESPONSE 0x01
 #define CMD_RUN_LUA_SCRIPT 0x02
+#define CMD_PROFILE_REQUEST 0x04
+#define CMD_PROFILE_RESPONSE 0x05
+#define CMD_RUN_METRICS_RESPONSE 0x06
+#define CMD_BUS_HEALTH_REQUEST 0x07
+#define CMD_BUS_HEALTH_RESPONSE 0x08
+#define CMD_TRACE_REQUEST 0x09
+#define CMD_TRACE_RESPONSE 0x0A
 #define CMD_ERROR_RESPONSE 0xFE
 
 // Lua execution task configuration
 #define LUA_TASK_STACK_SIZE 8192
 #define LUA_TASK_PRIORITY 3
+#define RUN_METRICS_VERSION 1
+#define PROFILE_MAX_ENTRIES 60 // 14 + 60 x 8 bytes, under the 512 of a notification; the hottest lines go
+#define BUS_HEALTH_VERSION 2
+#define BUS_HEALTH_CHUNK_RECORDS 7 // 8 + 7 x 70 bytes, under the 512 of a notification; the host asks again for the rest
+#define TRACE_VERSION 1
+#define TRACE_CHUNK_ENTRIES 16 // entries per notification; the host asks again for the rest
 
 // Global BLE characteristics
 BLECharacteristic *pCharacteristicGet = nullptr;
@@ -85,28 +105,203 @@ void sendErrorResponse(const char *errorMessage) {
  * Send device list response
  */
 void sendDeviceList() {
-    std::lock_guard<std::mutex> lock(device_map_mutex);
-
     // Calculate response size: 18 bytes per device
-    size_t deviceCount = device_map.size();
+    size_t deviceCount = brick_registry_count();
     std::vector<uint8_t> deviceData;
     deviceData.reserve(deviceCount * 18);
 
-    for (const auto &[uuid, device]: device_map) {
+    for (brick_device_handle_t handle = 0; handle < deviceCount; ++handle) {
+        brick_device_t device;
+        brick_registry_snapshot(handle, &device);
+
         // Add 16-byte UUID
         deviceData.insert(deviceData.end(), device.uuid.bytes, device.uuid.bytes + 16);
 
         // Add I2C address
         deviceData.push_back(device.i2c_address);
 
-        // Add online status
-        deviceData.push_back(device.online ? 1 : 0);
+        // Add status: bit 0 = online, bits 1-3 = I2C bus
+        deviceData.push_back((device.online ? 1 : 0) | (device.i2c_bus << 1));
     }
 
     sendBleResponse(CMD_DEVICE_LIST_RESPONSE, deviceData);
     ESP_LOGI(GATTS_TAG, "Sent device list: %zu devices", deviceCount);
 }
 
+/**
+ * Append little-endian integers to a response buffer
+ */
+void appendU16(std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void appendU32(std::vector<uint8_t> &out, uint32_t value) {
+    appendU16(out, value & 0xFFFF);
+    appendU16(out, value >> 16);
+}
+
+/**
+ * Send profiler histogram of the current (or last) Lua script
+ */
+void sendProfile() {
+    brick_lua_profile_t profile = brick_lua_vm_profiler_snapshot();
+
+    // A full table does not fit one notification: keep the lines with the most samples
+    if (profile.entries.size() > PROFILE_MAX_ENTRIES) {
+        std::partial_sort(profile.entries.begin(), profile.entries.begin() + PROFILE_MAX_ENTRIES, profile.entries.end(),
+                          [](const brick_lua_profile_entry_t &a, const brick_lua_profile_entry_t &b) {
+                              return a.samples > b.samples;
+                          });
+        profile.entries.resize(PROFILE_MAX_ENTRIES);
+    }
+
+    // Header: interval, total samples, dropped samples (u32 each) + entry count (u16)
+    // Entry: line (u16), function line (u16), samples (u32)
+    std::vector<uint8_t> profileData;
+    profileData.reserve(14 + profile.entries.size() * 8);
+
+    appendU32(profileData, profile.interval);
+    appendU32(profileData, profile.total_samples);
+    appendU32(profileData, profile.dropped_samples);
+    appendU16(profileData, profile.entries.size());
+
+    for (const auto &entry: profile.entries) {
+        appendU16(profileData, entry.line);
+        appendU16(profileData, entry.function_line);
+        appendU32(profileData, entry.samples);
+    }
+
+    sendBleResponse(CMD_PROFILE_RESPONSE, profileData);
+    ESP_LOGI(GATTS_TAG, "Sent profile: %zu lines, %lu samples",
+             profile.entries.size(), static_cast<unsigned long>(profile.total_samples));
+}
+
+/**
+ * Send execution metrics of a finished Lua script
+ */
+void sendRunMetrics(const brick_lua_run_metrics_t &metrics) {
+    // Record: version (u8), status (u8), then little-endian u32 fields
+    std::vector<uint8_t> metricsData;
+    metricsData.reserve(2 + 10 * 4);
+
+    metricsData.push_back(RUN_METRICS_VERSION);
+    metricsData.push_back(metrics.status);
+    appendU32(metricsData, metrics.load_us);
+    appendU32(metricsData, metrics.exec_us);
+    appendU32(metricsData, metrics.gc_cycles);
+    appendU32(metricsData, metrics.gc_us);
+    appendU32(metricsData, metrics.peak_heap_bytes);
+    appendU32(metricsData, metrics.brick_calls);
+    appendU32(metricsData, metrics.i2c_transactions);
+    appendU32(metricsData, metrics.i2c_bytes);
+    appendU32(metricsData, metrics.i2c_errors);
+    appendU32(metricsData, metrics.stack_headroom_bytes);
+
+    sendBleResponse(CMD_RUN_METRICS_RESPONSE, metricsData);
+}
+
+/**
+ * Send bus health counters of the addresses that saw traffic, one chunk from the requested
+ * slot (bus x 128 + address) on
+ */
+void sendBusHealth(const std::vector<uint8_t> &request) {
+    uint16_t fromSlot = 0;
+    if (request.size() >= 2) {
+        fromSlot = request[0] | (request[1] << 8);
+    }
+
+    // Header: version (u8), bucket count (u8), first bucket bound in us (u16), record count (u16),
+    // next slot (u16, 0xFFFF once every address is sent)
+    // Record: address (u8), flags (u8, bit 0 = quarantined, bits 1-3 = bus), success, failure, timeout, retries,
+    // skipped, quarantines, quarantine ms left (u32 each), then bucket count x u32
+    std::vector<uint8_t> healthData;
+    healthData.reserve(8 + BUS_HEALTH_CHUNK_RECORDS * (30 + BRICK_I2C_HEALTH_BUCKETS * 4));
+
+    healthData.push_back(BUS_HEALTH_VERSION);
+    healthData.push_back(BRICK_I2C_HEALTH_BUCKETS);
+    appendU16(healthData, BRICK_I2C_HEALTH_BUCKET_MIN_US);
+    appendU16(healthData, 0); // record count, patched below
+    appendU16(healthData, 0); // next slot, patched below
+
+    uint16_t records = 0;
+    uint16_t slot = fromSlot;
+    for (; slot < BRICK_I2C_BUS_COUNT * 128 && records < BUS_HEALTH_CHUNK_RECORDS; ++slot) {
+        uint8_t bus = slot / 128;
+        uint8_t address = slot % 128;
+        brick_i2c_health_t health;
+        if (!brick_i2c_health_get(bus, address, &health)) continue;
+
+        healthData.push_back(address);
+        healthData.push_back((health.quarantine_ms_left > 0 ? 1 : 0) | (bus << 1));
+        appendU32(healthData, health.success);
+        appendU32(healthData, health.failure);
+        appendU32(healthData, health.timeout);
+        appendU32(healthData, health.retries);
+        appendU32(healthData, health.skipped);
+        appendU32(healthData, health.quarantines);
+        appendU32(healthData, health.quarantine_ms_left);
+        for (uint32_t count: health.latency_hist) appendU32(healthData, count);
+        records++;
+    }
+    healthData[4] = records & 0xFF;
+    healthData[5] = records >> 8;
+    uint16_t nextSlot = slot < BRICK_I2C_BUS_COUNT * 128 ? slot : 0xFFFF;
+    healthData[6] = nextSlot & 0xFF;
+    healthData[7] = nextSlot >> 8;
+
+    sendBleResponse(CMD_BUS_HEALTH_RESPONSE, healthData);
+    ESP_LOGI(GATTS_TAG, "Sent bus health: %u addresses from slot %u", records, fromSlot);
+}
+
+/**
+ * Send one chunk of the I2C trace ring, starting at the requested sequence number
+ */
+void sendTrace(const std::vector<uint8_t> &request) {
+    uint32_t fromSeq = 0;
+    if (request.size() >= 4) {
+        fromSeq = request[0] | (request[1] << 8) | (request[2] << 16) | (static_cast<uint32_t>(request[3]) << 24);
+    }
+
+    brick_i2c_trace_entry_t entries[TRACE_CHUNK_ENTRIES];
+    uint32_t firstSeq;
+    size_t count = brick_i2c_trace_read(fromSeq, entries, TRACE_CHUNK_ENTRIES, &firstSeq);
+
+    // Header: version (u8), entry size (u8), now us (u32), next seq (u32), first seq (u32),
+    // task count (u8) + task names (u8 length + chars), entry count (u8)
+    // Entry: start us (u32), duration us (u32), address, command, write len, read len,
+    // result, flags, task, bus (u8 each)
+    std::vector<uint8_t> traceData;
+    traceData.reserve(16 + BRICK_I2C_TRACE_MAX_TASKS * BRICK_I2C_TRACE_TASK_NAME + count * sizeof(brick_i2c_trace_entry_t));
+
+    traceData.push_back(TRACE_VERSION);
+    traceData.push_back(sizeof(brick_i2c_trace_entry_t));
+    appendU32(traceData, static_cast<uint32_t>(esp_timer_get_time()));
+    appendU32(traceData, brick_i2c_trace_next_seq());
+    appendU32(traceData, firstSeq);
+
+    uint8_t taskCount = 0;
+    while (taskCount < BRICK_I2C_TRACE_MAX_TASKS && brick_i2c_trace_task_name(taskCount)) taskCount++;
+    traceData.push_back(taskCount);
+    for (uint8_t task = 0; task < taskCount; ++task) {
+        const char *name = brick_i2c_trace_task_name(task);
+        size_t len = strlen(name);
+        traceData.push_back(len);
+        traceData.insert(traceData.end(), name, name + len);
+    }
+
+    traceData.push_back(count);
+    for (size_t i = 0; i < count; ++i) {
+        const brick_i2c_trace_entry_t &entry = entries[i];
+        appendU32(traceData, entry.start_us);
+        appendU32(traceData, entry.duration_us);
+        traceData.insert(traceData.end(), {entry.address, entry.command, entry.write_len, entry.read_len,
+                                           entry.result, entry.flags, entry.task, entry.bus});
+    }
+
+    sendBleResponse(CMD_TRACE_RESPONSE, traceData);
+}
+
 /**
  * Simple Lua execution task - just runs the script and exits
  */
@@ -117,7 +312,9 @@ void luaExecutionTask(void *parameter) {
              currentLuaScript.size() > 101 ? "..." : "");
 
     // Execute Lua code safely
-    const char *error = brick_lua_vm_run(currentLuaScript.data());
+    brick_lua_run_metrics_t metrics = {};
+    const char *error = brick_lua_vm_run(currentLuaScript.data(), &metrics);
+    metrics.stack_headroom_bytes = uxTaskGetStackHighWaterMark(nullptr);
 
     if (error) {
         ESP_LOGE(LUA_TAG, "Lua execution error: %s", error);
@@ -126,6 +323,15 @@ void luaExecutionTask(void *parameter) {
         ESP_LOGI(LUA_TAG, "Lua script executed successfully");
     }
 
+    ESP_LOGI(LUA_TAG, "Run metrics: load %lu us, exec %lu us, GC %lu cycles / %lu us, peak heap %lu B, "
+             "%lu brick calls, I2C %lu tx / %lu B / %lu errors, stack headroom %lu B",
+             (unsigned long) metrics.load_us, (unsigned long) metrics.exec_us,
+             (unsigned long) metrics.gc_cycles, (unsigned long) metrics.gc_us,
+             (unsigned long) metrics.peak_heap_bytes, (unsigned long) metrics.brick_calls,
+             (unsigned long) metrics.i2c_transactions, (unsigned long) metrics.i2c_bytes,
+             (unsigned long) metrics.i2c_errors, (unsigned long) metrics.stack_headroom_bytes);
+    sendRunMetrics(metrics);
+
     ESP_LOGI(LUA_TAG, "Lua execution task finished");
 
     // Task self-destructs
@@ -154,6 +360,10 @@ void executeLuaScript(const std::vector<uint8_t> &data) {
     if (luaTaskHandle != nullptr) {
         ESP_LOGW(LUA_TAG, "Killing existing Lua task for new script");
         vTaskDelete(luaTaskHandle);
+
+        // Transfers it left in flight still complete, but nobody will wait for them
+        brick_i2c_release_task(luaTaskHandle);
+        brick_events_release_task(luaTaskHandle);
         luaTaskHandle = nullptr;
 
         // Small delay to ensure task cleanup
@@ -204,6 +414,20 @@ void processCommand(const BlePacket &packet) {
             executeLuaScript(packet.data); // Kill old task and start new one
             break;
 
+        case CMD_PROFILE_REQUEST:
+            ESP_LOGI(GATTS_TAG, "Profile requested");
+            sendProfile();
+            break;
+
+        case CMD_BUS_HEALTH_REQUEST:
+            ESP_LOGI(GATTS_TAG, "Bus health requested");
+            sendBusHealth(packet.data);
+            break;
+
+        case CMD_TRACE_REQUEST:
+            sendTrace(packet.data);
+            break;
+
         default:
             ESP_LOGW(GATTS_TAG, "Unknown command: 0x%02X", packet.command);
             sendErrorResponse("Unknown command");
@@ -296,30 +520,56 @@ extern "C" void app_main() {
     brick_lua_vm_init();
     ESP_LOGI("MAIN", "Lua VM initialized");
 
-    // Start I2C scanning task
-    xTaskCreatePinnedToCore(
-        brick_task_i2c_scan_devices,
-        "scan_devices",
-        4096,
-        nullptr,
-        5,
-        nullptr,
-        tskNO_AFFINITY
-    );
-    ESP_LOGI("MAIN", "I2C scanner started");
+    // NVS holds the I2C address book
+    esp_err_t nvs_res = nvs_flash_init();
+    if (nvs_res == ESP_ERR_NVS_NO_FREE_PAGES || nvs_res == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        nvs_res = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(nvs_res);
+
+    // Initialize I2C driver and transaction engine
+    brick_i2c_init();
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        ESP_LOGI("MAIN", "I\302\262C bus %u initialized on SDA=GPIO%d, SCL=GPIO%d", bus,
+                 brick_i2c_buses[bus].sda, brick_i2c_buses[bus].scl);
+    }
+
+    // Start polling sensors in the background so scripts read cached values
+    brick_sampler_start();
+
+    // Collect module events when an attention line falls, instead of polling for them
+    brick_events_start();
+
+    // Start one I2C scanning task per bus
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "scan_devices%u", bus);
+
+        xTaskCreatePinnedToCore(
+            brick_task_i2c_scan_devices,
+            name,
+            4096,
+            reinterpret_cast<void *>(static_cast<uintptr_t>(bus)),
+            5,
+            nullptr,
+            tskNO_AFFINITY
+        );
+    }
+    ESP_LOGI("MAIN", "I2C scanners started");
 
     /*while (1) {
         brick_device_t *device = brick_i2c_get_device_uuid("424c2002-0000-0000-9374-675a4712a023");
 
         if (device) {
             brick_uuid_t uuid = device->uuid; // or device->uuid, depending on implementation
-            if (device_map.contains(uuid)) {
+            if (brick_registry_find_uuid(&uuid) != BRICK_INVALID_DEVICE_HANDLE) {
                 brick_command_t command = {
                     .command = CMD_STEPPER_MOVE,
                     .device = device
                 };
 
-                command.device->impl.stepper_motor.motor = 0b00001111;
+                command.device->impl.stepper_motor.move = {.mode = 0, .steps = 200, .max_speed = 400, .accel = 800};
 
                 brick_i2c_send_device_command(&command);
                 printf("Move\n");
@@ -334,12 +584,77 @@ extern "C" void app_main() {
     ESP_LOGI("MAIN", "BrickLab system ready");
 
     // Main loop - system monitoring
+    brick_i2c_engine_stats_t lastI2cStats = brick_i2c_engine_get_stats();
+
     while (true) {
         vTaskDelay(pdMS_TO_TICKS(10000));
 
         // Log system status
         const char *luaStatus = luaTaskHandle ? "RUNNING" : "IDLE";
         ESP_LOGI("MAIN", "System running - %zu devices, Lua: %s",
-                 device_map.size(), luaStatus);
+                 brick_registry_count(), luaStatus);
+
+        // Log I2C bus utilisation and per-priority latency over the last interval
+        brick_i2c_engine_stats_t i2cStats = brick_i2c_engine_get_stats();
+        uint64_t elapsedUs = i2cStats.uptime_us - lastI2cStats.uptime_us;
+        uint64_t busyUs = i2cStats.busy_us - lastI2cStats.busy_us;
+        ESP_LOGI("MAIN", "I2C bus %llu%% busy, %lu batches / %lu requests batched, %lu rejected",
+                 (unsigned long long) (elapsedUs ? busyUs * 100 / elapsedUs : 0),
+                 (unsigned long) (i2cStats.batches - lastI2cStats.batches),
+                 (unsigned long) (i2cStats.batched_requests - lastI2cStats.batched_requests),
+                 (unsigned long) (i2cStats.rejected - lastI2cStats.rejected));
+
+        // Command links are built in static buffers; anything but 0.00 heap allocs/tx is a regression
+        uint32_t transactions = i2cStats.transactions - lastI2cStats.transactions;
+        uint32_t heapAllocs = i2cStats.link_heap_allocs - lastI2cStats.link_heap_allocs;
+        ESP_LOGI("MAIN", "I2C links: %lu tx, %lu heap allocs (%lu.%02lu per tx)",
+                 (unsigned long) transactions, (unsigned long) heapAllocs,
+                 (unsigned long) (transactions ? heapAllocs / transactions : 0),
+                 (unsigned long) (transactions ? heapAllocs * 100 / transactions % 100 : 0));
+
+        // Effective rate: 9 clocks per byte (8 bits + ACK) over the time the bus was busy,
+        // against the clock negotiated with the bus's modules
+        for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+            uint64_t busBytes = i2cStats.bus_bytes[bus] - lastI2cStats.bus_bytes[bus];
+            uint64_t busBusyUs = i2cStats.bus_busy_us[bus] - lastI2cStats.bus_busy_us[bus];
+            if (busBytes == 0 || busBusyUs == 0) continue;
+
+            ESP_LOGI("MAIN", "I2C bus %u at %lu kHz: %llu B/s, %llu kbit/s effective while busy, %lu clock switches",
+                     bus, (unsigned long) (i2cStats.bus_clock_hz[bus] / 1000),
+                     (unsigned long long) (elapsedUs ? busBytes * 1000000 / elapsedUs : 0),
+                     (unsigned long long) (busBytes * 9 * 1000 / busBusyUs),
+                     (unsigned long) (i2cStats.bus_clock_switches[bus] - lastI2cStats.bus_clock_switches[bus]));
+        }
+
+        static const char *priorityNames[BRICK_I2C_PRIORITY_COUNT] = {"actuation", "sensor", "discovery"};
+        for (int prio = 0; prio < BRICK_I2C_PRIORITY_COUNT; ++prio) {
+            const brick_i2c_priority_stats_t &now = i2cStats.priority[prio];
+            const brick_i2c_priority_stats_t &before = lastI2cStats.priority[prio];
+            uint32_t count = (now.completed + now.failed) - (before.completed + before.failed);
+            if (count == 0) continue;
+
+            ESP_LOGI("MAIN", "I2C %s: %lu tx, %lu failed, bus %llu us/s, avg %llu us, max %lu us since boot",
+                     priorityNames[prio], (unsigned long) count,
+                     (unsigned long) (now.failed - before.failed),
+                     (unsigned long long) (elapsedUs ? (now.busy_us - before.busy_us) * 1000000 / elapsedUs : 0),
+                     (unsigned long long) ((now.latency_us_total - before.latency_us_total) / count),
+                     (unsigned long) now.latency_us_max);
+        }
+
+        lastI2cStats = i2cStats;
+
+        brick_i2c_discovery_stats_t discovery = brick_i2c_get_discovery_stats();
+        ESP_LOGI("MAIN", "Discovery: %lu probes, %lu heartbeat checks, full sweep every %lu ms",
+                 (unsigned long) discovery.probes, (unsigned long) discovery.verifications,
+                 (unsigned long) (discovery.last_sweep_us / 1000));
+
+        brick_i2c_coalesce_stats_t coalesce = brick_i2c_get_coalesce_stats();
+        ESP_LOGI("MAIN", "Actuator writes saved: %lu identical, %lu merged",
+                 (unsigned long) coalesce.suppressed, (unsigned long) coalesce.merged);
+
+        brick_events_stats_t events = brick_events_get_stats();
+        ESP_LOGI("MAIN", "Module events: %lu taken in %lu reads over %lu passes, %lu attention interrupts",
+                 (unsigned long) events.events, (unsigned long) events.reads,
+                 (unsigned long) events.passes, (unsigned long) events.interrupts);
     }
 }
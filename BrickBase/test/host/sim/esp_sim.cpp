@@ -0,0 +1,120 @@
+// ESP-IDF services BrickBase uses besides FreeRTOS and I2C: the timer, logging, error names
+// and NVS (in memory, gone with the process).
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs_flash.h>
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static const auto process_start = std::chrono::steady_clock::now();
+
+static std::mutex &nvs_lock() {
+    static auto *lock = new std::mutex;
+    return *lock;
+}
+
+static std::map<std::string, std::vector<uint8_t>> &nvs_store() {
+    static auto *store = new std::map<std::string, std::vector<uint8_t>>;
+    return *store;
+}
+
+extern "C" {
+
+int64_t esp_timer_get_time(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - process_start).count();
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        default: return "ERROR";
+    }
+}
+
+// SIM_LOG_LEVEL: 0 = nothing, 1 = errors, 2 = warnings, 3 = info (default), 4 = everything
+void sim_log(char level, const char *tag, const char *format, ...) {
+    static const int threshold = [] {
+        const char *env = std::getenv("SIM_LOG_LEVEL");
+        return env ? std::atoi(env) : 3;
+    }();
+    const char *levels = "EWIDV";
+    const char *at = std::strchr(levels, level);
+    if (!at || at - levels >= threshold) return;
+
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    std::fprintf(stderr, "%c (%lld) %s: %s\n", level, static_cast<long long>(esp_timer_get_time() / 1000), tag, line);
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    std::lock_guard<std::mutex> held(nvs_lock());
+    nvs_store().clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *, nvs_open_mode_t, nvs_handle_t *handle) {
+    *handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t, const char *key, void *out, size_t *length) {
+    std::lock_guard<std::mutex> held(nvs_lock());
+    auto it = nvs_store().find(key);
+    if (it == nvs_store().end()) return ESP_ERR_NVS_NOT_FOUND;
+
+    if (out) {
+        if (*length < it->second.size()) return ESP_ERR_INVALID_SIZE;
+        std::memcpy(out, it->second.data(), it->second.size());
+    }
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t, const char *key, const void *value, size_t length) {
+    std::lock_guard<std::mutex> held(nvs_lock());
+    const auto *bytes = static_cast<const uint8_t *>(value);
+    nvs_store()[key].assign(bytes, bytes + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t, const char *key) {
+    std::lock_guard<std::mutex> held(nvs_lock());
+    return nvs_store().erase(key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {
+}
+
+} // extern "C"
@@ -0,0 +1,269 @@
+// FreeRTOS on POSIX threads, for running BrickBase code on a PC. Covers what the firmware
+// uses and nothing more: tasks never end (the process exits under them), priorities and
+// core affinity are ignored, and all critical sections share one lock. Objects are never
+// freed, so a task still running at exit never touches a destroyed one.
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <esp_timer.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct sim_task {
+    std::string name;
+    std::mutex lock;
+    std::condition_variable wake;
+    uint32_t count = 0; // xTaskNotifyGive / ulTaskNotifyTake
+    uint32_t value = 0; // xTaskNotify / xTaskNotifyWait
+    bool value_pending = false;
+};
+
+struct sim_queue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t item_size;
+    size_t length;
+};
+
+static std::recursive_mutex &critical_lock() {
+    static auto *lock = new std::recursive_mutex;
+    return *lock;
+}
+
+static thread_local sim_task *current_task = nullptr;
+
+// Waits on cv until ready() holds or the ticks run out; portMAX_DELAY waits forever
+template<typename Ready>
+static bool wait_ticks(std::condition_variable &cv, std::unique_lock<std::mutex> &held, TickType_t ticks, Ready ready) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(held, ready);
+        return true;
+    }
+    return cv.wait_for(held, std::chrono::milliseconds(ticks), ready);
+}
+
+extern "C" {
+
+void sim_enter_critical(void) {
+    critical_lock().lock();
+}
+
+void sim_exit_critical(void) {
+    critical_lock().unlock();
+}
+
+//====================================================================================
+// Tasks
+//====================================================================================
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t, void *params, UBaseType_t,
+                                   TaskHandle_t *created, BaseType_t) {
+    auto *task = new sim_task;
+    task->name = name ? name : "";
+    if (created) *created = task;
+
+    std::thread([task, code, params] {
+        current_task = task;
+        code(params);
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *params, UBaseType_t priority,
+                       TaskHandle_t *created) {
+    return xTaskCreatePinnedToCore(code, name, stack_depth, params, priority, created, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t) {
+    // Threads cannot be killed from outside; no host test deletes a task
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (!current_task) {
+        current_task = new sim_task;
+        current_task->name = "main";
+    }
+    return current_task;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    if (!task) task = xTaskGetCurrentTaskHandle();
+    return const_cast<char *>(task->name.c_str());
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+    return 0;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return static_cast<TickType_t>(esp_timer_get_time() / 1000);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period) {
+    *previous_wake += period;
+    TickType_t now = xTaskGetTickCount();
+    if (static_cast<int32_t>(*previous_wake - now) > 0) vTaskDelay(*previous_wake - now);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> held(task->lock);
+    task->count++;
+    task->wake.notify_all();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    xTaskNotifyGive(task);
+    if (woken) *woken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t timeout) {
+    sim_task *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> held(task->lock);
+
+    wait_ticks(task->wake, held, timeout, [task] { return task->count > 0; });
+    uint32_t count = task->count;
+    if (clear_on_exit) task->count = 0;
+    else if (count > 0) task->count--;
+    return count;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    std::lock_guard<std::mutex> held(task->lock);
+    switch (action) {
+        case eSetBits: task->value |= value; break;
+        case eIncrement: task->value++; break;
+        case eNoAction: break;
+        default: task->value = value; break;
+    }
+    task->value_pending = true;
+    task->wake.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *woken) {
+    if (woken) *woken = pdTRUE;
+    return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t timeout) {
+    sim_task *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> held(task->lock);
+
+    if (!task->value_pending) task->value &= ~clear_on_entry;
+    bool got = wait_ticks(task->wake, held, timeout, [task] { return task->value_pending; });
+    if (value) *value = task->value;
+    if (got) {
+        task->value &= ~clear_on_exit;
+        task->value_pending = false;
+    }
+    return got ? pdTRUE : pdFALSE;
+}
+
+//====================================================================================
+// Queues and semaphores
+//====================================================================================
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    auto *queue = new sim_queue;
+    queue->item_size = item_size;
+    queue->length = length;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t) {
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t timeout, bool front) {
+    std::unique_lock<std::mutex> held(queue->lock);
+    if (!wait_ticks(queue->changed, held, timeout, [queue] { return queue->items.size() < queue->length; })) {
+        return pdFALSE;
+    }
+
+    const auto *bytes = static_cast<const uint8_t *>(item);
+    std::vector<uint8_t> copy(bytes, bytes + (item ? queue->item_size : 0));
+    if (front) queue->items.push_front(std::move(copy));
+    else queue->items.push_back(std::move(copy));
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout) {
+    return queue_send(queue, item, timeout, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t timeout) {
+    return queue_send(queue, item, timeout, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t timeout) {
+    return queue_send(queue, item, timeout, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t queue, void *item, TickType_t timeout, bool remove) {
+    std::unique_lock<std::mutex> held(queue->lock);
+    if (!wait_ticks(queue->changed, held, timeout, [queue] { return !queue->items.empty(); })) return pdFALSE;
+
+    if (item && queue->item_size) std::memcpy(item, queue->items.front().data(), queue->item_size);
+    if (remove) {
+        queue->items.pop_front();
+        queue->changed.notify_all();
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout) {
+    return queue_receive(queue, item, timeout, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t timeout) {
+    return queue_receive(queue, item, timeout, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> held(queue->lock);
+    return static_cast<UBaseType_t>(queue->items.size());
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t semaphore = xSemaphoreCreateBinary();
+    xSemaphoreGive(semaphore);
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+    return xQueueReceive(semaphore, nullptr, timeout);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return xQueueSend(semaphore, nullptr, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken) {
+    if (woken) *woken = pdTRUE;
+    return xSemaphoreGive(semaphore);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t) {
+}
+
+} // extern "C"
@@ -0,0 +1,438 @@
+#include "i2c_sim.hpp"
+
+#include <driver/i2c.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#define REG_OFFSET(reg) (static_cast<uint8_t>((reg) - BRICK_REG_BASE))
+
+// Module state and the bus statistics; a transaction holds it while it runs through its bytes
+static std::mutex &sim_lock() {
+    static auto *lock = new std::mutex;
+    return *lock;
+}
+
+static std::vector<sim_module *> &sim_modules() {
+    static auto *modules = new std::vector<sim_module *>;
+    return *modules;
+}
+
+static sim_i2c_stats_t sim_stats[I2C_NUM_MAX];
+
+//====================================================================================
+// Modules
+//====================================================================================
+
+sim_module::sim_module(uint8_t bus, uint8_t address, brick_device_type_t type, uint8_t serial, uint8_t protocol,
+                       uint16_t max_clock_khz)
+    : bus_(bus), address_(address) {
+    uint8_t *uuid = registers_.uuid.bytes;
+    uuid[0] = 'B';
+    uuid[1] = 'L';
+    uuid[2] = static_cast<uint16_t>(type) >> 8;
+    uuid[3] = static_cast<uint16_t>(type) & 0xFF;
+    uuid[4] = 0x51; // 'Q', simulated
+    uuid[15] = serial;
+
+    registers_.caps.protocol_version = protocol;
+    registers_.caps.max_clock_khz = max_clock_khz;
+    registers_.caps.max_write = 20;
+    registers_.caps.max_read = sizeof(brick_register_file_t);
+    registers_.status.queue_slots = 4;
+    registers_.events = protocol >= 4 ? BRICK_EVENT_RESET : 0;
+    registers_.event_mask = BRICK_EVENT_ALL;
+}
+
+void sim_module::attach() {
+    std::lock_guard<std::mutex> held(sim_lock());
+    sim_modules().push_back(this);
+}
+
+std::vector<std::vector<uint8_t>> sim_module::applied() const {
+    std::lock_guard<std::mutex> held(sim_lock());
+    return applied_;
+}
+
+void sim_module::clear_applied() {
+    std::lock_guard<std::mutex> held(sim_lock());
+    applied_.clear();
+}
+
+void sim_module::fail_next(unsigned transfers) {
+    std::lock_guard<std::mutex> held(sim_lock());
+    failing_ = transfers;
+}
+
+void sim_module::fail_after(uint8_t command, unsigned transfers) {
+    std::lock_guard<std::mutex> held(sim_lock());
+    fail_after_command_ = command;
+    fail_after_transfers_ = transfers;
+}
+
+void sim_module::raise_event(uint8_t events) {
+    std::lock_guard<std::mutex> held(sim_lock());
+    registers_.events |= events;
+}
+
+brick_register_file_t sim_module::registers() const {
+    std::lock_guard<std::mutex> held(sim_lock());
+    return registers_;
+}
+
+void sim_module::set_registers(uint8_t reg, const void *data, size_t len) {
+    std::lock_guard<std::mutex> held(sim_lock());
+    auto *file = reinterpret_cast<uint8_t *>(&registers_);
+    size_t offset = REG_OFFSET(reg);
+    std::memcpy(file + offset, data, std::min(len, sizeof(registers_) - offset));
+}
+
+uint8_t sim_module::duplicates() const {
+    std::lock_guard<std::mutex> held(sim_lock());
+    return registers_.status.duplicates;
+}
+
+// Register a one-byte write selects for the read after it
+static uint8_t read_register(uint8_t cmd, uint8_t protocol) {
+    if (cmd >= BRICK_REG_BASE) return cmd;
+
+    switch (cmd) {
+        case CMD_GET_CAPS: return protocol > 0 ? BRICK_REG_CAPS : BRICK_REG_UUID; // older firmware: the UUID
+        case CMD_GET_STATUS: return BRICK_REG_STATUS;
+        case CMD_STEPPER_STATUS: return BRICK_REG_STEPPER_STATUS;
+        case CMD_SENSOR_GET_CM: return BRICK_REG_SENSOR_VALUE;
+        default: return BRICK_REG_UUID;
+    }
+}
+
+void sim_module::on_address(bool read, bool general_call) {
+    if (read) prepare_read();
+    rx_.clear();
+    rx_general_call_ = general_call;
+}
+
+void sim_module::on_rx(uint8_t data) {
+    rx_.push_back(data);
+}
+
+uint8_t sim_module::on_tx() {
+    return tx_pos_ < tx_.size() ? tx_[tx_pos_++] : 0xFF;
+}
+
+void sim_module::on_stop() {
+    if (rx_.empty()) return;
+    registers_.counters.frames++;
+
+    if (rx_general_call_) {
+        if (rx_[0] == CMD_BUS_CLOCK) return;
+        if (rx_.size() >= 2 && (rx_[1] & registers_.group_mask)) {
+            if (rx_[0] == CMD_LATCH && !staged_.empty()) {
+                std::vector<uint8_t> staged;
+                staged.swap(staged_);
+                apply(staged.data(), staged.size());
+            } else if (rx_[0] == CMD_GROUP_WRITE && rx_.size() >= 3) {
+                apply(&rx_[2], rx_.size() - 2);
+            }
+        }
+    } else if (rx_[0] == CMD_CHECKED) {
+        take_checked_frame(); // nobody reads the status
+    } else if (rx_[0] != CMD_CHECKED_READ && rx_[0] != CMD_ENUM_RESET && rx_[0] != CMD_ENUM_ASSIGN) {
+        apply(rx_.data(), rx_.size());
+    }
+    rx_.clear();
+}
+
+void sim_module::prepare_read() {
+    const auto *file = reinterpret_cast<const uint8_t *>(&registers_);
+    uint8_t crc = brick_crc8_byte(0, static_cast<uint8_t>((address_ << 1) | 1));
+    size_t offset = REG_OFFSET(rx_.size() == 1 ? read_register(rx_[0], registers_.caps.protocol_version) : BRICK_REG_UUID);
+
+    registers_.counters.reads++;
+    tx_.clear();
+    tx_pos_ = 0;
+
+    if (!rx_.empty() && rx_[0] == CMD_CHECKED) {
+        registers_.counters.frames++;
+        uint8_t status = take_checked_frame();
+        tx_ = {status, brick_crc8_byte(crc, status)};
+        return;
+    }
+
+    if (!rx_.empty() && rx_[0] == CMD_CHECKED_READ) {
+        if (rx_.size() != 4 || brick_crc8(brick_crc8_byte(0, address_ << 1), rx_.data(), rx_.size()) != 0) {
+            registers_.counters.crc_errors++;
+            tx_ = {static_cast<uint8_t>(~crc)};
+            return;
+        }
+        offset = REG_OFFSET(read_register(rx_[1], registers_.caps.protocol_version));
+        for (uint8_t i = 0; i < rx_[2]; ++i) tx_.push_back(offset + i < sizeof(registers_) ? file[offset + i] : 0xFF);
+        tx_.push_back(brick_crc8(crc, tx_.data(), tx_.size()));
+        return;
+    }
+
+    tx_.assign(file + offset, file + sizeof(registers_));
+}
+
+bool sim_module::seq_taken(uint8_t seq) const {
+    uint8_t age = static_cast<uint8_t>(seq_newest_ - seq);
+    if (seq_window_ == 0 || static_cast<int8_t>(age) < 0) return false;
+    return age >= BRICK_FRAME_SEQ_WINDOW || (seq_window_ & (1u << age));
+}
+
+void sim_module::seq_take(uint8_t seq) {
+    uint8_t ahead = static_cast<uint8_t>(seq - seq_newest_);
+    if (seq_window_ != 0 && static_cast<int8_t>(ahead) <= 0) {
+        seq_window_ |= 1u << static_cast<uint8_t>(-ahead);
+        return;
+    }
+    seq_window_ = (seq_window_ == 0 || ahead >= BRICK_FRAME_SEQ_WINDOW) ? 1 : static_cast<uint16_t>((seq_window_ << ahead) | 1);
+    seq_newest_ = seq;
+}
+
+uint8_t sim_module::take_checked_frame() {
+    if (rx_.size() < BRICK_FRAME_CHECK_LEN || brick_crc8(brick_crc8_byte(0, address_ << 1), rx_.data(), rx_.size()) != 0) {
+        registers_.counters.crc_errors++;
+        return 0;
+    }
+
+    uint8_t seq = rx_[1];
+    if (rx_.size() == BRICK_FRAME_CHECK_LEN) {
+        seq_newest_ = seq;
+        seq_window_ = 0xFFFF;
+        return BRICK_FRAME_ACCEPTED;
+    }
+    if (seq_taken(seq)) {
+        if (registers_.status.duplicates < 0xFF) registers_.status.duplicates++;
+        return BRICK_FRAME_ACCEPTED | BRICK_FRAME_DUPLICATE;
+    }
+
+    seq_take(seq);
+    apply(&rx_[2], rx_.size() - BRICK_FRAME_CHECK_LEN);
+    return BRICK_FRAME_ACCEPTED;
+}
+
+void sim_module::write_registers(const uint8_t *frame, size_t len) {
+    auto *file = reinterpret_cast<uint8_t *>(&registers_);
+    size_t offset = REG_OFFSET(frame[0]);
+
+    for (size_t i = 1; i < len && offset < sizeof(registers_); ++i, ++offset) {
+        if (offset == REG_OFFSET(BRICK_REG_EVENTS)) file[offset] &= static_cast<uint8_t>(~frame[i]);
+        else if (offset == REG_OFFSET(BRICK_REG_GROUP_MASK) || offset == REG_OFFSET(BRICK_REG_EVENT_MASK) ||
+                 offset >= REG_OFFSET(BRICK_REG_DEVICE)) file[offset] = frame[i];
+    }
+}
+
+void sim_module::apply(const uint8_t *frame, size_t len) {
+    if (len == 0) return;
+
+    if (frame[0] >= BRICK_REG_BASE) {
+        write_registers(frame, len);
+    } else if (frame[0] == CMD_GROUP_ASSIGN && len == 2) {
+        registers_.group_mask = frame[1];
+    } else if (frame[0] == CMD_STAGE && len >= 2) {
+        staged_.assign(frame + 1, frame + len);
+        return;
+    }
+    applied_.emplace_back(frame, frame + len);
+
+    if (frame[0] == fail_after_command_) {
+        failing_ = fail_after_transfers_;
+        fail_after_command_ = -1;
+    }
+}
+
+//====================================================================================
+// Driver
+//====================================================================================
+
+namespace {
+
+struct link_op_t {
+    enum kind_t : uint8_t { START, WRITE, READ, STOP } kind;
+    std::vector<uint8_t> data; // WRITE
+    uint8_t *out; // READ
+    size_t len; // READ
+};
+
+struct link_t {
+    std::vector<link_op_t> ops;
+    size_t capacity; // link commands that fit, 0 = unbounded (heap link)
+};
+
+esp_err_t add_op(i2c_cmd_handle_t cmd, link_op_t op) {
+    auto *link = static_cast<link_t *>(cmd);
+    if (link->capacity && link->ops.size() >= link->capacity) return ESP_ERR_NO_MEM;
+    link->ops.push_back(std::move(op));
+    return ESP_OK;
+}
+
+} // namespace
+
+struct sim_bus {
+    // Runs a link against the modules of a port. Returns the result and the bits it clocked.
+    static esp_err_t run(i2c_port_t port, const link_t &link, uint64_t *bits) {
+        std::vector<sim_module *> addressed; // everyone who sees the stop
+        std::vector<sim_module *> targets; // addressed by the current segment
+        bool expect_address = false;
+        bool reading = false;
+        esp_err_t result = ESP_OK;
+
+        for (const auto &op: link.ops) {
+            if (op.kind == link_op_t::START) {
+                *bits += 1;
+                expect_address = true;
+                continue;
+            }
+
+            if (op.kind == link_op_t::STOP) {
+                *bits += 1;
+                break;
+            }
+
+            if (op.kind == link_op_t::READ) {
+                for (size_t i = 0; i < op.len; ++i) {
+                    uint8_t value = 0xFF; // wired AND
+                    for (auto *module: targets) value &= module->on_tx();
+                    op.out[i] = value;
+                    *bits += 9;
+                }
+                continue;
+            }
+
+            for (uint8_t byte: op.data) {
+                *bits += 9;
+                if (!expect_address) {
+                    if (!reading) {
+                        for (auto *module: targets) module->on_rx(byte);
+                    }
+                    continue;
+                }
+
+                expect_address = false;
+                uint8_t address = byte >> 1;
+                reading = byte & 1;
+                bool general_call = address == BRICK_I2C_GENERAL_CALL_ADDRESS && !reading;
+
+                targets.clear();
+                bool nack = false;
+                for (auto *module: sim_modules()) {
+                    if (module->bus_ != port || (!general_call && module->address_ != address)) continue;
+                    if (module->failing_ > 0) {
+                        module->failing_--;
+                        nack = true;
+                        continue;
+                    }
+                    targets.push_back(module);
+                }
+                if (targets.empty() || (nack && !general_call)) {
+                    result = ESP_FAIL;
+                    break;
+                }
+
+                for (auto *module: targets) {
+                    module->on_address(reading, general_call);
+                    if (std::find(addressed.begin(), addressed.end(), module) == addressed.end()) {
+                        addressed.push_back(module);
+                    }
+                }
+            }
+            if (result != ESP_OK) break;
+        }
+
+        for (auto *module: addressed) module->on_stop();
+        return result;
+    }
+};
+
+extern "C" {
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *config) {
+    if (port >= I2C_NUM_MAX || !config) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> held(sim_lock());
+    sim_stats[port].clock_hz = config->master.clk_speed;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t, size_t, size_t, int) {
+    return port < I2C_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+    return new link_t{{}, 0};
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create_static(uint8_t *buffer, uint32_t size) {
+    if (!buffer || size < sizeof(link_t) || size < I2C_LINK_RECOMMENDED_SIZE(0)) return nullptr;
+    return new (buffer) link_t{{}, size / I2C_INTERNAL_STRUCT_SIZE - 2};
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd) {
+    delete static_cast<link_t *>(cmd);
+}
+
+void i2c_cmd_link_delete_static(i2c_cmd_handle_t cmd) {
+    static_cast<link_t *>(cmd)->~link_t();
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd) {
+    return add_op(cmd, {link_op_t::START, {}, nullptr, 0});
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool) {
+    return add_op(cmd, {link_op_t::WRITE, {data}, nullptr, 0});
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd, const uint8_t *data, size_t data_len, bool) {
+    return add_op(cmd, {link_op_t::WRITE, std::vector<uint8_t>(data, data + data_len), nullptr, 0});
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd, uint8_t *data, size_t data_len, i2c_ack_type_t) {
+    return add_op(cmd, {link_op_t::READ, {}, data, data_len});
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd) {
+    return add_op(cmd, {link_op_t::STOP, {}, nullptr, 0});
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t) {
+    if (port >= I2C_NUM_MAX || !cmd) return ESP_ERR_INVALID_ARG;
+
+    int64_t start_us = esp_timer_get_time();
+    uint64_t bits = 0;
+    esp_err_t result;
+    uint32_t clock_hz;
+    {
+        std::lock_guard<std::mutex> held(sim_lock());
+        result = sim_bus::run(port, *static_cast<link_t *>(cmd), &bits);
+        clock_hz = sim_stats[port].clock_hz ? sim_stats[port].clock_hz : 100000;
+    }
+
+    // Hold the caller for as long as the bits take on the wire; sleep most of it, spin the rest
+    int64_t end_us = start_us + static_cast<int64_t>(bits * 1000000ULL / clock_hz);
+    if (end_us - esp_timer_get_time() > 200) {
+        std::this_thread::sleep_for(std::chrono::microseconds(end_us - esp_timer_get_time() - 150));
+    }
+    while (esp_timer_get_time() < end_us) {
+    }
+
+    std::lock_guard<std::mutex> held(sim_lock());
+    sim_i2c_stats_t &stats = sim_stats[port];
+    stats.transactions++;
+    if (result != ESP_OK) stats.nacks++;
+    stats.bytes += bits / 9;
+    stats.busy_us += esp_timer_get_time() - start_us;
+    return result;
+}
+
+} // extern "C"
+
+sim_i2c_stats_t sim_i2c_get_stats(uint8_t port) {
+    std::lock_guard<std::mutex> held(sim_lock());
+    return port < I2C_NUM_MAX ? sim_stats[port] : sim_i2c_stats_t{};
+}
@@ -0,0 +1,99 @@
+// i2c_sim.hpp
+#ifndef I2C_SIM_HPP
+#define I2C_SIM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "brick_i2c_api.h"
+
+/*
+ * Simulated I2C buses behind the driver API of driver/i2c.h. A transaction takes the bus time
+ * its bits need at the port's clock, so the engine's timing figures mean what they do on the
+ * chip. Modules follow BrickPicModule.X/brick_i2c_slave.c byte by byte where the host can
+ * tell: a write opens a new frame on every address match and is applied at the stop, a
+ * checked frame is taken at the repeated start of its status read, the general call reaches
+ * every module. They apply commands at once instead of from a main loop.
+ */
+
+class sim_module {
+public:
+    /**
+     * @brief A module already at its final address, e.g. one enumeration assigned in an earlier run.
+     * @param serial Makes the UUID unique among modules of one type.
+     */
+    sim_module(uint8_t bus, uint8_t address, brick_device_type_t type, uint8_t serial,
+               uint8_t protocol = BRICK_PROTOCOL_VERSION, uint16_t max_clock_khz = 400);
+
+    /** Puts the module on its bus; from then on it answers. */
+    void attach();
+
+    uint8_t bus() const { return bus_; }
+    uint8_t address() const { return address_; }
+    const brick_uuid_t &uuid() const { return registers_.uuid; }
+
+    /** Commands applied so far, command byte first, checked frames unwrapped. */
+    std::vector<std::vector<uint8_t>> applied() const;
+    void clear_applied();
+
+    /** Leaves the next transfers addressed to this module unacknowledged. */
+    void fail_next(unsigned transfers);
+
+    /** Leaves the transfers after the next one that applies command (e.g. at a latch) unacknowledged. */
+    void fail_after(uint8_t command, unsigned transfers);
+
+    /** Sets bits in the events register, as the firmware's brick_slave_raise_event(). */
+    void raise_event(uint8_t events);
+
+    /** Copies the register file out / writes into it, read-only registers included. */
+    brick_register_file_t registers() const;
+    void set_registers(uint8_t reg, const void *data, size_t len);
+
+    /** Checked frames dropped as repeats. */
+    uint8_t duplicates() const;
+
+private:
+    friend struct sim_bus;
+
+    void on_address(bool read, bool general_call);
+    void on_rx(uint8_t data);
+    uint8_t on_tx();
+    void on_stop();
+
+    void prepare_read();
+    uint8_t take_checked_frame();
+    bool seq_taken(uint8_t seq) const;
+    void seq_take(uint8_t seq);
+    void apply(const uint8_t *frame, size_t len);
+    void write_registers(const uint8_t *frame, size_t len);
+
+    uint8_t bus_;
+    uint8_t address_;
+    brick_register_file_t registers_ = {};
+    unsigned failing_ = 0;
+    int fail_after_command_ = -1;
+    unsigned fail_after_transfers_ = 0;
+
+    std::vector<uint8_t> rx_;
+    bool rx_general_call_ = false;
+    std::vector<uint8_t> tx_;
+    size_t tx_pos_ = 0;
+
+    uint8_t seq_newest_ = 0;
+    uint16_t seq_window_ = 0;
+    std::vector<uint8_t> staged_;
+    std::vector<std::vector<uint8_t>> applied_;
+};
+
+struct sim_i2c_stats_t {
+    uint32_t transactions; /**< Transactions started, NACKed ones included */
+    uint32_t nacks; /**< Transactions ended by an unacknowledged address */
+    uint64_t bytes; /**< Bytes clocked, address bytes included */
+    uint64_t busy_us; /**< Bus time of all transactions */
+    uint32_t clock_hz; /**< Current SCL clock */
+};
+
+sim_i2c_stats_t sim_i2c_get_stats(uint8_t port);
+
+#endif // I2C_SIM_HPP
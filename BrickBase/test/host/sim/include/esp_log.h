@@ -0,0 +1,21 @@
+// Host build: log lines go to stderr; SIM_LOG_LEVEL=0 silences them
+#ifndef SIM_ESP_LOG_H
+#define SIM_ESP_LOG_H
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void sim_log(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+#ifdef __cplusplus
+}
+#endif
+
+#define ESP_LOGE(tag, format, ...) sim_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) sim_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) sim_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) sim_log('D', tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) sim_log('V', tag, format, ##__VA_ARGS__)
+
+#endif // SIM_ESP_LOG_H
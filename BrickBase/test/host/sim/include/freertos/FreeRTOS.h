@@ -0,0 +1,46 @@
+// Host build: the parts of the FreeRTOS API BrickBase uses, on POSIX threads (see freertos_sim.cpp)
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+// One tick per millisecond, as configured for the firmware
+#define configTICK_RATE_HZ       1000
+#define configMAX_TASK_NAME_LEN  16
+#define portTICK_PERIOD_MS       1
+#define portMAX_DELAY            0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms)        ((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks)     ((uint32_t)(ticks))
+#define pdTRUE                   1
+#define pdFALSE                  0
+#define pdPASS                   pdTRUE
+#define pdFAIL                   pdFALSE
+#define tskNO_AFFINITY           0x7FFFFFFF
+
+// Critical sections all share one recursive lock; the ISR flavours are the same on a host
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void sim_enter_critical(void);
+void sim_exit_critical(void);
+#ifdef __cplusplus
+}
+#endif
+
+#define portENTER_CRITICAL(mux)     ((void)(mux), sim_enter_critical())
+#define portEXIT_CRITICAL(mux)      ((void)(mux), sim_exit_critical())
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)  portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(woken)   ((void)(woken))
+
+#endif // SIM_FREERTOS_H
@@ -0,0 +1,16 @@
+// Host build: see nvs.h
+#ifndef SIM_NVS_FLASH_H
+#define SIM_NVS_FLASH_H
+
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_NVS_FLASH_H
@@ -0,0 +1,158 @@
+/**
+ * Write coalescing on an examples/led_cycle.lua-style workload
+ *
+ * One RGB module cycles through the six colours of led_cycle.lua, 3000 calls per scenario:
+ *   repeat  sync calls, every colour sent 10 times in a row: all but the first of each
+ *           run repeat the state the module acknowledged and are suppressed
+ *   burst   async calls, 10 steps towards every colour back to back, then a wait for all
+ *           of them: queued steps are superseded by the next, the last one wins
+ * Each scenario prints the calls made, the writes that reached the module, what the host
+ * dropped, and bus transactions per second against calls per second.
+ *
+ * Last, a write the module does not acknowledge waits out its retry backoff while a newer
+ * one goes out: the retry must not follow and undo it.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+#include <esp_timer.h>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_health.hpp"
+#include "brick_i2c_host.hpp"
+#include "i2c_sim.hpp"
+#include "test_support.hpp"
+
+#define CYCLE_CALLS   3000
+#define CYCLE_REPEATS 10 // frames per colour
+
+static const brick_device_led_rgb_impl_t colours[] = {
+    {255, 255, 255, 0}, {255, 255, 0, 0}, {0, 255, 0, 0}, {0, 0, 255, 0}, {255, 0, 255, 0}, {0, 0, 0, 0},
+};
+#define COLOUR_COUNT (sizeof(colours) / sizeof(colours[0]))
+
+struct scenario_result_t {
+    uint32_t calls;
+    uint32_t writes; // reached the module
+    uint32_t suppressed;
+    uint32_t merged;
+    int64_t elapsed_us;
+    uint32_t transactions; // bus 0, all traffic
+};
+
+static scenario_result_t scenario_begin(sim_module &module) {
+    module.clear_applied();
+
+    scenario_result_t begin = {};
+    brick_i2c_coalesce_stats_t coalesce = brick_i2c_get_coalesce_stats();
+    begin.suppressed = coalesce.suppressed;
+    begin.merged = coalesce.merged;
+    begin.elapsed_us = esp_timer_get_time();
+    begin.transactions = sim_i2c_get_stats(0).transactions;
+    return begin;
+}
+
+static scenario_result_t scenario_end(sim_module &module, const scenario_result_t &begin, uint32_t calls) {
+    scenario_result_t result = {};
+    brick_i2c_coalesce_stats_t coalesce = brick_i2c_get_coalesce_stats();
+    result.calls = calls;
+    result.writes = static_cast<uint32_t>(module.applied().size());
+    result.suppressed = coalesce.suppressed - begin.suppressed;
+    result.merged = coalesce.merged - begin.merged;
+    result.elapsed_us = esp_timer_get_time() - begin.elapsed_us;
+    result.transactions = sim_i2c_get_stats(0).transactions - begin.transactions;
+    return result;
+}
+
+static void print_scenario(const char *name, const scenario_result_t &result) {
+    double seconds = result.elapsed_us / 1e6;
+    std::printf("%-7s %6" PRIu32 " %7" PRIu32 " %10" PRIu32 " %7" PRIu32 " %9.0f %9.0f\n", name, result.calls,
+                result.writes, result.suppressed, result.merged, result.calls / seconds, result.transactions / seconds);
+}
+
+static bool applied_colour_is(sim_module &module, const brick_device_led_rgb_impl_t &colour) {
+    auto applied = module.applied();
+    if (applied.empty()) return false;
+
+    const auto &last = applied.back();
+    return last.size() == 4 && last[0] == CMD_LED_RGB && last[1] == colour.red && last[2] == colour.blue &&
+           last[3] == colour.green;
+}
+
+int main() {
+    sim_module module(0, 0x10, LED_RGB, 1);
+    module.attach();
+
+    brick_i2c_init();
+    for (int pass = 0; pass < 100 && brick_registry_count() == 0; ++pass) brick_i2c_scan_devices(0);
+    CHECK(brick_registry_count() == 1);
+
+    brick_device_t device;
+    brick_registry_snapshot(0, &device);
+    brick_command_t command = {CMD_LED_RGB, &device};
+
+    std::printf("        calls  writes suppressed  merged   calls/s  bus-tx/s\n");
+
+    // Every colour CYCLE_REPEATS times, blocking
+    scenario_result_t begin = scenario_begin(module);
+    bool ok = true;
+    for (uint32_t call = 0; call < CYCLE_CALLS; ++call) {
+        device.impl.led_rgb = colours[(call / CYCLE_REPEATS) % COLOUR_COUNT];
+        ok &= brick_i2c_send_device_command(&command);
+    }
+    scenario_result_t repeat = scenario_end(module, begin, CYCLE_CALLS);
+    print_scenario("repeat", repeat);
+
+    CHECK(ok);
+    CHECK(repeat.writes == CYCLE_CALLS / CYCLE_REPEATS);
+    CHECK(repeat.suppressed == CYCLE_CALLS - repeat.writes);
+    CHECK(applied_colour_is(module, device.impl.led_rgb));
+
+    // CYCLE_REPEATS steps towards every colour without waiting, then wait for the burst
+    begin = scenario_begin(module);
+    bool last_wins = true;
+    for (uint32_t call = 0; call < CYCLE_CALLS; call += CYCLE_REPEATS) {
+        const brick_device_led_rgb_impl_t &target = colours[(call / CYCLE_REPEATS) % COLOUR_COUNT];
+        brick_i2c_handle_t handles[CYCLE_REPEATS];
+
+        for (int step = 0; step < CYCLE_REPEATS; ++step) {
+            device.impl.led_rgb.red = target.red * (step + 1) / CYCLE_REPEATS;
+            device.impl.led_rgb.blue = target.blue * (step + 1) / CYCLE_REPEATS;
+            device.impl.led_rgb.green = target.green * (step + 1) / CYCLE_REPEATS;
+            handles[step] = brick_i2c_send_device_command_async(&command);
+        }
+        for (auto handle: handles) {
+            ok &= handle != BRICK_I2C_INVALID_HANDLE && brick_i2c_wait(handle, portMAX_DELAY) == ESP_OK;
+            brick_i2c_release(handle);
+        }
+        last_wins &= applied_colour_is(module, target);
+    }
+    scenario_result_t burst = scenario_end(module, begin, CYCLE_CALLS);
+    print_scenario("burst", burst);
+
+    CHECK(ok);
+    CHECK(last_wins);
+    CHECK(burst.writes + burst.merged + burst.suppressed == CYCLE_CALLS);
+    CHECK(burst.writes < CYCLE_CALLS / 2);
+
+    // A NACKed write parks for a retry; the newer write sent meanwhile supersedes it
+    module.clear_applied();
+    uint32_t merged_before = brick_i2c_get_coalesce_stats().merged;
+    module.fail_next(1);
+    device.impl.led_rgb = colours[0];
+    brick_i2c_handle_t parked = brick_i2c_send_device_command_async(&command);
+    vTaskDelay(pdMS_TO_TICKS(BRICK_I2C_RETRY_BACKOFF_MS / 2)); // NACKed, not yet retried
+    device.impl.led_rgb = colours[1];
+    CHECK(brick_i2c_send_device_command(&command));
+    CHECK(brick_i2c_wait(parked, portMAX_DELAY) == ESP_OK);
+    brick_i2c_release(parked);
+    vTaskDelay(pdMS_TO_TICKS(4 * BRICK_I2C_RETRY_BACKOFF_MS)); // past every backoff
+
+    CHECK(module.applied().size() == 1);
+    CHECK(applied_colour_is(module, colours[1]));
+    CHECK(brick_i2c_get_coalesce_stats().merged == merged_before + 1);
+
+    test_finish();
+}
@@ -0,0 +1,171 @@
+/**
+ * Bus utilisation and command latency of device traffic while discovery runs
+ *
+ * Six RGB modules sit on two simulated buses. The test sends each module of bus 0 a new
+ * colour every BENCH_PERIOD_MS, first with discovery stopped, then with the scan tasks
+ * running as main.cpp starts them. Each phase reads brick_i2c_engine_get_stats() before and
+ * after and prints the actuation queue's submit-to-completion latency, the time a blocking
+ * command takes, and how much of the bus time device and discovery traffic take. The
+ * simulated bus holds each transaction for the time its bits need at the negotiated clock,
+ * so the figures are bus figures; scheduling jitter of the PC comes on top of the maxima.
+ *
+ * The checks hold every colour to arrive, in order, and discovery to cost actuation no more
+ * than a few probes of latency.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <esp_timer.h>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_host.hpp"
+#include "i2c_sim.hpp"
+#include "test_support.hpp"
+
+#define BENCH_MODULES_BUS0 4
+#define BENCH_MODULES_BUS1 2
+#define BENCH_PERIOD_MS    2    // one colour to every module of bus 0 per period
+#define BENCH_PHASE_MS     3000
+
+// Worst actuation latency allowed with the scan running, over the quiet figure. A command
+// may wait for the probe on the bus and the switch back to the device clock, not a slice.
+#define BENCH_SCAN_LATENCY_MAX_US 600
+
+struct phase_result_t {
+    uint32_t commands;
+    uint32_t failed;
+    double latency_avg_us; // engine: submit to completion
+    int64_t call_p99_us; // writer: brick_i2c_send_device_command() from call to return
+    int64_t call_max_us;
+    double device_load; // share of bus 0 time spent on actuation
+    double discovery_load; // share of a bus's time spent on discovery, averaged over the buses
+    double bus0_load; // share of bus 0 time spent on any traffic
+    uint32_t clock_switches;
+    uint32_t probes;
+};
+
+static brick_i2c_engine_stats_t stats_delta(const brick_i2c_engine_stats_t &after, const brick_i2c_engine_stats_t &before) {
+    brick_i2c_engine_stats_t delta = after;
+    for (int p = 0; p < BRICK_I2C_PRIORITY_COUNT; ++p) {
+        delta.priority[p].completed -= before.priority[p].completed;
+        delta.priority[p].failed -= before.priority[p].failed;
+        delta.priority[p].bytes -= before.priority[p].bytes;
+        delta.priority[p].latency_us_total -= before.priority[p].latency_us_total;
+        delta.priority[p].busy_us -= before.priority[p].busy_us;
+    }
+    for (int bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        delta.bus_busy_us[bus] -= before.bus_busy_us[bus];
+        delta.bus_clock_switches[bus] -= before.bus_clock_switches[bus];
+    }
+    delta.uptime_us -= before.uptime_us;
+    return delta;
+}
+
+// Sends BENCH_PHASE_MS of colours to the modules of bus 0; each colour differs from the last
+static phase_result_t run_phase(std::vector<brick_device_t> &devices, uint8_t *next_level) {
+    brick_i2c_engine_stats_t before = brick_i2c_engine_get_stats();
+    uint32_t probes_before = brick_i2c_get_discovery_stats().probes;
+    uint32_t failed = 0;
+    std::vector<int64_t> call_us;
+
+    TickType_t last_wake = xTaskGetTickCount();
+    for (int round = 0; round < BENCH_PHASE_MS / BENCH_PERIOD_MS; ++round) {
+        for (auto &device: devices) {
+            if (device.i2c_bus != 0) continue;
+            device.impl.led_rgb.red = ++*next_level;
+            brick_command_t command = {CMD_LED_RGB, &device};
+            int64_t start_us = esp_timer_get_time();
+            if (!brick_i2c_send_device_command(&command)) failed++;
+            call_us.push_back(esp_timer_get_time() - start_us);
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(BENCH_PERIOD_MS));
+    }
+
+    brick_i2c_engine_stats_t delta = stats_delta(brick_i2c_engine_get_stats(), before);
+    const brick_i2c_priority_stats_t &actuation = delta.priority[BRICK_I2C_PRIORITY_ACTUATION];
+    const brick_i2c_priority_stats_t &discovery = delta.priority[BRICK_I2C_PRIORITY_DISCOVERY];
+
+    phase_result_t result = {};
+    result.commands = actuation.completed + actuation.failed;
+    result.failed = failed + actuation.failed;
+    result.latency_avg_us = result.commands ? static_cast<double>(actuation.latency_us_total) / result.commands : 0;
+    std::sort(call_us.begin(), call_us.end());
+    result.call_p99_us = call_us[call_us.size() * 99 / 100];
+    result.call_max_us = call_us.back();
+    result.device_load = static_cast<double>(actuation.busy_us) / delta.uptime_us;
+    result.discovery_load = static_cast<double>(discovery.busy_us) / delta.uptime_us / BRICK_I2C_BUS_COUNT;
+    result.bus0_load = static_cast<double>(delta.bus_busy_us[0]) / delta.uptime_us;
+    result.clock_switches = delta.bus_clock_switches[0];
+    result.probes = brick_i2c_get_discovery_stats().probes - probes_before;
+    return result;
+}
+
+static void print_phase(const char *name, const phase_result_t &result) {
+    std::printf("%-9s %8" PRIu32 " %6" PRIu32 " %7.0f %7" PRId64 " %7" PRId64 " %6.1f%% %9.1f%% %5.1f%% %8" PRIu32
+                " %6" PRIu32 "\n",
+                name, result.commands, result.failed, result.latency_avg_us, result.call_p99_us, result.call_max_us,
+                100 * result.device_load, 100 * result.discovery_load, 100 * result.bus0_load, result.clock_switches,
+                result.probes);
+}
+
+int main() {
+    std::vector<sim_module *> modules;
+    for (uint8_t i = 0; i < BENCH_MODULES_BUS0 + BENCH_MODULES_BUS1; ++i) {
+        uint8_t bus = i < BENCH_MODULES_BUS0 ? 0 : 1;
+        auto *module = new sim_module(bus, 0x10 + i, LED_RGB, i);
+        module->attach();
+        modules.push_back(module);
+    }
+
+    brick_i2c_init();
+
+    // Discovery by hand until every module is known, so the quiet phase has no scan at all
+    for (int pass = 0; pass < 400 && brick_registry_count() < modules.size(); ++pass) {
+        for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) brick_i2c_scan_devices(bus);
+    }
+    CHECK(brick_registry_count() == modules.size());
+
+    std::vector<brick_device_t> devices(brick_registry_count());
+    for (size_t i = 0; i < devices.size(); ++i) brick_registry_snapshot(static_cast<brick_device_handle_t>(i), &devices[i]);
+    for (auto *module: modules) module->clear_applied();
+
+    uint8_t level = 0;
+    std::printf("phase     commands failed avg-us  p99-us  max-us  device discovery  bus0 switches probes\n");
+
+    phase_result_t quiet = run_phase(devices, &level);
+    print_phase("quiet", quiet);
+
+    for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) {
+        xTaskCreatePinnedToCore(brick_task_i2c_scan_devices, "scan_devices", 4096,
+                                reinterpret_cast<void *>(static_cast<uintptr_t>(bus)), 5, nullptr, 0);
+    }
+    phase_result_t scanning = run_phase(devices, &level);
+    print_phase("scanning", scanning);
+
+    CHECK(quiet.failed == 0 && scanning.failed == 0);
+    CHECK(quiet.probes == 0 && scanning.probes > 0);
+    CHECK(scanning.discovery_load > 0);
+    CHECK(scanning.latency_avg_us < quiet.latency_avg_us + BENCH_SCAN_LATENCY_MAX_US);
+
+    // Every colour arrived, in order: the module's last is the one sent last
+    const uint32_t rounds = 2 * (BENCH_PHASE_MS / BENCH_PERIOD_MS);
+    for (auto *module: modules) {
+        auto applied = module->applied();
+        if (module->bus() != 0) {
+            CHECK(applied.empty());
+            continue;
+        }
+        CHECK(applied.size() == rounds);
+        bool ordered = true;
+        for (size_t i = 1; i < applied.size(); ++i) {
+            ordered &= applied[i][0] == CMD_LED_RGB && static_cast<uint8_t>(applied[i][1] - applied[i - 1][1]) == BENCH_MODULES_BUS0;
+        }
+        CHECK(ordered);
+    }
+
+    test_finish();
+}
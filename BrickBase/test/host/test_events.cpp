@@ -0,0 +1,170 @@
+/**
+ * Module events without a bus: brick_events_service_bus(), brick_events_take() and
+ * brick_events_wait() against a fake register file per module
+ *
+ * The fake stands in for brick_events_transport_t. It can raise an event between the read
+ * of a module's events register and the write that clears it, which is the race the
+ * clear-only-what-was-read rule is for: that event must stay pending on the module, keep
+ * its line low, and be taken on the next pass.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_events.hpp"
+#include "test_support.hpp"
+
+struct fake_module_t {
+    uint8_t bus;
+    uint8_t address;
+    uint8_t protocol;
+    uint8_t events; // the events register
+    uint8_t raise_after_read; // raised once, right after the next read
+    bool fail_reads;
+    unsigned reads;
+    unsigned clears;
+    unsigned forgotten;
+};
+
+static fake_module_t fakes[] = {
+    {0, 0x10, 4, 0, 0, false, 0, 0, 0},
+    {0, 0x11, 3, 0, 0, false, 0, 0, 0}, // no events register
+    {1, 0x10, 5, 0, 0, false, 0, 0, 0},
+};
+static brick_device_handle_t handles[sizeof(fakes) / sizeof(fakes[0])];
+
+static fake_module_t *fake_of(const brick_device_t *device) {
+    for (auto &fake: fakes) {
+        if (fake.bus == device->i2c_bus && fake.address == device->i2c_address) return &fake;
+    }
+    return nullptr;
+}
+
+static bool fake_read_registers(const brick_device_t *device, uint8_t reg, void *out, size_t len) {
+    fake_module_t *fake = fake_of(device);
+    if (!fake || fake->fail_reads || reg != BRICK_REG_EVENTS || len != 1) return false;
+
+    fake->reads++;
+    *static_cast<uint8_t *>(out) = fake->events;
+    fake->events |= fake->raise_after_read;
+    fake->raise_after_read = 0;
+    return true;
+}
+
+static bool fake_write_registers(const brick_device_t *device, uint8_t reg, const void *data, size_t len) {
+    fake_module_t *fake = fake_of(device);
+    if (!fake || reg != BRICK_REG_EVENTS || len != 1) return false;
+
+    fake->clears++;
+    fake->events &= static_cast<uint8_t>(~*static_cast<const uint8_t *>(data)); // writing a 1 clears the bit
+    return true;
+}
+
+static void fake_forget_device_state(const brick_device_t *device) {
+    fake_module_t *fake = fake_of(device);
+    if (fake) fake->forgotten++;
+}
+
+static const brick_events_transport_t fake_transport = {
+    fake_read_registers,
+    fake_write_registers,
+    fake_forget_device_state,
+};
+
+static void register_fakes() {
+    for (size_t i = 0; i < sizeof(fakes) / sizeof(fakes[0]); ++i) {
+        brick_device_t device = {};
+        device.uuid.raw.prefix[0] = 'B';
+        device.uuid.raw.prefix[1] = 'L';
+        device.uuid.raw.unique_id[7] = static_cast<uint8_t>(i + 1);
+        device.device_type = MOTOR_STEPPER;
+        device.i2c_bus = fakes[i].bus;
+        device.i2c_address = fakes[i].address;
+        device.online = 1;
+        device.caps.protocol_version = fakes[i].protocol;
+        handles[i] = brick_registry_insert(&device);
+    }
+}
+
+struct wait_args_t {
+    brick_device_handle_t device;
+    volatile uint8_t taken;
+    volatile bool done;
+};
+
+static void wait_task(void *arg) {
+    auto *args = static_cast<wait_args_t *>(arg);
+    args->taken = brick_events_wait(args->device, BRICK_EVENT_MOVE_DONE, pdMS_TO_TICKS(2000));
+    args->done = true;
+    vTaskDelete(nullptr);
+}
+
+int main() {
+    brick_events_set_transport(&fake_transport);
+    register_fakes();
+    fake_module_t &a = fakes[0], &old = fakes[1], &c = fakes[2];
+
+    // Nothing pending: one read per module that has the register, nothing cleared
+    CHECK(brick_events_service_bus(0) == 0);
+    CHECK(a.reads == 1 && a.clears == 0 && old.reads == 0);
+    CHECK(c.reads == 0); // other bus
+
+    // A reset is cleared on the module, forgets the host's state for it and is kept for take()
+    a.events = BRICK_EVENT_RESET;
+    CHECK(brick_events_service_bus(0) == 1);
+    CHECK(a.events == 0 && a.clears == 1 && a.forgotten == 1);
+    CHECK(brick_events_take(handles[0], BRICK_EVENT_MOVE_DONE) == 0); // masked out, still kept
+    CHECK(brick_events_take(handles[0], BRICK_EVENT_ALL) == BRICK_EVENT_RESET);
+    CHECK(brick_events_take(handles[0], BRICK_EVENT_ALL) == 0);
+
+    // An event raised between the read and the clear stays on the module for the next pass
+    a.events = BRICK_EVENT_MOVE_DONE;
+    a.raise_after_read = BRICK_EVENT_RESET;
+    CHECK(brick_events_service_bus(0) == 1);
+    CHECK(a.events == BRICK_EVENT_RESET);
+    CHECK(a.forgotten == 1);
+    CHECK(brick_events_take(handles[0], BRICK_EVENT_ALL) == BRICK_EVENT_MOVE_DONE);
+    CHECK(brick_events_service_bus(0) == 1);
+    CHECK(a.events == 0 && a.forgotten == 2);
+    CHECK(brick_events_take(handles[0], BRICK_EVENT_ALL) == BRICK_EVENT_RESET);
+
+    // Events pile up until taken
+    a.events = BRICK_EVENT_MOVE_DONE;
+    brick_events_service_bus(0);
+    a.events = BRICK_EVENT_RESET;
+    brick_events_service_bus(0);
+    CHECK(brick_events_take(handles[0], BRICK_EVENT_ALL) == (BRICK_EVENT_MOVE_DONE | BRICK_EVENT_RESET));
+
+    // A failed read leaves the register alone and counts no read
+    brick_events_stats_t before = brick_events_get_stats();
+    a.events = BRICK_EVENT_MOVE_DONE;
+    a.fail_reads = true;
+    CHECK(brick_events_service_bus(0) == 0);
+    CHECK(a.events == BRICK_EVENT_MOVE_DONE);
+    CHECK(brick_events_get_stats().reads == before.reads);
+    a.fail_reads = false;
+    CHECK(brick_events_service_bus(0) == 1);
+    CHECK(brick_events_get_stats().reads == before.reads + 1);
+    CHECK(brick_events_get_stats().passes == before.passes + 2);
+    brick_events_take(handles[0], BRICK_EVENT_ALL);
+
+    // A waiting task wakes on a pass over the other bus, and only for the events it asked for
+    wait_args_t args = {handles[2], 0, false};
+    xTaskCreate(wait_task, "wait_events", 4096, &args, 3, nullptr);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    c.events = BRICK_EVENT_RESET;
+    brick_events_service_bus(1);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    CHECK(!args.done);
+    c.events = BRICK_EVENT_MOVE_DONE;
+    brick_events_service_bus(1);
+    for (int i = 0; i < 100 && !args.done; ++i) vTaskDelay(pdMS_TO_TICKS(10));
+    CHECK(args.done && args.taken == BRICK_EVENT_MOVE_DONE);
+    CHECK(brick_events_take(handles[2], BRICK_EVENT_ALL) == BRICK_EVENT_RESET);
+
+    // A wait with nothing coming times out
+    CHECK(brick_events_wait(handles[2], BRICK_EVENT_ALL, pdMS_TO_TICKS(30)) == 0);
+
+    test_finish();
+}
@@ -0,0 +1,76 @@
+/**
+ * brick_i2c_move_together() on two stepper modules, one per bus
+ *
+ * A move that goes out starts both axes at the latch and leaves each module in the groups it
+ * had. One that cannot be staged starts nothing, and the part already staged on the other
+ * axis is replaced, so a latch of that axis' own group does not start it later. An axis that
+ * cannot be taken back out of BRICK_GROUP_SYNC after the latch fails the call, moving or not.
+ */
+
+#include <cstdio>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_host.hpp"
+#include "i2c_sim.hpp"
+#include "test_support.hpp"
+
+#define OWN_GROUP 0x01
+
+// Last command the module applied, register writes aside; 0 if none
+static uint8_t last_command(sim_module &module) {
+    uint8_t last = 0;
+    for (const auto &frame: module.applied()) {
+        if (frame[0] < BRICK_REG_BASE) last = frame[0];
+    }
+    return last;
+}
+
+int main() {
+    sim_module modules[] = {{0, 0x10, MOTOR_STEPPER, 1}, {1, 0x10, MOTOR_STEPPER, 2}};
+    for (auto &module: modules) module.attach();
+
+    brick_i2c_init();
+    for (int pass = 0; pass < 200 && brick_registry_count() < 2; ++pass) {
+        for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) brick_i2c_scan_devices(bus);
+    }
+    CHECK(brick_registry_count() == 2);
+
+    // axes[i] is modules[i]
+    brick_device_t axes[2];
+    for (brick_device_handle_t handle = 0; handle < 2; ++handle) {
+        brick_device_t device;
+        brick_registry_snapshot(handle, &device);
+        axes[device.i2c_bus] = device;
+    }
+    for (auto &axis: axes) CHECK(brick_i2c_assign_group(&axis, OWN_GROUP));
+    const int32_t steps[] = {400, -100};
+
+    // Both start at the latch and are back in their own group only
+    for (auto &module: modules) module.clear_applied();
+    CHECK(brick_i2c_move_together(axes, steps, 2, 1000, 500, 0));
+    for (auto &module: modules) {
+        CHECK(last_command(module) == CMD_STEPPER_MOVE_SYNC);
+        CHECK(module.registers().group_mask == OWN_GROUP);
+    }
+
+    // The second axis does not answer: nothing starts, and the first axis' part is replaced
+    for (auto &module: modules) module.clear_applied();
+    modules[1].fail_next(1000);
+    CHECK(!brick_i2c_move_together(axes, steps, 2, 1000, 500, 0));
+    modules[1].fail_next(0);
+    CHECK(last_command(modules[0]) == 0 && last_command(modules[1]) == 0);
+    CHECK(modules[0].registers().group_mask == OWN_GROUP);
+    CHECK(brick_i2c_latch(OWN_GROUP));
+    CHECK(last_command(modules[0]) == CMD_STEPPER_STOP);
+
+    // The first axis stops answering once it has started: the move runs, the call still fails
+    for (auto &module: modules) module.clear_applied();
+    modules[0].fail_after(CMD_STEPPER_MOVE_SYNC, 1000);
+    CHECK(!brick_i2c_move_together(axes, steps, 2, 1000, 500, 0));
+    modules[0].fail_next(0);
+    for (auto &module: modules) CHECK(last_command(module) == CMD_STEPPER_MOVE_SYNC);
+    CHECK(modules[0].registers().group_mask == (OWN_GROUP | BRICK_GROUP_SYNC));
+    CHECK(modules[1].registers().group_mask == OWN_GROUP);
+
+    test_finish();
+}
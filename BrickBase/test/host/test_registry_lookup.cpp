@@ -0,0 +1,112 @@
+/**
+ * Lookup cost of the device registry with 16, 64 and 112 devices
+ *
+ * Devices of one type, UUIDs differing in their unique ID only, are inserted across both
+ * buses until the registry holds each size in turn. At every size the test times, in ns per
+ * call over LOOKUP_ROUNDS passes over all devices:
+ *   uuid      brick_registry_find_uuid() of a known device
+ *   miss      brick_registry_find_uuid() of a UUID never inserted
+ *   address   brick_registry_find_address()
+ *   snapshot  brick_registry_snapshot()
+ *   scan      finding the UUID by snapshotting every device in turn, the linear walk the
+ *             registry replaced, for scale
+ * Figures are for the PC the test runs on; the ESP32 is slower, the ratios hold.
+ *
+ * The checks hold every lookup to find the right device and no miss to find one.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "brick_device_registry.hpp"
+#include "test_support.hpp"
+
+#define LOOKUP_ROUNDS 2000
+
+static const size_t sizes[] = {16, 64, 112};
+
+static brick_uuid_t uuid_of(uint32_t serial) {
+    brick_uuid_t uuid = {};
+    uuid.raw.prefix[0] = 'B';
+    uuid.raw.prefix[1] = 'L';
+    uuid.raw.device_type[0] = LED_RGB >> 8;
+    uuid.raw.device_type[1] = LED_RGB & 0xFF;
+    std::memcpy(&uuid.raw.unique_id[4], &serial, sizeof(serial));
+    return uuid;
+}
+
+// Runs lookup(i) for every device, LOOKUP_ROUNDS times; returns ns per call
+template <typename lookup_t>
+static double time_lookups(size_t count, lookup_t lookup) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < LOOKUP_ROUNDS; ++round) {
+        for (size_t i = 0; i < count; ++i) lookup(i);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return elapsed / (static_cast<double>(LOOKUP_ROUNDS) * count);
+}
+
+int main() {
+    std::vector<brick_uuid_t> uuids;
+    std::vector<brick_uuid_t> absent;
+    volatile uint32_t sink = 0; // keeps the lookups from being optimised away
+
+    std::printf("devices  uuid-ns  miss-ns  address-ns  snapshot-ns  scan-ns\n");
+
+    for (size_t size: sizes) {
+        while (uuids.size() < size) {
+            auto serial = static_cast<uint32_t>(uuids.size());
+            brick_device_t device = {};
+            device.uuid = uuid_of(serial);
+            device.device_type = LED_RGB;
+            device.i2c_bus = serial % BRICK_I2C_BUS_COUNT;
+            device.i2c_address = static_cast<uint8_t>(0x10 + serial / BRICK_I2C_BUS_COUNT);
+            device.online = 1;
+            CHECK(brick_registry_insert(&device) == serial);
+
+            uuids.push_back(device.uuid);
+            absent.push_back(uuid_of(0x10000 + serial));
+        }
+
+        bool found = true, missed = true;
+        double uuid_ns = time_lookups(size, [&](size_t i) {
+            brick_device_handle_t handle = brick_registry_find_uuid(&uuids[i]);
+            found &= handle == i;
+            sink += handle;
+        });
+        double miss_ns = time_lookups(size, [&](size_t i) {
+            brick_device_handle_t handle = brick_registry_find_uuid(&absent[i]);
+            missed &= handle == BRICK_INVALID_DEVICE_HANDLE;
+            sink += handle;
+        });
+        double address_ns = time_lookups(size, [&](size_t i) {
+            brick_device_handle_t handle = brick_registry_find_address(i % BRICK_I2C_BUS_COUNT, 0x10 + i / BRICK_I2C_BUS_COUNT);
+            found &= handle == i;
+            sink += handle;
+        });
+        double snapshot_ns = time_lookups(size, [&](size_t i) {
+            brick_device_t device;
+            found &= brick_registry_snapshot(static_cast<brick_device_handle_t>(i), &device);
+            sink += device.i2c_address;
+        });
+        double scan_ns = time_lookups(size, [&](size_t i) {
+            brick_device_t device;
+            size_t handle = 0;
+            while (handle < size && brick_registry_snapshot(static_cast<brick_device_handle_t>(handle), &device) &&
+                   std::memcmp(device.uuid.bytes, uuids[i].bytes, sizeof(device.uuid.bytes)) != 0) {
+                handle++;
+            }
+            found &= handle == i;
+            sink += handle;
+        });
+
+        std::printf("%7zu %8.1f %8.1f %11.1f %12.1f %8.1f\n", size, uuid_ns, miss_ns, address_ns, snapshot_ns, scan_ns);
+        CHECK(found);
+        CHECK(missed);
+    }
+
+    CHECK(brick_registry_count() == sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    test_finish();
+}
@@ -0,0 +1,94 @@
+/**
+ * Sensor sampler rings across sensors coming and going
+ *
+ * BRICK_SAMPLER_MAX_SENSORS distance sensors take every ring. Another sensor that shows up
+ * then is not sampled, and setting its period fails, while all of them stay online. Once
+ * the first ones go offline it takes one of their rings, from the sampler's own tick and
+ * from brick_sampler_set_period(), and gets samples.
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_host.hpp"
+#include "brick_sensor_sampler.hpp"
+#include "i2c_sim.hpp"
+#include "test_support.hpp"
+
+#define SENSORS (BRICK_SAMPLER_MAX_SENSORS + 2)
+
+static void scan_until(size_t count) {
+    for (int pass = 0; pass < 400 && brick_registry_count() < count; ++pass) {
+        for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) brick_i2c_scan_devices(bus);
+    }
+}
+
+static brick_device_handle_t handle_of(const sim_module &module) {
+    return brick_registry_find_uuid(&module.uuid());
+}
+
+static bool sampled(const sim_module &module) {
+    brick_sensor_sample_t sample;
+    return brick_sampler_latest(handle_of(module), &sample) && sample.value == module.address();
+}
+
+// Waits a few default periods for the sensor to get (or not get) a sample
+static bool sampled_soon(const sim_module &module) {
+    for (int wait = 0; wait < 50 && !sampled(module); ++wait) vTaskDelay(pdMS_TO_TICKS(BRICK_SAMPLER_DEFAULT_PERIOD_MS / 10));
+    return sampled(module);
+}
+
+static void go_offline(const sim_module &module) {
+    brick_registry_set_presence(handle_of(module), module.bus(), module.address(), false);
+}
+
+int main() {
+    std::vector<sim_module *> modules;
+    for (uint8_t i = 0; i < SENSORS; ++i) {
+        auto *module = new sim_module(i % BRICK_I2C_BUS_COUNT, 0x10 + i, SENSOR_DISTANCE, i);
+        brick_sensor_reading_t reading = {};
+        reading.flags = BRICK_SENSOR_VALID;
+        reading.samples = 1;
+        reading.value[0] = module->address(); // tells the sensors' samples apart
+        module->set_registers(BRICK_REG_SENSOR_READING, &reading, sizeof(reading));
+        modules.push_back(module);
+    }
+    for (int i = 0; i < BRICK_SAMPLER_MAX_SENSORS; ++i) modules[i]->attach();
+
+    brick_i2c_init();
+    scan_until(BRICK_SAMPLER_MAX_SENSORS);
+    CHECK(brick_registry_count() == BRICK_SAMPLER_MAX_SENSORS);
+    brick_sampler_start();
+
+    // Every ring taken
+    bool all_sampled = true;
+    for (int i = 0; i < BRICK_SAMPLER_MAX_SENSORS; ++i) all_sampled &= sampled_soon(*modules[i]);
+    CHECK(all_sampled);
+
+    // Two more sensors while the others are all online: no ring for them
+    sim_module &late = *modules[BRICK_SAMPLER_MAX_SENSORS], &later = *modules[BRICK_SAMPLER_MAX_SENSORS + 1];
+    late.attach();
+    later.attach();
+    scan_until(SENSORS);
+    CHECK(brick_registry_count() == SENSORS);
+    CHECK(!sampled_soon(late) && !sampled_soon(later));
+    CHECK(!brick_sampler_set_period(handle_of(later), 50));
+
+    // One sensor goes offline: the sampler's tick hands its ring to a waiting one
+    go_offline(*modules[0]);
+    CHECK(sampled_soon(late) != sampled_soon(later));
+    sim_module &waiting = sampled(late) ? later : late;
+
+    // Another goes offline: setting a period claims its ring at once
+    go_offline(*modules[1]);
+    CHECK(brick_sampler_set_period(handle_of(waiting), 50));
+    CHECK(sampled_soon(waiting));
+
+    // The online ones kept theirs
+    all_sampled = true;
+    for (int i = 2; i < BRICK_SAMPLER_MAX_SENSORS; ++i) all_sampled &= sampled(*modules[i]);
+    CHECK(all_sampled);
+
+    test_finish();
+}
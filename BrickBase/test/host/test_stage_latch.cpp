@@ -0,0 +1,77 @@
+/**
+ * Stage and latch across modules and buses
+ *
+ * Three RGB modules in group 0x01, two on bus 0 and one on bus 1, get a colour staged
+ * without waiting, then a latch. The latch has to wait for every stage and go out in a
+ * transaction of its own: a module takes a plain write at its stop, so a latch that shared
+ * the stage's transaction, or overtook it, would find nothing staged. A stage that fails
+ * keeps the latch from going out at all.
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include "brick_device_registry.hpp"
+#include "brick_i2c_host.hpp"
+#include "i2c_sim.hpp"
+#include "test_support.hpp"
+
+#define GROUP 0x01
+
+static bool shows(sim_module &module, uint8_t red) {
+    auto applied = module.applied();
+    return !applied.empty() && applied.back().size() == 4 && applied.back()[0] == CMD_LED_RGB &&
+           applied.back()[1] == red;
+}
+
+static bool stage_all(std::vector<brick_device_t> &devices, uint8_t red) {
+    bool ok = true;
+    for (auto &device: devices) {
+        device.impl.led_rgb = {red, 0, 0, 0};
+        brick_command_t command = {CMD_LED_RGB, &device};
+        ok &= brick_i2c_stage_device_command_async(&command);
+    }
+    return ok;
+}
+
+int main() {
+    sim_module modules[] = {{0, 0x10, LED_RGB, 1}, {0, 0x11, LED_RGB, 2}, {1, 0x10, LED_RGB, 3}};
+    for (auto &module: modules) module.attach();
+
+    brick_i2c_init();
+    for (int pass = 0; pass < 200 && brick_registry_count() < 3; ++pass) {
+        for (uint8_t bus = 0; bus < BRICK_I2C_BUS_COUNT; ++bus) brick_i2c_scan_devices(bus);
+    }
+    CHECK(brick_registry_count() == 3);
+
+    std::vector<brick_device_t> devices(brick_registry_count());
+    for (size_t i = 0; i < devices.size(); ++i) {
+        brick_registry_snapshot(static_cast<brick_device_handle_t>(i), &devices[i]);
+        CHECK(brick_i2c_assign_group(&devices[i], GROUP));
+    }
+    CHECK(!brick_i2c_assign_group(&devices[0], GROUP | BRICK_GROUP_SYNC)); // move_together's
+
+    // Staged colours show on the latch, on every bus, and not before
+    for (auto &module: modules) module.clear_applied();
+    CHECK(stage_all(devices, 0x40));
+    CHECK(brick_i2c_latch(GROUP));
+    for (auto &module: modules) CHECK(shows(module, 0x40));
+
+    // Back to back, many times over: no latch overtakes or joins its stages
+    bool all_shown = true;
+    for (uint8_t red = 1; red <= 50; ++red) {
+        CHECK(stage_all(devices, red));
+        CHECK(brick_i2c_latch(GROUP));
+        for (auto &module: modules) all_shown &= shows(module, red);
+    }
+    CHECK(all_shown);
+
+    // A module that never acknowledges its stage: no latch, the others keep their colour
+    modules[1].fail_next(1000);
+    CHECK(stage_all(devices, 0x7F));
+    CHECK(!brick_i2c_latch(GROUP));
+    CHECK(shows(modules[0], 50) && shows(modules[2], 50));
+    modules[1].fail_next(0);
+
+    test_finish();
+}
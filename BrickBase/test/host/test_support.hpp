@@ -0,0 +1,31 @@
+// test_support.hpp
+#ifndef TEST_SUPPORT_HPP
+#define TEST_SUPPORT_HPP
+
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Checks for the host tests. A failed check is reported and counted, the test runs on.
+ * Tests end with test_finish(): engine and scan tasks never return, so the process leaves
+ * without unwinding them.
+ */
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+[[noreturn]] static inline void test_finish() {
+    std::printf(test_failures ? "%d checks failed\n" : "all checks passed\n", test_failures);
+    std::fflush(stdout);
+    std::fflush(stderr);
+    std::_Exit(test_failures ? 1 : 0);
+}
+
+#endif // TEST_SUPPORT_HPP
@@ -1,6 +1,7 @@
 // BrickExtension/src/bleService.ts - Simplified without chunking
 
 import { BLE_COMMANDS } from './luaStringConverter';
+import { BusHealth, BusHealthChunk, I2cTraceChunk, I2cTraceEntry, LuaProfile, LuaRunMetrics, parseBusHealthChunk, parseI2cTraceChunk, parseLuaProfile, parseRunMetrics } from './brickBleApi';
 
 // Import Noble
 const noble = require('@abandonware/noble');
@@ -17,6 +18,7 @@ export interface BrickModule {
     uuid: string;        // Device UUID as hex string (32 chars)
     deviceType: number;  // Device type extracted from UUID
     i2cAddress: number;  // I2C bus address
+    i2cBus: number;      // ESP32 I2C controller the device is wired to
     online: boolean;     // Connection status
 }
 
@@ -26,7 +28,7 @@ export interface BrickModule {
 function parseBrickDeviceList(buffer: ArrayBuffer): BrickModule[] {
     const devices: BrickModule[] = [];
     const view = new DataView(buffer);
-    const deviceSize = 18; // 16 bytes UUID + 1 byte I2C + 1 byte online
+    const deviceSize = 18; // 16 bytes UUID + 1 byte I2C + 1 byte status (online, bus)
 
     for (let offset = 0; offset + deviceSize <= buffer.byteLength; offset += deviceSize) {
         // Extract 16-byte UUID
@@ -39,15 +41,16 @@ function parseBrickDeviceList(buffer: ArrayBuffer): BrickModule[] {
         // Extract device type from UUID bytes 2-3 (big-endian)
         const deviceType = (uuidBytes[2] << 8) | uuidBytes[3];
         
-        // Extract I2C address and online status
+        // Extract I2C address, bus and online status
         const i2cAddress = view.getUint8(offset + 16);
-        const online = view.getUint8(offset + 17) === 1;
+        const status = view.getUint8(offset + 17);
 
         devices.push({
             uuid: uuidHex,
             deviceType,
             i2cAddress,
-            online
+            i2cBus: (status >> 1) & 0x07,
+            online: (status & 0x01) !== 0
         });
     }
 
@@ -88,6 +91,8 @@ export class BrickBleService {
     // Event handling
     private notificationHandlers: Map<number, (data: Buffer) => void> = new Map();
     private isScanning: boolean = false;
+    private runMetricsListener: ((metrics: LuaRunMetrics) => void) | null = null;
+    private lastRunMetrics: LuaRunMetrics | null = null;
 
     constructor() {
         this.initializeNoble();
@@ -601,6 +606,15 @@ export class BrickBleService {
             } catch (parseError) {
                 console.error('❌ Failed to auto-parse device list:', parseError);
             }
+        } else if (responseType === BLE_COMMANDS.RUN_METRICS_RESPONSE) {
+            try {
+                const metrics = parseRunMetrics(new Uint8Array(data.slice(1)).buffer);
+                this.lastRunMetrics = metrics;
+                console.log('📊 Run metrics:', metrics);
+                this.runMetricsListener?.(metrics);
+            } catch (parseError) {
+                console.error('❌ Failed to parse run metrics:', parseError);
+            }
         } else if (responseType === BLE_COMMANDS.ERROR_RESPONSE) {
             const errorMsg = new TextDecoder().decode(bytes.slice(1));
             console.error('❌ ESP32 error:', errorMsg);
@@ -645,6 +659,20 @@ export class BrickBleService {
         return this.isConnected && this.connectedPeripheral !== null;
     }
 
+    /**
+     * Metrics of the last script run reported by the device
+     */
+    get runMetrics(): LuaRunMetrics | null {
+        return this.lastRunMetrics;
+    }
+
+    /**
+     * Register a listener called whenever a script run finishes
+     */
+    onRunMetrics(listener: ((metrics: LuaRunMetrics) => void) | null): void {
+        this.runMetricsListener = listener;
+    }
+
     /**
      * Get cached device list
      */
@@ -730,6 +758,159 @@ export class BrickBleService {
         });
     }
 
+    /**
+     * Request the Lua profiler histogram of the running (or last) script
+     */
+    async requestProfile(): Promise<LuaProfile> {
+        if (!this.connected) {
+            throw new Error('Not connected to device');
+        }
+
+        const command = new Uint8Array([BLE_COMMANDS.PROFILE_REQUEST]);
+
+        return new Promise(async (resolve, reject) => {
+            const timeout = setTimeout(() => {
+                this.notificationHandlers.delete(BLE_COMMANDS.PROFILE_RESPONSE);
+                reject(new Error('Profile request timeout'));
+            }, 8000);
+
+            this.notificationHandlers.set(BLE_COMMANDS.PROFILE_RESPONSE, (data: Buffer) => {
+                clearTimeout(timeout);
+                this.notificationHandlers.delete(BLE_COMMANDS.PROFILE_RESPONSE);
+
+                try {
+                    const responseData = new Uint8Array(data.slice(1)); // Skip command byte
+                    const profile = parseLuaProfile(responseData.buffer);
+
+                    console.log(`✅ Profile received: ${profile.entries.length} lines, ${profile.totalSamples} samples`);
+                    resolve(profile);
+                } catch (parseError) {
+                    reject(new Error(`Failed to parse profile: ${parseError}`));
+                }
+            });
+
+            const success = await this.sendCommand(command);
+            if (!success) {
+                clearTimeout(timeout);
+                this.notificationHandlers.delete(BLE_COMMANDS.PROFILE_RESPONSE);
+                reject(new Error('Failed to send profile request'));
+            }
+        });
+    }
+
+    /**
+     * Request one chunk of the bus health counters, starting at a slot (bus x 128 + address)
+     */
+    private async requestBusHealthChunk(fromSlot: number): Promise<BusHealthChunk> {
+        const command = new Uint8Array(3);
+        command[0] = BLE_COMMANDS.BUS_HEALTH_REQUEST;
+        new DataView(command.buffer).setUint16(1, fromSlot, true);
+
+        return new Promise(async (resolve, reject) => {
+            const timeout = setTimeout(() => {
+                this.notificationHandlers.delete(BLE_COMMANDS.BUS_HEALTH_RESPONSE);
+                reject(new Error('Bus health request timeout'));
+            }, 8000);
+
+            this.notificationHandlers.set(BLE_COMMANDS.BUS_HEALTH_RESPONSE, (data: Buffer) => {
+                clearTimeout(timeout);
+                this.notificationHandlers.delete(BLE_COMMANDS.BUS_HEALTH_RESPONSE);
+
+                try {
+                    resolve(parseBusHealthChunk(new Uint8Array(data.slice(1)).buffer));
+                } catch (parseError) {
+                    reject(new Error(`Failed to parse bus health: ${parseError}`));
+                }
+            });
+
+            const success = await this.sendCommand(command);
+            if (!success) {
+                clearTimeout(timeout);
+                this.notificationHandlers.delete(BLE_COMMANDS.BUS_HEALTH_RESPONSE);
+                reject(new Error('Failed to send bus health request'));
+            }
+        });
+    }
+
+    /**
+     * Request per-address I2C bus health counters, chunk by chunk until every address is in
+     */
+    async requestBusHealth(): Promise<BusHealth> {
+        if (!this.connected) {
+            throw new Error('Not connected to device');
+        }
+
+        let chunk = await this.requestBusHealthChunk(0);
+        const health: BusHealth = { bucketMinUs: chunk.bucketMinUs, records: [...chunk.records] };
+
+        while (chunk.nextSlot !== 0xFFFF) {
+            chunk = await this.requestBusHealthChunk(chunk.nextSlot);
+            health.records.push(...chunk.records);
+        }
+
+        console.log(`✅ Bus health received: ${health.records.length} addresses`);
+        return health;
+    }
+
+    /**
+     * Request one chunk of the I2C trace ring, starting at a sequence number
+     */
+    private async requestTraceChunk(fromSeq: number): Promise<I2cTraceChunk> {
+        const command = new Uint8Array(5);
+        command[0] = BLE_COMMANDS.TRACE_REQUEST;
+        new DataView(command.buffer).setUint32(1, fromSeq, true);
+
+        return new Promise(async (resolve, reject) => {
+            const timeout = setTimeout(() => {
+                this.notificationHandlers.delete(BLE_COMMANDS.TRACE_RESPONSE);
+                reject(new Error('Trace request timeout'));
+            }, 8000);
+
+            this.notificationHandlers.set(BLE_COMMANDS.TRACE_RESPONSE, (data: Buffer) => {
+                clearTimeout(timeout);
+                this.notificationHandlers.delete(BLE_COMMANDS.TRACE_RESPONSE);
+
+                try {
+                    resolve(parseI2cTraceChunk(new Uint8Array(data.slice(1)).buffer));
+                } catch (parseError) {
+                    reject(new Error(`Failed to parse trace: ${parseError}`));
+                }
+            });
+
+            const success = await this.sendCommand(command);
+            if (!success) {
+                clearTimeout(timeout);
+                this.notificationHandlers.delete(BLE_COMMANDS.TRACE_RESPONSE);
+                reject(new Error('Failed to send trace request'));
+            }
+        });
+    }
+
+    /**
+     * Download the whole I2C trace ring, oldest entry first.
+     * Stops at what was recorded when the dump started, so a busy bus cannot keep it going.
+     */
+    async requestI2cTrace(): Promise<I2cTraceEntry[]> {
+        if (!this.connected) {
+            throw new Error('Not connected to device');
+        }
+
+        const entries: I2cTraceEntry[] = [];
+        let chunk = await this.requestTraceChunk(0);
+        const endSeq = chunk.nextSeq;
+
+        while (true) {
+            entries.push(...chunk.entries.filter(entry => entry.seq < endSeq));
+
+            const nextSeq = chunk.firstSeq + chunk.entries.length;
+            if (chunk.entries.length === 0 || nextSeq >= endSeq) break;
+            chunk = await this.requestTraceChunk(nextSeq);
+        }
+
+        console.log(`✅ I2C trace received: ${entries.length} entries`);
+        return entries;
+    }
+
     /**
      * Send Lua script to ESP32 as single packet (SIMPLIFIED - NO CHUNKING)
      */
@@ -23,8 +23,11 @@ export const COMMANDS = {
     CMD_LED: 0x01,
     CMD_LED_DOUBLE: 0x02,
     CMD_LED_RGB: 0x03,
+    CMD_LED_FADE: 0x04,
     CMD_SERVO_SET_ANGLE: 0x10,
     CMD_STEPPER_MOVE: 0x11,
+    CMD_STEPPER_STATUS: 0x12,
+    CMD_STEPPER_STOP: 0x13,
     CMD_SENSOR_GET_CM: 0x30
 } as const;
 
@@ -36,6 +39,13 @@ export const BLE_PROTOCOL = {
     DEVICE_LIST_RESPONSE: 0x01,
     RUN_LUA_SCRIPT: 0x02,
     SET_DEVICE_STATE: 0x03,
+    PROFILE_REQUEST: 0x04,
+    PROFILE_RESPONSE: 0x05,
+    RUN_METRICS_RESPONSE: 0x06,
+    BUS_HEALTH_REQUEST: 0x07,
+    BUS_HEALTH_RESPONSE: 0x08,
+    TRACE_REQUEST: 0x09,
+    TRACE_RESPONSE: 0x0A,
     ERROR_RESPONSE: 0xFE
 } as const;
 
@@ -46,12 +56,13 @@ export interface BrickModule {
     uuid: string;        // 32-char hex string (no dashes)
     deviceType: number;  // Device type from DEVICE_TYPES
     i2cAddress: number;  // I2C address (0x08-0x77)
+    i2cBus: number;      // ESP32 I2C controller the module is wired to
     online: boolean;     // Connection status
 }
 
 /**
  * Parses BLE device list payload from ESP32
- * Format: 18 bytes per device (16 UUID + 1 I2C + 1 online)
+ * Format: 18 bytes per device (16 UUID + 1 I2C + 1 status: bit 0 online, bits 1-3 bus)
  */
 export function parseBrickDeviceList(buffer: ArrayBuffer): BrickModule[] {
     const devices: BrickModule[] = [];
@@ -71,21 +82,288 @@ export function parseBrickDeviceList(buffer: ArrayBuffer): BrickModule[] {
         // Extract device type from UUID bytes [2,3] (big-endian)
         const deviceType = (uuidBytes[2] << 8) | uuidBytes[3];
         
-        // Extract I2C address and online status
+        // Extract I2C address, bus and online status
         const i2cAddress = view.getUint8(offset + 16);
-        const online = view.getUint8(offset + 17) === 1;
+        const status = view.getUint8(offset + 17);
 
         devices.push({
             uuid: uuidHex,
             deviceType,
             i2cAddress,
-            online
+            i2cBus: (status >> 1) & 0x07,
+            online: (status & 0x01) !== 0
         });
     }
 
     return devices;
 }
 
+/**
+ * One line of the Lua sampling profiler histogram
+ */
+export interface LuaProfileEntry {
+    line: number;          // Script line (1-based, as reported by Lua)
+    functionLine: number;  // Line where the enclosing function starts (0 = main chunk)
+    samples: number;       // Samples attributed to this line
+}
+
+/**
+ * Lua sampling profiler snapshot
+ */
+export interface LuaProfile {
+    interval: number;        // VM instructions between samples
+    totalSamples: number;    // All samples taken during the run
+    droppedSamples: number;  // Samples that could not be attributed to a line
+    entries: LuaProfileEntry[];
+}
+
+/**
+ * Parses BLE profile payload from ESP32 (little-endian)
+ * Format: interval (u32), total (u32), dropped (u32), count (u16),
+ * then count x [line (u16), function line (u16), samples (u32)]; at most 60 entries, the
+ * lines with the most samples, so the payload fits one notification
+ */
+export function parseLuaProfile(buffer: ArrayBuffer): LuaProfile {
+    const view = new DataView(buffer);
+    const headerSize = 14;
+    const entrySize = 8;
+
+    if (buffer.byteLength < headerSize) {
+        throw new Error(`Profile payload too short (${buffer.byteLength} bytes)`);
+    }
+
+    const count = view.getUint16(12, true);
+    const entries: LuaProfileEntry[] = [];
+
+    for (let i = 0; i < count; i++) {
+        const offset = headerSize + i * entrySize;
+        if (offset + entrySize > buffer.byteLength) break;
+
+        entries.push({
+            line: view.getUint16(offset, true),
+            functionLine: view.getUint16(offset + 2, true),
+            samples: view.getUint32(offset + 4, true)
+        });
+    }
+
+    return {
+        interval: view.getUint32(0, true),
+        totalSamples: view.getUint32(4, true),
+        droppedSamples: view.getUint32(8, true),
+        entries
+    };
+}
+
+/**
+ * Execution metrics sent by the ESP32 after every script run
+ */
+export interface LuaRunMetrics {
+    status: 'ok' | 'load_error' | 'runtime_error';
+    loadUs: number;           // Compile time
+    execUs: number;           // Run time (includes GC and I2C)
+    gcCycles: number;         // Completed GC cycles
+    gcUs: number;             // Total time in GC steps
+    peakHeapBytes: number;    // Peak Lua heap
+    brickCalls: number;       // Calls into the native `brick` API
+    i2cTransactions: number;  // Device commands issued
+    i2cBytes: number;         // Bytes put on the bus
+    i2cErrors: number;        // Failed device commands
+    stackHeadroomBytes: number; // Minimum free stack of the Lua task
+}
+
+/**
+ * Parses BLE run metrics payload from ESP32 (little-endian)
+ * Format: version (u8), status (u8), then 10 x u32
+ */
+export function parseRunMetrics(buffer: ArrayBuffer): LuaRunMetrics {
+    const view = new DataView(buffer);
+
+    if (buffer.byteLength < 42 || view.getUint8(0) !== 1) {
+        throw new Error(`Unsupported run metrics record (${buffer.byteLength} bytes)`);
+    }
+
+    const statusNames: LuaRunMetrics['status'][] = ['ok', 'load_error', 'runtime_error'];
+    const field = (index: number) => view.getUint32(2 + index * 4, true);
+
+    return {
+        status: statusNames[view.getUint8(1)] || 'runtime_error',
+        loadUs: field(0),
+        execUs: field(1),
+        gcCycles: field(2),
+        gcUs: field(3),
+        peakHeapBytes: field(4),
+        brickCalls: field(5),
+        i2cTransactions: field(6),
+        i2cBytes: field(7),
+        i2cErrors: field(8),
+        stackHeadroomBytes: field(9)
+    };
+}
+
+/**
+ * I2C bus health of one address, as tracked by the ESP32 engine
+ */
+export interface BusHealthRecord {
+    bus: number;               // ESP32 I2C controller
+    address: number;           // 7-bit I2C address
+    quarantined: boolean;      // Requests currently fail fast instead of using the bus
+    success: number;           // Attempts the device acknowledged
+    failure: number;           // NACKs and bus errors
+    timeout: number;           // Attempts that hit the I2C timeout
+    retries: number;           // Attempts that retried a failed one
+    skipped: number;           // Requests failed without bus traffic while quarantined
+    quarantines: number;       // Times the device was quarantined
+    quarantineMsLeft: number;  // Remaining quarantine
+    latencyHistogram: number[]; // Attempts per bus-time bucket
+}
+
+/**
+ * Bus health snapshot
+ */
+export interface BusHealth {
+    bucketMinUs: number;       // Upper bound of the first bucket; each next bucket doubles it
+    records: BusHealthRecord[];
+}
+
+/**
+ * One chunk of the bus health snapshot as sent by the ESP32
+ */
+export interface BusHealthChunk extends BusHealth {
+    nextSlot: number;          // bus x 128 + address to ask for next; 0xFFFF once every address is sent
+}
+
+/**
+ * Parses BLE bus health payload from ESP32 (little-endian)
+ * Format: version (u8), bucket count (u8), first bucket bound us (u16), record count (u16),
+ * next slot (u16, 0xFFFF when done), then count x [address (u8), flags (u8: bit 0
+ * quarantined, bits 1-3 bus), 7 x u32 counters, bucket count x u32]
+ */
+export function parseBusHealthChunk(buffer: ArrayBuffer): BusHealthChunk {
+    const view = new DataView(buffer);
+
+    if (buffer.byteLength < 8 || view.getUint8(0) !== 2) {
+        throw new Error(`Unsupported bus health record (${buffer.byteLength} bytes)`);
+    }
+
+    const buckets = view.getUint8(1);
+    const count = view.getUint16(4, true);
+    const recordSize = 2 + 7 * 4 + buckets * 4;
+    const records: BusHealthRecord[] = [];
+
+    for (let i = 0; i < count; i++) {
+        const offset = 8 + i * recordSize;
+        if (offset + recordSize > buffer.byteLength) break;
+
+        const field = (index: number) => view.getUint32(offset + 2 + index * 4, true);
+        const latencyHistogram: number[] = [];
+        for (let b = 0; b < buckets; b++) latencyHistogram.push(field(7 + b));
+
+        const flags = view.getUint8(offset + 1);
+        records.push({
+            bus: (flags >> 1) & 0x07,
+            address: view.getUint8(offset),
+            quarantined: (flags & 0x01) !== 0,
+            success: field(0),
+            failure: field(1),
+            timeout: field(2),
+            retries: field(3),
+            skipped: field(4),
+            quarantines: field(5),
+            quarantineMsLeft: field(6),
+            latencyHistogram
+        });
+    }
+
+    return { bucketMinUs: view.getUint16(2, true), records, nextSlot: view.getUint16(6, true) };
+}
+
+/**
+ * One bus attempt recorded in the ESP32 I2C trace ring
+ */
+export interface I2cTraceEntry {
+    seq: number;         // Sequence number since boot
+    startUs: number;     // Low 32 bits of the ESP32 microsecond clock
+    durationUs: number;  // Bus time (shared by all requests of a batch)
+    bus: number;         // ESP32 I2C controller
+    address: number;     // 7-bit target address
+    command: number;     // First written byte (0 for probes)
+    writeLen: number;
+    readLen: number;
+    result: 'ok' | 'nack' | 'timeout' | 'skipped' | 'error' | 'check'; // check: a checked frame's reply failed
+    priority: number;    // 0 = actuation, 1 = sensor, 2 = discovery
+    batch: boolean;      // Shared the transaction with other requests
+    retry: boolean;      // Repeated a failed attempt
+    task: string;        // Submitting task
+}
+
+/**
+ * One chunk of the trace ring as sent by the ESP32
+ */
+export interface I2cTraceChunk {
+    nowUs: number;       // ESP32 clock when the chunk was sent
+    nextSeq: number;     // Entries recorded since boot
+    firstSeq: number;    // Sequence number of entries[0]
+    entries: I2cTraceEntry[];
+}
+
+/**
+ * Parses BLE trace payload from ESP32 (little-endian)
+ * Format: version (u8), entry size (u8), now us (u32), next seq (u32), first seq (u32),
+ * task count (u8) + [name length (u8) + name], entry count (u8), then 16-byte entries
+ */
+export function parseI2cTraceChunk(buffer: ArrayBuffer): I2cTraceChunk {
+    const view = new DataView(buffer);
+    const bytes = new Uint8Array(buffer);
+
+    if (buffer.byteLength < 15 || view.getUint8(0) !== 1) {
+        throw new Error(`Unsupported trace record (${buffer.byteLength} bytes)`);
+    }
+
+    const entrySize = view.getUint8(1);
+    const firstSeq = view.getUint32(10, true);
+    let offset = 14;
+
+    const tasks: string[] = [];
+    const taskCount = view.getUint8(offset++);
+    for (let i = 0; i < taskCount; i++) {
+        const len = view.getUint8(offset++);
+        tasks.push(new TextDecoder().decode(bytes.slice(offset, offset + len)));
+        offset += len;
+    }
+
+    const resultNames: I2cTraceEntry['result'][] = ['ok', 'nack', 'timeout', 'skipped', 'error', 'check'];
+    const count = view.getUint8(offset++);
+    const entries: I2cTraceEntry[] = [];
+
+    for (let i = 0; i < count && offset + entrySize <= buffer.byteLength; i++, offset += entrySize) {
+        const flags = view.getUint8(offset + 13);
+        const task = view.getUint8(offset + 14);
+
+        entries.push({
+            seq: firstSeq + i,
+            startUs: view.getUint32(offset, true),
+            durationUs: view.getUint32(offset + 4, true),
+            bus: view.getUint8(offset + 15),
+            address: view.getUint8(offset + 8),
+            command: view.getUint8(offset + 9),
+            writeLen: view.getUint8(offset + 10),
+            readLen: view.getUint8(offset + 11),
+            result: resultNames[view.getUint8(offset + 12)] || 'error',
+            priority: flags & 0x03,
+            batch: (flags & 0x04) !== 0,
+            retry: (flags & 0x08) !== 0,
+            task: tasks[task] || 'other'
+        });
+    }
+
+    return {
+        nowUs: view.getUint32(2, true),
+        nextSeq: view.getUint32(6, true),
+        firstSeq,
+        entries
+    };
+}
+
 /**
  * Formats UUID for display (adds dashes)
  */
@@ -162,6 +440,7 @@ export function createMockDevice(deviceType: number, uniqueId: string = '0123456
         uuid,
         deviceType,
         i2cAddress: 0x10 + (deviceType & 0x0F), // Mock I2C address
+        i2cBus: 0,
         online: true
     };
 }
@@ -6,7 +6,8 @@ import { bleService, formatUuid } from './bleService';
 import { getDeviceTypeName, formatUuidForDisplay } from './brickBleApi';
 import { DeviceSidebarPanel } from './panels/DeviceSidebarPanel';
 import { TutorialSidebarPanel } from './panels/TutorialSidebarPanel';
-import { showLiveHint } from './utils/liveHints';
+import { showLiveHint, showProfileHotspots, clearProfileHotspots } from './utils/liveHints';
+import { formatI2cTimeline, i2cDeviceKey } from './utils/i2cTrace';
 
 
 
@@ -234,7 +235,7 @@ export function activate(context: vscode.ExtensionContext) {
 
             const deviceItems = devices.map(device => ({
                 label: formatUuidForDisplay(device.uuid),
-                description: `${getDeviceTypeName(device.deviceType)} • I2C: 0x${device.i2cAddress.toString(16).padStart(2, '0')}`,
+                description: `${getDeviceTypeName(device.deviceType)} • I2C: ${device.i2cBus}:0x${device.i2cAddress.toString(16).padStart(2, '0')}`,
                 detail: device.online ? '🟢 Online' : '🔴 Offline',
                 device: device
             }));
@@ -456,6 +457,96 @@ export function activate(context: vscode.ExtensionContext) {
     });
 
 
+    let showProfileCmd = vscode.commands.registerCommand('bricklab.showProfile', async () => {
+        const editor = vscode.window.activeTextEditor;
+        if (!editor) {
+            vscode.window.showWarningMessage('Open the Lua file that is running to see its profile.');
+            return;
+        }
+
+        if (!bleService.connected) {
+            vscode.window.showErrorMessage('Not connected to BrickLab device');
+            return;
+        }
+
+        try {
+            const profile = await bleService.requestProfile();
+            if (profile.totalSamples === 0) {
+                clearProfileHotspots();
+                vscode.window.showInformationMessage('No profiler samples yet - run a script first.');
+                return;
+            }
+
+            showProfileHotspots(profile, editor.document.uri);
+            vscode.window.showInformationMessage(
+                `Profile: ${profile.totalSamples} samples every ${profile.interval} instructions` +
+                (profile.droppedSamples > 0 ? ` (${profile.droppedSamples} unattributed)` : '')
+            );
+        } catch (error) {
+            vscode.window.showErrorMessage(`Failed to get profile: ${error}`);
+        }
+    });
+
+    let showBusHealthCmd = vscode.commands.registerCommand('bricklab.showBusHealth', async () => {
+        if (!bleService.connected) {
+            vscode.window.showErrorMessage('Not connected to BrickLab device');
+            return;
+        }
+
+        try {
+            const health = await bleService.requestBusHealth();
+            if (health.records.length === 0) {
+                vscode.window.showInformationMessage('No I2C traffic recorded yet');
+                return;
+            }
+
+            const devices = bleService.deviceList;
+            const items = health.records.map(record => {
+                const device = devices.find(d => d.i2cBus === record.bus && d.i2cAddress === record.address);
+                const attempts = record.success + record.failure + record.timeout;
+
+                // Slowest bucket that saw traffic, as an upper bound for the worst transfer
+                const slowest = record.latencyHistogram.reduce((last, count, i) => count > 0 ? i : last, -1);
+                const worst = slowest < 0 ? '-' : slowest === record.latencyHistogram.length - 1
+                    ? `>= ${health.bucketMinUs << (slowest - 1)} us`
+                    : `< ${health.bucketMinUs << slowest} us`;
+
+                return {
+                    label: `${record.quarantined ? '⛔' : '🟢'} ${record.bus}:0x${record.address.toString(16).padStart(2, '0')}` +
+                        (device ? ` ${getDeviceTypeName(device.deviceType)}` : ''),
+                    description: `${record.success}/${attempts} ok • ${record.failure} NACK • ${record.timeout} timeout • ${record.retries} retries`,
+                    detail: `worst transfer ${worst} • quarantined ${record.quarantines}x` +
+                        (record.quarantined ? ` (${record.quarantineMsLeft} ms left, ${record.skipped} requests skipped)` : '')
+                };
+            });
+
+            await vscode.window.showQuickPick(items, { placeHolder: `I2C bus health (${items.length} addresses)` });
+        } catch (error) {
+            vscode.window.showErrorMessage(`Failed to get bus health: ${error}`);
+        }
+    });
+
+    let showI2cTraceCmd = vscode.commands.registerCommand('bricklab.showI2cTrace', async () => {
+        if (!bleService.connected) {
+            vscode.window.showErrorMessage('Not connected to BrickLab device');
+            return;
+        }
+
+        try {
+            const entries = await bleService.requestI2cTrace();
+            const names = new Map(bleService.deviceList.map(device =>
+                [i2cDeviceKey(device.i2cBus, device.i2cAddress), getDeviceTypeName(device.deviceType)] as [number, string]));
+
+            const document = await vscode.workspace.openTextDocument({
+                content: formatI2cTimeline(entries, names),
+                language: 'log'
+            });
+            await vscode.window.showTextDocument(document, { preview: false });
+        } catch (error) {
+            vscode.window.showErrorMessage(`Failed to get I2C trace: ${error}`);
+        }
+    });
+
     // Register all commands
     context.subscriptions.push(
         createProjectCmd,
@@ -468,9 +559,30 @@ export function activate(context: vscode.ExtensionContext) {
         scanUnknownDevicesCmd,
         autoTestUnknownCmd,
         manualDeviceTestCmd,
-        showHintCmd
+        showHintCmd,
+        showProfileCmd,
+        showBusHealthCmd,
+        showI2cTraceCmd
     );
 
+    // Report metrics of every finished script run
+    bleService.onRunMetrics(metrics => {
+        const ms = (us: number) => (us / 1000).toFixed(1);
+        const summary = `Script ${metrics.status === 'ok' ? 'finished' : 'failed'}: ` +
+            `compile ${ms(metrics.loadUs)} ms, run ${ms(metrics.execUs)} ms, ` +
+            `GC ${metrics.gcCycles} cycles / ${ms(metrics.gcUs)} ms, ` +
+            `peak heap ${(metrics.peakHeapBytes / 1024).toFixed(1)} KB, ` +
+            `I2C ${metrics.i2cTransactions} tx (${metrics.i2cErrors} errors), ` +
+            `stack headroom ${metrics.stackHeadroomBytes} B`;
+
+        if (metrics.status === 'ok') {
+            vscode.window.showInformationMessage(summary);
+        } else {
+            vscode.window.showWarningMessage(summary);
+        }
+    });
+    context.subscriptions.push({ dispose: () => bleService.onRunMetrics(null) });
+
     // Show connection status in status bar
     const statusBarItem = vscode.window.createStatusBarItem(vscode.StatusBarAlignment.Right, 100);
     statusBarItem.command = 'bricklab.connect';
@@ -8,6 +8,13 @@ export const BLE_COMMANDS = {
   DEVICE_LIST_RESPONSE: 0x01,
   RUN_LUA_SCRIPT: 0x02,
   SET_DEVICE_STATE: 0x03,
+  PROFILE_REQUEST: 0x04,
+  PROFILE_RESPONSE: 0x05,
+  RUN_METRICS_RESPONSE: 0x06,
+  BUS_HEALTH_REQUEST: 0x07,
+  BUS_HEALTH_RESPONSE: 0x08,
+  TRACE_REQUEST: 0x09,
+  TRACE_RESPONSE: 0x0A,
   ERROR_RESPONSE: 0xFE
 } as const;
 
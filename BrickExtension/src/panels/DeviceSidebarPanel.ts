@@ -93,7 +93,7 @@ export class DeviceSidebarPanel {
             <div class="device-card">
             <div class="device-title">${getDeviceTypeName(device.deviceType)}</div>
             <div class="device-info">UUID: ${device.uuid}</div>
-            <div class="device-info">I2C: 0x${device.i2cAddress.toString(16).padStart(2, '0')}</div>
+            <div class="device-info">I2C: bus ${device.i2cBus}, 0x${device.i2cAddress.toString(16).padStart(2, '0')}</div>
             <div class="status ${device.online ? 'online' : 'offline'}">
                 ${device.online ? '🟢 Online' : '🔴 Offline'}
             </div>
@@ -0,0 +1,149 @@
+// src/utils/i2cTrace.ts
+import { I2cTraceEntry } from '../brickBleApi';
+
+const PRIORITY_NAMES = ['actuation', 'sensor', 'discovery'];
+const UTILISATION_BINS = 20;
+
+interface Tally {
+    count: number;
+    failed: number;
+    busyUs: number;
+    maxUs: number;
+}
+
+function tally(map: Map<string, Tally>, key: string, entry: I2cTraceEntry, busyUs: number) {
+    const t = map.get(key) || { count: 0, failed: 0, busyUs: 0, maxUs: 0 };
+    t.count++;
+    if (entry.result !== 'ok') t.failed++;
+    t.busyUs += busyUs;
+    t.maxUs = Math.max(t.maxUs, entry.durationUs);
+    map.set(key, t);
+}
+
+const ms = (us: number) => (us / 1000).toFixed(3);
+const pct = (part: number, whole: number) => whole > 0 ? `${(100 * part / whole).toFixed(1)}%` : '-';
+const hex = (value: number) => `0x${value.toString(16).padStart(2, '0')}`;
+
+/**
+ * Key of a module in the names map: addresses repeat across the ESP32's I2C controllers.
+ */
+export const i2cDeviceKey = (bus: number, address: number) => (bus << 7) | address;
+
+function tallyTable(title: string, map: Map<string, Tally>, windowUs: number): string[] {
+    const lines = [title];
+    const rows = [...map.entries()].sort((a, b) => b[1].busyUs - a[1].busyUs);
+
+    for (const [key, t] of rows) {
+        lines.push(`  ${key.padEnd(24)} ${String(t.count).padStart(6)} tx  ${String(t.failed).padStart(5)} failed  ` +
+            `${ms(t.busyUs).padStart(10)} ms busy (${pct(t.busyUs, windowUs).padStart(6)})  max ${ms(t.maxUs)} ms`);
+    }
+
+    return lines;
+}
+
+/**
+ * Renders a trace dump as a text timeline followed by bus-utilisation statistics.
+ * @param entries Trace entries, oldest first.
+ * @param names Optional display names, keyed by i2cDeviceKey().
+ */
+export function formatI2cTimeline(entries: I2cTraceEntry[], names: Map<number, string> = new Map()): string {
+    if (entries.length === 0) {
+        return 'I2C trace is empty.';
+    }
+
+    // Timestamps are the low 32 bits of the ESP32 clock; unsigned differences survive a wrap
+    const base = entries[0].startUs;
+    const rel = (us: number) => (us - base) >>> 0;
+
+    const lines: string[] = [];
+    const byBus = new Map<string, Tally>();
+    const byAddress = new Map<string, Tally>();
+    const byPriority = new Map<string, Tally>();
+    const byTask = new Map<string, Tally>();
+    const results = new Map<string, number>();
+
+    let busyUs = 0;
+    let endUs = 0;
+    let longestGapUs = 0;
+    // Each bus has its own engine task, so their entries interleave in the ring
+    let lastTransaction = new Map<number, string>();
+
+    const busyPerBin: number[] = [];
+
+    lines.push('  time (ms)   bus (ms)  bus:addr  device              cmd   w  r  queue      task              result');
+
+    for (const entry of entries) {
+        const startUs = rel(entry.startUs);
+
+        // Requests of one batch share a transaction: count its bus time once
+        const transaction = `${entry.startUs}/${entry.durationUs}`;
+        const shared = entry.batch && transaction === lastTransaction.get(entry.bus);
+        lastTransaction.set(entry.bus, transaction);
+        const ownUs = shared ? 0 : entry.durationUs;
+
+        if (!shared) {
+            longestGapUs = Math.max(longestGapUs, startUs > endUs ? startUs - endUs : 0);
+            busyUs += ownUs;
+        }
+        endUs = Math.max(endUs, startUs + entry.durationUs);
+
+        const priority = PRIORITY_NAMES[entry.priority] || `prio ${entry.priority}`;
+        const target = `${entry.bus}:${hex(entry.address)}`;
+        const name = names.get(i2cDeviceKey(entry.bus, entry.address)) || '';
+        tally(byBus, `bus ${entry.bus}`, entry, ownUs);
+        tally(byAddress, `${target} ${name}`.trim(), entry, ownUs);
+        tally(byPriority, priority, entry, ownUs);
+        tally(byTask, entry.task, entry, ownUs);
+        results.set(entry.result, (results.get(entry.result) || 0) + 1);
+
+        const marks = [entry.batch ? 'batch' : '', entry.retry ? 'retry' : ''].filter(Boolean).join(',');
+        lines.push(
+            `${ms(startUs).padStart(11)} ${ms(entry.durationUs).padStart(10)}  ${target.padEnd(8)}  ` +
+            `${name.padEnd(18).slice(0, 18)}  ` +
+            `${entry.writeLen > 0 ? hex(entry.command) : '  - '}  ${String(entry.writeLen).padStart(2)} ${String(entry.readLen).padStart(2)}  ` +
+            `${priority.padEnd(9)}  ${entry.task.padEnd(16).slice(0, 16)}  ${entry.result.toUpperCase()}${marks ? ` [${marks}]` : ''}`
+        );
+    }
+
+    // Spread each transaction's bus time over the bins it overlaps. The buses run in
+    // parallel, so utilisation is relative to the capacity of all buses seen.
+    const windowUs = Math.max(endUs, 1);
+    const capacityUs = windowUs * Math.max(byBus.size, 1);
+    const binUs = windowUs / UTILISATION_BINS;
+    for (let i = 0; i < UTILISATION_BINS; i++) busyPerBin.push(0);
+    lastTransaction = new Map<number, string>();
+    for (const entry of entries) {
+        const transaction = `${entry.startUs}/${entry.durationUs}`;
+        if (entry.batch && transaction === lastTransaction.get(entry.bus)) continue;
+        lastTransaction.set(entry.bus, transaction);
+
+        const start = rel(entry.startUs);
+        const end = start + entry.durationUs;
+        for (let bin = Math.floor(start / binUs); bin < UTILISATION_BINS && bin * binUs < end; bin++) {
+            busyPerBin[bin] += Math.min(end, (bin + 1) * binUs) - Math.max(start, bin * binUs);
+        }
+    }
+
+    const summary: string[] = [
+        `I2C trace: ${entries.length} attempts over ${ms(windowUs)} ms`,
+        `Bus utilisation: ${pct(busyUs, capacityUs)} of ${byBus.size} bus(es) (${ms(busyUs)} ms busy), longest idle gap ${ms(longestGapUs)} ms`,
+        `Results: ${[...results.entries()].map(([name, count]) => `${count} ${name}`).join(', ')}`,
+        '',
+        `Utilisation over time (${ms(binUs)} ms per bar):`,
+        ...busyPerBin.map((busy, bin) =>
+            `  ${ms(bin * binUs).padStart(10)} ms  ${'#'.repeat(Math.round(20 * busy / (binUs * byBus.size))).padEnd(20)}  ` +
+            pct(busy, binUs * byBus.size)),
+        '',
+        ...tallyTable('By bus:', byBus, windowUs),
+        '',
+        ...tallyTable('By address:', byAddress, windowUs),
+        '',
+        ...tallyTable('By queue:', byPriority, windowUs),
+        '',
+        ...tallyTable('By task:', byTask, windowUs),
+        '',
+        'Timeline:'
+    ];
+
+    return [...summary, ...lines].join('\n');
+}
@@ -1,5 +1,6 @@
 // src/utils/liveHints.ts
 import * as vscode from 'vscode';
+import { LuaProfile } from '../brickBleApi';
 
 export function showLiveHint(message: string, uri: vscode.Uri, line: number) {
   const decoType = vscode.window.createTextEditorDecorationType({
@@ -19,3 +20,51 @@ export function showLiveHint(message: string, uri: vscode.Uri, line: number) {
     setTimeout(() => decoType.dispose(), 8000);
   }
 }
+
+// Hotspot decorations from the last profile, kept so a new profile replaces them
+let hotspotDecorations: vscode.TextEditorDecorationType[] = [];
+
+export function clearProfileHotspots() {
+  hotspotDecorations.forEach(deco => deco.dispose());
+  hotspotDecorations = [];
+}
+
+export function showProfileHotspots(profile: LuaProfile, uri: vscode.Uri) {
+  clearProfileHotspots();
+
+  const editor = vscode.window.visibleTextEditors.find(e => e.document.uri.fsPath === uri.fsPath);
+  // The ESP32 sends only the hottest lines of a full table; shares are of every attributed sample
+  const attributed = profile.totalSamples - profile.droppedSamples;
+  if (!editor || attributed === 0) {
+    return;
+  }
+
+  // Several functions can share a line; merge them so each line gets one hint
+  const samplesPerLine = new Map<number, number>();
+  for (const entry of profile.entries) {
+    samplesPerLine.set(entry.line, (samplesPerLine.get(entry.line) || 0) + entry.samples);
+  }
+
+  for (const [line, samples] of samplesPerLine) {
+    const share = samples / attributed;
+    if (line < 1 || line > editor.document.lineCount || share < 0.01) {
+      continue;
+    }
+
+    // Heat: >= 25% hot, >= 5% warm, otherwise cool
+    const alpha = share >= 0.25 ? 0.35 : share >= 0.05 ? 0.2 : 0.08;
+    const decoType = vscode.window.createTextEditorDecorationType({
+      isWholeLine: true,
+      backgroundColor: `rgba(255, 80, 0, ${alpha})`,
+      after: {
+        contentText: `🔥 ${(share * 100).toFixed(1)}% (${samples} samples)`,
+        color: new vscode.ThemeColor('editorHint.foreground'),
+        margin: '10px'
+      }
+    });
+
+    const range = new vscode.Range(line - 1, 0, line - 1, 0);
+    editor.setDecorations(decoType, [{ range }]);
+    hotspotDecorations.push(decoType);
+  }
+}
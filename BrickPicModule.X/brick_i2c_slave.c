@@ -0,0 +1,485 @@
+/**
+ * BrickLab IC Slave - protocol core
+ * Portable C: no register access, see brick_i2c_slave.h
+ */
+
+#include "brick_i2c_slave.h"
+
+// Received writes wait in a ring for the main loop. The ISR receives straight into the
+// slot at frame_head and publishes it by advancing frame_head; the main loop applies the
+// slot at frame_tail and frees it by advancing frame_tail. Each index is a single byte with
+// one writer, so neither side needs a lock.
+typedef struct {
+    uint8_t len;        // cmd + payload
+    bool general_call;  // came in on the general call address
+    uint8_t data[BRICK_SLAVE_FRAME_MAX];
+} frame_t;
+static volatile frame_t frame_ring[BRICK_SLAVE_RING_SLOTS];
+static volatile frame_t frame_spill;      // receives while the ring is full
+static volatile uint8_t frame_head = 0;   // written by the ISR only
+static volatile uint8_t frame_tail = 0;   // written by the main loop only
+
+// Register file (BRICK_REG_BASE). Identity and capabilities are filled in at boot; the
+// counters are kept in place; the device status is snapshotted when a read starts.
+brick_register_file_t brick_slave_registers;
+
+static const brick_slave_device_t *device;
+
+static volatile frame_t *rx_frame = &frame_spill;  // slot the current write goes to
+static volatile uint8_t *rx_buf = frame_spill.data;
+static volatile uint8_t rx_idx = 0;  // number of bytes written so far
+static volatile bool rx_overrun = false;  // the write was longer than BRICK_SLAVE_FRAME_MAX
+static volatile bool rx_general_call = false; // current write came in on the general call address
+static volatile uint8_t rx_crc = 0;  // CRC-8 of the address byte and the bytes written so far
+static volatile uint8_t tx_reg = 0;  // register file offset of the next byte read
+
+// What a read returns, decided by the write that preceded it in the same transaction
+typedef enum {
+    TX_REGISTERS = 0,  // the register file from tx_reg on; from the UUID by default
+    TX_SEARCH,         // CMD_ENUM_SEARCH reply
+    TX_CHECKED_STATUS, // CMD_CHECKED reply: tx_status, then the CRC
+    TX_CHECKED_REGISTERS, // CMD_CHECKED_READ reply: tx_left bytes from tx_reg on, then the CRC
+    TX_CRC,            // tx_crc, then past the end
+    TX_END,            // 0xFF
+} tx_source_t;
+static volatile tx_source_t tx_source = TX_REGISTERS;
+static volatile uint8_t tx_bit = 0;      // next UUID bit of the search reply
+static volatile uint8_t tx_status = 0;   // BRICK_FRAME_* of the checked frame just written
+static volatile uint8_t tx_left = 0;     // data bytes left in a checked read
+static volatile uint8_t tx_crc = 0;      // CRC-8 of the read address byte and the bytes sent
+
+// Checked frames taken: bit n of seq_window is set if seq_newest - n was taken
+static uint8_t seq_newest = 0;
+static uint16_t seq_window = 0;  // 0 = nothing taken since power-up
+
+// Address enumeration: we answer on BRICK_I2C_ENUM_ADDRESS until the host assigns an address
+static bool address_assigned = false;
+static bool enum_active = false;  // still taking part in the current UUID search
+
+// Group addressing: the command staged for the next latch (membership is the group_mask register)
+static uint8_t staged_buf[BRICK_SLAVE_FRAME_MAX - 1];   // cmd + payload
+static uint8_t staged_len = 0;  // 0 = nothing staged
+
+// The attention line follows events & event_mask from the next poll on
+static bool attention_stale = true;
+
+#define REG_OFFSET(reg) ((uint8_t)((reg) - BRICK_REG_BASE))
+
+void brick_slave_init(const brick_slave_device_t *dev, uint16_t max_clock_khz) {
+    device = dev;
+    brick_slave_registers.caps.protocol_version = BRICK_PROTOCOL_VERSION;
+    brick_slave_registers.caps.max_clock_khz = max_clock_khz;
+    brick_slave_registers.caps.max_write = BRICK_SLAVE_FRAME_MAX;
+    brick_slave_registers.caps.max_read = sizeof(brick_slave_registers);
+    brick_slave_registers.status.queue_slots = BRICK_SLAVE_RING_SLOTS;
+    brick_slave_registers.events = BRICK_EVENT_RESET;
+    brick_slave_registers.event_mask = BRICK_EVENT_ALL;
+}
+
+bool brick_slave_pending(void) {
+    return frame_head != frame_tail;
+}
+
+//====================================================================================
+// Main loop: applying commands
+//====================================================================================
+
+void brick_slave_raise_event(uint8_t events) {
+    brick_slave_registers.events |= events;
+    attention_stale = true;
+}
+
+static bool register_writable(uint8_t offset) {
+    return offset == REG_OFFSET(BRICK_REG_GROUP_MASK) ||
+           offset == REG_OFFSET(BRICK_REG_EVENTS) || offset == REG_OFFSET(BRICK_REG_EVENT_MASK) ||
+           (offset >= REG_OFFSET(BRICK_REG_DEVICE) && offset < REG_OFFSET(BRICK_REG_DEVICE) + device->move_size);
+}
+
+// Register write: frame[0] = pointer, then the data. Skips read-only registers, clears
+// the events written as 1, then acts on the blocks the write touched.
+static void write_registers(const volatile uint8_t *frame, uint8_t len) {
+    uint8_t *file = (uint8_t *)&brick_slave_registers;
+    uint8_t offset = REG_OFFSET(frame[0]);
+    bool move_written = false;
+
+    for (uint8_t i = 1; i < len && offset < sizeof(brick_slave_registers); i++, offset++) {
+        if (!register_writable(offset))
+            continue;
+        if (offset == REG_OFFSET(BRICK_REG_EVENTS))
+            file[offset] &= (uint8_t)~frame[i];
+        else
+            file[offset] = frame[i];
+        if (offset >= REG_OFFSET(BRICK_REG_DEVICE))
+            move_written = true;
+        else if (offset != REG_OFFSET(BRICK_REG_GROUP_MASK))
+            attention_stale = true;
+    }
+
+    if (move_written)
+        device->apply_move();
+}
+
+// Apply a command; frame[0] = command ID or register pointer, len = command byte + payload
+static void apply_command(const volatile uint8_t *frame, uint8_t len) {
+    if (frame[0] >= BRICK_REG_BASE)
+        write_registers(frame, len);
+    else
+        device->apply_command(frame, len);
+}
+
+// Writes to the general call address: only the groups named in data[1] take part
+static void handle_general_call(const volatile frame_t *frame) {
+    if (frame->len < 2 || !(frame->data[1] & brick_slave_registers.group_mask))
+        return;
+
+    switch ((brick_command_type_t)frame->data[0]) {
+        case CMD_LATCH:
+            if (staged_len > 0) {
+                apply_command(staged_buf, staged_len);
+                staged_len = 0;
+            }
+            break;
+
+        case CMD_GROUP_WRITE:
+            if (frame->len >= 3)  // mask + wrapped command
+                apply_command(&frame->data[2], frame->len - 2);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Writes to our own address; data[0] = command ID
+static void handle_frame(const volatile uint8_t *data, uint8_t len) {
+    if (data[0] == CMD_CHECKED) {
+        // The interrupt checked it and only queued a command it had not taken before
+        data += 2;
+        len -= BRICK_FRAME_CHECK_LEN;
+    }
+
+    switch ((brick_command_type_t)data[0]) {
+        case CMD_GROUP_ASSIGN:
+            if (len == 2)
+                brick_slave_registers.group_mask = data[1];
+            break;
+
+        case CMD_STAGE:
+            // Keep the wrapped command until a latch for one of our groups
+            if (len >= 2 && (uint8_t)(len - 1) <= sizeof(staged_buf)) {
+                for (uint8_t i = 1; i < len; i++)
+                    staged_buf[i - 1] = data[i];
+                staged_len = len - 1;
+            }
+            break;
+
+        default:
+            apply_command(data, len);
+            break;
+    }
+}
+
+void brick_slave_poll(void) {
+    if (attention_stale) {
+        attention_stale = false;
+        brick_slave_hw_attention((brick_slave_registers.events & brick_slave_registers.event_mask) != 0);
+    }
+
+    if (frame_tail == frame_head)
+        return;
+
+    const volatile frame_t *frame = &frame_ring[frame_tail & (BRICK_SLAVE_RING_SLOTS - 1)];
+    if (frame->general_call)
+        handle_general_call(frame);
+    else
+        handle_frame(frame->data, frame->len);
+    frame_tail++;
+}
+
+//====================================================================================
+// Interrupt: bus events
+//====================================================================================
+
+static uint8_t uuid_bit(uint8_t bit) {
+    return (brick_slave_registers.uuid.bytes[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+// One CMD_ENUM_SEARCH reply byte: (bit, !bit) pairs from UUID bit 'bit' on, (1, 1) once out of the search
+static uint8_t enum_search_byte(uint8_t bit) {
+    uint8_t out = 0xFF;
+
+    for (uint8_t pair = 0; pair < BRICK_ENUM_PAIRS_PER_BYTE; pair++, bit++) {
+        if (!enum_active || bit >= BRICK_ENUM_UUID_BITS)
+            continue;
+        out &= (uint8_t)~((uuid_bit(bit) ? 0x02 : 0x01) << (2 * pair));
+    }
+    return out;
+}
+
+// Register a one-byte write selects for the read after it; the read commands are aliases
+static uint8_t read_register(uint8_t cmd) {
+    if (cmd >= BRICK_REG_BASE)
+        return cmd;
+
+    switch ((brick_command_type_t)cmd) {
+        case CMD_GET_CAPS: return BRICK_REG_CAPS;
+        case CMD_GET_STATUS: return BRICK_REG_STATUS;
+        case CMD_STEPPER_STATUS: return BRICK_REG_STEPPER_STATUS;
+        case CMD_SENSOR_GET_CM: return BRICK_REG_SENSOR_VALUE;
+        default: return BRICK_REG_UUID;  // CMD_IDENTIFY
+    }
+}
+
+// CMD_CHECKED_READ [cmd, reg, len, crc]: the checked version of a one-byte pointer write
+static void prepare_checked_read(void) {
+    if (rx_idx != 4 || rx_crc != 0) {
+        // Send a CRC the host cannot match, so it asks again
+        brick_slave_registers.counters.crc_errors++;
+        tx_crc = (uint8_t)~tx_crc;
+        tx_source = TX_CRC;
+        return;
+    }
+
+    tx_reg = REG_OFFSET(read_register(rx_buf[1]));
+    tx_left = rx_buf[2];
+    tx_source = tx_left > 0 ? TX_CHECKED_REGISTERS : TX_CRC;
+}
+
+// Hands the write just received to the main loop; false if it had to be dropped
+static bool queue_frame(void) {
+    brick_module_status_t *status = &brick_slave_registers.status;
+
+    if (rx_frame == &frame_spill || rx_overrun) {
+        if (status->frames_dropped < 0xFF)
+            status->frames_dropped++;
+        return false;
+    }
+
+    rx_frame->len = rx_idx;
+    rx_frame->general_call = rx_general_call;
+    frame_head++;
+
+    uint8_t depth = (uint8_t)(frame_head - frame_tail);
+    if (depth > status->queue_high_water)
+        status->queue_high_water = depth;
+    return true;
+}
+
+// True if a frame with this sequence number was taken already, or is too old to tell
+static bool seq_taken(uint8_t seq) {
+    uint8_t age = (uint8_t)(seq_newest - seq);
+
+    if (seq_window == 0 || (int8_t)age < 0)  // nothing taken yet, or newer than the newest
+        return false;
+    return age >= BRICK_FRAME_SEQ_WINDOW || (seq_window & (1u << age));
+}
+
+static void seq_take(uint8_t seq) {
+    uint8_t ahead = (uint8_t)(seq - seq_newest);
+
+    if (seq_window != 0 && (int8_t)ahead <= 0) {
+        seq_window |= 1u << (uint8_t)-ahead;  // a retry overtaken by newer frames
+        return;
+    }
+    seq_window = (seq_window == 0 || ahead >= BRICK_FRAME_SEQ_WINDOW) ? 1 : (uint16_t)((seq_window << ahead) | 1);
+    seq_newest = seq;
+}
+
+// CMD_CHECKED [cmd, seq, command + payload, crc]: queues the command unless the frame is corrupt
+// or a repeat. Returns its BRICK_FRAME_* status.
+static uint8_t take_checked_frame(void) {
+    uint8_t seq = rx_buf[1];
+
+    if (rx_idx < BRICK_FRAME_CHECK_LEN || rx_crc != 0) {
+        brick_slave_registers.counters.crc_errors++;
+        return 0;
+    }
+    if (rx_idx == BRICK_FRAME_CHECK_LEN) {
+        // No command: the host restarts its numbering after seq
+        seq_newest = seq;
+        seq_window = 0xFFFF;
+        return BRICK_FRAME_ACCEPTED;
+    }
+    if (seq_taken(seq)) {
+        brick_module_status_t *status = &brick_slave_registers.status;
+        if (status->duplicates < 0xFF)
+            status->duplicates++;
+        return BRICK_FRAME_ACCEPTED | BRICK_FRAME_DUPLICATE;
+    }
+    if (!queue_frame())
+        return 0;
+    seq_take(seq);
+    return BRICK_FRAME_ACCEPTED;
+}
+
+// Decides what a read returns from the write that preceded it in the same transaction
+static void prepare_read(uint8_t address) {
+    brick_slave_registers.counters.reads++;
+    if (device->load_status)
+        device->load_status();
+
+    tx_crc = brick_crc8_byte(0, (uint8_t)((address << 1) | 1));
+    tx_source = TX_REGISTERS;
+    tx_reg = REG_OFFSET(rx_idx == 1 ? read_register(rx_buf[0]) : BRICK_REG_UUID);
+    if (rx_idx == 0)
+        return;
+
+    switch ((brick_command_type_t)rx_buf[0]) {
+        case CMD_ENUM_SEARCH:
+            if (rx_idx != 3)
+                break;
+            tx_source = TX_SEARCH;
+
+            // Drop out if we lost on the bit the host just resolved
+            tx_bit = rx_buf[1];
+            if (tx_bit > 0 && tx_bit <= BRICK_ENUM_UUID_BITS && uuid_bit(tx_bit - 1) != rx_buf[2])
+                enum_active = false;
+            break;
+
+        case CMD_CHECKED:
+            // The write ends at the repeated start; the host reads whether we took it
+            brick_slave_registers.counters.frames++;
+            tx_status = take_checked_frame();
+            tx_source = TX_CHECKED_STATUS;
+            break;
+
+        case CMD_CHECKED_READ:
+            prepare_checked_read();
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool enum_uuid_matches(const volatile uint8_t *uuid) {
+    for (uint8_t i = 0; i < sizeof(brick_slave_registers.uuid); i++) {
+        if (uuid[i] != brick_slave_registers.uuid.bytes[i])
+            return false;
+    }
+    return true;
+}
+
+// Writes the next transaction depends on take effect at once, in the ISR: they change the
+// address we answer on, the enumeration state a search read reports, or how the MSSP
+// samples. Returns false for the writes the main loop applies.
+static bool handle_bus_frame(void) {
+    if (rx_general_call) {
+        if (rx_idx != 3 || rx_buf[0] != CMD_BUS_CLOCK)  // every module, grouped or not
+            return false;
+        brick_slave_hw_set_clock((uint16_t)(rx_buf[1] | (rx_buf[2] << 8)));
+        return true;
+    }
+
+    switch ((brick_command_type_t)rx_buf[0]) {
+        case CMD_CHECKED:
+            take_checked_frame();  // nobody reads the status
+            return true;
+
+        case CMD_CHECKED_READ:  // without its read
+            return true;
+
+        case CMD_ENUM_RESET:
+            enum_active = !address_assigned;
+            return true;
+
+        case CMD_ENUM_ASSIGN:
+            // Only the module whose UUID the host resolved moves to the new address
+            if (rx_idx == 18 && enum_uuid_matches(&rx_buf[2])) {
+                brick_slave_hw_set_address(rx_buf[1]);
+                address_assigned = true;
+                enum_active = false;
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void receive_into_ring(void) {
+    if ((uint8_t)(frame_head - frame_tail) < BRICK_SLAVE_RING_SLOTS)
+        rx_frame = &frame_ring[frame_head & (BRICK_SLAVE_RING_SLOTS - 1)];
+    else
+        rx_frame = &frame_spill;  // bus-level writes still work; the rest is counted as dropped
+    rx_buf = rx_frame->data;
+    rx_overrun = false;
+}
+
+void brick_slave_address(uint8_t address, bool read) {
+    if (read)
+        prepare_read(address);
+    else
+        receive_into_ring();
+    rx_idx = 0;
+    rx_crc = brick_crc8_byte(0, (uint8_t)(address << 1));
+    rx_general_call = (address == BRICK_I2C_GENERAL_CALL_ADDRESS);
+    brick_slave_hw_activity(true);
+}
+
+static uint8_t register_byte(void) {
+    if (tx_reg < sizeof(brick_slave_registers))
+        return ((const uint8_t *)&brick_slave_registers)[tx_reg++];
+    return 0xFF;  // past the end of the file
+}
+
+uint8_t brick_slave_tx(void) {
+    uint8_t out;
+
+    switch (tx_source) {
+        case TX_SEARCH:
+            out = enum_search_byte(tx_bit);
+            if (tx_bit < BRICK_ENUM_UUID_BITS)
+                tx_bit += BRICK_ENUM_PAIRS_PER_BYTE;
+            return out;
+
+        case TX_CHECKED_STATUS:
+            out = tx_status;
+            tx_source = TX_CRC;
+            break;
+
+        case TX_CHECKED_REGISTERS:
+            out = register_byte();
+            if (--tx_left == 0)
+                tx_source = TX_CRC;
+            break;
+
+        case TX_CRC:
+            tx_source = TX_END;
+            return tx_crc;
+
+        case TX_END:
+            return 0xFF;
+
+        default:
+            return register_byte();
+    }
+
+    tx_crc = brick_crc8_byte(tx_crc, out);
+    return out;
+}
+
+void brick_slave_rx(uint8_t data) {
+    rx_crc = brick_crc8_byte(rx_crc, data);
+    if (rx_idx < BRICK_SLAVE_FRAME_MAX) {
+        rx_buf[rx_idx++] = data;
+        return;
+    }
+    rx_overrun = true;  // overflow protection
+}
+
+void brick_slave_stop(void) {
+    brick_slave_hw_activity(false);
+
+    if (rx_idx == 0)  // No command
+        return;
+
+    brick_slave_registers.counters.frames++;
+    if (!handle_bus_frame())
+        queue_frame();
+    rx_idx = 0;  // ready for next packet
+}
+
+void brick_slave_bus_error(void) {
+    brick_slave_registers.counters.bus_errors++;
+}
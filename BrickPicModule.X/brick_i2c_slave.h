@@ -0,0 +1,55 @@
+/**
+ * BrickLab IC Slave - protocol core
+ *
+ * The slave state machine without any register access: address match, receive and
+ * transmit, the frame ring, the register file, the UUID search and command dispatch. The
+ * firmware feeds it bus events from its MSSP interrupt and supplies the hardware through
+ * the brick_slave_hw_* functions and a table for its device type, so the same core runs on
+ * every module type and builds on a PC.
+ */
+
+#ifndef BRICK_I2C_SLAVE_H
+#define BRICK_I2C_SLAVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "brick_i2c_api.h"
+
+#define BRICK_SLAVE_RING_SLOTS 4   // received commands waiting for the main loop; power of two
+#define BRICK_SLAVE_FRAME_MAX  20  // cmd + payload (CMD_ENUM_ASSIGN: cmd + address + UUID)
+
+/**
+ * What a device type adds to the core. apply_command and apply_move run in the main loop
+ * (brick_slave_poll); load_status runs in the interrupt as a read starts.
+ */
+typedef struct {
+    uint8_t move_size;  // bytes of the RW move block that opens the device registers, 0 = none
+    void (*apply_command)(const volatile uint8_t *frame, uint8_t len);  // frame[0] = command ID
+    void (*apply_move)(void);   // a register write touched the move block
+    void (*load_status)(void);  // snapshot the device status registers; NULL = nothing to do
+} brick_slave_device_t;
+
+/** The register file (BRICK_REG_BASE). The firmware fills in the UUID before brick_slave_init. */
+extern brick_register_file_t brick_slave_registers;
+
+void brick_slave_init(const brick_slave_device_t *device, uint16_t max_clock_khz);
+
+// Bus events, from the MSSP interrupt
+void brick_slave_address(uint8_t address, bool read);  // 7-bit address matched, 0 = general call
+void brick_slave_rx(uint8_t data);
+uint8_t brick_slave_tx(void);
+void brick_slave_stop(void);
+void brick_slave_bus_error(void);
+
+// Main loop
+void brick_slave_poll(void);     // applies the oldest received command, if any
+bool brick_slave_pending(void);  // commands received but not applied yet
+void brick_slave_raise_event(uint8_t events);  // BRICK_EVENT_*; the line follows on the next poll
+
+// Hardware adapter, implemented by the firmware; called from the interrupt unless noted
+void brick_slave_hw_set_address(uint8_t address);
+void brick_slave_hw_set_clock(uint16_t khz);
+void brick_slave_hw_activity(bool on);
+void brick_slave_hw_attention(bool on);  // from the main loop: pull the attention line low (on) or let it go
+
+#endif // BRICK_I2C_SLAVE_H
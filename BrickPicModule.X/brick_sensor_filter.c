@@ -0,0 +1,72 @@
+/**
+ * BrickLab sensor filter - see brick_sensor_filter.h
+ */
+
+#include "brick_sensor_filter.h"
+
+void brick_sensor_filter_configure(brick_sensor_filter_t *filter, brick_sensor_config_t *config,
+                                   uint16_t default_period_ms, uint16_t min_period_ms) {
+    if (config->period_ms == 0)
+        config->period_ms = default_period_ms;
+    else if (config->period_ms < min_period_ms)
+        config->period_ms = min_period_ms;
+    if (config->median == 0)
+        config->median = 1;
+    else if (config->median > BRICK_SENSOR_MAX_MEDIAN)
+        config->median = BRICK_SENSOR_MAX_MEDIAN;
+    else if ((config->median & 1) == 0)
+        config->median--;
+    if (config->ema_shift > BRICK_SENSOR_MAX_EMA_SHIFT)
+        config->ema_shift = BRICK_SENSOR_MAX_EMA_SHIFT;
+
+    filter->config = *config;
+    filter->window_fill = 0;
+    filter->window_next = 0;
+    filter->averaged = false;
+}
+
+// Median of one channel's window; an insertion sort of a copy, the window being short
+static uint16_t brick_sensor_filter_median(const brick_sensor_filter_t *filter, uint8_t channel) {
+    uint16_t sorted[BRICK_SENSOR_MAX_MEDIAN];
+
+    for (uint8_t i = 0; i < filter->window_fill; i++) {
+        uint16_t v = filter->window[channel][i];
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > v; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+    }
+    return sorted[filter->window_fill / 2];
+}
+
+void brick_sensor_filter_take(brick_sensor_filter_t *filter, const uint16_t *measured, uint8_t channels,
+                              uint32_t taken_ms, brick_sensor_reading_t *reading) {
+    uint16_t value[BRICK_SENSOR_CHANNELS] = {0};
+
+    for (uint8_t c = 0; c < channels; c++)
+        filter->window[c][filter->window_next] = measured[c];
+    if (++filter->window_next == filter->config.median)
+        filter->window_next = 0;
+    if (filter->window_fill < filter->config.median)
+        filter->window_fill++;
+
+    for (uint8_t c = 0; c < channels; c++) {
+        int32_t median = (int32_t)brick_sensor_filter_median(filter, c) << 8;
+        if (filter->averaged)
+            filter->average[c] += (median - filter->average[c]) >> filter->config.ema_shift;
+        else
+            filter->average[c] = median;
+        value[c] = (uint16_t)((filter->average[c] + 128) >> 8);
+    }
+    filter->averaged = true;
+
+    reading->flags = BRICK_SENSOR_VALID;
+    reading->samples++;
+    reading->timestamp_ms = taken_ms;
+    for (uint8_t c = 0; c < BRICK_SENSOR_CHANNELS; c++)
+        reading->value[c] = value[c];
+}
+
+void brick_sensor_filter_missed(brick_sensor_reading_t *reading) {
+    reading->flags |= BRICK_SENSOR_OUT_OF_RANGE;
+}
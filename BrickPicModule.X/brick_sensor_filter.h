@@ -0,0 +1,41 @@
+/**
+ * BrickLab sensor filter
+ *
+ * What a sensor module does with its measurements before the host reads them: a median
+ * over the last brick_sensor_config_t::median of them, then an exponential average, per
+ * channel. Plain arithmetic without register access, so it builds on a PC; the firmware
+ * feeds it from the main loop and publishes the reading with interrupts off.
+ */
+
+#ifndef BRICK_SENSOR_FILTER_H
+#define BRICK_SENSOR_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "brick_i2c_api.h"
+
+typedef struct {
+    brick_sensor_config_t config;  // in effect
+    uint16_t window[BRICK_SENSOR_CHANNELS][BRICK_SENSOR_MAX_MEDIAN];  // last measurements, a ring
+    uint8_t window_fill;
+    uint8_t window_next;
+    int32_t average[BRICK_SENSOR_CHANNELS];  // in 1/256 of the unit
+    bool averaged;  // average holds a value
+} brick_sensor_filter_t;
+
+// Clamps config in place and takes it, starting the filter over: a period of 0 becomes
+// default_period_ms, one below min_period_ms is raised to it, the median window goes to an
+// odd 1..BRICK_SENSOR_MAX_MEDIAN (an even one to the odd one below), ema_shift to at most
+// BRICK_SENSOR_MAX_EMA_SHIFT
+void brick_sensor_filter_configure(brick_sensor_filter_t *filter, brick_sensor_config_t *config,
+                                   uint16_t default_period_ms, uint16_t min_period_ms);
+
+// A measurement of the first channels: into the window, then the median into the average.
+// reading gets the result, BRICK_SENSOR_VALID alone in its flags, one more sample and taken_ms.
+void brick_sensor_filter_take(brick_sensor_filter_t *filter, const uint16_t *measured, uint8_t channels,
+                              uint32_t taken_ms, brick_sensor_reading_t *reading);
+
+// Nothing in range: flagged, the value stays as it was
+void brick_sensor_filter_missed(brick_sensor_reading_t *reading);
+
+#endif // BRICK_SENSOR_FILTER_H
@@ -1,12 +1,15 @@
 /**
- * BrickLab IC Slave - Stepper Motor Implementation
- * Uses brick_i2c_api.h for protocol definitions
+ * BrickLab IC Slave - Stepper Motor / Servo / Distance Sensor Implementation
+ * Uses brick_i2c_api.h for protocol definitions; the protocol itself runs in
+ * brick_i2c_slave.c, this file is its hardware adapter and the device drivers
  */
 
 #include <xc.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "brick_i2c_api.h"  // Include the API header
+#include "brick_i2c_slave.h"  // Protocol core
+#include "brick_sensor_filter.h"  // Median and average of the sensor's measurements
 
 // Configuration bits (same as MCC)
 #pragma config FEXTOSC = ECH
@@ -52,23 +55,25 @@
 #pragma config EBTR7 = OFF
 #pragma config EBTRB = OFF
 
-// IC Client events (replicating i2c_client_types.h)
-typedef enum {
-    I2C_CLIENT_TRANSFER_EVENT_NONE = 0,
-    I2C_CLIENT_TRANSFER_EVENT_ADDR_MATCH,
-    I2C_CLIENT_TRANSFER_EVENT_RX_READY,
-    I2C_CLIENT_TRANSFER_EVENT_TX_READY,
-    I2C_CLIENT_TRANSFER_EVENT_STOP_BIT_RECEIVED,
-    I2C_CLIENT_TRANSFER_EVENT_ERROR,
-} i2c_client_transfer_event_t;
-
-// Device UUID - STEPPER MOTOR
+// Device type the image is built for: MOTOR_STEPPER, MOTOR_SERVO_180 for a servo on RA0,
+// SENSOR_DISTANCE for an HC-SR04 style sensor on RA1/RA2, or LED_RGB. The device drivers
+// use the device registers, so an image runs one of them; every image drives the status LED.
+#define MODULE_DEVICE_TYPE MOTOR_STEPPER
+
+// Device UUID - from MODULE_DEVICE_TYPE. Bytes 8..15 (unique_id) are filled in from the chip at boot.
 const uint8_t BRICK_DEVICE_UUID[16] = {
-    0x42, 0x4c, 0x20, 0x02, 0x00, 0x00, 0x00, 0x00,
-    0x93, 0x74, 0x67, 0x5a, 0x47, 0x12, 0xa0, 0x23
+    0x42, 0x4c, (uint8_t)(MODULE_DEVICE_TYPE >> 8), (uint8_t)MODULE_DEVICE_TYPE, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-#define I2C_DEVICE_ADDRESS (BRICK_DEVICE_UUID[8])  // 0x93
+// Capabilities record (CMD_GET_CAPS). The MSSP follows SCL up to 1 MHz at Fosc = 64 MHz,
+// holding the clock (SEN) while the ISR prepares each byte.
+#define MODULE_MAX_CLOCK_KHZ 1000
+
+#define _XTAL_FREQ 64000000UL  // for __delay_us
+
+#define DIA_MUI_ADDRESS 0x3F0000  // Microchip Unique Identifier in the Device Information Area
+#define DIA_MUI_BYTES   18        // 9 words
 
 // Stepper motor control functions
 // Pins: S1=RC4, S2=RD3, S3=RD2, STEP=RC6, DIR=RC5
@@ -78,21 +83,145 @@ static inline void stepper_set_s3(uint8_t val)   { LATDbits.LATD2 = (val != 0);
 static inline void stepper_set_step(uint8_t val) { LATCbits.LATC6 = (val != 0); }
 static inline void stepper_set_dir(uint8_t val)  { LATCbits.LATC5 = (val != 0); }
 
+// Attention line on RB0, open drain and shared with the other modules on the bus
+static inline void attention_write(uint8_t pull) { LATBbits.LATB0 = (pull == 0); }
+
+// Motion engine: TMR4 interrupts at STEPPER_TICK_HZ and a phase accumulator adds the
+// current speed every tick, so the step rate follows the profile without reloading the
+// timer. A STEP pulse lasts one tick, which caps the rate at half the tick rate. The
+// profile runs over the steps of the lead axis; this axis steps on as many of them as its
+// own move has, spread by a Bresenham error term. A plain move is its own lead.
+#define STEPPER_TICK_HZ       20000UL  // Fosc/4 / 16 / (STEPPER_TICK_PR + 1)
+#define STEPPER_TICK_PR       49
+#define STEPPER_TICKS_PER_MS  (STEPPER_TICK_HZ / 1000)
+#define STEPPER_PHASE_WRAP    (STEPPER_TICK_HZ * 1000UL)  // speeds are in milli-steps/s
+#define STEPPER_START_SPEED   50       // steps/s a ramp starts from and ends at
+
+// Servo: PWM3 on RA0, on TMR2 at Fosc/4 / 128, so a duty count is 2 us and the PWM period
+// 2.048 ms. The duty is non-zero for one period in SERVO_FRAME_PERIODS, which gives the
+// usual ~20 ms servo frame with the pulse width exact to the count.
+#define SERVO_PWM_PR          0xFF
+#define SERVO_FRAME_PERIODS   10       // 20.48 ms
+#define SERVO_MIN_COUNT       500UL    // 1000 us pulse at 0 degrees
+#define SERVO_MAX_COUNT       1000UL   // 2000 us pulse at BRICK_SERVO_MAX_ANGLE
+#define SERVO_SPAN            (SERVO_MAX_COUNT - SERVO_MIN_COUNT)
+// Position step per frame for 1 degree/s, in 1/256 counts, times 100
+#define SERVO_SLEW_X100       (SERVO_SPAN * 256UL * 2048UL / (BRICK_SERVO_MAX_ANGLE * 1000UL))
+
+// Distance sensor: a 10 us pulse on TRIG=RA1 starts a measurement and the sensor answers
+// with a pulse on ECHO=RA2 as long as the sound took there and back. TMR1 times that pulse
+// in gate single-pulse mode at Fosc/4 / 8, so 116 counts are 1 cm; an echo longer than
+// TMR1 counts (~5.6 m) is out of range. TMR0 keeps the millisecond clock that paces and
+// stamps the measurements.
+#define SENSOR_CLOCK_PR           249  // TMR0 at Fosc/4 / 64: 250 counts per ms
+#define SENSOR_COUNTS_PER_CM      116
+#define SENSOR_DEFAULT_PERIOD_MS  100
+#define SENSOR_MIN_PERIOD_MS      60   // the sensor's own cycle; sooner, it hears old echoes
+#define SENSOR_ECHO_TIMEOUT_MS    40   // no echo by then: nothing in range
+#define SENSOR_DEFAULT_MEDIAN     3
+#define SENSOR_DEFAULT_EMA_SHIFT  1
+
+// Status LED: bit-angle modulation paced by TMR6 at Fosc/4 / 128 (8 us). Bit b of each
+// channel's duty is shown for 2^(b + 1) counts, so a cycle of eight interrupts gives 8-bit
+// PWM at ~245 Hz on any pin. Fades advance once per cycle.
+#define LED_CYCLE_US   4080  // 255 duty units of 16 us
+#define LED_CHANNELS   3     // red, green, blue
+#define STATUS_RED     0x01
+#define STATUS_GREEN   0x02
+#define STATUS_BLUE    0x04
+
+// Perceived brightness to duty (gamma 2.2)
+static const uint8_t led_gamma[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
+static volatile bool led_lit = false;     // a colour is set: the LED shows it
+static volatile uint8_t led_activity = 0; // STATUS_* indicators, shown while no colour is set
+
+static inline void led_write_pins(uint8_t on) {
+    LATDbits.LATD1 = (on & STATUS_RED) != 0;
+    LATDbits.LATD0 = (on & STATUS_GREEN) != 0;
+    LATCbits.LATC7 = (on & STATUS_BLUE) != 0;
+}
+
+// Called from the ISRs or with interrupts off only
+static inline void led_set_activity(uint8_t led, uint8_t val) {
+    led_activity = val ? (uint8_t)(led_activity | led) : (uint8_t)(led_activity & ~led);
+    if (!led_lit)
+        led_write_pins(led_activity);
+}
+
 // LED control functions (for debugging/status)
-static inline void digital_write_red(uint8_t val)   { LATDbits.LATD1 = (val != 0); }   // Status LED
-static inline void digital_write_green(uint8_t val) { LATDbits.LATD0 = (val != 0); } // Status LED
-static inline void digital_write_blue(uint8_t val)  { LATCbits.LATC7 = (val != 0); }  // Status LED
+static inline void digital_write_red(uint8_t val)   { led_set_activity(STATUS_RED, val); }   // Status LED
+static inline void digital_write_green(uint8_t val) { led_set_activity(STATUS_GREEN, val); } // Status LED
+static inline void digital_write_blue(uint8_t val)  { led_set_activity(STATUS_BLUE, val); }  // Status LED
+
+// Motion state, shared by the TMR4 and MSSP interrupts (same priority, so never concurrent)
+typedef enum {
+    MOTION_IDLE = 0,
+    MOTION_ACCEL,
+    MOTION_CRUISE,
+    MOTION_DECEL,
+} motion_phase_t;
+static volatile motion_phase_t motion_phase = MOTION_IDLE;
+static int32_t motion_position = 0;
+static uint32_t motion_remaining = 0;  // lead steps left in the move
+static uint32_t motion_lead = 0;       // lead steps of the move
+static uint32_t motion_axis = 0;       // steps of this axis in the move, at most motion_lead
+static uint32_t motion_error = 0;      // Bresenham term: this axis steps each time it reaches motion_lead
+static uint32_t motion_ramp_steps = 0; // steps the ramp up took = steps the ramp down needs
+static uint32_t motion_speed = 0;      // milli-steps/s
+static uint32_t motion_max_speed = 0;  // milli-steps/s
+static uint32_t motion_min_speed = 0;  // milli-steps/s the ramp down stops at
+static uint32_t motion_accel = 0;      // milli-steps/s added per millisecond
+static uint32_t motion_phase_acc = 0;
+static int8_t motion_dir = 1;
+static uint8_t motion_ms_ticks = 0;
+static uint8_t motion_flags = 0;       // BRICK_STEPPER_REJECTED
+static uint16_t motion_speed_sps = 0;  // this axis' step rate in steps/s, kept by the main loop
+static uint32_t motion_ratio = 0x10000; // motion_axis / motion_lead in 1/65536, main loop only
 
-// Global variables
-static volatile uint8_t rx_buf[8];   // cmd + payload (increased for stepper data)
-static volatile uint8_t rx_idx = 0;  // number of bytes written so far
-static volatile uint8_t tx_idx = 0;  // UUID byte index for reads
+// A move was accepted and the host has not been told it finished (BRICK_EVENT_MOVE_DONE).
+// Main loop only.
+static bool move_unreported = false;
 
-// Device state
-static brick_device_impl_t device_state = {0};
+// Servo state, shared by the TMR2 and MSSP interrupts. Positions are in 1/256 duty counts.
+static uint32_t servo_position = 0;    // 0 = no pulses yet
+static uint32_t servo_target = 0;
+static uint32_t servo_step = 0;        // per frame, 0 = jump
+static uint8_t servo_period = 0;       // PWM periods into the frame
+static uint8_t servo_angle = 0;        // servo_position in degrees, kept by the main loop
 
-// Callback function pointer
-static bool (*i2c_callback_function)(i2c_client_transfer_event_t event) = NULL;
+// Sensor state, main loop only but for two things: TMR0 counts clock_ms, and the MSSP
+// interrupt copies sensor_latest into the reading registers as a read starts.
+static volatile uint32_t clock_ms = 0;
+static bool sensor_measuring = false;
+static uint32_t sensor_started_ms = 0;
+static brick_sensor_filter_t sensor_filter;  // holds the config in effect
+static brick_sensor_reading_t sensor_latest;
+
+// Status LED state, shared by TMR6 and the main loop. Levels are in 1/256 of a brightness step.
+static uint16_t led_level[LED_CHANNELS];
+static int16_t led_step[LED_CHANNELS];   // per cycle
+static uint8_t led_target[LED_CHANNELS];
+static uint16_t led_fade_cycles = 0;     // cycles left; the last one lands on the target
+static uint8_t led_duty[LED_CHANNELS];   // gamma applied, for the cycle being shown
+static uint8_t led_bit = 0;              // duty bit being shown
 
 // Hand-written IC functions (replicating MCC interface)
 void I2C1_WriteByte(uint8_t wrByte) {
@@ -104,10 +233,6 @@ uint8_t I2C1_ReadByte(void) {
     return SSP1BUF;
 }
 
-void I2C1_CallbackRegister(bool (*callback)(i2c_client_transfer_event_t clientEvent)) {
-    i2c_callback_function = callback;
-}
-
 // System initialization functions
 void CLOCK_Initialize(void) {
     OSCCON1 = (0 << _OSCCON1_NDIV_POSN) | (6 << _OSCCON1_NOSC_POSN);
@@ -143,11 +268,23 @@ void PIN_MANAGER_Initialize(void) {
     ANSELDbits.ANSELD0 = 0;  TRISDbits.TRISD0 = 0;  // Green status LED
     ANSELDbits.ANSELD1 = 0;  TRISDbits.TRISD1 = 0;  // Red status LED
     ANSELCbits.ANSELC7 = 0;  TRISCbits.TRISC7 = 0;  // Blue status LED
+
+    // Configure servo pulse pin as digital output
+    ANSELAbits.ANSELA0 = 0;  TRISAbits.TRISA0 = 0;  // Servo (PWM3)
+
+    // Configure distance sensor pins: trigger output, echo input (TMR1 gate)
+    ANSELAbits.ANSELA1 = 0;  TRISAbits.TRISA1 = 0;  // TRIG
+    ANSELAbits.ANSELA2 = 0;                          // ECHO
+
+    // Configure attention pin as open-drain output, released until an event is pending
+    ANSELBbits.ANSELB0 = 0;  ODCONBbits.ODCB0 = 1;  LATBbits.LATB0 = 1;  TRISBbits.TRISB0 = 0;
     
     // PPS configuration (same as MCC: RC0=SDA, RC1=SCL)
     PPSLOCK = 0x55; PPSLOCK = 0xAA; PPSLOCKbits.PPSLOCKED = 0;
     SSP1CLKPPS = 0x11;  RC1PPS = 0x0F;  // RC1->SCL
     SSP1DATPPS = 0x10;  RC0PPS = 0x10;  // RC0->SDA
+    RA0PPS = 0x07;  // RA0->PWM3 (servo)
+    T1GPPS = 0x02;  // RA2->T1G (sensor echo)
     PPSLOCK = 0x55; PPSLOCK = 0xAA; PPSLOCKbits.PPSLOCKED = 1;
 }
 
@@ -157,10 +294,11 @@ void I2C1_Initialize(void) {
     
     // Configure IC slave mode
     SSP1CON1bits.SSPM = 0b0110;  // IC Slave mode, 7-bit address
-    SSP1ADD = I2C_DEVICE_ADDRESS;  // Set slave address
+    SSP1ADD = (uint8_t)(BRICK_I2C_ENUM_ADDRESS << 1);  // Shared address until enumerated
     
     // Configure control bits
     SSP1CON2bits.SEN = 1;     // Clock stretching enabled
+    SSP1CON2bits.GCEN = 1;    // Also answer the general call address (group writes, latch)
     SSP1CON3bits.BOEN = 1;    // Buffer overwrite enable
     SSP1CON3bits.AHEN = 0;    // Address hold disabled
     SSP1CON3bits.DHEN = 0;    // Data hold disabled
@@ -176,11 +314,96 @@ void I2C1_Initialize(void) {
     SSP1CON1bits.CKP = 1;  // Release clock
 }
 
+// TMR4 drives the motion engine (replicating MCC tmr4.c, at 1 MHz counting and 20 kHz period)
+void TMR4_Initialize(void) {
+    T4CLKCON = (1 << _T4CLKCON_T4CS_POSN);  // T4CS FOSC/4
+    T4HLT = (0 << _T4HLT_T4MODE_POSN);      // T4MODE Software control
+    T4RST = (0 << _T4RST_T4RSEL_POSN);
+    T4PR = STEPPER_TICK_PR;
+    T4TMR = 0x0;
+    PIR4bits.TMR4IF = 0;
+    T4CON = (4 << _T4CON_T4CKPS_POSN)     // T4CKPS 1:16
+        | (1 << _T4CON_TMR4ON_POSN)       // TMR4ON on
+        | (0 << _T4CON_T4OUTPS_POSN);     // T4OUTPS 1:1
+}
+
+// TMR2 times the servo PWM (replicating MCC tmr2.c, at 125 kHz counting and 2.048 ms period)
+void TMR2_Initialize(void) {
+    T2CLKCON = (1 << _T2CLKCON_T2CS_POSN);  // T2CS FOSC/4
+    T2HLT = (0 << _T2HLT_T2MODE_POSN);      // T2MODE Software control
+    T2RST = (0 << _T2RST_T2RSEL_POSN);
+    T2PR = SERVO_PWM_PR;
+    T2TMR = 0x0;
+    PIR4bits.TMR2IF = 0;
+    T2CON = (7 << _T2CON_T2CKPS_POSN)     // T2CKPS 1:128
+        | (1 << _T2CON_TMR2ON_POSN)       // TMR2ON on
+        | (0 << _T2CON_T2OUTPS_POSN);     // T2OUTPS 1:1
+}
+
+// PWM3 (replicating MCC pwm3.c), but on TMR2 since TMR4 is the motion tick, and low until
+// the first move
+void PWM3_Initialize(void) {
+    PWM3CON = 0x80;  // PWM3EN enabled, PWM3POL active_hi
+    PWM3DCH = 0x0;
+    PWM3DCL = 0x0;
+    CCPTMRSbits.P3TSEL = 0x1;  // TMR2
+}
+
+void PWM3_LoadDutyValue(uint16_t dutyValue) {
+    PWM3DCH = (uint8_t)((dutyValue & 0x03FC) >> 2);
+    PWM3DCL = (uint8_t)((dutyValue & 0x0003) << 6);
+}
+
+// TMR6 paces the status LED (replicating MCC tmr6.c, at 125 kHz counting; TMR6_ISR sets the period)
+void TMR6_Initialize(void) {
+    T6CLKCON = (1 << _T6CLKCON_T6CS_POSN);  // T6CS FOSC/4
+    T6HLT = (0 << _T6HLT_T6MODE_POSN);      // T6MODE Software control
+    T6RST = (0 << _T6RST_T6RSEL_POSN);
+    T6PR = 0x1;
+    T6TMR = 0x0;
+    PIR4bits.TMR6IF = 0;
+    T6CON = (7 << _T6CON_T6CKPS_POSN)     // T6CKPS 1:128
+        | (1 << _T6CON_TMR6ON_POSN)       // TMR6ON on
+        | (0 << _T6CON_T6OUTPS_POSN);     // T6OUTPS 1:1
+}
+
+// TMR0 counts the sensor clock (replicating MCC tmr0.c, 8-bit at 250 kHz counting and 1 ms period)
+void TMR0_Initialize(void) {
+    T0CON1 = (2 << _T0CON1_T0CS_POSN)     // T0CS FOSC/4
+        | (6 << _T0CON1_T0CKPS_POSN);     // T0CKPS 1:64
+    TMR0H = SENSOR_CLOCK_PR;
+    TMR0L = 0x0;
+    PIR0bits.TMR0IF = 0;
+    T0CON0 = (1 << _T0CON0_T0EN_POSN)     // T0EN enabled
+        | (0 << _T0CON0_T016BIT_POSN)     // 8-bit
+        | (0 << _T0CON0_T0OUTPS_POSN);    // T0OUTPS 1:1
+}
+
+// TMR1 times the sensor echo (replicating MCC tmr1.c, at 2 MHz counting, gated by T1G = RA2
+// in single-pulse mode: each GGO counts one high pulse)
+void TMR1_Initialize(void) {
+    T1GCON = (1 << _T1GCON_GE_POSN)       // GE gate enabled
+        | (1 << _T1GCON_GPOL_POSN)        // GPOL counts while high
+        | (1 << _T1GCON_GSPM_POSN);       // GSPM single pulse
+    T1GATE = 0x0;                         // GSS T1G_pin
+    T1CLK = 0x1;                          // CS FOSC/4
+    TMR1H = 0x0;
+    TMR1L = 0x0;
+    PIR5bits.TMR1IF = 0;
+    T1CON = (3 << _T1CON_CKPS_POSN)       // CKPS 1:8
+        | (1 << _T1CON_RD16_POSN)         // RD16 16-bit reads
+        | (1 << _T1CON_ON_POSN);          // ON
+}
+
 void INTERRUPT_Initialize(void) {
     INTCONbits.IPEN = 0;   // Disable priority interrupts
     INTCONbits.PEIE = 1;   // Enable peripheral interrupts
     PIE3bits.SSP1IE = 1;   // Enable MSSP interrupt
     PIE3bits.BCL1IE = 1;   // Enable bus collision interrupt
+    PIE4bits.TMR4IE = 1;   // Enable motion engine tick
+    PIE4bits.TMR2IE = (MODULE_DEVICE_TYPE == MOTOR_SERVO_180);  // Servo frame tick
+    PIE4bits.TMR6IE = 1;   // Enable status LED modulation
+    PIE0bits.TMR0IE = (MODULE_DEVICE_TYPE == SENSOR_DISTANCE);  // Sensor clock
     INTCONbits.GIE = 1;    // Enable global interrupts
 }
 
@@ -188,6 +411,16 @@ void SYSTEM_Initialize(void) {
     CLOCK_Initialize();
     PIN_MANAGER_Initialize();
     I2C1_Initialize();
+    TMR4_Initialize();
+    if (MODULE_DEVICE_TYPE == MOTOR_SERVO_180) {
+        TMR2_Initialize();
+        PWM3_Initialize();
+    }
+    if (MODULE_DEVICE_TYPE == SENSOR_DISTANCE) {
+        TMR0_Initialize();
+        TMR1_Initialize();
+    }
+    TMR6_Initialize();
     INTERRUPT_Initialize();
 }
 
@@ -199,57 +432,201 @@ void INTERRUPT_PeripheralInterruptEnable(void) {
     INTCONbits.PEIE = 1;
 }
 
-// IC ISR functions (replicating MCC generated ISR)
+// IC ISR (replicating MCC generated ISR): the bus events go to the protocol core
 void I2C1_ISR(void) {
     PIR3bits.SSP1IF = 0;  // Clear interrupt flag
     
-    if (i2c_callback_function) {
-        if (!SSP1STATbits.D_nA) {
-            // Address byte received
-            uint8_t dummy = SSP1BUF;  // Read to clear
-            (void)dummy;
-            
-            // Call address match callback
-            i2c_callback_function(I2C_CLIENT_TRANSFER_EVENT_ADDR_MATCH);
-            
-            if (SSP1STATbits.R_nW) {
-                // Master wants to read - call TX_READY
-                i2c_callback_function(I2C_CLIENT_TRANSFER_EVENT_TX_READY);
-            }
-        } else {
-            // Data byte
-            if (!SSP1STATbits.R_nW) {
-                // Master writing - call RX_READY
-                i2c_callback_function(I2C_CLIENT_TRANSFER_EVENT_RX_READY);
-            } else {
-                // Master reading - call TX_READY
-                i2c_callback_function(I2C_CLIENT_TRANSFER_EVENT_TX_READY);
-            }
-        }
+    if (!SSP1STATbits.D_nA) {
+        // Address byte received (read to clear; 0x00 = general call)
+        uint8_t address = SSP1BUF;
+        brick_slave_address(address >> 1, SSP1STATbits.R_nW);
+        
+        if (SSP1STATbits.R_nW)
+            I2C1_WriteByte(brick_slave_tx());  // Master wants to read
+    } else if (!SSP1STATbits.R_nW) {
+        brick_slave_rx(I2C1_ReadByte());  // Master writing
+    } else {
+        I2C1_WriteByte(brick_slave_tx());  // Master reading
     }
     
     // Release clock
     SSP1CON1bits.CKP = 1;
     
     // Check for STOP condition
-    if (!SSP1STATbits.S) {
-        if (i2c_callback_function) {
-            i2c_callback_function(I2C_CLIENT_TRANSFER_EVENT_STOP_BIT_RECEIVED);
-        }
-    }
+    if (!SSP1STATbits.S)
+        brick_slave_stop();
 }
 
 void I2C1_ERROR_ISR(void) {
     PIR3bits.BCL1IF = 0;  // Clear bus collision flag
+    brick_slave_bus_error();
     uint8_t dummy = SSP1BUF;  // Read to clear
     (void)dummy;
     SSP1CON1bits.WCOL = 0;
     SSP1CON1bits.SSPOV = 0;
     SSP1CON1bits.CKP = 1;
-    
-    if (i2c_callback_function) {
-        i2c_callback_function(I2C_CLIENT_TRANSFER_EVENT_ERROR);
+}
+
+// Hardware adapter of the protocol core
+void brick_slave_hw_set_address(uint8_t address) {
+    SSP1ADD = (uint8_t)(address << 1);
+}
+
+// Slew rate control is for 400 kHz; standard mode and 1 MHz want it off
+void brick_slave_hw_set_clock(uint16_t khz) {
+    SSP1STATbits.SMP = (khz > 100 && khz < 1000) ? 0 : 1;
+}
+
+void brick_slave_hw_activity(bool on) {
+    digital_write_red(on);  // Red LED on during IC transaction
+}
+
+void brick_slave_hw_attention(bool on) {
+    attention_write(on);
+}
+
+// Main loop: tell the host once the last accepted move has ended
+static void report_move_done(bool busy) {
+    if (move_unreported && !busy) {
+        move_unreported = false;
+        brick_slave_raise_event(BRICK_EVENT_MOVE_DONE);
+    }
+}
+
+// Once per millisecond: move the speed along the ramps
+static void motion_profile_ms(void) {
+    switch (motion_phase) {
+        case MOTION_ACCEL:
+            motion_speed += motion_accel;
+            if (motion_speed >= motion_max_speed) {
+                motion_speed = motion_max_speed;
+                motion_phase = MOTION_CRUISE;
+            }
+            break;
+
+        case MOTION_DECEL:
+            if (motion_speed >= motion_min_speed + motion_accel)
+                motion_speed -= motion_accel;
+            else
+                motion_speed = motion_min_speed;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void motion_finish(void) {
+    motion_phase = MOTION_IDLE;
+    motion_speed = 0;
+    motion_remaining = 0;
+    digital_write_blue(0);
+}
+
+// Motion engine tick. The ramp down starts once the steps left are no more than the
+// ramp up took, which needs no division; a short move turns round before reaching cruise.
+void TMR4_ISR(void) {
+    PIR4bits.TMR4IF = 0;
+    stepper_set_step(0);  // end of the pulse started last tick
+
+    if (motion_phase == MOTION_IDLE)
+        return;
+
+    if (++motion_ms_ticks >= STEPPER_TICKS_PER_MS) {
+        motion_ms_ticks = 0;
+        motion_profile_ms();
+    }
+
+    motion_phase_acc += motion_speed;
+    if (motion_phase_acc < STEPPER_PHASE_WRAP)
+        return;
+    motion_phase_acc -= STEPPER_PHASE_WRAP;
+
+    motion_error += motion_axis;
+    if (motion_error >= motion_lead) {
+        motion_error -= motion_lead;
+        stepper_set_step(1);
+        motion_position += motion_dir;
+    }
+
+    if (motion_phase == MOTION_ACCEL)
+        motion_ramp_steps++;
+    else if (motion_phase == MOTION_DECEL && motion_ramp_steps > 0)
+        motion_ramp_steps--;
+
+    if (--motion_remaining == 0)
+        motion_finish();
+    else if (motion_phase != MOTION_DECEL && motion_remaining <= motion_ramp_steps)
+        motion_phase = MOTION_DECEL;
+}
+
+// Once per servo frame: move the position towards the target
+static void servo_slew_frame(void) {
+    if (servo_step == 0 || servo_position == servo_target)
+        servo_position = servo_target;
+    else if (servo_position < servo_target)
+        servo_position = servo_target - servo_position > servo_step ? servo_position + servo_step : servo_target;
+    else
+        servo_position = servo_position - servo_target > servo_step ? servo_position - servo_step : servo_target;
+    digital_write_blue(servo_position != servo_target);  // Blue LED shows servo activity
+}
+
+// Servo PWM period tick. The duty written now is loaded at the end of the period that just
+// started, so each frame's pulse goes out one period after this.
+void TMR2_ISR(void) {
+    PIR4bits.TMR2IF = 0;
+
+    if (++servo_period < SERVO_FRAME_PERIODS) {
+        if (servo_period == 1)
+            PWM3_LoadDutyValue(0);  // the rest of the frame stays low
+        return;
+    }
+    servo_period = 0;
+
+    servo_slew_frame();
+    PWM3_LoadDutyValue((uint16_t)(servo_position >> 8));
+}
+
+// Once per LED cycle: move the fade on and take the duties for the next cycle
+static void led_fade_cycle(void) {
+    bool lit = false;
+
+    if (led_fade_cycles > 0)
+        led_fade_cycles--;
+    for (uint8_t c = 0; c < LED_CHANNELS; c++) {
+        if (led_fade_cycles == 0)
+            led_level[c] = (uint16_t)led_target[c] << 8;
+        else
+            led_level[c] = (uint16_t)(led_level[c] + led_step[c]);
+        led_duty[c] = led_gamma[led_level[c] >> 8];
+        lit |= led_duty[c] != 0;
+    }
+    led_lit = lit;
+}
+
+// End of one duty bit: show the next one for its weight
+void TMR6_ISR(void) {
+    PIR4bits.TMR6IF = 0;
+
+    if (++led_bit == 8) {
+        led_bit = 0;
+        led_fade_cycle();
+    }
+    T6PR = (uint8_t)((2 << led_bit) - 1);
+
+    if (!led_lit) {
+        led_write_pins(led_activity);
+        return;
     }
+    uint8_t mask = (uint8_t)(1 << led_bit);
+    led_write_pins((led_duty[0] & mask ? STATUS_RED : 0) |
+                   (led_duty[1] & mask ? STATUS_GREEN : 0) |
+                   (led_duty[2] & mask ? STATUS_BLUE : 0));
+}
+
+void TMR0_ISR(void) {
+    PIR0bits.TMR0IF = 0;
+    clock_ms++;
 }
 
 // Main interrupt manager (replicating MCC interrupt.c)
@@ -259,100 +636,418 @@ void __interrupt() INTERRUPT_InterruptManager(void) {
             I2C1_ERROR_ISR();
         } else if (PIE3bits.SSP1IE == 1 && PIR3bits.SSP1IF == 1) {
             I2C1_ISR();
+        } else if (PIE4bits.TMR4IE == 1 && PIR4bits.TMR4IF == 1) {
+            TMR4_ISR();
+        } else if (PIE4bits.TMR2IE == 1 && PIR4bits.TMR2IF == 1) {
+            TMR2_ISR();
+        } else if (PIE4bits.TMR6IE == 1 && PIR4bits.TMR6IF == 1) {
+            TMR6_ISR();
+        } else if (PIE0bits.TMR0IE == 1 && PIR0bits.TMR0IF == 1) {
+            TMR0_ISR();
         }
     }
 }
 
-// Apply stepper motor command
-static void apply_stepper_payload(void) {
-    // rx_buf[1] = stepper instruction byte
-    // Bit 0 = STEP, Bit 1 = S1, Bit 2 = S2, Bit 3 = S3
-    uint8_t instr = rx_buf[1];
-    
-    // Store instruction in device state
-    device_state.stepper_motor.instr = instr;
-    
-    // Set stepper control pins
-    stepper_set_step(instr & 0x01);  // Bit 0 = STEP
-    stepper_set_s1((instr >> 1) & 0x01);   // Bit 1 = S1
-    stepper_set_s2((instr >> 2) & 0x01);   // Bit 2 = S2
-    stepper_set_s3((instr >> 3) & 0x01);   // Bit 3 = S3
-    
-    // Optional: Set direction based on higher bits or separate command
-    // For now, direction can be controlled via separate logic
-    
-    // Status indication
-    digital_write_blue(instr != 0);  // Blue LED shows stepper activity
-}
-
-// Apply RGB payload (for debugging/status)
-static void apply_rgb_payload(void) {
-    // rx_buf[1] = R, rx_buf[2] = G, rx_buf[3] = B
-    digital_write_red(rx_buf[1]);
-    digital_write_green(rx_buf[2]);
-    digital_write_blue(rx_buf[3]);
-}
-
-// IC Callback function (modified for stepper motor)
-bool I2C_Callback(i2c_client_transfer_event_t event) {
-    switch (event) {
-        case I2C_CLIENT_TRANSFER_EVENT_ADDR_MATCH:
-            rx_idx = 0;
-            tx_idx = 0;
-            digital_write_red(1);  // Red LED on during IC transaction
-            return true;
-
-        case I2C_CLIENT_TRANSFER_EVENT_TX_READY:
-            if (tx_idx < sizeof(BRICK_DEVICE_UUID)) {
-                I2C1_WriteByte(BRICK_DEVICE_UUID[tx_idx++]);
-                return true;
-            }
-            return false;
+// Start a move whose profile runs over lead steps. A move that arrives while another runs
+// is dropped and flagged; the host stops the motor or waits for it first.
+static bool start_stepper_move(const brick_stepper_move_t *move, uint32_t lead) {
+    if (motion_phase != MOTION_IDLE) {
+        motion_flags |= BRICK_STEPPER_REJECTED;
+        return false;
+    }
+    motion_flags &= (uint8_t)~BRICK_STEPPER_REJECTED;
+    move_unreported = true;
+
+    if (move->steps == 0 || move->max_speed == 0)
+        return true;
+
+    uint8_t microstep = (move->mode >> BRICK_STEPPER_MICROSTEP_SHIFT) & BRICK_STEPPER_MICROSTEP_MASK;
+    stepper_set_s1(microstep & 0x01);
+    stepper_set_s2(microstep & 0x02);
+    stepper_set_s3(microstep & 0x04);
+    stepper_set_dir(move->mode & BRICK_STEPPER_DIR_REVERSE);  // set up a tick before the first step
+    motion_dir = (move->mode & BRICK_STEPPER_DIR_REVERSE) ? -1 : 1;
+
+    uint16_t speed = move->max_speed > BRICK_STEPPER_MAX_SPEED ? BRICK_STEPPER_MAX_SPEED : move->max_speed;
+    motion_max_speed = (uint32_t)speed * 1000;
+    motion_min_speed = speed < STEPPER_START_SPEED ? motion_max_speed : STEPPER_START_SPEED * 1000UL;
+    motion_accel = move->accel;  // steps/s = milli-steps/s per ms
+    motion_remaining = lead;
+    motion_lead = lead;
+    motion_axis = move->steps;
+    motion_error = lead >> 1;  // centres this axis' steps in the lead's
+    motion_ramp_steps = 0;
+    motion_phase_acc = 0;
+    motion_ms_ticks = 0;
+
+    if (move->accel == 0) {
+        motion_speed = motion_max_speed;
+        motion_phase = MOTION_CRUISE;
+    } else {
+        motion_speed = motion_min_speed;
+        motion_phase = motion_min_speed < motion_max_speed ? MOTION_ACCEL : MOTION_CRUISE;
+    }
+    digital_write_blue(1);  // Blue LED shows stepper activity
+    return true;
+}
+
+// Start the move in the move registers
+static bool apply_stepper_move(void) {
+    const brick_stepper_move_t *move = &brick_slave_registers.device.stepper.move;
+    return start_stepper_move(move, move->steps);
+}
+
+// Ramp down from the current speed; without a ramp, stop on the spot
+static void apply_stepper_stop(void) {
+    if (motion_phase == MOTION_IDLE)
+        return;
+    if (motion_accel == 0 || motion_ramp_steps == 0) {
+        motion_finish();
+        return;
+    }
+    if (motion_remaining > motion_ramp_steps)
+        motion_remaining = motion_ramp_steps;
+    motion_phase = MOTION_DECEL;
+}
+
+// Snapshot for a read that is about to start. A move still waiting in the frame ring
+// counts as busy, so a status read right after a move never sees the motor idle.
+static void load_stepper_status(void) {
+    brick_stepper_status_t *status = &brick_slave_registers.device.stepper.status;
+    bool busy = motion_phase != MOTION_IDLE || brick_slave_pending();
+
+    status->flags = motion_flags | (busy ? BRICK_STEPPER_BUSY : 0);
+    status->position = motion_position;
+    status->speed = motion_speed_sps;
+}
+
+// Main loop: the division is too slow for the ISRs. Also reports the end of a move.
+static void update_stepper_speed(void) {
+    INTCONbits.GIE = 0;
+    uint32_t speed = motion_speed;
+    bool busy = motion_phase != MOTION_IDLE;
+    INTCONbits.GIE = 1;
+
+    report_move_done(busy);
+
+    uint16_t sps = (uint16_t)((speed / 1000 * motion_ratio) >> 16);
+
+    INTCONbits.GIE = 0;
+    motion_speed_sps = sps;
+    INTCONbits.GIE = 1;
+}
+
+// Start the move in the servo move registers. The division stays out of the critical section.
+static void apply_servo_move(void) {
+    const brick_servo_move_t *move = &brick_slave_registers.device.servo.move;
+    uint8_t angle = move->angle > BRICK_SERVO_MAX_ANGLE ? BRICK_SERVO_MAX_ANGLE : move->angle;
+    uint32_t target = (SERVO_MIN_COUNT << 8) + (((uint32_t)angle * SERVO_SPAN) << 8) / BRICK_SERVO_MAX_ANGLE;
+    uint32_t step = (uint32_t)move->slew * SERVO_SLEW_X100 / 100;
+
+    INTCONbits.GIE = 0;
+    servo_target = target;
+    servo_step = step;
+    if (servo_position == 0)
+        servo_position = target;  // where the servo is is unknown, so no ramp
+    INTCONbits.GIE = 1;
+    move_unreported = true;
+}
+
+static void load_servo_status(void) {
+    brick_servo_status_t *status = &brick_slave_registers.device.servo.status;
+    bool busy = servo_position != servo_target || brick_slave_pending();
+
+    status->flags = busy ? BRICK_SERVO_BUSY : 0;
+    status->angle = servo_angle;
+    status->pulse_us = (uint16_t)(servo_position >> 8) * 2;
+}
+
+// Main loop, like update_stepper_speed
+static void update_servo_angle(void) {
+    INTCONbits.GIE = 0;
+    uint32_t position = servo_position;
+    bool busy = position != servo_target;
+    INTCONbits.GIE = 1;
+
+    report_move_done(busy);
+
+    if (position != 0)
+        servo_angle = (uint8_t)((((position >> 8) - SERVO_MIN_COUNT) * BRICK_SERVO_MAX_ANGLE + SERVO_SPAN / 2) / SERVO_SPAN);
+}
+
+static uint32_t clock_now(void) {
+    INTCONbits.GIE = 0;
+    uint32_t now = clock_ms;
+    INTCONbits.GIE = 1;
+    return now;
+}
+
+static inline void sensor_set_trigger(uint8_t val) { LATAbits.LATA1 = (val != 0); }
+
+// Take the config registers, clamped, and start the filter over; the reading keeps the
+// last value until the next measurement
+static void apply_sensor_config(void) {
+    brick_sensor_config_t config = brick_slave_registers.device.sensor.config;
+
+    brick_sensor_filter_configure(&sensor_filter, &config, SENSOR_DEFAULT_PERIOD_MS, SENSOR_MIN_PERIOD_MS);
+
+    INTCONbits.GIE = 0;
+    brick_slave_registers.device.sensor.config = config;  // what a read back returns
+    INTCONbits.GIE = 1;
+}
+
+static void load_sensor_defaults(void) {
+    brick_sensor_config_t *config = &brick_slave_registers.device.sensor.config;
+
+    config->period_ms = 0;
+    config->median = SENSOR_DEFAULT_MEDIAN;
+    config->ema_shift = SENSOR_DEFAULT_EMA_SHIFT;
+    apply_sensor_config();
+}
+
+static void load_sensor_reading(void) {
+    brick_sensor_reading_t *reading = &brick_slave_registers.device.sensor.reading;
+    uint32_t age = clock_ms - sensor_latest.timestamp_ms;
+
+    *reading = sensor_latest;
+    reading->age_ms = age > 0xFFFF ? 0xFFFF : (uint16_t)age;
+}
+
+// A measurement of the first channels, through the filter into the reading
+static void sensor_take(const uint16_t *measured, uint8_t channels, uint32_t taken_ms) {
+    brick_sensor_reading_t reading = sensor_latest;  // only the main loop writes it
+
+    brick_sensor_filter_take(&sensor_filter, measured, channels, taken_ms, &reading);
+
+    INTCONbits.GIE = 0;
+    sensor_latest = reading;
+    INTCONbits.GIE = 1;
+}
+
+// Nothing in range: the value stays as it was
+static void sensor_missed(void) {
+    INTCONbits.GIE = 0;
+    brick_sensor_filter_missed(&sensor_latest);
+    INTCONbits.GIE = 1;
+}
+
+// Main loop: start a measurement every period and take the echo once TMR1 has timed it
+static void update_sensor(void) {
+    uint32_t now = clock_now();
 
-        case I2C_CLIENT_TRANSFER_EVENT_RX_READY:
-            if (rx_idx < sizeof(rx_buf)) {
-                rx_buf[rx_idx++] = I2C1_ReadByte();
-                return true;
+    if (!sensor_measuring) {
+        if (now - sensor_started_ms < sensor_filter.config.period_ms)
+            return;
+        sensor_started_ms = now;
+        sensor_measuring = true;
+        TMR1H = 0x0;
+        TMR1L = 0x0;
+        PIR5bits.TMR1IF = 0;
+        T1GCONbits.GGO_nDONE = 1;  // count the next high pulse on ECHO
+        sensor_set_trigger(1);
+        __delay_us(10);
+        sensor_set_trigger(0);
+        return;
+    }
+
+    if (T1GCONbits.GGO_nDONE) {
+        // No whole echo yet: give up once it cannot be in range any more
+        if (!PIR5bits.TMR1IF && now - sensor_started_ms < SENSOR_ECHO_TIMEOUT_MS)
+            return;
+        T1GCONbits.GGO_nDONE = 0;
+        sensor_measuring = false;
+        sensor_missed();
+        return;
+    }
+    sensor_measuring = false;
+    if (PIR5bits.TMR1IF) {
+        sensor_missed();
+        return;
+    }
+
+    uint16_t counts = TMR1L;
+    counts |= (uint16_t)TMR1H << 8;  // TMR1L first: RD16 latches TMR1H with it
+    uint16_t cm = counts / SENSOR_COUNTS_PER_CM;
+    sensor_take(&cm, 1, sensor_started_ms);
+}
+
+// Start a fade from the colour showing now. The divisions run with the fade held, outside
+// the critical sections; a fade of 0 ms lands on the next cycle.
+static void apply_led_fade(const uint8_t *target, uint16_t fade_ms) {
+    uint16_t cycles = (uint16_t)(((uint32_t)fade_ms * 1000 + LED_CYCLE_US / 2) / LED_CYCLE_US);
+    uint16_t level[LED_CHANNELS];
+
+    INTCONbits.GIE = 0;
+    led_fade_cycles = 0;
+    for (uint8_t c = 0; c < LED_CHANNELS; c++) {
+        level[c] = led_level[c];
+        led_target[c] = led_level[c] >> 8;  // where a hold lands
+    }
+    INTCONbits.GIE = 1;
+
+    if (cycles == 0)
+        cycles = 1;
+    int16_t step[LED_CHANNELS];
+    for (uint8_t c = 0; c < LED_CHANNELS; c++)
+        step[c] = cycles > 1 ? (int16_t)(((int32_t)((uint16_t)target[c] << 8) - level[c]) / cycles) : 0;
+
+    INTCONbits.GIE = 0;
+    for (uint8_t c = 0; c < LED_CHANNELS; c++) {
+        led_target[c] = target[c];
+        led_step[c] = step[c];
+    }
+    led_fade_cycles = cycles;
+    INTCONbits.GIE = 1;
+}
+
+// CMD_LED_RGB and CMD_LED_FADE: frame[1..3] = red, blue, green (brick_device_led_rgb_impl_t),
+// then the fade time for CMD_LED_FADE
+static void apply_rgb_payload(const volatile uint8_t *frame, uint16_t fade_ms) {
+    const uint8_t target[LED_CHANNELS] = {frame[1], frame[3], frame[2]};  // red, green, blue
+    apply_led_fade(target, fade_ms);
+}
+
+// Commands every image takes: the status LED
+static void apply_led_command(const volatile uint8_t *frame, uint8_t len) {
+    switch ((brick_command_type_t)frame[0]) {
+        case CMD_LED_RGB:
+            if (len == 1 + offsetof(brick_device_led_rgb_impl_t, fade_ms))
+                apply_rgb_payload(frame, 0);
+            break;
+
+        case CMD_LED_FADE:
+            if (len == 1 + sizeof(brick_device_led_rgb_impl_t))
+                apply_rgb_payload(frame, (uint16_t)(frame[4] | (frame[5] << 8)));
+            break;
+
+        default:
+            break;
+    }
+}
+
+// The motion state is shared with the TMR4 and MSSP interrupts
+static void apply_stepper_registers(void) {
+    INTCONbits.GIE = 0;
+    bool started = apply_stepper_move();
+    INTCONbits.GIE = 1;
+    if (started)
+        motion_ratio = 0x10000;
+}
+
+// CMD_STEPPER_MOVE_SYNC: the move goes to the move registers like CMD_STEPPER_MOVE, the lead
+// only to the engine. The ratio for the status is worked out before the critical section.
+static void apply_stepper_sync(const volatile uint8_t *frame) {
+    brick_device_stepper_motor_impl_t sync;
+    uint8_t *bytes = (uint8_t *)&sync;
+    for (uint8_t i = 0; i < sizeof(sync); i++)
+        bytes[i] = frame[1 + i];
+    if (sync.lead_steps < sync.move.steps)
+        sync.lead_steps = sync.move.steps;
+
+    uint32_t axis = sync.move.steps;
+    uint32_t lead = sync.lead_steps;
+    for (; lead > 0xFFFF; lead >>= 1)
+        axis >>= 1;
+    uint32_t ratio = lead == 0 ? 0x10000 : (axis << 16) / lead;
+
+    brick_slave_registers.device.stepper.move = sync.move;
+    INTCONbits.GIE = 0;
+    bool started = start_stepper_move(&brick_slave_registers.device.stepper.move, sync.lead_steps);
+    INTCONbits.GIE = 1;
+    if (started)
+        motion_ratio = ratio;
+}
+
+static void apply_stepper_command(const volatile uint8_t *frame, uint8_t len) {
+    switch ((brick_command_type_t)frame[0]) {
+        case CMD_STEPPER_MOVE:  // same as a write of the whole move block
+            if (len == 1 + sizeof(brick_stepper_move_t)) {
+                uint8_t *move = (uint8_t *)&brick_slave_registers.device.stepper.move;
+                for (uint8_t i = 0; i < sizeof(brick_stepper_move_t); i++)
+                    move[i] = frame[1 + i];
+                apply_stepper_registers();
             }
-            (void)I2C1_ReadByte(); // overflow protection
-            return true;
-
-        case I2C_CLIENT_TRANSFER_EVENT_STOP_BIT_RECEIVED:
-            digital_write_red(0);  // Red LED off
-            
-            if (rx_idx == 0)  // No command
-                return true;
-
-            switch ((brick_command_type_t)rx_buf[0]) {  // rx_buf[0] = command ID
-                case CMD_STEPPER_MOVE:
-                    if (rx_idx >= 2) {  // cmd + 1 instruction byte minimum
-                        apply_stepper_payload();
-                    }
-                    break;
-
-                case CMD_LED_RGB:
-                    if (rx_idx == 4)  // cmd + 3 payload bytes (for status LEDs)
-                        apply_rgb_payload();
-                    break;
-
-                case CMD_SERVO_SET_ANGLE:
-                    // Add servo control here if needed
-                    break;
-
-                default:
-                    break;
+            break;
+
+        case CMD_STEPPER_MOVE_SYNC:
+            if (len == 1 + sizeof(brick_device_stepper_motor_impl_t))
+                apply_stepper_sync(frame);
+            break;
+
+        case CMD_STEPPER_STOP:
+            INTCONbits.GIE = 0;
+            apply_stepper_stop();
+            INTCONbits.GIE = 1;
+            break;
+
+        default:
+            apply_led_command(frame, len);
+            break;
+    }
+}
+
+static void apply_servo_command(const volatile uint8_t *frame, uint8_t len) {
+    switch ((brick_command_type_t)frame[0]) {
+        case CMD_SERVO_SET_ANGLE:  // same as a write of the move block; a bare angle jumps
+            if (len >= 2 && len <= 1 + sizeof(brick_servo_move_t)) {
+                uint8_t *move = (uint8_t *)&brick_slave_registers.device.servo.move;
+                for (uint8_t i = 0; i < sizeof(brick_servo_move_t); i++)
+                    move[i] = i + 1 < len ? frame[1 + i] : 0;
+                apply_servo_move();
             }
-            rx_idx = 0;  // ready for next packet
-            return true;
+            break;
 
         default:
-            return false;
+            apply_led_command(frame, len);
+            break;
+    }
+}
+
+// What each device type adds to the protocol core
+static const brick_slave_device_t stepper_device = {
+    sizeof(brick_stepper_move_t), apply_stepper_command, apply_stepper_registers, load_stepper_status
+};
+static const brick_slave_device_t servo_device = {
+    sizeof(brick_servo_move_t), apply_servo_command, apply_servo_move, load_servo_status
+};
+static const brick_slave_device_t sensor_device = {
+    sizeof(brick_sensor_config_t), apply_led_command, apply_sensor_config, load_sensor_reading
+};
+static const brick_slave_device_t led_device = {
+    0, apply_led_command, NULL, NULL
+};
+
+// Builds the UUID from the type template and the factory unique ID, folded into
+// unique_id, so every module of a type runs the same firmware image
+static void load_device_uuid(void) {
+    uint8_t *uuid = brick_slave_registers.uuid.bytes;
+
+    for (uint8_t i = 0; i < sizeof(brick_slave_registers.uuid); i++)
+        uuid[i] = BRICK_DEVICE_UUID[i];
+
+    TBLPTRU = (uint8_t)(DIA_MUI_ADDRESS >> 16);
+    TBLPTRH = (uint8_t)(DIA_MUI_ADDRESS >> 8);
+    TBLPTRL = (uint8_t)DIA_MUI_ADDRESS;
+    for (uint8_t i = 0; i < DIA_MUI_BYTES; i++) {
+        asm("TBLRD*+");
+        uuid[8 + (i & 7)] ^= TABLAT;
     }
 }
 
 // Main function
 int main(void) {
+    load_device_uuid();
+    if (MODULE_DEVICE_TYPE == MOTOR_SERVO_180)
+        brick_slave_init(&servo_device, MODULE_MAX_CLOCK_KHZ);
+    else if (MODULE_DEVICE_TYPE == MOTOR_STEPPER)
+        brick_slave_init(&stepper_device, MODULE_MAX_CLOCK_KHZ);
+    else if (MODULE_DEVICE_TYPE == SENSOR_DISTANCE)
+        brick_slave_init(&sensor_device, MODULE_MAX_CLOCK_KHZ);
+    else
+        brick_slave_init(&led_device, MODULE_MAX_CLOCK_KHZ);
     SYSTEM_Initialize();
+    if (MODULE_DEVICE_TYPE == SENSOR_DISTANCE)
+        load_sensor_defaults();
 
     // Initialize stepper motor pins (all off initially)
     stepper_set_s1(0);
@@ -366,9 +1061,6 @@ int main(void) {
     digital_write_green(0);
     digital_write_blue(0);
 
-    // Register IC callback
-    I2C1_CallbackRegister(I2C_Callback);
-
     // Enable interrupts
     INTERRUPT_GlobalInterruptEnable();
     INTERRUPT_PeripheralInterruptEnable();
@@ -377,6 +1069,16 @@ int main(void) {
     while (1) {
         // Keep watchdog happy if enabled
         CLRWDT();
+
+        if (MODULE_DEVICE_TYPE == MOTOR_SERVO_180)
+            update_servo_angle();
+        else if (MODULE_DEVICE_TYPE == MOTOR_STEPPER)
+            update_stepper_speed();
+        else if (MODULE_DEVICE_TYPE == SENSOR_DISTANCE)
+            update_sensor();
+
+        // Apply received commands in order, one per pass
+        brick_slave_poll();
     }
     
     return 0;
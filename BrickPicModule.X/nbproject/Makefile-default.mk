@@ -51,17 +51,17 @@ OBJECTDIR=build/${CND_CONF}/${IMAGE_TYPE}
 DISTDIR=dist/${CND_CONF}/${IMAGE_TYPE}
 
 # Source Files Quoted if spaced
-SOURCEFILES_QUOTED_IF_SPACED=main.c brick_i2c_api.c
+SOURCEFILES_QUOTED_IF_SPACED=main.c brick_i2c_api.c brick_i2c_slave.c brick_sensor_filter.c
 
 # Object Files Quoted if spaced
-OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/main.p1 ${OBJECTDIR}/brick_i2c_api.p1
-POSSIBLE_DEPFILES=${OBJECTDIR}/main.p1.d ${OBJECTDIR}/brick_i2c_api.p1.d
+OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/main.p1 ${OBJECTDIR}/brick_i2c_api.p1 ${OBJECTDIR}/brick_i2c_slave.p1 ${OBJECTDIR}/brick_sensor_filter.p1
+POSSIBLE_DEPFILES=${OBJECTDIR}/main.p1.d ${OBJECTDIR}/brick_i2c_api.p1.d ${OBJECTDIR}/brick_i2c_slave.p1.d ${OBJECTDIR}/brick_sensor_filter.p1.d
 
 # Object Files
-OBJECTFILES=${OBJECTDIR}/main.p1 ${OBJECTDIR}/brick_i2c_api.p1
+OBJECTFILES=${OBJECTDIR}/main.p1 ${OBJECTDIR}/brick_i2c_api.p1 ${OBJECTDIR}/brick_i2c_slave.p1 ${OBJECTDIR}/brick_sensor_filter.p1
 
 # Source Files
-SOURCEFILES=main.c brick_i2c_api.c
+SOURCEFILES=main.c brick_i2c_api.c brick_i2c_slave.c brick_sensor_filter.c
 
 
 
@@ -104,6 +104,22 @@ ${OBJECTDIR}/brick_i2c_api.p1: brick_i2c_api.c  nbproject/Makefile-${CND_CONF}.m
 	@-${MV} ${OBJECTDIR}/brick_i2c_api.d ${OBJECTDIR}/brick_i2c_api.p1.d 
 	@${FIXDEPS} ${OBJECTDIR}/brick_i2c_api.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
 	
+${OBJECTDIR}/brick_i2c_slave.p1: brick_i2c_slave.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}" 
+	@${RM} ${OBJECTDIR}/brick_i2c_slave.p1.d 
+	@${RM} ${OBJECTDIR}/brick_i2c_slave.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c  -D__DEBUG=1  -mdebugger=none   -mdfp="${DFP_DIR}/xc8"  -memi=wordwrite -O0 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mno-default-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/brick_i2c_slave.p1 brick_i2c_slave.c 
+	@-${MV} ${OBJECTDIR}/brick_i2c_slave.d ${OBJECTDIR}/brick_i2c_slave.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/brick_i2c_slave.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+	
+${OBJECTDIR}/brick_sensor_filter.p1: brick_sensor_filter.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}" 
+	@${RM} ${OBJECTDIR}/brick_sensor_filter.p1.d 
+	@${RM} ${OBJECTDIR}/brick_sensor_filter.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c  -D__DEBUG=1  -mdebugger=none   -mdfp="${DFP_DIR}/xc8"  -memi=wordwrite -O0 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mno-default-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/brick_sensor_filter.p1 brick_sensor_filter.c 
+	@-${MV} ${OBJECTDIR}/brick_sensor_filter.d ${OBJECTDIR}/brick_sensor_filter.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/brick_sensor_filter.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+	
 else
 ${OBJECTDIR}/main.p1: main.c  nbproject/Makefile-${CND_CONF}.mk 
 	@${MKDIR} "${OBJECTDIR}" 
@@ -121,6 +137,22 @@ ${OBJECTDIR}/brick_i2c_api.p1: brick_i2c_api.c  nbproject/Makefile-${CND_CONF}.m
 	@-${MV} ${OBJECTDIR}/brick_i2c_api.d ${OBJECTDIR}/brick_i2c_api.p1.d 
 	@${FIXDEPS} ${OBJECTDIR}/brick_i2c_api.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
 	
+${OBJECTDIR}/brick_i2c_slave.p1: brick_i2c_slave.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}" 
+	@${RM} ${OBJECTDIR}/brick_i2c_slave.p1.d 
+	@${RM} ${OBJECTDIR}/brick_i2c_slave.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c   -mdfp="${DFP_DIR}/xc8"  -memi=wordwrite -O0 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mno-default-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/brick_i2c_slave.p1 brick_i2c_slave.c 
+	@-${MV} ${OBJECTDIR}/brick_i2c_slave.d ${OBJECTDIR}/brick_i2c_slave.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/brick_i2c_slave.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+	
+${OBJECTDIR}/brick_sensor_filter.p1: brick_sensor_filter.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}" 
+	@${RM} ${OBJECTDIR}/brick_sensor_filter.p1.d 
+	@${RM} ${OBJECTDIR}/brick_sensor_filter.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c   -mdfp="${DFP_DIR}/xc8"  -memi=wordwrite -O0 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mno-default-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/brick_sensor_filter.p1 brick_sensor_filter.c 
+	@-${MV} ${OBJECTDIR}/brick_sensor_filter.d ${OBJECTDIR}/brick_sensor_filter.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/brick_sensor_filter.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+	
 endif
 
 # ------------------------------------------------------------------------------------
@@ -0,0 +1,561 @@
+/**
+ * BrickLab I2C Slave - host test of the protocol core
+ *
+ * Drives brick_i2c_slave.c with the byte-level events the MSSP interrupt would feed it
+ * (address match, byte received, byte to send, stop) and checks what the module applies
+ * and answers. Every event is also counted in instructions: the test runs in a child
+ * process that a ptrace parent single-steps through each event, so an event whose path
+ * grows past its budget fails the run before it ever meets the ISR on the chip.
+ *
+ * The counts are host instructions, not PIC18 ones; they track the length of the path,
+ * not its cycles. The budgets are set for x86-64 at -O2 with headroom over today's worst
+ * case. Without ptrace (or on another architecture) the checks run and the budgets are
+ * skipped.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "brick_i2c_slave.h"
+
+//====================================================================================
+// Event budgets
+//====================================================================================
+
+typedef enum {
+    EV_ADDRESS = 0,
+    EV_RX,
+    EV_TX,
+    EV_STOP,
+    EV_POLL,
+    EV_COUNT
+} event_kind_t;
+
+static const char *const event_names[EV_COUNT] = {"address", "rx", "tx", "stop", "poll"};
+
+// Worst path allowed per event, in host instructions. poll runs in the main loop and is
+// listed for reference only.
+static const unsigned long event_budget[EV_COUNT] = {
+    [EV_ADDRESS] = 160,
+    [EV_RX] = 32,
+    [EV_TX] = 48,
+    [EV_STOP] = 220,
+    [EV_POLL] = 0,
+};
+
+#define MAX_EVENTS 4096
+
+// Written by the child, one byte per measured event, read by the parent in the same order
+static int kind_pipe = -1;
+static bool traced = false;
+
+// The parent single-steps the code between a begin and an end mark
+static void mark(void) {
+    if (traced)
+        raise(SIGUSR1);
+}
+
+static void measured(event_kind_t kind) {
+    uint8_t k = (uint8_t)kind;
+
+    if (kind_pipe >= 0 && write(kind_pipe, &k, 1) != 1)
+        kind_pipe = -1;
+}
+
+//====================================================================================
+// Hardware adapter and device
+//====================================================================================
+
+static uint8_t own_address = BRICK_I2C_ENUM_ADDRESS;
+static uint16_t bus_clock_khz = 0;
+static bool attention = false;
+
+void brick_slave_hw_set_address(uint8_t address) {
+    own_address = address;
+}
+
+void brick_slave_hw_set_clock(uint16_t khz) {
+    bus_clock_khz = khz;
+}
+
+void brick_slave_hw_activity(bool on) {
+    (void)on;
+}
+
+void brick_slave_hw_attention(bool on) {
+    attention = on;
+}
+
+// Commands the module applied, in order: command byte and first payload byte
+#define MAX_APPLIED 32
+static uint8_t applied[MAX_APPLIED][2];
+static uint8_t applied_count = 0;
+static uint8_t moves_applied = 0;
+
+static void test_apply_command(const volatile uint8_t *frame, uint8_t len) {
+    if (applied_count < MAX_APPLIED) {
+        applied[applied_count][0] = frame[0];
+        applied[applied_count][1] = len > 1 ? frame[1] : 0;
+    }
+    applied_count++;
+}
+
+static void test_apply_move(void) {
+    moves_applied++;
+}
+
+static const brick_slave_device_t test_device = {
+    .move_size = sizeof(brick_stepper_move_t),
+    .apply_command = test_apply_command,
+    .apply_move = test_apply_move,
+    .load_status = NULL,
+};
+
+//====================================================================================
+// Bus
+//====================================================================================
+
+// The MSSP only interrupts for its own address and the general call
+static bool matches(uint8_t address) {
+    return address == own_address || address == BRICK_I2C_GENERAL_CALL_ADDRESS;
+}
+
+static bool selected = false;  // the core saw the address of the current transfer
+
+static void bus_start(uint8_t address, bool read) {
+    selected = matches(address);
+    if (!selected)
+        return;
+    measured(EV_ADDRESS);
+    mark();
+    brick_slave_address(address, read);
+    mark();
+}
+
+static void bus_write_bytes(const uint8_t *data, uint8_t len) {
+    for (uint8_t i = 0; i < len && selected; i++) {
+        measured(EV_RX);
+        mark();
+        brick_slave_rx(data[i]);
+        mark();
+    }
+}
+
+static void bus_read_bytes(uint8_t *out, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        if (!selected) {
+            out[i] = 0xFF;  // nobody drives SDA
+            continue;
+        }
+        measured(EV_TX);
+        mark();
+        out[i] = brick_slave_tx();
+        mark();
+    }
+}
+
+static void bus_stop(void) {
+    if (!selected)
+        return;
+    selected = false;
+    measured(EV_STOP);
+    mark();
+    brick_slave_stop();
+    mark();
+}
+
+static void module_poll(void) {
+    measured(EV_POLL);
+    mark();
+    brick_slave_poll();
+    mark();
+}
+
+static void module_poll_all(void) {
+    while (brick_slave_pending())
+        module_poll();
+}
+
+// One write with its own stop
+static void write_frame(uint8_t address, const uint8_t *data, uint8_t len) {
+    bus_start(address, false);
+    bus_write_bytes(data, len);
+    bus_stop();
+}
+
+// Fills in [CMD_CHECKED, seq, command..., crc] and returns its length
+static uint8_t checked_frame(uint8_t address, uint8_t seq, const uint8_t *command, uint8_t len, uint8_t *out) {
+    out[0] = CMD_CHECKED;
+    out[1] = seq;
+    memcpy(&out[2], command, len);
+    uint8_t crc = brick_crc8(brick_crc8_byte(0, (uint8_t)(address << 1)), out, len + 2u);
+    out[len + 2] = crc;
+    return len + BRICK_FRAME_CHECK_LEN;
+}
+
+// A checked frame and the read of its status, without the stop: the host batches these
+static uint8_t checked_write(uint8_t address, uint8_t seq, const uint8_t *command, uint8_t len) {
+    uint8_t frame[BRICK_SLAVE_FRAME_MAX];
+    uint8_t reply[BRICK_FRAME_REPLY_LEN];
+
+    uint8_t frame_len = checked_frame(address, seq, command, len, frame);
+    bus_start(address, false);
+    bus_write_bytes(frame, frame_len);
+    bus_start(address, true);  // repeated start
+    bus_read_bytes(reply, sizeof(reply));
+
+    uint8_t crc = brick_crc8(brick_crc8_byte(0, (uint8_t)((address << 1) | 1)), reply, 1);
+    return crc == reply[1] ? reply[0] : 0;
+}
+
+//====================================================================================
+// Checks
+//====================================================================================
+
+static int failures = 0;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+#define MODULE_ADDRESS 0x21
+
+static void test_identify_and_assign(void) {
+    uint8_t cmd = CMD_IDENTIFY;
+    uint8_t uuid[16];
+
+    bus_start(BRICK_I2C_ENUM_ADDRESS, false);
+    bus_write_bytes(&cmd, 1);
+    bus_start(BRICK_I2C_ENUM_ADDRESS, true);
+    bus_read_bytes(uuid, sizeof(uuid));
+    bus_stop();
+    CHECK(memcmp(uuid, brick_slave_registers.uuid.bytes, sizeof(uuid)) == 0);
+
+    uint8_t assign[18] = {CMD_ENUM_ASSIGN, MODULE_ADDRESS};
+    memcpy(&assign[2], uuid, sizeof(uuid));
+    write_frame(BRICK_I2C_ENUM_ADDRESS, assign, sizeof(assign));
+    CHECK(own_address == MODULE_ADDRESS);
+    CHECK(!brick_slave_pending());
+}
+
+static void test_plain_write(void) {
+    uint8_t rgb[] = {CMD_LED_RGB, 10, 20, 30};
+
+    applied_count = 0;
+    write_frame(MODULE_ADDRESS, rgb, sizeof(rgb));
+    module_poll_all();
+    CHECK(applied_count == 1 && applied[0][0] == CMD_LED_RGB && applied[0][1] == 10);
+
+    // Someone else's traffic never reaches the core
+    write_frame(MODULE_ADDRESS + 1, rgb, sizeof(rgb));
+    CHECK(!brick_slave_pending());
+}
+
+// A plain write is handed on at the stop; a second one in the same transaction replaces it.
+// This is why the host never batches plain writes.
+static void test_plain_writes_commit_at_stop(void) {
+    uint8_t first[] = {CMD_LED_RGB, 1, 0, 0};
+    uint8_t second[] = {CMD_LED_RGB, 2, 0, 0};
+
+    applied_count = 0;
+    bus_start(MODULE_ADDRESS, false);
+    bus_write_bytes(first, sizeof(first));
+    bus_start(MODULE_ADDRESS, false);
+    bus_write_bytes(second, sizeof(second));
+    bus_stop();
+    module_poll_all();
+    CHECK(applied_count == 1 && applied[0][1] == 2);
+}
+
+static void test_checked_frames(void) {
+    uint8_t rgb[] = {CMD_LED_RGB, 40, 0, 0};
+
+    // Resynchronise the sequence numbers
+    CHECK(checked_write(MODULE_ADDRESS, 100, NULL, 0) == BRICK_FRAME_ACCEPTED);
+    bus_stop();
+
+    applied_count = 0;
+    CHECK(checked_write(MODULE_ADDRESS, 101, rgb, sizeof(rgb)) == BRICK_FRAME_ACCEPTED);
+    bus_stop();
+    CHECK(checked_write(MODULE_ADDRESS, 101, rgb, sizeof(rgb)) == (BRICK_FRAME_ACCEPTED | BRICK_FRAME_DUPLICATE));
+    bus_stop();
+    module_poll_all();
+    CHECK(applied_count == 1 && applied[0][1] == 40);
+
+    // A corrupted frame is refused and not applied
+    uint8_t frame[BRICK_SLAVE_FRAME_MAX];
+    uint8_t reply[BRICK_FRAME_REPLY_LEN];
+    uint8_t len = checked_frame(MODULE_ADDRESS, 102, rgb, sizeof(rgb), frame);
+    frame[3] ^= 0x01;
+    bus_start(MODULE_ADDRESS, false);
+    bus_write_bytes(frame, len);
+    bus_start(MODULE_ADDRESS, true);
+    bus_read_bytes(reply, sizeof(reply));
+    bus_stop();
+    CHECK(reply[0] == 0);
+    CHECK(!brick_slave_pending());
+}
+
+// Checked frames are taken at their repeated start, so a batch of them in one
+// transaction is applied in full and in order
+static void test_checked_batch(void) {
+    applied_count = 0;
+    for (uint8_t i = 0; i < BRICK_SLAVE_RING_SLOTS; i++) {
+        uint8_t rgb[] = {CMD_LED_RGB, (uint8_t)(50 + i), 0, 0};
+        CHECK(checked_write(MODULE_ADDRESS, (uint8_t)(110 + i), rgb, sizeof(rgb)) == BRICK_FRAME_ACCEPTED);
+    }
+    bus_stop();
+    module_poll_all();
+
+    CHECK(applied_count == BRICK_SLAVE_RING_SLOTS);
+    for (uint8_t i = 0; i < BRICK_SLAVE_RING_SLOTS && i < applied_count; i++)
+        CHECK(applied[i][1] == 50 + i);
+
+    // One more than the ring holds before the main loop runs: the last one is refused, so
+    // the host sends it again
+    uint8_t rgb[] = {CMD_LED_RGB, 60, 0, 0};
+    applied_count = 0;
+    for (uint8_t i = 0; i < BRICK_SLAVE_RING_SLOTS; i++)
+        checked_write(MODULE_ADDRESS, (uint8_t)(120 + i), rgb, sizeof(rgb));
+    CHECK(checked_write(MODULE_ADDRESS, 124, rgb, sizeof(rgb)) == 0);
+    bus_stop();
+    module_poll_all();
+    CHECK(applied_count == BRICK_SLAVE_RING_SLOTS);
+}
+
+static void test_stage_and_latch(void) {
+    uint8_t group[] = {CMD_GROUP_ASSIGN, 0x02};
+    uint8_t stage[] = {CMD_STAGE, CMD_LED_RGB, 70, 0, 0};
+    uint8_t other_latch[] = {CMD_LATCH, 0x01};
+    uint8_t latch[] = {CMD_LATCH, 0x02};
+
+    write_frame(MODULE_ADDRESS, group, sizeof(group));
+    module_poll_all();
+    CHECK(brick_slave_registers.group_mask == 0x02);
+
+    applied_count = 0;
+    write_frame(MODULE_ADDRESS, stage, sizeof(stage));
+    module_poll_all();
+    CHECK(applied_count == 0);
+
+    write_frame(BRICK_I2C_GENERAL_CALL_ADDRESS, other_latch, sizeof(other_latch));
+    module_poll_all();
+    CHECK(applied_count == 0);
+
+    write_frame(BRICK_I2C_GENERAL_CALL_ADDRESS, latch, sizeof(latch));
+    module_poll_all();
+    CHECK(applied_count == 1 && applied[0][0] == CMD_LED_RGB && applied[0][1] == 70);
+
+    // A latch in the same transaction as the stage starts a new frame over the stage, so
+    // the host sends it on its own once the stages are acknowledged
+    applied_count = 0;
+    bus_start(MODULE_ADDRESS, false);
+    bus_write_bytes(stage, sizeof(stage));
+    bus_start(BRICK_I2C_GENERAL_CALL_ADDRESS, false);
+    bus_write_bytes(latch, sizeof(latch));
+    bus_stop();
+    module_poll_all();
+    CHECK(applied_count == 0);
+}
+
+static void test_registers(void) {
+    uint8_t request[4] = {CMD_CHECKED_READ, BRICK_REG_CAPS, sizeof(brick_caps_t)};
+    uint8_t reply[sizeof(brick_caps_t) + 1];
+
+    request[3] = brick_crc8(brick_crc8_byte(0, MODULE_ADDRESS << 1), request, 3);
+    bus_start(MODULE_ADDRESS, false);
+    bus_write_bytes(request, sizeof(request));
+    bus_start(MODULE_ADDRESS, true);
+    bus_read_bytes(reply, sizeof(reply));
+    bus_stop();
+
+    uint8_t crc = brick_crc8(brick_crc8_byte(0, (MODULE_ADDRESS << 1) | 1), reply, sizeof(brick_caps_t));
+    CHECK(crc == reply[sizeof(brick_caps_t)]);
+    CHECK(reply[0] == BRICK_PROTOCOL_VERSION);
+
+    // A burst write into the move block applies it once
+    uint8_t move[1 + sizeof(brick_stepper_move_t)] = {BRICK_REG_STEPPER_MOVE, 0, 100, 0, 0, 0};
+    moves_applied = 0;
+    write_frame(MODULE_ADDRESS, move, sizeof(move));
+    module_poll_all();
+    CHECK(moves_applied == 1);
+    CHECK(brick_slave_registers.device.stepper.move.steps == 100);
+
+    // General-call clock changes take effect in the interrupt
+    uint8_t clock[] = {CMD_BUS_CLOCK, 0x90, 0x01};
+    write_frame(BRICK_I2C_GENERAL_CALL_ADDRESS, clock, sizeof(clock));
+    CHECK(bus_clock_khz == 400);
+    CHECK(!brick_slave_pending());
+}
+
+static void test_events(void) {
+    uint8_t clear[] = {BRICK_REG_EVENTS, 0xFF};
+
+    module_poll();
+    CHECK(attention);  // BRICK_EVENT_RESET from power-up
+    write_frame(MODULE_ADDRESS, clear, sizeof(clear));
+    module_poll_all();
+    module_poll();
+    CHECK(!attention);
+}
+
+static void run_tests(void) {
+    static const uint8_t uuid[16] = {'B', 'L', 0x30, 0x01, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+
+    memcpy(brick_slave_registers.uuid.bytes, uuid, sizeof(uuid));
+    brick_slave_init(&test_device, 400);
+
+    test_identify_and_assign();
+    test_plain_write();
+    test_plain_writes_commit_at_stop();
+    test_checked_frames();
+    test_checked_batch();
+    test_stage_and_latch();
+    test_registers();
+    test_events();
+}
+
+//====================================================================================
+// Instruction counting
+//====================================================================================
+
+// Child: runs the tests, stopping at every mark for the parent
+static int run_child(int pipe_out) {
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0)
+        return 2;
+    traced = true;
+    kind_pipe = pipe_out;
+
+    // Calibration bracket: the marks on their own
+    measured(EV_COUNT);
+    mark();
+    mark();
+
+    run_tests();
+    close(pipe_out);
+    return failures > 0;
+}
+
+// Parent: single-steps from each begin mark to its end mark
+static int count_events(pid_t child, unsigned long *counts, size_t max_counts, size_t *n_counts) {
+    int status;
+    bool inside = false;
+    unsigned long steps = 0;
+
+    *n_counts = 0;
+    for (;;) {
+        if (waitpid(child, &status, 0) < 0)
+            return -1;
+        if (WIFEXITED(status))
+            return WEXITSTATUS(status);
+        if (WIFSIGNALED(status))
+            return 128 + WTERMSIG(status);
+
+        int sig = WSTOPSIG(status);
+        if (sig == SIGUSR1) {
+            if (inside && *n_counts < max_counts)
+                counts[(*n_counts)++] = steps;
+            inside = !inside;
+            steps = 0;
+            sig = 0;
+        } else if (sig == SIGTRAP && inside) {
+            steps++;
+            sig = 0;
+        }
+
+        long request = inside ? PTRACE_SINGLESTEP : PTRACE_CONT;
+        if (ptrace(request, child, NULL, (void *)(long)sig) != 0)
+            return -1;
+    }
+}
+
+static int report(const unsigned long *counts, size_t n_counts, int kinds_fd) {
+    unsigned long worst[EV_COUNT] = {0};
+    unsigned long total[EV_COUNT] = {0};
+    unsigned long seen[EV_COUNT] = {0};
+    unsigned long overhead = 0;
+    int over = 0;
+
+    for (size_t i = 0; i < n_counts; i++) {
+        uint8_t kind;
+        if (read(kinds_fd, &kind, 1) != 1)
+            break;
+        if (kind == EV_COUNT) {
+            overhead = counts[i];
+            continue;
+        }
+        if (kind > EV_COUNT)
+            continue;
+
+        unsigned long n = counts[i] > overhead ? counts[i] - overhead : 0;
+        if (n > worst[kind])
+            worst[kind] = n;
+        total[kind] += n;
+        seen[kind]++;
+    }
+
+    printf("%-8s %7s %7s %7s %7s\n", "event", "count", "mean", "worst", "budget");
+    for (int k = 0; k < EV_COUNT; k++) {
+        bool budgeted = event_budget[k] > 0;
+        char budget[24] = "-";
+        if (budgeted)
+            snprintf(budget, sizeof(budget), "%lu", event_budget[k]);
+        printf("%-8s %7lu %7lu %7lu %7s", event_names[k], seen[k], seen[k] ? total[k] / seen[k] : 0, worst[k], budget);
+        if (budgeted && worst[k] > event_budget[k]) {
+            printf("  OVER BUDGET");
+            over++;
+        }
+        printf("\n");
+    }
+    return over;
+}
+
+int main(void) {
+#if defined(__x86_64__)
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        _exit(run_child(fds[1]));
+    }
+    close(fds[1]);
+
+    static unsigned long counts[2 * MAX_EVENTS];
+    size_t n_counts;
+    int result = count_events(child, counts, sizeof(counts) / sizeof(counts[0]), &n_counts);
+    if (result == 2 || result < 0) {
+        fprintf(stderr, "ptrace unavailable, skipping the event budgets\n");
+        close(fds[0]);
+        run_tests();
+        return failures > 0;
+    }
+    if (result != 0) {
+        fprintf(stderr, "checks failed\n");
+        return 1;
+    }
+
+    int over = report(counts, n_counts, fds[0]);
+    close(fds[0]);
+    return over > 0;
+#else
+    fprintf(stderr, "event budgets are set for x86-64, skipping them\n");
+    run_tests();
+    return failures > 0;
+#endif
+}
@@ -0,0 +1,167 @@
+/**
+ * BrickLab sensor filter - host test
+ *
+ * Feeds brick_sensor_filter.c measurements the way update_sensor() does and checks the
+ * config it applies, the median window as it fills and wraps, the average at both ends of
+ * ema_shift, and what a reading keeps when nothing was in range.
+ */
+
+#include <stdio.h>
+
+#include "brick_sensor_filter.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+#define DEFAULT_PERIOD_MS 100
+#define MIN_PERIOD_MS     60
+
+static brick_sensor_filter_t filter;
+static brick_sensor_reading_t reading;
+
+static brick_sensor_config_t configure(uint16_t period_ms, uint8_t median, uint8_t ema_shift) {
+    brick_sensor_config_t config = {period_ms, median, ema_shift};
+
+    brick_sensor_filter_configure(&filter, &config, DEFAULT_PERIOD_MS, MIN_PERIOD_MS);
+    return config;
+}
+
+// One channel in, the reading's value out
+static uint16_t take(uint16_t measured) {
+    brick_sensor_filter_take(&filter, &measured, 1, 0, &reading);
+    return reading.value[0];
+}
+
+static void test_config_clamping(void) {
+    brick_sensor_config_t config = configure(0, 0, 0);
+    CHECK(config.period_ms == DEFAULT_PERIOD_MS && config.median == 1 && config.ema_shift == 0);
+
+    config = configure(10, 3, 2);
+    CHECK(config.period_ms == MIN_PERIOD_MS && config.median == 3 && config.ema_shift == 2);
+
+    config = configure(500, BRICK_SENSOR_MAX_MEDIAN + 5, BRICK_SENSOR_MAX_EMA_SHIFT + 1);
+    CHECK(config.period_ms == 500 && config.median == BRICK_SENSOR_MAX_MEDIAN);
+    CHECK(config.ema_shift == BRICK_SENSOR_MAX_EMA_SHIFT);
+
+    // An even window is cut to the odd one below, so the median is always a measurement
+    CHECK(configure(0, 2, 0).median == 1);
+    CHECK(configure(0, 4, 0).median == 3);
+    CHECK(configure(0, 6, 0).median == 5);
+    CHECK(filter.config.median == 5);  // what the filter runs with is what was written back
+}
+
+static void test_window_fill(void) {
+    configure(0, 5, 0);
+
+    // Filling: the median of what is there, the upper middle while the count is even
+    CHECK(take(10) == 10);
+    CHECK(take(30) == 30);
+    CHECK(take(20) == 20);
+    CHECK(take(100) == 30);
+    CHECK(take(100) == 30);  // full: 10 20 30 100 100
+    CHECK(filter.window_fill == 5);
+
+    // Full: every new measurement replaces the oldest
+    CHECK(take(100) == 100);  // 10 out: 20 30 100 100 100
+    CHECK(take(0) == 100);    // 30 out: 0 20 100 100 100
+    CHECK(filter.window_fill == 5);
+
+    // A new config starts the window over
+    configure(0, 3, 0);
+    CHECK(filter.window_fill == 0);
+    CHECK(take(7) == 7);
+}
+
+static void test_median_drops_spikes(void) {
+    configure(0, 3, 0);
+
+    take(50);
+    take(50);
+    CHECK(take(400) == 50);  // one echo off by far moves nothing
+    CHECK(take(50) == 50);
+}
+
+static void test_ema(void) {
+    // ema_shift 0: no average, every median goes straight through
+    configure(0, 1, 0);
+    CHECK(take(10) == 10);
+    CHECK(take(50) == 50);
+    CHECK(take(0) == 0);
+
+    // The slowest average: a new median weighs 1/128, rounded to the nearest unit
+    configure(0, 1, BRICK_SENSOR_MAX_EMA_SHIFT);
+    CHECK(take(0) == 0);  // the first measurement seeds the average
+    CHECK(take(256) == 2);
+    uint16_t value = 0;
+    for (int i = 0; i < 2000; i++)
+        value = take(256);
+    CHECK(value == 256);  // settles on a steady input
+
+    // One step in between: half way each time
+    configure(0, 1, 1);
+    CHECK(take(100) == 100);
+    CHECK(take(200) == 150);
+    CHECK(take(200) == 175);
+}
+
+static void test_channels(void) {
+    uint16_t measured[3] = {10, 20, 30};
+
+    configure(0, 1, 0);
+    reading.value[3] = 99;
+    brick_sensor_filter_take(&filter, measured, 3, 0, &reading);
+    CHECK(reading.value[0] == 10 && reading.value[1] == 20 && reading.value[2] == 30);
+    CHECK(reading.value[3] == 0);  // a channel the sensor does not have reads 0
+}
+
+static void test_out_of_range(void) {
+    configure(0, 1, 0);
+    take(42);
+    uint16_t samples = reading.samples;
+    uint32_t taken = reading.timestamp_ms;
+
+    // Nothing in range: flagged, the last value and its time stay, no sample counted
+    brick_sensor_filter_missed(&reading);
+    CHECK(reading.flags == (BRICK_SENSOR_VALID | BRICK_SENSOR_OUT_OF_RANGE));
+    CHECK(reading.value[0] == 42 && reading.samples == samples && reading.timestamp_ms == taken);
+
+    // The next measurement clears the flag
+    CHECK(take(43) == 43);
+    CHECK(reading.flags == BRICK_SENSOR_VALID);
+}
+
+static void test_samples(void) {
+    uint16_t measured = 5;
+
+    configure(0, 1, 0);
+    reading.samples = 0xFFFE;
+    brick_sensor_filter_take(&filter, &measured, 1, 1000, &reading);
+    CHECK(reading.samples == 0xFFFF && reading.timestamp_ms == 1000);
+    brick_sensor_filter_take(&filter, &measured, 1, 1100, &reading);
+    CHECK(reading.samples == 0 && reading.timestamp_ms == 1100);  // wraps; the host looks for a change
+
+    // A new config restarts the filter, not the count
+    configure(0, 3, 0);
+    brick_sensor_filter_take(&filter, &measured, 1, 1200, &reading);
+    CHECK(reading.samples == 1);
+}
+
+int main(void) {
+    test_config_clamping();
+    test_window_fill();
+    test_median_drops_spikes();
+    test_ema();
+    test_channels();
+    test_out_of_range();
+    test_samples();
+
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures > 0;
+}